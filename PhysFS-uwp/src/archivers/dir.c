@@ -69,6 +69,15 @@ static int DIR_fileClose(fvoid *opaque)
 } /* DIR_fileClose */
 
 
+static int DIR_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    *handle = opaque;  /* the platform handle IS the file. */
+    *offset = 0;
+    return(1);
+} /* DIR_getRawRegion */
+
+
 static int DIR_isArchive(const char *filename, int forWriting)
 {
     /* directories ARE archives in this driver... */
@@ -276,7 +285,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_DIR =
     DIR_tell,               /* tell() method           */
     DIR_seek,               /* seek() method           */
     DIR_fileLength,         /* fileLength() method     */
-    DIR_fileClose           /* fileClose() method      */
+    DIR_fileClose,          /* fileClose() method      */
+    DIR_getRawRegion,       /* getRawRegion() method   */
+    NULL,                   /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 /* end of dir.c ... */
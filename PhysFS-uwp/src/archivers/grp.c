@@ -47,12 +47,14 @@ typedef struct
     PHYSFS_sint64 last_mod_time;
     PHYSFS_uint32 entryCount;
     GRPentry *entries;
+    void *handle;  /* files opened in the archive read through this. */
 } GRPinfo;
 
 typedef struct
 {
-    void *handle;
+    GRPinfo *info;
     GRPentry *entry;
+    void *handle;  /* see __PHYSFS_openEntryHandle(). */
     PHYSFS_uint32 curPos;
 } GRPfileinfo;
 
@@ -60,6 +62,7 @@ typedef struct
 static void GRP_dirClose(dvoid *opaque)
 {
     GRPinfo *info = ((GRPinfo *) opaque);
+    __PHYSFS_platformClose(info->handle);
     allocator.Free(info->filename);
     allocator.Free(info->entries);
     allocator.Free(info);
@@ -78,9 +81,14 @@ static PHYSFS_sint64 GRP_read(fvoid *opaque, void *buffer,
     if (objsLeft < objCount)
         objCount = objsLeft;
 
-    rc = __PHYSFS_platformRead(finfo->handle, buffer, objSize, objCount);
+    rc = __PHYSFS_readArchiveAt(finfo->handle, NULL, buffer,
+                                entry->startPos + finfo->curPos,
+                                objSize * objCount);
     if (rc > 0)
+    {
+        rc /= objSize;  /* whole objects only. */
         finfo->curPos += (PHYSFS_uint32) (rc * objSize);
+    } /* if */
 
     return(rc);
 } /* GRP_read */
@@ -111,15 +119,11 @@ static int GRP_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     GRPfileinfo *finfo = (GRPfileinfo *) opaque;
     GRPentry *entry = finfo->entry;
-    int rc;
 
     BAIL_IF_MACRO(offset < 0, ERR_INVALID_ARGUMENT, 0);
     BAIL_IF_MACRO(offset >= entry->size, ERR_PAST_EOF, 0);
-    rc = __PHYSFS_platformSeek(finfo->handle, entry->startPos + offset);
-    if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
-
-    return(rc);
+    finfo->curPos = (PHYSFS_uint32) offset;  /* reads start from here. */
+    return(1);
 } /* GRP_seek */
 
 
@@ -133,12 +137,22 @@ static PHYSFS_sint64 GRP_fileLength(fvoid *opaque)
 static int GRP_fileClose(fvoid *opaque)
 {
     GRPfileinfo *finfo = (GRPfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* GRP_fileClose */
 
 
+static int GRP_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    GRPfileinfo *finfo = (GRPfileinfo *) opaque;
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->startPos;
+    return(1);  /* these are never compressed. */
+} /* GRP_getRawRegion */
+
+
 static int grp_open(const char *filename, int forWriting,
                     void **fh, PHYSFS_uint32 *count)
 {
@@ -220,6 +234,8 @@ static int grp_load_entries(const char *name, int forWriting, GRPinfo *info)
     void *fh = NULL;
     PHYSFS_uint32 fileCount;
     PHYSFS_uint32 location = 16;  /* sizeof sig. */
+    PHYSFS_uint8 *dir;
+    const PHYSFS_uint8 *rec;
     GRPentry *entry;
     char *ptr;
 
@@ -232,32 +248,33 @@ static int grp_load_entries(const char *name, int forWriting, GRPinfo *info)
         BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
     } /* if */
 
+    /* the whole directory in one read: a 12-byte name and a size apiece. */
+    dir = (PHYSFS_uint8 *) __PHYSFS_readTable(fh, 16, fileCount);
+    if (dir == NULL)
+    {
+        __PHYSFS_platformClose(fh);
+        return(0);
+    } /* if */
+
     location += (16 * fileCount);
 
+    rec = dir;
     for (entry = info->entries; fileCount > 0; fileCount--, entry++)
     {
-        if (__PHYSFS_platformRead(fh, &entry->name, 12, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
+        memcpy(entry->name, rec, 12);
         entry->name[12] = '\0';  /* name isn't null-terminated in file. */
         if ((ptr = strchr(entry->name, ' ')) != NULL)
             *ptr = '\0';  /* trim extra spaces. */
 
-        if (__PHYSFS_platformRead(fh, &entry->size, 4, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
+        memcpy(&entry->size, rec + 12, 4);
         entry->size = PHYSFS_swapULE32(entry->size);
         entry->startPos = location;
         location += entry->size;
+        rec += 16;
     } /* for */
 
-    __PHYSFS_platformClose(fh);
+    allocator.Free(dir);
+    info->handle = fh;  /* keep it open for reading files. */
 
     __PHYSFS_sort(info->entries, info->entryCount,
                   grp_entry_cmp, grp_entry_swap);
@@ -397,14 +414,14 @@ static fvoid *GRP_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     finfo = (GRPfileinfo *) allocator.Malloc(sizeof (GRPfileinfo));
     BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
-    finfo->handle = __PHYSFS_platformOpenRead(info->filename);
-    if ( (finfo->handle == NULL) ||
-         (!__PHYSFS_platformSeek(finfo->handle, entry->startPos)) )
+    finfo->handle = __PHYSFS_openEntryHandle(info->filename, info->handle);
+    if (finfo->handle == NULL)
     {
         allocator.Free(finfo);
         return(NULL);
     } /* if */
 
+    finfo->info = info;
     finfo->curPos = 0;
     finfo->entry = entry;
     return(finfo);
@@ -466,7 +483,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_GRP =
     GRP_tell,               /* tell() method           */
     GRP_seek,               /* seek() method           */
     GRP_fileLength,         /* fileLength() method     */
-    GRP_fileClose           /* fileClose() method      */
+    GRP_fileClose,          /* fileClose() method      */
+    GRP_getRawRegion,       /* getRawRegion() method   */
+    NULL,                   /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_GRP */
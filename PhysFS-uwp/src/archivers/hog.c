@@ -39,6 +39,12 @@
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_internal.h"
 
+/* Headers are scanned out of a buffer this big; see hog_scan(). */
+#define HOG_SCANBUFSIZE (64 * 1024)
+
+/* ...and a file this small has the header after it in the same buffer. */
+#define HOG_SMALLFILE (HOG_SCANBUFSIZE - (17 * 2))
+
 /*
  * One HOGentry is kept for each file in an open HOG archive.
  */
@@ -58,6 +64,7 @@ typedef struct
     PHYSFS_sint64 last_mod_time;
     PHYSFS_uint32 entryCount;
     HOGentry *entries;
+    void *handle;  /* files opened in the archive read through this. */
 } HOGinfo;
 
 /*
@@ -65,8 +72,9 @@ typedef struct
  */
 typedef struct
 {
-    void *handle;
+    HOGinfo *info;
     HOGentry *entry;
+    void *handle;  /* see __PHYSFS_openEntryHandle(). */
     PHYSFS_uint32 curPos;
 } HOGfileinfo;
 
@@ -74,6 +82,7 @@ typedef struct
 static void HOG_dirClose(dvoid *opaque)
 {
     HOGinfo *info = ((HOGinfo *) opaque);
+    __PHYSFS_platformClose(info->handle);
     allocator.Free(info->filename);
     allocator.Free(info->entries);
     allocator.Free(info);
@@ -92,9 +101,14 @@ static PHYSFS_sint64 HOG_read(fvoid *opaque, void *buffer,
     if (objsLeft < objCount)
         objCount = objsLeft;
 
-    rc = __PHYSFS_platformRead(finfo->handle, buffer, objSize, objCount);
+    rc = __PHYSFS_readArchiveAt(finfo->handle, NULL, buffer,
+                                entry->startPos + finfo->curPos,
+                                objSize * objCount);
     if (rc > 0)
+    {
+        rc /= objSize;  /* whole objects only. */
         finfo->curPos += (PHYSFS_uint32) (rc * objSize);
+    } /* if */
 
     return(rc);
 } /* HOG_read */
@@ -125,15 +139,11 @@ static int HOG_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     HOGfileinfo *finfo = (HOGfileinfo *) opaque;
     HOGentry *entry = finfo->entry;
-    int rc;
 
     BAIL_IF_MACRO(offset < 0, ERR_INVALID_ARGUMENT, 0);
     BAIL_IF_MACRO(offset >= entry->size, ERR_PAST_EOF, 0);
-    rc = __PHYSFS_platformSeek(finfo->handle, entry->startPos + offset);
-    if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
-
-    return(rc);
+    finfo->curPos = (PHYSFS_uint32) offset;  /* reads start from here. */
+    return(1);
 } /* HOG_seek */
 
 
@@ -147,18 +157,130 @@ static PHYSFS_sint64 HOG_fileLength(fvoid *opaque)
 static int HOG_fileClose(fvoid *opaque)
 {
     HOGfileinfo *finfo = (HOGfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* HOG_fileClose */
 
 
+static int HOG_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    HOGfileinfo *finfo = (HOGfileinfo *) opaque;
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->startPos;
+    return(1);  /* these are never compressed. */
+} /* HOG_getRawRegion */
+
+
+/*
+ * Walk the chain of headers after the signature, once. (*count) is set to
+ *  how many there are, and if (entries) isn't NULL, (*entries) to a new
+ *  array of them. Runs of small files have their headers picked out of a
+ *  big buffer that slides along the file, so they take a handful of reads
+ *  instead of a few syscalls per file. Past a big file we read just the
+ *  next header, and only fill the rest of the buffer if the header after
+ *  that one would land in it.
+ */
+static int hog_scan(void *fh, HOGentry **entries, PHYSFS_uint32 *count)
+{
+    PHYSFS_uint8 *buf;
+    HOGentry *list = NULL;
+    PHYSFS_uint32 listAlloc = 0;
+    PHYSFS_uint64 bufPos = 0;  /* file offset of buf[0]. */
+    PHYSFS_uint32 bufLen = 0;  /* bytes in buf. */
+    PHYSFS_uint64 pos = 3;  /* next header; the first is after the sig. */
+    PHYSFS_uint32 found = 0;
+    PHYSFS_uint32 size = 0;
+    PHYSFS_sint64 rc;
+    int retval = 0;
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc(HOG_SCANBUFSIZE);
+    BAIL_IF_MACRO(buf == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    while (1)
+    {
+        const PHYSFS_uint8 *hdr;
+
+        /* slide the buffer up to this header if it isn't all in there. */
+        if ((pos < bufPos) || (pos + 17 > bufPos + bufLen))
+        {
+            /* (size) is still the last file's; if it was small, so are
+               the files around it, probably. */
+            const int inRun = ((found > 0) && (size <= HOG_SMALLFILE));
+            const PHYSFS_uint32 want = inRun ? HOG_SCANBUFSIZE : 17;
+
+            GOTO_IF_MACRO(!__PHYSFS_platformSeek(fh, pos), NULL, hogScan_end);
+            rc = __PHYSFS_platformRead(fh, buf, 1, want);
+            GOTO_IF_MACRO(rc < 0, NULL, hogScan_end);
+            bufPos = pos;
+            bufLen = (PHYSFS_uint32) rc;
+
+            if (bufLen < 13)
+                break;  /* eof here is ok */
+            GOTO_IF_MACRO(bufLen < 17, ERR_CORRUPTED, hogScan_end);
+
+            memcpy(&size, buf + 13, 4);
+            size = PHYSFS_swapULE32(size);
+            if ((!inRun) && (size <= HOG_SMALLFILE))
+            {
+                /* a small file; read on from here, the next one's close. */
+                rc = __PHYSFS_platformRead(fh, buf + 17, 1,
+                                           HOG_SCANBUFSIZE - 17);
+                GOTO_IF_MACRO(rc < 0, NULL, hogScan_end);
+                bufLen += (PHYSFS_uint32) rc;
+            } /* if */
+        } /* if */
+
+        hdr = buf + (size_t) (pos - bufPos);
+        memcpy(&size, hdr + 13, 4);
+        size = PHYSFS_swapULE32(size);
+
+        if (entries != NULL)
+        {
+            if (found == listAlloc)
+            {
+                const PHYSFS_uint32 newAlloc = listAlloc ? listAlloc * 2 : 64;
+                const PHYSFS_uint64 bytes = ((PHYSFS_uint64) newAlloc) *
+                                            sizeof (HOGentry);
+                void *ptr = NULL;
+                if ((newAlloc > listAlloc) &&
+                    (!__PHYSFS_ui64FitsAddressSpace(bytes)))
+                    ptr = allocator.Realloc(list, (size_t) bytes);
+                GOTO_IF_MACRO(ptr == NULL, ERR_OUT_OF_MEMORY, hogScan_end);
+                list = (HOGentry *) ptr;
+                listAlloc = newAlloc;
+            } /* if */
+
+            memcpy(list[found].name, hdr, 13);
+            list[found].size = size;
+            list[found].startPos = (PHYSFS_uint32) (pos + 17);
+        } /* if */
+
+        found++;
+        pos += 17 + (PHYSFS_uint64) size;  /* skip over entry... */
+    } /* while */
+
+    *count = found;
+    if (entries != NULL)
+    {
+        *entries = list;
+        list = NULL;
+    } /* if */
+    retval = 1;
+
+hogScan_end:
+    if (list != NULL)
+        allocator.Free(list);
+    allocator.Free(buf);
+    return(retval);
+} /* hog_scan */
+
+
 static int hog_open(const char *filename, int forWriting,
-                    void **fh, PHYSFS_uint32 *count)
+                    void **fh, HOGentry **entries, PHYSFS_uint32 *count)
 {
-    PHYSFS_uint8 buf[13];
-    PHYSFS_uint32 size;
-    PHYSFS_sint64 pos;
+    PHYSFS_uint8 buf[3];
 
     *count = 0;
 
@@ -177,28 +299,7 @@ static int hog_open(const char *filename, int forWriting,
         goto openHog_failed;
     } /* if */
 
-    while (1)
-    {
-        if (__PHYSFS_platformRead(*fh, buf, 13, 1) != 1)
-            break; /* eof here is ok */
-
-        if (__PHYSFS_platformRead(*fh, &size, 4, 1) != 1)
-            goto openHog_failed;
-
-        size = PHYSFS_swapULE32(size);
-
-        (*count)++;
-
-        /* Skip over entry... */
-        pos = __PHYSFS_platformTell(*fh);
-        if (pos == -1)
-            goto openHog_failed;
-        if (!__PHYSFS_platformSeek(*fh, pos + size))
-            goto openHog_failed;
-    } /* while */
-
-    /* Rewind to start of entries... */
-    if (!__PHYSFS_platformSeek(*fh, 3))
+    if (!hog_scan(*fh, entries, count))
         goto openHog_failed;
 
     return(1);
@@ -217,7 +318,7 @@ static int HOG_isArchive(const char *filename, int forWriting)
 {
     void *fh;
     PHYSFS_uint32 fileCount;
-    int retval = hog_open(filename, forWriting, &fh, &fileCount);
+    int retval = hog_open(filename, forWriting, &fh, NULL, &fileCount);
 
     if (fh != NULL)
         __PHYSFS_platformClose(fh);
@@ -256,48 +357,11 @@ static int hog_load_entries(const char *name, int forWriting, HOGinfo *info)
 {
     void *fh = NULL;
     PHYSFS_uint32 fileCount;
-    HOGentry *entry;
 
-    BAIL_IF_MACRO(!hog_open(name, forWriting, &fh, &fileCount), NULL, 0);
+    BAIL_IF_MACRO(!hog_open(name, forWriting, &fh, &info->entries, &fileCount),
+                  NULL, 0);
     info->entryCount = fileCount;
-    info->entries = (HOGentry *) allocator.Malloc(sizeof(HOGentry)*fileCount);
-    if (info->entries == NULL)
-    {
-        __PHYSFS_platformClose(fh);
-        BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
-    } /* if */
-
-    for (entry = info->entries; fileCount > 0; fileCount--, entry++)
-    {
-        if (__PHYSFS_platformRead(fh, &entry->name, 13, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        if (__PHYSFS_platformRead(fh, &entry->size, 4, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        entry->size = PHYSFS_swapULE32(entry->size);
-        entry->startPos = (unsigned int) __PHYSFS_platformTell(fh);
-        if (entry->startPos == -1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        }
-
-        /* Skip over entry */
-        if (!__PHYSFS_platformSeek(fh, entry->startPos + entry->size))
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        }
-    } /* for */
-
-    __PHYSFS_platformClose(fh);
+    info->handle = fh;  /* keep it open for reading files. */
 
     __PHYSFS_sort(info->entries, info->entryCount,
                   hog_entry_cmp, hog_entry_swap);
@@ -436,14 +500,14 @@ static fvoid *HOG_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     finfo = (HOGfileinfo *) allocator.Malloc(sizeof (HOGfileinfo));
     BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
-    finfo->handle = __PHYSFS_platformOpenRead(info->filename);
-    if ( (finfo->handle == NULL) ||
-         (!__PHYSFS_platformSeek(finfo->handle, entry->startPos)) )
+    finfo->handle = __PHYSFS_openEntryHandle(info->filename, info->handle);
+    if (finfo->handle == NULL)
     {
         allocator.Free(finfo);
         return(NULL);
     } /* if */
 
+    finfo->info = info;
     finfo->curPos = 0;
     finfo->entry = entry;
     return(finfo);
@@ -505,7 +569,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_HOG =
     HOG_tell,               /* tell() method           */
     HOG_seek,               /* seek() method           */
     HOG_fileLength,         /* fileLength() method     */
-    HOG_fileClose           /* fileClose() method      */
+    HOG_fileClose,          /* fileClose() method      */
+    HOG_getRawRegion,       /* getRawRegion() method   */
+    NULL,                   /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_HOG */
@@ -22,15 +22,52 @@
 #include "lzma/C/Archive/7z/7zIn.h"
 #include "lzma/C/Archive/7z/7zExtract.h"
 
+/*
+ * Big folders can be decoded a piece at a time instead of all at once, but
+ *  only if the decoder keeps its state between calls (_LZMA_OUT_READ) and
+ *  pulls its input through a callback (_LZMA_IN_CB).
+ */
+#if (defined _LZMA_OUT_READ) && (defined _LZMA_IN_CB)
+# define LZMA_STREAMING 1
+# include "lzma/C/Compress/Lzma/LzmaDecode.h"
+#endif
+
 
 /* 7z internal from 7zIn.c */
 extern int TestSignatureCandidate(Byte *testBytes);
 
 
+/*
+ * Decoded folders shared by all mounted 7z archives, set up by PHYSFS_init()
+ *  and torn down by PHYSFS_deinit() once the search path is gone.
+ *  lzmaStateLock guards these and every folder's references/prev/next,
+ *  and callers of the lzma_cache_*() functions must hold it.
+ */
+static void *lzmaStateLock = NULL;
+static PHYSFS_7zStats lzmaStats;
+static PHYSFS_uint64 lzmaCacheBudget = 0;
+static struct _LZMAfolder *lzmaCacheHead = NULL; /* most recently used */
+static struct _LZMAfolder *lzmaCacheTail = NULL; /* least recently used */
+static struct _LZMAfolder *lzmaPinned = NULL; /* by PHYSFS_predecode() */
+
+
 #ifdef _LZMA_IN_CB
 # define BUFFER_SIZE (1 << 12)
 #endif /* _LZMA_IN_CB */
 
+/*
+ * Folders decode in parallel, but each one only once; folder (i) is
+ *  decoded under its archive's folderLocks[i % LZMA_FOLDER_LOCKS].
+ */
+#define LZMA_FOLDER_LOCKS 16
+
+#ifdef LZMA_STREAMING
+/* Folders bigger than this are streamed instead of decoded whole. */
+# define LZMA_STREAM_MINSIZE (16 * 1024 * 1024)
+/* Streamed folders are decoded into a window this big. */
+# define LZMA_STREAM_WINDOW (256 * 1024)
+#endif /* LZMA_STREAMING */
+
 
 /*
  * Carries filestream metadata through 7z
@@ -41,6 +78,8 @@ typedef struct _FileInputStream
     ISzAlloc allocTempImp; /* Temporary allocation implementation, used by 7z */
     ISzInStream inStream; /* Input stream with read callbacks, used by 7z */
     void *file; /* Filehandle, used by read implementation */
+    void *lock; /* For __PHYSFS_readArchiveAt() on (file) */
+    PHYSFS_uint64 pos; /* Where the next read starts, set by seek */
 #ifdef _LZMA_IN_CB
     Byte buffer[BUFFER_SIZE]; /* Buffer, used by read implementation */
 #endif /* _LZMA_IN_CB */
@@ -49,6 +88,11 @@ typedef struct _FileInputStream
 /*
  * In the 7z format archives are splited into blocks, those are called folders
  * Set by LZMA_read()
+ * A decoded folder outlives its last open file, sitting in the global LRU
+ *  (prev/next) until it's evicted to stay under the budget; see
+ *  lzma_cache_trim(). Folders with open files are never in the LRU.
+ * PHYSFS_predecode() pins folders by holding a reference of its own, and
+ *  links them (pinPrev/pinNext) so it can let go of them all later.
 */
 typedef struct _LZMAfolder
 {
@@ -56,11 +100,18 @@ typedef struct _LZMAfolder
     PHYSFS_uint32 references; /* Number of files using this block */
     PHYSFS_uint8 *cache; /* Cached folder */
     size_t size; /* Size of folder */
+    struct _LZMAfolder *prev; /* More recently used idle folder */
+    struct _LZMAfolder *next; /* Less recently used idle folder */
+    struct _LZMAfolder *pinPrev; /* Previous pinned folder */
+    struct _LZMAfolder *pinNext; /* Next pinned folder */
+    int pinned; /* Nonzero if one of (references) is the pin */
 } LZMAfolder;
 
 /*
  * Set by LZMA_openArchive(), except folder which gets it's values
  *  in LZMA_read()
+ * Every decode reads through its own copy of (stream), so decodes of
+ *  different folders can run at once.
  */
 typedef struct _LZMAarchive
 {
@@ -68,9 +119,14 @@ typedef struct _LZMAarchive
     LZMAfolder *folders; /* Array of folders, size == archive->db.Database.NumFolders */
     CArchiveDatabaseEx db; /* For 7z: Database */
     FileInputStream stream; /* For 7z: Input file incl. read and seek callbacks */
+    void *lock; /* For __PHYSFS_readArchiveAt() on (stream.file) */
+    void *folderLocks[LZMA_FOLDER_LOCKS]; /* See lzma_folder_lock() */
 } LZMAarchive;
 
-/* Set by LZMA_openArchive(), except offset which is set by LZMA_read() */
+/*
+ * Set by LZMA_openArchive(). LZMA_openRead() hands out a copy, so every
+ *  open handle has its own position.
+ */
 typedef struct _LZMAfile
 {
     PHYSFS_uint32 index; /* Index of file in archive */
@@ -79,9 +135,140 @@ typedef struct _LZMAfile
     CFileItem *item; /* For 7z: File info, eg. name, size */
     size_t offset; /* Offset in folder */
     size_t position; /* Current "virtual" position in file */
+    struct _LZMAstream *stream; /* This handle's decoder of a streamed folder */
 } LZMAfile;
 
 
+static void lzma_cache_unlink(LZMAfolder *folder)
+{
+    if (folder->prev != NULL)
+        folder->prev->next = folder->next;
+    else
+        lzmaCacheHead = folder->next;
+
+    if (folder->next != NULL)
+        folder->next->prev = folder->prev;
+    else
+        lzmaCacheTail = folder->prev;
+
+    folder->prev = folder->next = NULL;
+} /* lzma_cache_unlink */
+
+
+static void lzma_cache_link(LZMAfolder *folder)
+{
+    folder->prev = NULL;
+    folder->next = lzmaCacheHead;
+    if (lzmaCacheHead != NULL)
+        lzmaCacheHead->prev = folder;
+    else
+        lzmaCacheTail = folder;
+    lzmaCacheHead = folder;
+} /* lzma_cache_link */
+
+
+/*
+ * Free a folder's decoded data. It must not be in the LRU.
+ */
+static void lzma_cache_drop(LZMAfolder *folder)
+{
+    lzmaStats.cachedFolders--;
+    lzmaStats.cachedBytes -= folder->size;
+    allocator.Free(folder->cache);
+    folder->cache = NULL;
+    folder->size = 0;
+} /* lzma_cache_drop */
+
+
+/*
+ * Evict idle folders, least recently used first, until we're in budget.
+ *  Folders with open files count against the budget but stay put.
+ */
+static void lzma_cache_trim(void)
+{
+    while ((lzmaCacheTail != NULL) && (lzmaStats.cachedBytes > lzmaCacheBudget))
+    {
+        LZMAfolder *folder = lzmaCacheTail;
+        lzma_cache_unlink(folder);
+        lzma_cache_drop(folder);
+        lzmaStats.evictions++;
+    } /* while */
+} /* lzma_cache_trim */
+
+
+/*
+ * Drop a reference to (folder). Once nothing's using it, its decoded data
+ *  goes to the LRU, for the next file that wants it.
+ */
+static void lzma_folder_release(LZMAfolder *folder)
+{
+    /* Prevents from overflows and close-on-open... */
+    if (folder->references > 0)
+        folder->references--;
+    if ((folder->references == 0) && (folder->cache != NULL))
+    {
+        lzma_cache_link(folder);
+        lzma_cache_trim();
+    } /* if */
+} /* lzma_folder_release */
+
+
+/*
+ * Take (folder) off the pinned list. Its pin's reference is the caller's
+ *  to drop.
+ */
+static void lzma_pin_unlink(LZMAfolder *folder)
+{
+    if (folder->pinPrev != NULL)
+        folder->pinPrev->pinNext = folder->pinNext;
+    else
+        lzmaPinned = folder->pinNext;
+
+    if (folder->pinNext != NULL)
+        folder->pinNext->pinPrev = folder->pinPrev;
+
+    folder->pinPrev = folder->pinNext = NULL;
+    folder->pinned = 0;
+} /* lzma_pin_unlink */
+
+
+int __PHYSFS_lzmaInit(void)
+{
+    lzmaStateLock = __PHYSFS_platformCreateMutex();
+    BAIL_IF_MACRO(lzmaStateLock == NULL, NULL, 0);
+    memset(&lzmaStats, '\0', sizeof (lzmaStats));
+    lzmaCacheBudget = 0;
+    lzmaCacheHead = lzmaCacheTail = NULL;
+    lzmaPinned = NULL;
+    return(1);
+} /* __PHYSFS_lzmaInit */
+
+
+void __PHYSFS_lzmaDeinit(void)
+{
+    /* every archive is closed by now, so nothing's left in the cache. */
+    __PHYSFS_platformDestroyMutex(lzmaStateLock);
+    lzmaStateLock = NULL;
+} /* __PHYSFS_lzmaDeinit */
+
+
+void __PHYSFS_lzmaGetStats(PHYSFS_7zStats *stats)
+{
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    memcpy(stats, &lzmaStats, sizeof (PHYSFS_7zStats));
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+} /* __PHYSFS_lzmaGetStats */
+
+
+void __PHYSFS_lzmaSetCache(PHYSFS_uint64 budget)
+{
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    lzmaCacheBudget = budget;
+    lzma_cache_trim();
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+} /* __PHYSFS_lzmaSetCache */
+
+
 /* Memory management implementations to be passed to 7z */
 
 static void *SzAllocPhysicsFS(size_t size)
@@ -113,7 +300,12 @@ SZ_RESULT SzFileReadImp(void *object, void **buffer, size_t maxReqSize,
 
     if (maxReqSize > BUFFER_SIZE)
         maxReqSize = BUFFER_SIZE;
-    processedSizeLoc = __PHYSFS_platformRead(s->file, s->buffer, 1, maxReqSize);
+    processedSizeLoc = __PHYSFS_readArchiveAt(s->file, s->lock, s->buffer,
+                                              s->pos,
+                                              (PHYSFS_uint32) maxReqSize);
+    if (processedSizeLoc < 0)
+        return SZE_FAIL;
+    s->pos += (PHYSFS_uint64) processedSizeLoc;
     *buffer = s->buffer;
     if (processedSize != NULL)
         *processedSize = (size_t) processedSizeLoc;
@@ -131,7 +323,26 @@ SZ_RESULT SzFileReadImp(void *object, void *buffer, size_t size,
                         size_t *processedSize)
 {
     FileInputStream *s = (FileInputStream *)((unsigned long)object - offsetof(FileInputStream, inStream)); /* HACK! */
-    size_t processedSizeLoc = __PHYSFS_platformRead(s->file, buffer, 1, size);
+    size_t processedSizeLoc = 0;
+
+    /* 7z wants all of it in one call; feed it in chunks we can express. */
+    while (processedSizeLoc < size)
+    {
+        size_t len = size - processedSizeLoc;
+        PHYSFS_sint64 rc;
+        if (len > 0x40000000)
+            len = 0x40000000;
+        rc = __PHYSFS_readArchiveAt(s->file, s->lock,
+                                    (Byte *) buffer + processedSizeLoc,
+                                    s->pos, (PHYSFS_uint32) len);
+        if (rc < 0)
+            return SZE_FAIL;
+        s->pos += (PHYSFS_uint64) rc;
+        processedSizeLoc += (size_t) rc;
+        if ((size_t) rc < len)
+            break;  /* end of file. */
+    } /* while */
+
     if (processedSize != 0)
         *processedSize = processedSizeLoc;
     return SZ_OK;
@@ -146,9 +357,8 @@ SZ_RESULT SzFileReadImp(void *object, void *buffer, size_t size,
 SZ_RESULT SzFileSeekImp(void *object, CFileSize pos)
 {
     FileInputStream *s = (FileInputStream *)((unsigned long)object - offsetof(FileInputStream, inStream)); /* HACK! */
-    if (__PHYSFS_platformSeek(s->file, (PHYSFS_uint64) pos))
-        return SZ_OK;
-    return SZE_FAIL;
+    s->pos = (PHYSFS_uint64) pos; /* Reads are positional; nothing to move */
+    return SZ_OK;
 } /* SzFileSeekImp */
 
 
@@ -220,7 +430,8 @@ static LZMAfile * lzma_find_file(LZMAarchive *archive, const char *name)
 /*
  * Load metadata for the file at given index
  */
-static int lzma_file_init(LZMAarchive *archive, PHYSFS_uint32 fileIndex)
+static int lzma_file_init(LZMAarchive *archive, PHYSFS_uint32 fileIndex,
+                          size_t offset)
 {
     LZMAfile *file = &archive->files[fileIndex];
     PHYSFS_uint32 folderIndex = archive->db.FileIndexToFolderIndexMap[fileIndex];
@@ -230,7 +441,7 @@ static int lzma_file_init(LZMAarchive *archive, PHYSFS_uint32 fileIndex)
     file->folder = (folderIndex != (PHYSFS_uint32)-1 ? &archive->folders[folderIndex] : NULL); /* Directories don't have a folder (they contain no own data...) */
     file->item = &archive->db.Database.Files[fileIndex]; /* Holds crucial data and is often referenced -> Store link */
     file->position = 0;
-    file->offset = 0; /* Offset will be set by LZMA_read() */
+    file->offset = offset; /* Where it starts in its decoded folder */
 
     return(1);
 } /* lzma_load_file */
@@ -242,10 +453,23 @@ static int lzma_file_init(LZMAarchive *archive, PHYSFS_uint32 fileIndex)
 static int lzma_files_init(LZMAarchive *archive)
 {
     PHYSFS_uint32 fileIndex = 0, numFiles = archive->db.Database.NumFiles;
+    size_t next = 0; /* Where the next file of the current folder starts */
 
     for (fileIndex = 0; fileIndex < numFiles; fileIndex++ )
     {
-        if (!lzma_file_init(archive, fileIndex))
+        PHYSFS_uint32 folderIndex = archive->db.FileIndexToFolderIndexMap[fileIndex];
+        size_t offset = 0;
+
+        /* A folder's files are stored back to back, in database order. */
+        if (folderIndex != (PHYSFS_uint32)-1)
+        {
+            if (archive->db.FolderStartFileIndex[folderIndex] == fileIndex)
+                next = 0; /* First file of a new folder */
+            offset = next;
+            next += (size_t) archive->db.Database.Files[fileIndex].Size;
+        }
+
+        if (!lzma_file_init(archive, fileIndex, offset))
         {
             return(0); /* FALSE on failure */
         }
@@ -281,6 +505,16 @@ static void lzma_archive_init(LZMAarchive *archive)
  */
 static void lzma_archive_exit(LZMAarchive *archive)
 {
+    int i;
+
+    if (archive->lock != NULL)
+        __PHYSFS_platformDestroyMutex(archive->lock);
+    for (i = 0; i < LZMA_FOLDER_LOCKS; i++)
+    {
+        if (archive->folderLocks[i] != NULL)
+            __PHYSFS_platformDestroyMutex(archive->folderLocks[i]);
+    } /* for */
+
     /* Free arrays */
     allocator.Free(archive->folders);
     allocator.Free(archive->files);
@@ -322,14 +556,302 @@ static int lzma_err(SZ_RESULT rc)
 } /* lzma_err */
 
 
+/*
+ * The lock that makes sure (file)'s folder is only decoded once. Folders
+ *  share them in stripes, so unrelated folders rarely wait on each other.
+ */
+static void *lzma_folder_lock(LZMAfile *file)
+{
+    const size_t folderIndex = (size_t) (file->folder - file->archive->folders);
+    return(file->archive->folderLocks[folderIndex % LZMA_FOLDER_LOCKS]);
+} /* lzma_folder_lock */
+
+
+/*
+ * Decode (file)'s folder whole, unless that's been done already. Caller
+ *  holds lzma_folder_lock(file) and a reference to the folder.
+ */
+static int lzma_folder_load(LZMAfile *file)
+{
+    LZMAfolder *folder = file->folder;
+    FileInputStream stream;
+    PHYSFS_uint32 index = folder->index;
+    PHYSFS_uint8 *cache = NULL;
+    size_t size = 0;
+    size_t offset = 0;
+    size_t fileSize = 0;
+    int rc;
+
+    if (folder->cache != NULL)
+        return(1);
+
+    /* Our own read position, so other folders can decode at the same time */
+    memcpy(&stream, &file->archive->stream, sizeof (FileInputStream));
+    stream.pos = 0;
+
+    rc = lzma_err(SzExtract(
+        &stream.inStream, /* compressed data */
+        &file->archive->db, /* 7z's database, containing everything */
+        file->index, /* Index into database arrays */
+        &index, /* Index of cached folder, will be changed by SzExtract */
+        &cache, /* Cache for decompressed folder, allocated by SzExtract */
+        &size, /* Size of cache, will be changed by SzExtract */
+        &offset, /* Offset of this file inside the cache, set by SzExtract */
+        &fileSize, /* Size of this file */
+        &stream.allocImp,
+        &stream.allocTempImp));
+
+    if (rc != SZ_OK)
+    {
+        if (cache != NULL) /* don't keep half a folder */
+            allocator.Free(cache);
+        return(0);
+    } /* if */
+
+    /* openRead() looks at (cache) under this lock, so publish it there. */
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    folder->index = index;
+    folder->cache = cache;
+    folder->size = size;
+    lzmaStats.decodes++;
+    lzmaStats.cachedFolders++;
+    lzmaStats.cachedBytes += size;
+    lzma_cache_trim();  /* it's pinned by our reference; this can't evict it. */
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+
+    return(1);
+} /* lzma_folder_load */
+
+
+#ifdef LZMA_STREAMING
+
+/*
+ * A big folder being decoded incrementally. The decoder's output goes into
+ *  a window that slides forward through the folder; reading what's in the
+ *  window is a memcpy, reading further on decodes up to it, and reading
+ *  something already behind the window starts over from the beginning.
+ *  Every open handle has its own, so handles reading different parts of
+ *  one folder don't drag each other back to the start; the price is a
+ *  dictionary per handle. Only single-coder LZMA folders can be streamed;
+ *  anything with filters (BCJ and friends) is decoded whole, the old way.
+ */
+typedef struct _LZMAstream
+{
+    ILzmaInCallback inCallback; /* Must be first; LzmaDecode() passes it back */
+    LZMAarchive *archive; /* Where the packed data lives */
+    PHYSFS_uint64 packStart; /* Packed data's offset in the archive file */
+    PHYSFS_uint64 packPos; /* Next packed byte to feed the decoder */
+    PHYSFS_uint64 packEnd; /* End of the packed data */
+    CLzmaDecoderState state; /* Decoder, including its dictionary */
+    size_t unpackSize; /* Size of the whole decoded folder */
+    size_t windowStart; /* Folder offset of window[0] */
+    size_t windowLen; /* Decoded bytes in (window) */
+    int checkCrc; /* Nonzero if the archive has a CRC for the folder */
+    UInt32 unpackCrc; /* That CRC */
+    UInt32 crc; /* CRC of everything decoded since the last restart */
+    Byte window[LZMA_STREAM_WINDOW];
+    Byte input[BUFFER_SIZE]; /* Packed data on its way to the decoder */
+} LZMAstream;
+
+
+/*
+ * Input callback for LzmaDecode().
+ */
+static int lzma_stream_read(void *object, const unsigned char **buffer,
+                            SizeT *bufferSize)
+{
+    LZMAstream *stream = (LZMAstream *) object;
+    PHYSFS_uint64 len = stream->packEnd - stream->packPos;
+    PHYSFS_sint64 rc = 0;
+
+    if (len > BUFFER_SIZE)
+        len = BUFFER_SIZE;
+    if (len > 0)
+        rc = __PHYSFS_readArchiveAt(stream->archive->stream.file,
+                                    stream->archive->lock, stream->input,
+                                    stream->packPos, (PHYSFS_uint32) len);
+    if (rc < 0)
+        return(LZMA_RESULT_DATA_ERROR);
+
+    stream->packPos += (PHYSFS_uint64) rc;
+    *buffer = stream->input;
+    *bufferSize = (SizeT) rc;
+    return(LZMA_RESULT_OK);
+} /* lzma_stream_read */
+
+
+static void lzma_stream_free(LZMAstream *stream)
+{
+    allocator.Free(stream->state.Probs);
+    if (stream->state.Dictionary != NULL)
+        allocator.Free(stream->state.Dictionary);
+    allocator.Free(stream);
+} /* lzma_stream_free */
+
+
+/*
+ * Rewind to the start of the folder.
+ */
+static void lzma_stream_restart(LZMAstream *stream)
+{
+    LzmaDecoderInit(&stream->state);
+    stream->packPos = stream->packStart;
+    stream->windowStart = 0;
+    stream->windowLen = 0;
+    stream->crc = CRC_INIT_VAL;
+} /* lzma_stream_restart */
+
+
+/*
+ * Nonzero if folder (folderIndex) is worth streaming, and we can.
+ */
+static int lzma_stream_wanted(CArchiveDatabaseEx *db,
+                              PHYSFS_uint32 folderIndex)
+{
+    static CMethodID k_LZMA = { { 0x3, 0x1, 0x1 }, 3 };
+    CFolder *folder = &db->Database.Folders[folderIndex];
+    CFileSize unpackSize = SzFolderGetUnPackSize(folder);
+
+    return( (folder->NumCoders == 1) && (folder->NumPackStreams == 1) &&
+            (AreMethodsEqual(&folder->Coders[0].MethodID, &k_LZMA)) &&
+            (unpackSize > LZMA_STREAM_MINSIZE) &&
+            (unpackSize == (CFileSize) (size_t) unpackSize) );
+} /* lzma_stream_wanted */
+
+
+/*
+ * Set up streaming for folder (folderIndex) if it's worth it and we can.
+ *  Returns NULL if the folder should be decoded whole instead.
+ */
+static LZMAstream *lzma_stream_open(LZMAarchive *archive,
+                                    PHYSFS_uint32 folderIndex)
+{
+    CArchiveDatabaseEx *db = &archive->db;
+    CFolder *folder = &db->Database.Folders[folderIndex];
+    CCoderInfo *coder = &folder->Coders[0];
+    CFileSize unpackSize = SzFolderGetUnPackSize(folder);
+    LZMAstream *stream;
+    UInt32 numProbs;
+    UInt32 packIndex;
+
+    if (!lzma_stream_wanted(db, folderIndex))
+        return(NULL);
+
+    stream = (LZMAstream *) allocator.Malloc(sizeof (LZMAstream));
+    BAIL_IF_MACRO(stream == NULL, ERR_OUT_OF_MEMORY, NULL);
+    memset(stream, '\0', sizeof (LZMAstream));
+
+    if (LzmaDecodeProperties(&stream->state.Properties,
+                             coder->Properties.Items,
+                             (int) coder->Properties.Capacity)
+            != LZMA_RESULT_OK)
+    {
+        allocator.Free(stream);
+        BAIL_MACRO(ERR_DATA_ERROR, NULL);
+    }
+
+    numProbs = LzmaGetNumProbs(&stream->state.Properties);
+    stream->state.Probs = (CProb *) allocator.Malloc(numProbs * sizeof (CProb));
+    if (stream->state.Properties.DictionarySize > 0)
+        stream->state.Dictionary = (unsigned char *)
+                allocator.Malloc(stream->state.Properties.DictionarySize);
+    if ( (stream->state.Probs == NULL) ||
+         ((stream->state.Properties.DictionarySize > 0) &&
+          (stream->state.Dictionary == NULL)) )
+    {
+        if (stream->state.Probs != NULL)
+            allocator.Free(stream->state.Probs);
+        allocator.Free(stream);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    }
+
+    stream->inCallback.Read = lzma_stream_read;
+    stream->archive = archive;
+    packIndex = db->FolderStartPackStreamIndex[folderIndex];
+    stream->packStart = (PHYSFS_uint64)
+                            SzArDbGetFolderStreamPos(db, folderIndex, 0);
+    stream->packEnd = stream->packStart +
+                            (PHYSFS_uint64) db->Database.PackSizes[packIndex];
+    stream->unpackSize = (size_t) unpackSize;
+    stream->checkCrc = db->Database.Folders[folderIndex].UnPackCRCDefined;
+    stream->unpackCrc = db->Database.Folders[folderIndex].UnPackCRC;
+    lzma_stream_restart(stream);
+
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    lzmaStats.streamedFolders++;
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+
+    return(stream);
+} /* lzma_stream_open */
+
+
+/*
+ * Copy (len) bytes at (offset) in the folder into (buffer), decoding as
+ *  far as needed. Caller holds the folder's lock.
+ */
+static int lzma_stream_copy(LZMAstream *stream, PHYSFS_uint8 *buffer,
+                            size_t offset, size_t len)
+{
+    while (len > 0)
+    {
+        const size_t windowEnd = stream->windowStart + stream->windowLen;
+
+        if (offset < stream->windowStart)
+            lzma_stream_restart(stream); /* behind us; start over */
+
+        else if (offset < windowEnd)
+        {
+            size_t cpy = windowEnd - offset;
+            if (cpy > len)
+                cpy = len;
+            memcpy(buffer, stream->window + (offset - stream->windowStart),
+                   cpy);
+            buffer += cpy;
+            offset += cpy;
+            len -= cpy;
+        }
+
+        else /* decode the next window's worth */
+        {
+            SizeT want = (SizeT) (stream->unpackSize - windowEnd);
+            SizeT got = 0;
+            int rc;
+            if (want > LZMA_STREAM_WINDOW)
+                want = LZMA_STREAM_WINDOW;
+            BAIL_IF_MACRO(want == 0, ERR_PAST_EOF, 0);
+            rc = LzmaDecode(&stream->state, &stream->inCallback,
+                            stream->window, want, &got);
+            BAIL_IF_MACRO(rc != LZMA_RESULT_OK, ERR_DATA_ERROR, 0);
+            BAIL_IF_MACRO(got == 0, ERR_DATA_ERROR, 0);
+            stream->windowStart = windowEnd;
+            stream->windowLen = (size_t) got;
+
+            /* Decoded the whole folder; make sure it's what was packed. */
+            stream->crc = CrcUpdate(stream->crc, stream->window, got);
+            if ( (stream->checkCrc) &&
+                 (windowEnd + stream->windowLen == stream->unpackSize) &&
+                 (CRC_GET_DIGEST(stream->crc) != stream->unpackCrc) )
+            {
+                lzma_stream_restart(stream); /* don't serve the bad window */
+                BAIL_MACRO(ERR_CORRUPTED, 0);
+            } /* if */
+        }
+    } /* while */
+
+    return(1);
+} /* lzma_stream_copy */
+
+#endif /* LZMA_STREAMING */
+
+
 static PHYSFS_sint64 LZMA_read(fvoid *opaque, void *outBuffer,
                                PHYSFS_uint32 objSize, PHYSFS_uint32 objCount)
 {
     LZMAfile *file = (LZMAfile *) opaque;
+    void *lock = lzma_folder_lock(file);
 
     size_t wantedSize = objSize*objCount;
     size_t remainingSize = file->item->Size - file->position;
-    size_t fileSize = 0;
 
     BAIL_IF_MACRO(wantedSize == 0, NULL, 0); /* quick rejection. */
     BAIL_IF_MACRO(remainingSize == 0, ERR_PAST_EOF, 0);
@@ -342,29 +864,40 @@ static PHYSFS_sint64 LZMA_read(fvoid *opaque, void *outBuffer,
         __PHYSFS_setError(ERR_PAST_EOF); /* this is always true here. */
     } /* if */
 
+    /* (cache) is only ever set under this lock, so look at it here too. */
+    __PHYSFS_platformGrabMutex(lock);
+
+#ifdef LZMA_STREAMING
+    /* Big folders are decoded a window at a time, as far as we've read */
+    if ((file->folder->cache == NULL) && (file->stream == NULL))
+    {
+        const PHYSFS_uint32 folderIndex = (PHYSFS_uint32)
+                                    (file->folder - file->archive->folders);
+        file->stream = lzma_stream_open(file->archive, folderIndex);
+    } /* if */
+
+    /* Only this handle uses its stream, so no folder lock for this. */
+    if (file->stream != NULL)
+    {
+        __PHYSFS_platformReleaseMutex(lock);
+        BAIL_IF_MACRO(!lzma_stream_copy(file->stream,
+                                        (PHYSFS_uint8 *) outBuffer,
+                                        file->offset + file->position,
+                                        wantedSize), NULL, -1);
+        file->position += wantedSize; /* Increase virtual position */
+        return objCount;
+    } /* if */
+#endif /* LZMA_STREAMING */
+
     /* Only decompress the folder if it is not allready cached */
-    if (file->folder->cache == NULL)
+    if (!lzma_folder_load(file))
     {
-        int rc = lzma_err(SzExtract(
-            &file->archive->stream.inStream, /* compressed data */
-            &file->archive->db, /* 7z's database, containing everything */
-            file->index, /* Index into database arrays */
-            /* Index of cached folder, will be changed by SzExtract */
-            &file->folder->index,
-            /* Cache for decompressed folder, allocated/freed by SzExtract */
-            &file->folder->cache,
-            /* Size of cache, will be changed by SzExtract */
-            &file->folder->size,
-            /* Offset of this file inside the cache, set by SzExtract */
-            &file->offset,
-            &fileSize, /* Size of this file */
-            &file->archive->stream.allocImp,
-            &file->archive->stream.allocTempImp));
-
-        if (rc != SZ_OK)
-            return -1;
+        __PHYSFS_platformReleaseMutex(lock);
+        return -1;
     } /* if */
 
+    __PHYSFS_platformReleaseMutex(lock);
+
     /* Copy wanted bytes over from cache to outBuffer */
     memcpy(outBuffer,
             (file->folder->cache +
@@ -423,20 +956,158 @@ static int LZMA_fileClose(fvoid *opaque)
 
     BAIL_IF_MACRO(file->folder == NULL, ERR_NOT_A_FILE, 0);
 
-	/* Only decrease refcount if someone actually requested this file... Prevents from overflows and close-on-open... */
-    if (file->folder->references > 0)
-        file->folder->references--;
-    if (file->folder->references == 0)
-    {
-        /* Free the cache which might have been allocated by LZMA_read() */
-        allocator.Free(file->folder->cache);
-        file->folder->cache = NULL;
-    }
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    lzma_folder_release(file->folder);
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+
+#ifdef LZMA_STREAMING
+    if (file->stream != NULL)
+        lzma_stream_free(file->stream);
+#endif /* LZMA_STREAMING */
 
+    allocator.Free(file);
     return(1);
 } /* LZMA_fileClose */
 
 
+/*
+ * Decode the file's folder now, so reading it later is just a copy. That
+ *  only outlives the handle if the folder fits in PHYSFS_set7zCache().
+ */
+static int LZMA_prefetch(fvoid *opaque)
+{
+    LZMAfile *file = (LZMAfile *) opaque;
+    void *lock = lzma_folder_lock(file);
+    int retval;
+
+#ifdef LZMA_STREAMING
+    const PHYSFS_uint32 folderIndex = (PHYSFS_uint32)
+                                (file->folder - file->archive->folders);
+    CArchiveDatabaseEx *db = &file->archive->db;
+
+    /* Too big to decode ahead of time; just get the packed bytes coming */
+    if (lzma_stream_wanted(db, folderIndex))
+    {
+        const UInt32 packIndex = db->FolderStartPackStreamIndex[folderIndex];
+        const PHYSFS_uint64 packStart = (PHYSFS_uint64)
+                                SzArDbGetFolderStreamPos(db, folderIndex, 0);
+        return(__PHYSFS_platformPrefetch(file->archive->stream.file, packStart,
+                            (PHYSFS_uint64) db->Database.PackSizes[packIndex]));
+    } /* if */
+#endif /* LZMA_STREAMING */
+
+    __PHYSFS_platformGrabMutex(lock);
+    retval = lzma_folder_load(file);
+    __PHYSFS_platformReleaseMutex(lock);
+
+    return(retval);
+} /* LZMA_prefetch */
+
+
+/*
+ * Point straight into the decoded folder. Our reference pins it, so it
+ *  stays put until the handle is closed, whatever the cache budget says.
+ */
+static int LZMA_getView(fvoid *opaque, const void **data)
+{
+    LZMAfile *file = (LZMAfile *) opaque;
+    void *lock = lzma_folder_lock(file);
+    int retval;
+
+#ifdef LZMA_STREAMING
+    const PHYSFS_uint32 folderIndex = (PHYSFS_uint32)
+                                (file->folder - file->archive->folders);
+
+    /* Never in memory all at once; let the caller read it. */
+    if (lzma_stream_wanted(&file->archive->db, folderIndex))
+        return(0);
+#endif /* LZMA_STREAMING */
+
+    __PHYSFS_platformGrabMutex(lock);
+    retval = lzma_folder_load(file);
+    __PHYSFS_platformReleaseMutex(lock);
+
+    BAIL_IF_MACRO(!retval, NULL, 0);
+    *data = file->folder->cache + file->offset;
+    return(1);
+} /* LZMA_getView */
+
+
+/*
+ * Which folder (opaque) is packed in, so PHYSFS_predecode() can do each
+ *  folder once.
+ */
+const void *__PHYSFS_lzmaFolderOf(fvoid *opaque)
+{
+    return(((LZMAfile *) opaque)->folder);
+} /* __PHYSFS_lzmaFolderOf */
+
+
+/*
+ * Decode (opaque)'s folder and pin it, so it stays in memory after (opaque)
+ *  is closed, until __PHYSFS_lzmaReleasePinned() or its archive is closed.
+ *  Streamed folders are never decoded whole; they're only prefetched.
+ */
+int __PHYSFS_lzmaPredecode(fvoid *opaque)
+{
+    LZMAfile *file = (LZMAfile *) opaque;
+    LZMAfolder *folder = file->folder;
+    void *lock = lzma_folder_lock(file);
+    int retval;
+
+#ifdef LZMA_STREAMING
+    const PHYSFS_uint32 folderIndex = (PHYSFS_uint32)
+                                (folder - file->archive->folders);
+
+    if (lzma_stream_wanted(&file->archive->db, folderIndex))
+    {
+        LZMA_prefetch(opaque);  /* just a hint; nothing can go wrong. */
+        return(1);
+    } /* if */
+#endif /* LZMA_STREAMING */
+
+    __PHYSFS_platformGrabMutex(lock);
+    retval = lzma_folder_load(file);
+    __PHYSFS_platformReleaseMutex(lock);
+    BAIL_IF_MACRO(!retval, NULL, 0);
+
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    if (!folder->pinned)
+    {
+        /* (opaque) holds a reference, so the folder isn't in the LRU. */
+        folder->references++;
+        folder->pinned = 1;
+        folder->pinPrev = NULL;
+        folder->pinNext = lzmaPinned;
+        if (lzmaPinned != NULL)
+            lzmaPinned->pinPrev = folder;
+        lzmaPinned = folder;
+        lzmaStats.pinnedFolders++;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+
+    return(1);
+} /* __PHYSFS_lzmaPredecode */
+
+
+/*
+ * Unpin every folder pinned by __PHYSFS_lzmaPredecode(). Ones no file is
+ *  using go to the LRU, which keeps them if they fit the budget.
+ */
+void __PHYSFS_lzmaReleasePinned(void)
+{
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    while (lzmaPinned != NULL)
+    {
+        LZMAfolder *folder = lzmaPinned;
+        lzma_pin_unlink(folder);
+        lzmaStats.pinnedFolders--;
+        lzma_folder_release(folder);
+    } /* while */
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
+} /* __PHYSFS_lzmaReleasePinned */
+
+
 static int LZMA_isArchive(const char *filename, int forWriting)
 {
     PHYSFS_uint8 sig[k7zSignatureSize];
@@ -465,6 +1136,7 @@ static void *LZMA_openArchive(const char *name, int forWriting)
 {
     size_t len = 0;
     LZMAarchive *archive = NULL;
+    int i;
 
     BAIL_IF_MACRO(forWriting, ERR_ARC_IS_READ_ONLY, NULL);
     BAIL_IF_MACRO(!LZMA_isArchive(name,forWriting), ERR_UNSUPPORTED_ARCHIVE, 0);
@@ -474,6 +1146,23 @@ static void *LZMA_openArchive(const char *name, int forWriting)
 
     lzma_archive_init(archive);
 
+    if ( (archive->lock = __PHYSFS_platformCreateMutex()) == NULL )
+    {
+        lzma_archive_exit(archive);
+        return(NULL);
+    }
+    archive->stream.lock = archive->lock;
+
+    for (i = 0; i < LZMA_FOLDER_LOCKS; i++)
+    {
+        archive->folderLocks[i] = __PHYSFS_platformCreateMutex();
+        if (archive->folderLocks[i] == NULL)
+        {
+            lzma_archive_exit(archive);
+            return(NULL);
+        }
+    } /* for */
+
     if ( (archive->stream.file = __PHYSFS_platformOpenRead(name)) == NULL )
     {
         __PHYSFS_platformClose(archive->stream.file);
@@ -644,15 +1333,29 @@ static fvoid *LZMA_openRead(dvoid *opaque, const char *name, int *fileExists)
 {
     LZMAarchive *archive = (LZMAarchive *) opaque;
     LZMAfile *file = lzma_find_file(archive, name);
+    LZMAfile *retval;
 
     *fileExists = (file != NULL);
     BAIL_IF_MACRO(file == NULL, ERR_NO_SUCH_FILE, NULL);
     BAIL_IF_MACRO(file->folder == NULL, ERR_NOT_A_FILE, NULL);
 
-    file->position = 0;
+    retval = (LZMAfile *) allocator.Malloc(sizeof (LZMAfile));
+    BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
+    memcpy(retval, file, sizeof (LZMAfile));
+    retval->position = 0;
+    retval->stream = NULL; /* set up by LZMA_read() if it's wanted */
+
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    if (file->folder->cache != NULL)
+    {
+        lzmaStats.cacheHits++;
+        if (file->folder->references == 0) /* idle; pin it */
+            lzma_cache_unlink(file->folder);
+    }
     file->folder->references++; /* Increase refcount for automatic cleanup... */
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
 
-    return(file);
+    return(retval);
 } /* LZMA_openRead */
 
 
@@ -671,12 +1374,28 @@ static fvoid *LZMA_openAppend(dvoid *opaque, const char *filename)
 static void LZMA_dirClose(dvoid *opaque)
 {
     LZMAarchive *archive = (LZMAarchive *) opaque;
-    PHYSFS_uint32 fileIndex = 0, numFiles = archive->db.Database.NumFiles;
+    PHYSFS_uint32 folderIndex = 0, numFolders = archive->db.Database.NumFolders;
 
-    for (fileIndex = 0; fileIndex < numFiles; fileIndex++)
+    /*
+     * Nothing is open any more, so every decoded folder is either in the
+     *  LRU or pinned.
+     */
+    __PHYSFS_platformGrabMutex(lzmaStateLock);
+    for (folderIndex = 0; folderIndex < numFolders; folderIndex++)
     {
-        LZMA_fileClose(&archive->files[fileIndex]);
+        LZMAfolder *folder = &archive->folders[folderIndex];
+        if (folder->pinned)
+        {
+            lzma_pin_unlink(folder);
+            lzmaStats.pinnedFolders--;
+        }
+        else if (folder->cache != NULL)
+            lzma_cache_unlink(folder);
+
+        if (folder->cache != NULL)
+            lzma_cache_drop(folder);
     } /* for */
+    __PHYSFS_platformReleaseMutex(lzmaStateLock);
 
     SzArDbExFree(&archive->db, SzFreePhysicsFS);
     __PHYSFS_platformClose(archive->stream.file);
@@ -727,7 +1446,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_LZMA =
     LZMA_tell,               /* tell() method           */
     LZMA_seek,               /* seek() method           */
     LZMA_fileLength,         /* fileLength() method     */
-    LZMA_fileClose           /* fileClose() method      */
+    LZMA_fileClose,          /* fileClose() method      */
+    NULL,                    /* getRawRegion() method   */
+    LZMA_prefetch,           /* prefetch() method       */
+    LZMA_getView             /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_7Z */
@@ -50,12 +50,14 @@ typedef struct
     PHYSFS_sint64 last_mod_time;
     PHYSFS_uint32 entryCount;
     MVLentry *entries;
+    void *handle;  /* files opened in the archive read through this. */
 } MVLinfo;
 
 typedef struct
 {
-    void *handle;
+    MVLinfo *info;
     MVLentry *entry;
+    void *handle;  /* see __PHYSFS_openEntryHandle(). */
     PHYSFS_uint32 curPos;
 } MVLfileinfo;
 
@@ -63,6 +65,7 @@ typedef struct
 static void MVL_dirClose(dvoid *opaque)
 {
     MVLinfo *info = ((MVLinfo *) opaque);
+    __PHYSFS_platformClose(info->handle);
     allocator.Free(info->filename);
     allocator.Free(info->entries);
     allocator.Free(info);
@@ -81,9 +84,14 @@ static PHYSFS_sint64 MVL_read(fvoid *opaque, void *buffer,
     if (objsLeft < objCount)
         objCount = objsLeft;
 
-    rc = __PHYSFS_platformRead(finfo->handle, buffer, objSize, objCount);
+    rc = __PHYSFS_readArchiveAt(finfo->handle, NULL, buffer,
+                                entry->startPos + finfo->curPos,
+                                objSize * objCount);
     if (rc > 0)
+    {
+        rc /= objSize;  /* whole objects only. */
         finfo->curPos += (PHYSFS_uint32) (rc * objSize);
+    } /* if */
 
     return(rc);
 } /* MVL_read */
@@ -114,15 +122,11 @@ static int MVL_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     MVLfileinfo *finfo = (MVLfileinfo *) opaque;
     MVLentry *entry = finfo->entry;
-    int rc;
 
     BAIL_IF_MACRO(offset < 0, ERR_INVALID_ARGUMENT, 0);
     BAIL_IF_MACRO(offset >= entry->size, ERR_PAST_EOF, 0);
-    rc = __PHYSFS_platformSeek(finfo->handle, entry->startPos + offset);
-    if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
-
-    return(rc);
+    finfo->curPos = (PHYSFS_uint32) offset;  /* reads start from here. */
+    return(1);
 } /* MVL_seek */
 
 
@@ -136,12 +140,22 @@ static PHYSFS_sint64 MVL_fileLength(fvoid *opaque)
 static int MVL_fileClose(fvoid *opaque)
 {
     MVLfileinfo *finfo = (MVLfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* MVL_fileClose */
 
 
+static int MVL_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    MVLfileinfo *finfo = (MVLfileinfo *) opaque;
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->startPos;
+    return(1);  /* these are never compressed. */
+} /* MVL_getRawRegion */
+
+
 static int mvl_open(const char *filename, int forWriting,
                     void **fh, PHYSFS_uint32 *count)
 {
@@ -223,6 +237,8 @@ static int mvl_load_entries(const char *name, int forWriting, MVLinfo *info)
     void *fh = NULL;
     PHYSFS_uint32 fileCount;
     PHYSFS_uint32 location = 8;  /* sizeof sig. */
+    PHYSFS_uint8 *dir;
+    const PHYSFS_uint8 *rec;
     MVLentry *entry;
 
     BAIL_IF_MACRO(!mvl_open(name, forWriting, &fh, &fileCount), NULL, 0);
@@ -234,28 +250,29 @@ static int mvl_load_entries(const char *name, int forWriting, MVLinfo *info)
         BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
     } /* if */
 
+    /* the whole directory in one read: a 13-byte name and a size apiece. */
+    dir = (PHYSFS_uint8 *) __PHYSFS_readTable(fh, 17, fileCount);
+    if (dir == NULL)
+    {
+        __PHYSFS_platformClose(fh);
+        return(0);
+    } /* if */
+
     location += (17 * fileCount);
 
+    rec = dir;
     for (entry = info->entries; fileCount > 0; fileCount--, entry++)
     {
-        if (__PHYSFS_platformRead(fh, &entry->name, 13, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        if (__PHYSFS_platformRead(fh, &entry->size, 4, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
+        memcpy(entry->name, rec, 13);
+        memcpy(&entry->size, rec + 13, 4);  /* unaligned in the file. */
         entry->size = PHYSFS_swapULE32(entry->size);
         entry->startPos = location;
         location += entry->size;
+        rec += 17;
     } /* for */
 
-    __PHYSFS_platformClose(fh);
+    allocator.Free(dir);
+    info->handle = fh;  /* keep it open for reading files. */
 
     __PHYSFS_sort(info->entries, info->entryCount,
                   mvl_entry_cmp, mvl_entry_swap);
@@ -393,14 +410,14 @@ static fvoid *MVL_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     finfo = (MVLfileinfo *) allocator.Malloc(sizeof (MVLfileinfo));
     BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
-    finfo->handle = __PHYSFS_platformOpenRead(info->filename);
-    if ( (finfo->handle == NULL) ||
-         (!__PHYSFS_platformSeek(finfo->handle, entry->startPos)) )
+    finfo->handle = __PHYSFS_openEntryHandle(info->filename, info->handle);
+    if (finfo->handle == NULL)
     {
         allocator.Free(finfo);
         return(NULL);
     } /* if */
 
+    finfo->info = info;
     finfo->curPos = 0;
     finfo->entry = entry;
     return(finfo);
@@ -462,7 +479,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_MVL =
     MVL_tell,               /* tell() method           */
     MVL_seek,               /* seek() method           */
     MVL_fileLength,         /* fileLength() method     */
-    MVL_fileClose           /* fileClose() method      */
+    MVL_fileClose,          /* fileClose() method      */
+    MVL_getRawRegion,       /* getRawRegion() method   */
+    NULL,                   /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_MVL */
@@ -61,12 +61,14 @@ typedef struct
     PHYSFS_sint64 last_mod_time;
     PHYSFS_uint32 entryCount;
     QPAKentry *entries;
+    void *handle;  /* files opened in the archive read through this. */
 } QPAKinfo;
 
 typedef struct
 {
-    void *handle;
+    QPAKinfo *info;
     QPAKentry *entry;
+    void *handle;  /* see __PHYSFS_openEntryHandle(). */
     PHYSFS_uint32 curPos;
 } QPAKfileinfo;
 
@@ -77,6 +79,7 @@ typedef struct
 static void QPAK_dirClose(dvoid *opaque)
 {
     QPAKinfo *info = ((QPAKinfo *) opaque);
+    __PHYSFS_platformClose(info->handle);
     allocator.Free(info->filename);
     allocator.Free(info->entries);
     allocator.Free(info);
@@ -95,9 +98,14 @@ static PHYSFS_sint64 QPAK_read(fvoid *opaque, void *buffer,
     if (objsLeft < objCount)
         objCount = objsLeft;
 
-    rc = __PHYSFS_platformRead(finfo->handle, buffer, objSize, objCount);
+    rc = __PHYSFS_readArchiveAt(finfo->handle, NULL, buffer,
+                                entry->startPos + finfo->curPos,
+                                objSize * objCount);
     if (rc > 0)
+    {
+        rc /= objSize;  /* whole objects only. */
         finfo->curPos += (PHYSFS_uint32) (rc * objSize);
+    } /* if */
 
     return(rc);
 } /* QPAK_read */
@@ -128,15 +136,11 @@ static int QPAK_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     QPAKfileinfo *finfo = (QPAKfileinfo *) opaque;
     QPAKentry *entry = finfo->entry;
-    int rc;
 
     BAIL_IF_MACRO(offset < 0, ERR_INVALID_ARGUMENT, 0);
     BAIL_IF_MACRO(offset >= entry->size, ERR_PAST_EOF, 0);
-    rc = __PHYSFS_platformSeek(finfo->handle, entry->startPos + offset);
-    if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
-
-    return(rc);
+    finfo->curPos = (PHYSFS_uint32) offset;  /* reads start from here. */
+    return(1);
 } /* QPAK_seek */
 
 
@@ -150,12 +154,22 @@ static PHYSFS_sint64 QPAK_fileLength(fvoid *opaque)
 static int QPAK_fileClose(fvoid *opaque)
 {
     QPAKfileinfo *finfo = (QPAKfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* QPAK_fileClose */
 
 
+static int QPAK_getRawRegion(fvoid *opaque, void **handle,
+                             PHYSFS_uint64 *offset)
+{
+    QPAKfileinfo *finfo = (QPAKfileinfo *) opaque;
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->startPos;
+    return(1);  /* these are never compressed. */
+} /* QPAK_getRawRegion */
+
+
 static int qpak_open(const char *filename, int forWriting,
                     void **fh, PHYSFS_uint32 *count)
 {
@@ -245,6 +259,8 @@ static int qpak_load_entries(const char *name, int forWriting, QPAKinfo *info)
 {
     void *fh = NULL;
     PHYSFS_uint32 fileCount;
+    PHYSFS_uint8 *dir;
+    const PHYSFS_uint8 *rec;
     QPAKentry *entry;
 
     BAIL_IF_MACRO(!qpak_open(name, forWriting, &fh, &fileCount), NULL, 0);
@@ -256,33 +272,27 @@ static int qpak_load_entries(const char *name, int forWriting, QPAKinfo *info)
         BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
     } /* if */
 
-    for (entry = info->entries; fileCount > 0; fileCount--, entry++)
+    /* the whole directory in one read: 56-byte name, offset and size. */
+    dir = (PHYSFS_uint8 *) __PHYSFS_readTable(fh, 64, fileCount);
+    if (dir == NULL)
     {
-        PHYSFS_uint32 loc;
-
-        if (__PHYSFS_platformRead(fh,&entry->name,sizeof(entry->name),1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        if (__PHYSFS_platformRead(fh,&loc,sizeof(loc),1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        if (__PHYSFS_platformRead(fh,&entry->size,sizeof(entry->size),1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
+        __PHYSFS_platformClose(fh);
+        return(0);
+    } /* if */
 
+    rec = dir;
+    for (entry = info->entries; fileCount > 0; fileCount--, entry++)
+    {
+        memcpy(entry->name, rec, sizeof (entry->name));
+        memcpy(&entry->startPos, rec + 56, 4);
+        memcpy(&entry->size, rec + 60, 4);
         entry->size = PHYSFS_swapULE32(entry->size);
-        entry->startPos = PHYSFS_swapULE32(loc);
+        entry->startPos = PHYSFS_swapULE32(entry->startPos);
+        rec += 64;
     } /* for */
 
-    __PHYSFS_platformClose(fh);
+    allocator.Free(dir);
+    info->handle = fh;  /* keep it open for reading files. */
 
     __PHYSFS_sort(info->entries, info->entryCount,
                   qpak_entry_cmp, qpak_entry_swap);
@@ -555,14 +565,14 @@ static fvoid *QPAK_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     finfo = (QPAKfileinfo *) allocator.Malloc(sizeof (QPAKfileinfo));
     BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
-    finfo->handle = __PHYSFS_platformOpenRead(info->filename);
-    if ( (finfo->handle == NULL) ||
-         (!__PHYSFS_platformSeek(finfo->handle, entry->startPos)) )
+    finfo->handle = __PHYSFS_openEntryHandle(info->filename, info->handle);
+    if (finfo->handle == NULL)
     {
         allocator.Free(finfo);
         return(NULL);
     } /* if */
 
+    finfo->info = info;
     finfo->curPos = 0;
     finfo->entry = entry;
     return(finfo);
@@ -624,7 +634,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_QPAK =
     QPAK_tell,               /* tell() method           */
     QPAK_seek,               /* seek() method           */
     QPAK_fileLength,         /* fileLength() method     */
-    QPAK_fileClose           /* fileClose() method      */
+    QPAK_fileClose,          /* fileClose() method      */
+    QPAK_getRawRegion,       /* getRawRegion() method   */
+    NULL,                    /* prefetch() method       */
+    NULL                     /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_QPAK */
@@ -66,12 +66,14 @@ typedef struct
     PHYSFS_uint32 entryCount;
     PHYSFS_uint32 entryOffset;
     WADentry *entries;
+    void *handle;  /* files opened in the archive read through this. */
 } WADinfo;
 
 typedef struct
 {
-    void *handle;
+    WADinfo *info;
     WADentry *entry;
+    void *handle;  /* see __PHYSFS_openEntryHandle(). */
     PHYSFS_uint32 curPos;
 } WADfileinfo;
 
@@ -79,6 +81,7 @@ typedef struct
 static void WAD_dirClose(dvoid *opaque)
 {
     WADinfo *info = ((WADinfo *) opaque);
+    __PHYSFS_platformClose(info->handle);
     allocator.Free(info->filename);
     allocator.Free(info->entries);
     allocator.Free(info);
@@ -97,9 +100,14 @@ static PHYSFS_sint64 WAD_read(fvoid *opaque, void *buffer,
     if (objsLeft < objCount)
         objCount = objsLeft;
 
-    rc = __PHYSFS_platformRead(finfo->handle, buffer, objSize, objCount);
+    rc = __PHYSFS_readArchiveAt(finfo->handle, NULL, buffer,
+                                entry->startPos + finfo->curPos,
+                                objSize * objCount);
     if (rc > 0)
+    {
+        rc /= objSize;  /* whole objects only. */
         finfo->curPos += (PHYSFS_uint32) (rc * objSize);
+    } /* if */
 
     return(rc);
 } /* WAD_read */
@@ -130,15 +138,11 @@ static int WAD_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     WADfileinfo *finfo = (WADfileinfo *) opaque;
     WADentry *entry = finfo->entry;
-    int rc;
 
     BAIL_IF_MACRO(offset < 0, ERR_INVALID_ARGUMENT, 0);
     BAIL_IF_MACRO(offset >= entry->size, ERR_PAST_EOF, 0);
-    rc = __PHYSFS_platformSeek(finfo->handle, entry->startPos + offset);
-    if (rc)
-        finfo->curPos = (PHYSFS_uint32) offset;
-
-    return(rc);
+    finfo->curPos = (PHYSFS_uint32) offset;  /* reads start from here. */
+    return(1);
 } /* WAD_seek */
 
 
@@ -152,12 +156,22 @@ static PHYSFS_sint64 WAD_fileLength(fvoid *opaque)
 static int WAD_fileClose(fvoid *opaque)
 {
     WADfileinfo *finfo = (WADfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* WAD_fileClose */
 
 
+static int WAD_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    WADfileinfo *finfo = (WADfileinfo *) opaque;
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->startPos;
+    return(1);  /* these are never compressed. */
+} /* WAD_getRawRegion */
+
+
 static int wad_open(const char *filename, int forWriting,
                     void **fh, PHYSFS_uint32 *count,PHYSFS_uint32 *offset)
 {
@@ -244,6 +258,8 @@ static int wad_load_entries(const char *name, int forWriting, WADinfo *info)
     void *fh = NULL;
     PHYSFS_uint32 fileCount;
     PHYSFS_uint32 directoryOffset;
+    PHYSFS_uint8 *dir;
+    const PHYSFS_uint8 *rec;
     WADentry *entry;
 
     BAIL_IF_MACRO(!wad_open(name, forWriting, &fh, &fileCount,&directoryOffset), NULL, 0);
@@ -255,34 +271,30 @@ static int wad_load_entries(const char *name, int forWriting, WADinfo *info)
         BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
     } /* if */
 
-    __PHYSFS_platformSeek(fh,directoryOffset);
+    /* the whole directory in one read: offset, size and 8-byte name. */
+    dir = NULL;
+    if (__PHYSFS_platformSeek(fh, directoryOffset))
+        dir = (PHYSFS_uint8 *) __PHYSFS_readTable(fh, 16, fileCount);
+    if (dir == NULL)
+    {
+        __PHYSFS_platformClose(fh);
+        return(0);
+    } /* if */
 
+    rec = dir;
     for (entry = info->entries; fileCount > 0; fileCount--, entry++)
     {
-        if (__PHYSFS_platformRead(fh, &entry->startPos, 4, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-        
-        if (__PHYSFS_platformRead(fh, &entry->size, 4, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
-        if (__PHYSFS_platformRead(fh, &entry->name, 8, 1) != 1)
-        {
-            __PHYSFS_platformClose(fh);
-            return(0);
-        } /* if */
-
+        memcpy(&entry->startPos, rec, 4);
+        memcpy(&entry->size, rec + 4, 4);
+        memcpy(entry->name, rec + 8, 8);
         entry->name[8] = '\0'; /* name might not be null-terminated in file. */
         entry->size = PHYSFS_swapULE32(entry->size);
         entry->startPos = PHYSFS_swapULE32(entry->startPos);
+        rec += 16;
     } /* for */
 
-    __PHYSFS_platformClose(fh);
+    allocator.Free(dir);
+    info->handle = fh;  /* keep it open for reading files. */
 
     __PHYSFS_sort(info->entries, info->entryCount,
                   wad_entry_cmp, wad_entry_swap);
@@ -453,14 +465,14 @@ static fvoid *WAD_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     finfo = (WADfileinfo *) allocator.Malloc(sizeof (WADfileinfo));
     BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
-    finfo->handle = __PHYSFS_platformOpenRead(info->filename);
-    if ( (finfo->handle == NULL) ||
-         (!__PHYSFS_platformSeek(finfo->handle, entry->startPos)) )
+    finfo->handle = __PHYSFS_openEntryHandle(info->filename, info->handle);
+    if (finfo->handle == NULL)
     {
         allocator.Free(finfo);
         return(NULL);
     } /* if */
 
+    finfo->info = info;
     finfo->curPos = 0;
     finfo->entry = entry;
     return(finfo);
@@ -522,7 +534,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_WAD =
     WAD_tell,               /* tell() method           */
     WAD_seek,               /* seek() method           */
     WAD_fileLength,         /* fileLength() method     */
-    WAD_fileClose           /* fileClose() method      */
+    WAD_fileClose,          /* fileClose() method      */
+    WAD_getRawRegion,       /* getRawRegion() method   */
+    NULL,                   /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_WAD */
@@ -23,18 +23,44 @@
 #include "physfs_internal.h"
 
 /*
- * A buffer of ZIP_READBUFSIZE is allocated for each compressed file opened,
- *  and is freed when you close the file; compressed data is read into
- *  this buffer, and then is decompressed into the buffer passed to
- *  PHYSFS_read().
+ * Each compressed file opened gets a buffer the size of its compressed
+ *  data, but no smaller than ZIP_MINBUFSIZE and no bigger than
+ *  ZIP_MAXBUFSIZE; compressed data is read into this buffer, and then is
+ *  decompressed into the buffer passed to PHYSFS_read(). The buffer and
+ *  the inflate state go back to a pool when you close the file, to be
+ *  reused by the next one; see zip_inflater_get().
  *
  * Uncompressed entries in a zipfile do not allocate this buffer; they just
- *  read data directly into the buffer passed to PHYSFS_read().
+ *  read data directly into the buffer passed to PHYSFS_read(). Neither do
+ *  entries in a memory-mapped archive, which inflate straight out of the
+ *  mapping; see PHYSFS_setZipMapArchives().
  *
- * Depending on your speed and memory requirements, you should tweak this
- *  value.
+ * Depending on your speed and memory requirements, you should tweak these
+ *  values.
  */
-#define ZIP_READBUFSIZE   (16 * 1024)
+#define ZIP_MINBUFSIZE    (1024)
+#define ZIP_MAXBUFSIZE    (256 * 1024)
+
+/* How many inflaters the pool keeps by default. */
+#define ZIP_DEFAULT_INFLATERPOOL  8
+
+/*
+ * Forward seeks in a compressed file decode and throw away everything in
+ *  between, ZIP_SKIPBUFSIZE bytes at a time.
+ */
+#define ZIP_SKIPBUFSIZE   (64 * 1024)
+
+/* Inflate never looks back further than this. */
+#define ZIP_WINDOWSIZE    (32 * 1024)
+
+/* Compressed entries bigger than this aren't cached unless asked for. */
+#define ZIP_CACHE_DEFAULT_MAXENTRY  (1024 * 1024)
+
+/*
+ * Resolving every local header at mount reads up to this much of the
+ *  archive at once, so headers that sit close together cost one read.
+ */
+#define ZIP_RESOLVEBUFSIZE  (256 * 1024)
 
 
 /*
@@ -56,6 +82,33 @@ typedef enum
 } ZipResolveType;
 
 
+/*
+ * A place to restart inflating a compressed entry; see zip_add_checkpoint().
+ *  (windowLen) bytes of history follow the struct in the same allocation.
+ */
+typedef struct
+{
+    PHYSFS_uint64 uncompressed;         /* offset in uncompressed data    */
+    PHYSFS_uint64 compressed;           /* offset of next compressed byte */
+    int bits;                           /* unused bits in the byte before */
+    PHYSFS_uint32 windowLen;            /* bytes of history that follow   */
+} ZIPcheckpoint;
+
+
+/*
+ * A fully decompressed copy of a compressed entry; see zip_cache_get().
+ *  (size) bytes of data follow the struct in the same allocation.
+ */
+typedef struct _ZIPcached
+{
+    struct _ZIPentry *entry;            /* whose data; NULL once evicted  */
+    PHYSFS_uint64 size;                 /* bytes of data that follow      */
+    PHYSFS_uint32 refcount;             /* handles reading from this      */
+    struct _ZIPcached *prev;            /* more recently used             */
+    struct _ZIPcached *next;            /* less recently used             */
+} ZIPcached;
+
+
 /*
  * One ZIPentry is kept for each file in an open ZIP archive.
  */
@@ -64,37 +117,84 @@ typedef struct _ZIPentry
     char *name;                         /* Name of file in archive        */
     struct _ZIPentry *symlink;          /* NULL or file we symlink to     */
     ZipResolveType resolved;            /* Have we resolved file/symlink? */
-    PHYSFS_uint32 offset;               /* offset of data in archive      */
+    PHYSFS_uint64 offset;               /* offset of data in archive      */
     PHYSFS_uint16 version;              /* version made by                */
     PHYSFS_uint16 version_needed;       /* version needed to extract      */
     PHYSFS_uint16 compression_method;   /* compression method             */
     PHYSFS_uint32 crc;                  /* crc-32                         */
-    PHYSFS_uint32 compressed_size;      /* compressed size                */
-    PHYSFS_uint32 uncompressed_size;    /* uncompressed size              */
+    PHYSFS_uint64 compressed_size;      /* compressed size                */
+    PHYSFS_uint64 uncompressed_size;    /* uncompressed size              */
     PHYSFS_sint64 last_mod_time;        /* last file mod time             */
+    ZIPcheckpoint **checkpoints;        /* seek checkpoints, in order     */
+    PHYSFS_uint32 checkpointCount;      /* number of (checkpoints)        */
+    ZIPcached *cached;                  /* decompressed data, or NULL     */
 } ZIPentry;
 
+#define ZIP_NO_NODE 0xFFFFFFFF
+
+/*
+ * One ZIPnode is kept for each file and directory in an open ZIP archive.
+ *  Links are indices into ZIPinfo.nodes, or ZIP_NO_NODE.
+ */
+typedef struct
+{
+    const char *name;           /* full path; NOT null-terminated for dirs. */
+    PHYSFS_uint32 namelen;      /* length of (name).                        */
+    ZIPentry *entry;            /* the file, or NULL for a directory.       */
+    PHYSFS_uint32 hashNext;     /* next node in the same hash bucket.       */
+    PHYSFS_uint32 firstChild;   /* first thing in this directory.           */
+    PHYSFS_uint32 nextSibling;  /* next thing in the parent directory.      */
+} ZIPnode;
+
 /*
  * One ZIPinfo is kept for each open ZIP archive.
  */
 typedef struct
 {
     char *archiveName;        /* path to ZIP in platform-dependent notation. */
-    PHYSFS_uint16 entryCount; /* Number of files in ZIP.                     */
+    PHYSFS_uint32 entryCount; /* Number of files in ZIP.                     */
     ZIPentry *entries;        /* info on all files in ZIP.                   */
+    ZIPnode *nodes;           /* path index; node zero is the root dir.      */
+    PHYSFS_uint32 nodeCount;  /* Number of used (nodes).                     */
+    PHYSFS_uint32 *buckets;   /* hash table of node chains, by full path.    */
+    PHYSFS_uint32 bucketCount; /* always a power of two.                     */
+    PHYSFS_uint64 indexBytes; /* memory held by (nodes) and (buckets).       */
+    void *resolveLock;        /* serializes lazy resolution of entries.      */
+    void *handle;             /* the archive; open files read through this.  */
+    void *ioLock;             /* for __PHYSFS_readArchiveAt().               */
+    const PHYSFS_uint8 *mapped; /* the whole archive in memory, or NULL.     */
+    PHYSFS_uint64 mappedLen;  /* bytes at (mapped).                          */
+    void *mapping;            /* for __PHYSFS_platformUnmap().               */
 } ZIPinfo;
 
+/*
+ * The inflate state and input buffer for reading a compressed file.
+ */
+typedef struct _ZIPinflater
+{
+    z_stream stream;                      /* zlib stream state.         */
+    PHYSFS_uint8 *buffer;                 /* decompression buffer/NULL. */
+    PHYSFS_uint32 bufferSize;             /* bytes in (buffer).         */
+    struct _ZIPinflater *next;            /* next in the pool.          */
+} ZIPinflater;
+
 /*
  * One ZIPfileinfo is kept for each open file in a ZIP archive.
  */
 typedef struct
 {
     ZIPentry *entry;                      /* Info on file.              */
-    void *handle;                         /* physical file handle.      */
-    PHYSFS_uint32 compressed_position;    /* offset in compressed data. */
-    PHYSFS_uint32 uncompressed_position;  /* tell() position.           */
-    PHYSFS_uint8 *buffer;                 /* decompression buffer.      */
-    z_stream stream;                      /* zlib stream state.         */
+    ZIPinfo *info;                        /* archive it's in.           */
+    void *handle;                         /* __PHYSFS_openEntryHandle() */
+    PHYSFS_uint64 compressed_position;    /* offset in compressed data. */
+    PHYSFS_uint64 uncompressed_position;  /* tell() position.           */
+    ZIPinflater *inflater;                /* NULL if not inflating.     */
+    PHYSFS_uint32 checkpointInterval;     /* zero if not adding any.    */
+    PHYSFS_uint64 nextCheckpoint;         /* try to add one past here.  */
+    PHYSFS_uint8 *history;                /* ring of recent output.     */
+    PHYSFS_uint32 historyPos;             /* next write in (history).   */
+    PHYSFS_uint32 historyFill;            /* valid bytes in (history).  */
+    ZIPcached *cached;                    /* read from here if not NULL. */
 } ZIPfileinfo;
 
 
@@ -102,6 +202,19 @@ typedef struct
 #define ZIP_LOCAL_FILE_SIG          0x04034b50
 #define ZIP_CENTRAL_DIR_SIG         0x02014b50
 #define ZIP_END_OF_CENTRAL_DIR_SIG  0x06054b50
+#define ZIP64_END_OF_CENTRAL_DIR_SIG  0x06064b50
+#define ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG  0x07064b50
+#define ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG  0x0001
+
+/* fixed-size parts of records, not counting variable-length fields... */
+#define ZIP_LOCAL_FILE_LEN          30
+#define ZIP_CENTRAL_DIR_LEN         46
+#define ZIP_END_OF_CENTRAL_DIR_LEN  22
+#define ZIP64_END_OF_CENTRAL_DIR_LEN  56
+#define ZIP64_END_OF_CENTRAL_DIR_LOCATOR_LEN  20
+
+/* end-of-central-dir record plus the largest possible zipfile comment. */
+#define ZIP_EOCD_SEARCHLEN  (ZIP_END_OF_CENTRAL_DIR_LEN + 0xFFFF)
 
 /* compression methods... */
 #define COMPMETH_NONE 0
@@ -112,6 +225,102 @@ typedef struct
 #define UNIX_FILETYPE_SYMLINK 0120000
 
 
+/*
+ * State shared by all mounted ZIPs, set up by PHYSFS_init() and torn down
+ *  by PHYSFS_deinit() once the search path is gone.
+ */
+static void *zipStateLock = NULL;
+static PHYSFS_ZipStats zipStats;
+static PHYSFS_uint32 zipCheckpointInterval = 0;
+static ZIPcached *zipCacheHead = NULL;  /* most recently used. */
+static ZIPcached *zipCacheTail = NULL;  /* least recently used. */
+static PHYSFS_uint64 zipCacheBudget = 0;
+static PHYSFS_uint32 zipCacheMaxEntry = ZIP_CACHE_DEFAULT_MAXENTRY;
+static ZIPinflater *zipInflaterPool = NULL;
+static PHYSFS_uint32 zipInflaterPoolMax = ZIP_DEFAULT_INFLATERPOOL;
+static int zipResolveOnMount = 0;
+static int zipMapArchives = 0;
+
+static void zip_cache_trim(PHYSFS_uint64 extra);
+static void zip_inflater_trim(void);
+
+int __PHYSFS_zipInit(void)
+{
+    zipStateLock = __PHYSFS_platformCreateMutex();
+    BAIL_IF_MACRO(zipStateLock == NULL, NULL, 0);
+    memset(&zipStats, '\0', sizeof (zipStats));
+    zipCheckpointInterval = 0;
+    zipCacheBudget = 0;
+    zipCacheMaxEntry = ZIP_CACHE_DEFAULT_MAXENTRY;
+    zipInflaterPoolMax = ZIP_DEFAULT_INFLATERPOOL;
+    zipResolveOnMount = 0;
+    zipMapArchives = 0;
+    return(1);
+} /* __PHYSFS_zipInit */
+
+
+void __PHYSFS_zipDeinit(void)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipInflaterPoolMax = 0;
+    zip_inflater_trim();
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+    __PHYSFS_platformDestroyMutex(zipStateLock);
+    zipStateLock = NULL;
+} /* __PHYSFS_zipDeinit */
+
+
+void __PHYSFS_zipGetStats(PHYSFS_ZipStats *stats)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    memcpy(stats, &zipStats, sizeof (PHYSFS_ZipStats));
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipGetStats */
+
+
+void __PHYSFS_zipSetCheckpointInterval(PHYSFS_uint32 interval)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipCheckpointInterval = interval;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipSetCheckpointInterval */
+
+
+void __PHYSFS_zipSetCache(PHYSFS_uint64 budget, PHYSFS_uint32 maxEntrySize)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipCacheBudget = budget;
+    zipCacheMaxEntry = maxEntrySize;
+    zip_cache_trim(0);
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipSetCache */
+
+
+void __PHYSFS_zipSetInflaterPool(PHYSFS_uint32 count)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipInflaterPoolMax = count;
+    zip_inflater_trim();
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipSetInflaterPool */
+
+
+void __PHYSFS_zipSetResolveOnMount(int enable)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipResolveOnMount = enable;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipSetResolveOnMount */
+
+
+void __PHYSFS_zipSetMapArchives(int enable)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipMapArchives = enable;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* __PHYSFS_zipSetMapArchives */
+
+
 /*
  * Bridge physfs allocation functions to zlib's format...
  */
@@ -174,6 +383,129 @@ static int zlib_err(int rc)
 } /* zlib_err */
 
 
+/*
+ * Pool of inflaters, so opening and closing lots of compressed files
+ *  doesn't mean allocating and freeing zlib's state and a read buffer
+ *  every time. zipStateLock guards the pool.
+ */
+static void zip_inflater_free(ZIPinflater *inf)
+{
+    inflateEnd(&inf->stream);
+    if (inf->buffer != NULL)
+        allocator.Free(inf->buffer);
+    allocator.Free(inf);
+} /* zip_inflater_free */
+
+
+/* Free pooled inflaters past the limit. Caller holds zipStateLock. */
+static void zip_inflater_trim(void)
+{
+    while (zipStats.pooledInflaters > zipInflaterPoolMax)
+    {
+        ZIPinflater *inf = zipInflaterPool;
+        zipInflaterPool = inf->next;
+        zipStats.pooledInflaters--;
+        zip_inflater_free(inf);
+    } /* while */
+} /* zip_inflater_trim */
+
+
+/*
+ * Get a freshly reset inflater, from the pool if there's one there, with
+ *  a buffer big enough to hold (compressed_size) bytes, within reason.
+ *  Inflating out of a mapped archive needs no buffer, so (needBuffer) may
+ *  be zero; the inflater might still have one from an earlier user.
+ */
+static ZIPinflater *zip_inflater_get(PHYSFS_uint64 compressed_size,
+                                     int needBuffer)
+{
+    PHYSFS_uint32 bufsize = ZIP_MAXBUFSIZE;
+    ZIPinflater *retval;
+
+    if (!needBuffer)
+        bufsize = 0;
+    else if (compressed_size < ZIP_MINBUFSIZE)
+        bufsize = ZIP_MINBUFSIZE;
+    else if (compressed_size < ZIP_MAXBUFSIZE)
+        bufsize = (PHYSFS_uint32) compressed_size;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    retval = zipInflaterPool;
+    if (retval != NULL)
+    {
+        zipInflaterPool = retval->next;
+        zipStats.pooledInflaters--;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
+    if (retval != NULL)
+    {
+        /* a smaller buffer still works, so a failed grow isn't fatal. */
+        if (retval->bufferSize < bufsize)
+        {
+            void *ptr;
+            if (retval->buffer == NULL)
+                ptr = allocator.Malloc(bufsize);
+            else
+                ptr = allocator.Realloc(retval->buffer, bufsize);
+
+            if (ptr != NULL)
+            {
+                retval->buffer = (PHYSFS_uint8 *) ptr;
+                retval->bufferSize = bufsize;
+            } /* if */
+        } /* if */
+
+        /* ...but having none at all is. */
+        if ((bufsize > 0) && (retval->buffer == NULL))
+        {
+            zip_inflater_free(retval);
+            BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+        } /* if */
+
+        inflateReset(&retval->stream);
+        retval->stream.next_in = NULL;
+        retval->stream.avail_in = 0;
+        return(retval);
+    } /* if */
+
+    retval = (ZIPinflater *) allocator.Malloc(sizeof (ZIPinflater));
+    BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
+    retval->buffer = NULL;
+    if (bufsize > 0)
+        retval->buffer = (PHYSFS_uint8 *) allocator.Malloc(bufsize);
+    if ((bufsize > 0) && (retval->buffer == NULL))
+    {
+        allocator.Free(retval);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    initializeZStream(&retval->stream);
+    if (zlib_err(inflateInit2(&retval->stream, -MAX_WBITS)) != Z_OK)
+    {
+        if (retval->buffer != NULL)
+            allocator.Free(retval->buffer);
+        allocator.Free(retval);
+        return(NULL);
+    } /* if */
+
+    retval->bufferSize = bufsize;
+    retval->next = NULL;
+    return(retval);
+} /* zip_inflater_get */
+
+
+static void zip_inflater_release(ZIPinflater *inf)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    inf->next = zipInflaterPool;
+    zipInflaterPool = inf;
+    zipStats.pooledInflaters++;
+    zip_inflater_trim();
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* zip_inflater_release */
+
+
 /*
  * Read an unsigned 32-bit int and swap to native byte order.
  */
@@ -187,15 +519,323 @@ static int readui32(void *in, PHYSFS_uint32 *val)
 
 
 /*
- * Read an unsigned 16-bit int and swap to native byte order.
+ * Read exactly (len) bytes at (pos) in the archive.
  */
-static int readui16(void *in, PHYSFS_uint16 *val)
+static int zip_read_at(ZIPinfo *info, void *buf, PHYSFS_uint64 pos,
+                       PHYSFS_uint32 len)
 {
-    PHYSFS_uint16 v;
-    BAIL_IF_MACRO(__PHYSFS_platformRead(in, &v, sizeof (v), 1) != 1, NULL, 0);
-    *val = PHYSFS_swapULE16(v);
+    PHYSFS_sint64 rc;
+
+    if (info->mapped != NULL)
+    {
+        BAIL_IF_MACRO(pos > info->mappedLen, ERR_PAST_EOF, 0);
+        BAIL_IF_MACRO(len > info->mappedLen - pos, ERR_PAST_EOF, 0);
+        memcpy(buf, info->mapped + pos, len);
+        return(1);
+    } /* if */
+
+    rc = __PHYSFS_readArchiveAt(info->handle, info->ioLock, buf, pos, len);
+    BAIL_IF_MACRO(rc == -1, NULL, 0);
+    BAIL_IF_MACRO(rc != (PHYSFS_sint64) len, ERR_PAST_EOF, 0);
+    return(1);
+} /* zip_read_at */
+
+
+/*
+ * Pull a little-endian 16/32-bit int out of a buffer we already read.
+ */
+static PHYSFS_uint16 zip_get_ui16(const PHYSFS_uint8 *ptr)
+{
+    return((PHYSFS_uint16) (((PHYSFS_uint16) ptr[0]) |
+                            (((PHYSFS_uint16) ptr[1]) << 8)));
+} /* zip_get_ui16 */
+
+
+static PHYSFS_uint32 zip_get_ui32(const PHYSFS_uint8 *ptr)
+{
+    return( ((PHYSFS_uint32) ptr[0])        |
+            (((PHYSFS_uint32) ptr[1]) << 8)  |
+            (((PHYSFS_uint32) ptr[2]) << 16) |
+            (((PHYSFS_uint32) ptr[3]) << 24) );
+} /* zip_get_ui32 */
+
+
+static PHYSFS_uint64 zip_get_ui64(const PHYSFS_uint8 *ptr)
+{
+    return( ((PHYSFS_uint64) zip_get_ui32(ptr)) |
+            (((PHYSFS_uint64) zip_get_ui32(ptr + 4)) << 32) );
+} /* zip_get_ui64 */
+
+
+/*
+ * Seek checkpoints for deflated entries (the idea is from zlib's zran.c).
+ *  While a handle inflates an entry, every so often at a deflate block
+ *  boundary we save where we are in both streams, plus the last
+ *  ZIP_WINDOWSIZE bytes of output, which is all the history inflate needs
+ *  to carry on from there. Seeking can then start at the closest
+ *  checkpoint before the target, instead of from the start of the entry.
+ *  Checkpoints belong to the entry, so every handle shares them, and they
+ *  live until the archive is unmounted. zipStateLock guards the lists.
+ */
+static void zip_remember_output(ZIPfileinfo *finfo, const PHYSFS_uint8 *buf,
+                                PHYSFS_uint32 len)
+{
+    PHYSFS_uint32 cpy;
+
+    if (len >= ZIP_WINDOWSIZE)  /* only the tail matters. */
+    {
+        buf += len - ZIP_WINDOWSIZE;
+        len = ZIP_WINDOWSIZE;
+    } /* if */
+
+    cpy = ZIP_WINDOWSIZE - finfo->historyPos;
+    if (cpy > len)
+        cpy = len;
+    memcpy(finfo->history + finfo->historyPos, buf, cpy);
+    memcpy(finfo->history, buf + cpy, len - cpy);
+    finfo->historyPos = (finfo->historyPos + len) % ZIP_WINDOWSIZE;
+
+    finfo->historyFill += len;
+    if (finfo->historyFill > ZIP_WINDOWSIZE)
+        finfo->historyFill = ZIP_WINDOWSIZE;
+} /* zip_remember_output */
+
+
+static void zip_add_checkpoint(ZIPfileinfo *finfo, PHYSFS_uint64 here)
+{
+    ZIPentry *entry = finfo->entry;
+    const PHYSFS_uint32 winlen = finfo->historyFill;
+    PHYSFS_uint64 last = 0;
+    ZIPcheckpoint *point;
+    void *ptr;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+
+    if (entry->checkpointCount > 0)
+        last = entry->checkpoints[entry->checkpointCount - 1]->uncompressed;
+
+    /* another handle may have been through here first. */
+    if (here < last + finfo->checkpointInterval)
+    {
+        finfo->nextCheckpoint = last + finfo->checkpointInterval;
+        __PHYSFS_platformReleaseMutex(zipStateLock);
+        return;
+    } /* if */
+
+    ptr = allocator.Realloc(entry->checkpoints,
+                    (entry->checkpointCount + 1) * sizeof (ZIPcheckpoint *));
+    point = (ZIPcheckpoint *) allocator.Malloc(sizeof (ZIPcheckpoint) + winlen);
+    if (ptr != NULL)
+        entry->checkpoints = (ZIPcheckpoint **) ptr;
+
+    if ((ptr == NULL) || (point == NULL))
+    {
+        /* no big deal; seeks will just be slower. Try again later. */
+        if (point != NULL)
+            allocator.Free(point);
+        finfo->nextCheckpoint = here + finfo->checkpointInterval;
+        __PHYSFS_platformReleaseMutex(zipStateLock);
+        return;
+    } /* if */
+
+    point->uncompressed = here;
+    point->compressed = finfo->compressed_position -
+                        finfo->inflater->stream.avail_in;
+    point->bits = finfo->inflater->stream.data_type & 7;
+    point->windowLen = winlen;
+
+    /* unwrap the history ring, oldest byte first. */
+    if (winlen < ZIP_WINDOWSIZE)
+        memcpy(point + 1, finfo->history, winlen);
+    else
+    {
+        const PHYSFS_uint32 tail = ZIP_WINDOWSIZE - finfo->historyPos;
+        memcpy(point + 1, finfo->history + finfo->historyPos, tail);
+        memcpy(((PHYSFS_uint8 *) (point + 1)) + tail, finfo->history,
+               finfo->historyPos);
+    } /* else */
+
+    entry->checkpoints[entry->checkpointCount++] = point;
+    finfo->nextCheckpoint = here + finfo->checkpointInterval;
+    zipStats.checkpoints++;
+    zipStats.checkpointBytes += sizeof (ZIPcheckpoint) + winlen;
+
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* zip_add_checkpoint */
+
+
+/* Returns the last checkpoint at or before (offset), or NULL if none. */
+static const ZIPcheckpoint *zip_find_checkpoint(ZIPentry *entry,
+                                                PHYSFS_uint64 offset)
+{
+    const ZIPcheckpoint *retval = NULL;
+    PHYSFS_uint32 lo = 0;
+    PHYSFS_uint32 hi;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    hi = entry->checkpointCount;
+    while (lo < hi)
+    {
+        const PHYSFS_uint32 middle = lo + ((hi - lo) / 2);
+        if (entry->checkpoints[middle]->uncompressed <= offset)
+        {
+            retval = entry->checkpoints[middle];
+            lo = middle + 1;
+        } /* if */
+        else
+        {
+            hi = middle;
+        } /* else */
+    } /* while */
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
+    return(retval);  /* checkpoints are never changed once they're added. */
+} /* zip_find_checkpoint */
+
+
+/*
+ * Restart the handle's inflate stream at (point), or at the start of the
+ *  entry if (point) is NULL.
+ */
+static int zip_restart_inflate(ZIPfileinfo *finfo, const ZIPcheckpoint *point)
+{
+    ZIPentry *entry = finfo->entry;
+    z_stream *str = &finfo->inflater->stream;
+    PHYSFS_uint64 ofs = (point != NULL) ? point->compressed : 0;
+    PHYSFS_uint8 byte = 0;
+
+    /* the checkpoint's block might start partway into the previous byte. */
+    if ((point != NULL) && (point->bits != 0))
+    {
+        if (!zip_read_at(finfo->info, &byte, entry->offset + ofs - 1, 1))
+            return(0);
+    } /* if */
+
+    /* can't fail on a good stream, so do it last; the state stays sane. */
+    inflateReset(str);
+    str->next_in = NULL;
+    str->avail_in = 0;
+    if ((point != NULL) && (point->bits != 0))
+        inflatePrime(str, point->bits, byte >> (8 - point->bits));
+
+    finfo->historyPos = finfo->historyFill = 0;
+    if ((point != NULL) && (point->windowLen > 0))
+    {
+        const PHYSFS_uint8 *window = (const PHYSFS_uint8 *) (point + 1);
+        inflateSetDictionary(str, window, point->windowLen);
+        if (finfo->history != NULL)
+            zip_remember_output(finfo, window, point->windowLen);
+    } /* if */
+
+    finfo->compressed_position = ofs;
+    finfo->uncompressed_position = (point != NULL) ? point->uncompressed : 0;
     return(1);
-} /* readui16 */
+} /* zip_restart_inflate */
+
+
+/*
+ * Cache of decompressed entries. Things like shaders and config files get
+ *  opened over and over, so instead of inflating the same bytes every
+ *  time, the first open of a small enough compressed entry decompresses
+ *  all of it into memory, and later opens just copy out of that. All
+ *  mounted ZIPs share one least-recently-used list and one byte budget.
+ *  Handles hold a reference, so evicting an entry that's still being read
+ *  only unhooks it; the last handle to let go frees it. zipStateLock
+ *  guards everything here, and callers of the functions that don't grab
+ *  it themselves must hold it.
+ */
+static void zip_cache_unlink(ZIPcached *c)
+{
+    if (c->prev != NULL)
+        c->prev->next = c->next;
+    else
+        zipCacheHead = c->next;
+
+    if (c->next != NULL)
+        c->next->prev = c->prev;
+    else
+        zipCacheTail = c->prev;
+
+    c->prev = c->next = NULL;
+} /* zip_cache_unlink */
+
+
+static void zip_cache_link(ZIPcached *c)
+{
+    c->prev = NULL;
+    c->next = zipCacheHead;
+    if (zipCacheHead != NULL)
+        zipCacheHead->prev = c;
+    else
+        zipCacheTail = c;
+    zipCacheHead = c;
+} /* zip_cache_link */
+
+
+static void zip_cache_drop(ZIPcached *c)
+{
+    zip_cache_unlink(c);
+    c->entry->cached = NULL;
+    c->entry = NULL;
+    zipStats.cacheEntries--;
+    zipStats.cacheBytes -= c->size;
+    if (c->refcount == 0)
+        allocator.Free(c);
+} /* zip_cache_drop */
+
+
+/* Evict least recently used data until (extra) more bytes fit. */
+static void zip_cache_trim(PHYSFS_uint64 extra)
+{
+    while ( (zipCacheTail != NULL) &&
+            ((zipStats.cacheBytes + extra) > zipCacheBudget) )
+    {
+        zip_cache_drop(zipCacheTail);
+        zipStats.cacheEvictions++;
+    } /* while */
+} /* zip_cache_trim */
+
+
+/*
+ * Grab a reference to (entry)'s cached data, or return NULL if it isn't
+ *  cached. (*cacheable) is set if it isn't, but could be.
+ */
+static ZIPcached *zip_cache_get(ZIPentry *entry, int *cacheable)
+{
+    ZIPcached *retval;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    retval = entry->cached;
+    *cacheable = 0;
+    if (retval != NULL)
+    {
+        retval->refcount++;
+        zip_cache_unlink(retval);
+        zip_cache_link(retval);
+        zipStats.cacheHits++;
+    } /* if */
+
+    else if ( (entry->uncompressed_size > 0) &&
+              (entry->uncompressed_size <= zipCacheMaxEntry) &&
+              (entry->uncompressed_size <= zipCacheBudget) )
+    {
+        *cacheable = 1;
+        zipStats.cacheMisses++;
+    } /* else if */
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
+    return(retval);
+} /* zip_cache_get */
+
+
+static void zip_cache_release(ZIPcached *c)
+{
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    c->refcount--;
+    if ((c->refcount == 0) && (c->entry == NULL))
+        allocator.Free(c);
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+} /* zip_cache_release */
 
 
 static PHYSFS_sint64 ZIP_read(fvoid *opaque, void *buf,
@@ -205,8 +845,8 @@ static PHYSFS_sint64 ZIP_read(fvoid *opaque, void *buf,
     ZIPentry *entry = finfo->entry;
     PHYSFS_sint64 retval = 0;
     PHYSFS_sint64 maxread = ((PHYSFS_sint64) objSize) * objCount;
-    PHYSFS_sint64 avail = entry->uncompressed_size -
-                          finfo->uncompressed_position;
+    PHYSFS_sint64 avail = (PHYSFS_sint64) (entry->uncompressed_size -
+                                           finfo->uncompressed_position);
 
     BAIL_IF_MACRO(maxread == 0, NULL, 0);    /* quick rejection. */
 
@@ -218,45 +858,129 @@ static PHYSFS_sint64 ZIP_read(fvoid *opaque, void *buf,
         __PHYSFS_setError(ERR_PAST_EOF);   /* this is always true here. */
     } /* if */
 
-    if (entry->compression_method == COMPMETH_NONE)
+    if (finfo->cached != NULL)
     {
-        retval = __PHYSFS_platformRead(finfo->handle, buf, objSize, objCount);
+        memcpy(buf, ((PHYSFS_uint8 *) (finfo->cached + 1)) +
+                        finfo->uncompressed_position, (size_t) maxread);
+        retval = objCount;
     } /* if */
 
+    else if ( (entry->compression_method == COMPMETH_NONE) &&
+              (finfo->info->mapped != NULL) )
+    {
+        const PHYSFS_uint64 pos = entry->offset + finfo->uncompressed_position;
+        const PHYSFS_uint64 len = finfo->info->mappedLen;
+        retval = maxread;
+        if (pos >= len)
+            retval = 0;  /* the central directory lied about this entry. */
+        else if ((PHYSFS_uint64) retval > len - pos)
+            retval = (PHYSFS_sint64) (len - pos);
+        BAIL_IF_MACRO(retval == 0, ERR_CORRUPTED, 0);
+
+        memcpy(buf, finfo->info->mapped + pos, (size_t) retval);
+        retval /= objSize;  /* whole objects only. */
+    } /* else if */
+
+    else if (entry->compression_method == COMPMETH_NONE)
+    {
+        const PHYSFS_uint64 pos = entry->offset + finfo->uncompressed_position;
+
+        while (retval < maxread)
+        {
+            const PHYSFS_sint64 left = maxread - retval;
+            const PHYSFS_uint32 len = (left > 0x40000000) ?
+                                        0x40000000 : (PHYSFS_uint32) left;
+            const PHYSFS_sint64 rc = __PHYSFS_readArchiveAt(finfo->handle,
+                                            NULL,
+                                            ((PHYSFS_uint8 *) buf) + retval,
+                                            pos + retval, len);
+            if (rc <= 0)
+            {
+                BAIL_IF_MACRO((rc < 0) && (retval == 0), NULL, -1);
+                break;
+            } /* if */
+
+            retval += rc;
+            if (rc < len)
+                break;  /* EOF (the archive got truncated under us?) */
+        } /* while */
+
+        retval /= objSize;  /* whole objects only. */
+    } /* else if */
+
     else
     {
-        finfo->stream.next_out = buf;
-        finfo->stream.avail_out = objSize * objCount;
+        z_stream *str = &finfo->inflater->stream;
+
+        str->next_out = buf;
+        str->avail_out = objSize * objCount;
 
         while (retval < maxread)
         {
-            PHYSFS_uint32 before = finfo->stream.total_out;
+            PHYSFS_uint32 before = str->total_out;
+            PHYSFS_uint8 *out = str->next_out;
+            int flush = Z_SYNC_FLUSH;
             int rc;
 
-            if (finfo->stream.avail_in == 0)
+            if (str->avail_in == 0)
             {
                 PHYSFS_sint64 br;
 
                 br = entry->compressed_size - finfo->compressed_position;
-                if (br > 0)
+                if ((br > 0) && (finfo->info->mapped != NULL))
                 {
-                    if (br > ZIP_READBUFSIZE)
-                        br = ZIP_READBUFSIZE;
+                    /* no copying; inflate reads the mapping directly. */
+                    ZIPinfo *info = finfo->info;
+                    const PHYSFS_uint64 pos = entry->offset +
+                                              finfo->compressed_position;
+                    if (pos >= info->mappedLen)
+                        break;  /* the archive is shorter than it claims. */
+                    else if ((PHYSFS_uint64) br > info->mappedLen - pos)
+                        br = (PHYSFS_sint64) (info->mappedLen - pos);
+                    if (br > 0x40000000)
+                        br = 0x40000000;  /* avail_in is only a uInt. */
+
+                    finfo->compressed_position += (PHYSFS_uint64) br;
+                    str->next_in = (Bytef *) (info->mapped + pos);
+                    str->avail_in = (PHYSFS_uint32) br;
+                } /* if */
 
-                    br = __PHYSFS_platformRead(finfo->handle,
-                                               finfo->buffer,
-                                               1, (PHYSFS_uint32) br);
+                else if (br > 0)
+                {
+                    if (br > finfo->inflater->bufferSize)
+                        br = finfo->inflater->bufferSize;
+
+                    br = __PHYSFS_readArchiveAt(finfo->handle, NULL,
+                                                finfo->inflater->buffer,
+                                                entry->offset +
+                                                  finfo->compressed_position,
+                                                (PHYSFS_uint32) br);
                     if (br <= 0)
                         break;
 
-                    finfo->compressed_position += (PHYSFS_uint32) br;
-                    finfo->stream.next_in = finfo->buffer;
-                    finfo->stream.avail_in = (PHYSFS_uint32) br;
+                    finfo->compressed_position += (PHYSFS_uint64) br;
+                    str->next_in = finfo->inflater->buffer;
+                    str->avail_in = (PHYSFS_uint32) br;
                 } /* if */
             } /* if */
 
-            rc = zlib_err(inflate(&finfo->stream, Z_SYNC_FLUSH));
-            retval += (finfo->stream.total_out - before);
+            /* stop at block boundaries if we might want a checkpoint. */
+            if (finfo->checkpointInterval != 0)
+                flush = Z_BLOCK;
+
+            rc = zlib_err(inflate(str, flush));
+            retval += (str->total_out - before);
+
+            if (finfo->history != NULL)
+            {
+                const PHYSFS_uint64 here = finfo->uncompressed_position +
+                                           (PHYSFS_uint64) retval;
+                const int type = str->data_type;
+                zip_remember_output(finfo, out, str->total_out - before);
+                if ( (rc == Z_OK) && (here >= finfo->nextCheckpoint) &&
+                     (type & 128) && (!(type & 64)) )  /* between blocks. */
+                    zip_add_checkpoint(finfo, here);
+            } /* if */
 
             if (rc != Z_OK)
                 break;
@@ -266,7 +990,7 @@ static PHYSFS_sint64 ZIP_read(fvoid *opaque, void *buf,
     } /* else */
 
     if (retval > 0)
-        finfo->uncompressed_position += (PHYSFS_uint32) (retval * objSize);
+        finfo->uncompressed_position += (PHYSFS_uint64) (retval * objSize);
 
     return(retval);
 } /* ZIP_read */
@@ -296,53 +1020,56 @@ static int ZIP_seek(fvoid *opaque, PHYSFS_uint64 offset)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) opaque;
     ZIPentry *entry = finfo->entry;
-    void *in = finfo->handle;
 
     BAIL_IF_MACRO(offset > entry->uncompressed_size, ERR_PAST_EOF, 0);
 
-    if (entry->compression_method == COMPMETH_NONE)
+    /* reads say where they want to be, so there's no file pointer to move. */
+    if ( (finfo->cached != NULL) ||
+         (entry->compression_method == COMPMETH_NONE) )
     {
-        PHYSFS_sint64 newpos = offset + entry->offset;
-        BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, newpos), NULL, 0);
-        finfo->uncompressed_position = (PHYSFS_uint32) offset;
+        finfo->uncompressed_position = offset;
     } /* if */
 
     else
     {
         /*
-         * If seeking backwards, we need to redecode the file
-         *  from the start and throw away the compressed bits until we hit
-         *  the offset we need. If seeking forward, we still need to
-         *  decode, but we don't rewind first.
+         * We can only decode forwards. If seeking backwards, or if a
+         *  checkpoint gets us closer than where we are now, restart
+         *  there (or at the start of the file), then decode and throw
+         *  away everything up to the offset we need.
          */
-        if (offset < finfo->uncompressed_position)
+        const PHYSFS_uint64 pos = offset;
+        const ZIPcheckpoint *point = zip_find_checkpoint(entry, pos);
+        PHYSFS_uint8 *buf;
+
+        if ( (pos < finfo->uncompressed_position) ||
+             ((point != NULL) &&
+              (point->uncompressed > finfo->uncompressed_position)) )
         {
-            /* we do a copy so state is sane if inflateInit2() fails. */
-            z_stream str;
-            initializeZStream(&str);
-            if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
+            if (!zip_restart_inflate(finfo, point))
                 return(0);
+        } /* if */
 
-            if (!__PHYSFS_platformSeek(in, entry->offset))
-                return(0);
+        if (finfo->uncompressed_position == pos)
+            return(1);
 
-            inflateEnd(&finfo->stream);
-            memcpy(&finfo->stream, &str, sizeof (z_stream));
-            finfo->uncompressed_position = finfo->compressed_position = 0;
-        } /* if */
+        buf = (PHYSFS_uint8 *) allocator.Malloc(ZIP_SKIPBUFSIZE);
+        BAIL_IF_MACRO(buf == NULL, ERR_OUT_OF_MEMORY, 0);
 
-        while (finfo->uncompressed_position != offset)
+        while (finfo->uncompressed_position != pos)
         {
-            PHYSFS_uint8 buf[512];
-            PHYSFS_uint32 maxread;
-
-            maxread = (PHYSFS_uint32) (offset - finfo->uncompressed_position);
-            if (maxread > sizeof (buf))
-                maxread = sizeof (buf);
+            PHYSFS_uint32 maxread = ZIP_SKIPBUFSIZE;
+            if (pos - finfo->uncompressed_position < maxread)
+                maxread = (PHYSFS_uint32) (pos - finfo->uncompressed_position);
 
             if (ZIP_read(finfo, buf, maxread, 1) != 1)
+            {
+                allocator.Free(buf);
                 return(0);
+            } /* if */
         } /* while */
+
+        allocator.Free(buf);
     } /* else */
 
     return(1);
@@ -359,104 +1086,121 @@ static PHYSFS_sint64 ZIP_fileLength(fvoid *opaque)
 static int ZIP_fileClose(fvoid *opaque)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) opaque;
-    BAIL_IF_MACRO(!__PHYSFS_platformClose(finfo->handle), NULL, 0);
 
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-        inflateEnd(&finfo->stream);
+    if (finfo->cached != NULL)
+        zip_cache_release(finfo->cached);
 
-    if (finfo->buffer != NULL)
-        allocator.Free(finfo->buffer);
+    if (finfo->inflater != NULL)
+        zip_inflater_release(finfo->inflater);
 
+    if (finfo->history != NULL)
+        allocator.Free(finfo->history);
+
+    __PHYSFS_closeEntryHandle(finfo->handle, finfo->info->handle);
     allocator.Free(finfo);
     return(1);
 } /* ZIP_fileClose */
 
 
-static PHYSFS_sint64 zip_find_end_of_central_dir(void *in, PHYSFS_sint64 *len)
+static int ZIP_getRawRegion(fvoid *opaque, void **handle,
+                            PHYSFS_uint64 *offset)
+{
+    ZIPfileinfo *finfo = (ZIPfileinfo *) opaque;
+    if (finfo->entry->compression_method != COMPMETH_NONE)
+        return(0);
+
+    *handle = finfo->info->handle;
+    *offset = finfo->entry->offset;  /* resolved when we opened it. */
+    return(1);
+} /* ZIP_getRawRegion */
+
+
+static int ZIP_prefetch(fvoid *opaque)
 {
-    PHYSFS_uint8 buf[256];
-    PHYSFS_uint8 extra[4] = { 0, 0, 0, 0 };
-    PHYSFS_sint32 i = 0;
+    ZIPfileinfo *finfo = (ZIPfileinfo *) opaque;
+    ZIPentry *entry = finfo->entry;
+
+    if (finfo->cached != NULL)
+        return(1);  /* already in memory. */
+
+    /* compressed or not, the bytes we'll want are all in one run. */
+    return(__PHYSFS_platformPrefetch(finfo->info->handle, entry->offset,
+                                     entry->compressed_size));
+} /* ZIP_prefetch */
+
+
+static PHYSFS_sint64 zip_find_end_of_central_dir(void *in,
+                                                 PHYSFS_uint8 *record)
+{
+    PHYSFS_uint8 *buf;
     PHYSFS_sint64 filelen;
     PHYSFS_sint64 filepos;
-    PHYSFS_sint32 maxread;
-    PHYSFS_sint32 totalread = 0;
-    int found = 0;
+    PHYSFS_uint32 maxread;
+    PHYSFS_uint32 found;
+    PHYSFS_uint32 i;
+    int seen = 0;
 
     filelen = __PHYSFS_platformFileLength(in);
-    BAIL_IF_MACRO(filelen == -1, NULL, 0);  /* !!! FIXME: unlocalized string */
-    BAIL_IF_MACRO(filelen > 0xFFFFFFFF, "ZIP bigger than 2 gigs?!", 0);
+    BAIL_IF_MACRO(filelen == -1, NULL, -1);
 
     /*
-     * Jump to the end of the file and start reading backwards.
-     *  The last thing in the file is the zipfile comment, which is variable
+     * The last thing in the file is the zipfile comment, which is variable
      *  length, and the field that specifies its size is before it in the
      *  file (argh!)...this means that we need to scan backwards until we
-     *  hit the end-of-central-dir signature. We can then sanity check that
-     *  the comment was as big as it should be to make sure we're in the
-     *  right place. The comment length field is 16 bits, so we can stop
-     *  searching for that signature after a little more than 64k at most,
-     *  and call it a corrupted zipfile.
+     *  hit the end-of-central-dir signature. The comment length field is
+     *  16 bits, so the whole record lives in the last ZIP_EOCD_SEARCHLEN
+     *  bytes: read that tail in one go and search it in memory. A
+     *  signature only counts if its comment length reaches exactly to the
+     *  end of the file, so a stray one inside the comment is skipped. If
+     *  there are signatures but none of them fit, we're either in the
+     *  wrong part of the file, or the file is corrupted, but we give up
+     *  either way.
      */
-
-    if (sizeof (buf) < filelen)
-    {
-        filepos = filelen - sizeof (buf);
-        maxread = sizeof (buf);
-    } /* if */
-    else
-    {
-        filepos = 0;
+    if (filelen < ZIP_EOCD_SEARCHLEN)
         maxread = (PHYSFS_uint32) filelen;
-    } /* else */
+    else
+        maxread = ZIP_EOCD_SEARCHLEN;
 
-    while ((totalread < filelen) && (totalread < 65557))
-    {
-        BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, filepos), NULL, -1);
+    BAIL_IF_MACRO(maxread < ZIP_END_OF_CENTRAL_DIR_LEN, ERR_NOT_AN_ARCHIVE, -1);
+    filepos = filelen - maxread;
 
-        /* make sure we catch a signature between buffers. */
-        if (totalread != 0)
-        {
-            if (__PHYSFS_platformRead(in, buf, maxread - 4, 1) != 1)
-                return(-1);
-            memcpy(&buf[maxread - 4], &extra, sizeof (extra));
-            totalread += maxread - 4;
-        } /* if */
-        else
-        {
-            if (__PHYSFS_platformRead(in, buf, maxread, 1) != 1)
-                return(-1);
-            totalread += maxread;
-        } /* else */
+    buf = (PHYSFS_uint8 *) allocator.Malloc(maxread);
+    BAIL_IF_MACRO(buf == NULL, ERR_OUT_OF_MEMORY, -1);
 
-        memcpy(&extra, buf, sizeof (extra));
+    if ( (!__PHYSFS_platformSeek(in, filepos)) ||
+         (__PHYSFS_platformRead(in, buf, maxread, 1) != 1) )
+    {
+        allocator.Free(buf);
+        return(-1);
+    } /* if */
 
-        for (i = maxread - 4; i > 0; i--)
+    found = maxread;  /* nothing yet. */
+    i = maxread - ZIP_END_OF_CENTRAL_DIR_LEN + 1;
+    while (i-- > 0)
+    {
+        if ((buf[i + 0] == 0x50) &&
+            (buf[i + 1] == 0x4B) &&
+            (buf[i + 2] == 0x05) &&
+            (buf[i + 3] == 0x06))
         {
-            if ((buf[i + 0] == 0x50) &&
-                (buf[i + 1] == 0x4B) &&
-                (buf[i + 2] == 0x05) &&
-                (buf[i + 3] == 0x06) )
+            seen = 1;
+            if ((i + ZIP_END_OF_CENTRAL_DIR_LEN + zip_get_ui16(&buf[i + 20])) ==
+                maxread)
             {
-                found = 1;  /* that's the signature! */
-                break;  
+                found = i;
+                break;  /* that's the signature! */
             } /* if */
-        } /* for */
-
-        if (found)
-            break;
-
-        filepos -= (maxread - 4);
-        if (filepos < 0)
-            filepos = 0;
+        } /* if */
     } /* while */
 
-    BAIL_IF_MACRO(!found, ERR_NOT_AN_ARCHIVE, -1);
+    if ((found < maxread) && (record != NULL))
+        memcpy(record, &buf[found], ZIP_END_OF_CENTRAL_DIR_LEN);
 
-    if (len != NULL)
-        *len = filelen;
+    allocator.Free(buf);
 
-    return(filepos + i);
+    BAIL_IF_MACRO(found == maxread,
+                  seen ? ERR_UNSUPPORTED_ARCHIVE : ERR_NOT_AN_ARCHIVE, -1);
+    return(filepos + found);
 } /* zip_find_end_of_central_dir */
 
 
@@ -495,84 +1239,213 @@ static int ZIP_isArchive(const char *filename, int forWriting)
 static void zip_free_entries(ZIPentry *entries, PHYSFS_uint32 max)
 {
     PHYSFS_uint32 i;
+    PHYSFS_uint32 j;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
     for (i = 0; i < max; i++)
     {
         ZIPentry *entry = &entries[i];
         if (entry->name != NULL)
             allocator.Free(entry->name);
+
+        if (entry->cached != NULL)
+            zip_cache_drop(entry->cached);
+
+        if (entry->checkpoints != NULL)
+        {
+            for (j = 0; j < entry->checkpointCount; j++)
+            {
+                zipStats.checkpoints--;
+                zipStats.checkpointBytes -= sizeof (ZIPcheckpoint) +
+                                            entry->checkpoints[j]->windowLen;
+                allocator.Free(entry->checkpoints[j]);
+            } /* for */
+            allocator.Free(entry->checkpoints);
+        } /* if */
     } /* for */
+    __PHYSFS_platformReleaseMutex(zipStateLock);
 
     allocator.Free(entries);
 } /* zip_free_entries */
 
 
 /*
- * This will find the ZIPentry associated with a path in platform-independent
- *  notation. Directories don't have ZIPentries associated with them, but 
- *  (*isDir) will be set to non-zero if a dir was hit.
+ * Path index, built at mount time. Every file and every directory (whether
+ *  the archive lists it, or we only infer it from a file's path) gets a
+ *  node. Nodes are chained into a hash table by full path, and linked into
+ *  a first-child/next-sibling tree, so lookups don't depend on the size of
+ *  the archive and enumerating a directory only touches its own children.
  */
-static ZIPentry *zip_find_entry(ZIPinfo *info, const char *path, int *isDir)
+static PHYSFS_uint32 zip_hash_path(const char *path, PHYSFS_uint32 len)
 {
-    ZIPentry *a = info->entries;
-    PHYSFS_sint32 pathlen = strlen(path);
-    PHYSFS_sint32 lo = 0;
-    PHYSFS_sint32 hi = (PHYSFS_sint32) (info->entryCount - 1);
-    PHYSFS_sint32 middle;
-    const char *thispath = NULL;
-    int rc;
+    PHYSFS_uint32 hash = 2166136261u;  /* FNV-1a */
+    PHYSFS_uint32 i;
+    for (i = 0; i < len; i++)
+        hash = (hash ^ ((PHYSFS_uint8) path[i])) * 16777619u;
+    return(hash);
+} /* zip_hash_path */
+
+
+static ZIPnode *zip_find_node(ZIPinfo *info, const char *path,
+                              PHYSFS_uint32 len)
+{
+    PHYSFS_uint32 i;
+
+    if (len == 0)  /* root dir? */
+        return(&info->nodes[0]);
 
-    while (lo <= hi)
+    i = info->buckets[zip_hash_path(path, len) & (info->bucketCount - 1)];
+    while (i != ZIP_NO_NODE)
     {
-        middle = lo + ((hi - lo) / 2);
-        thispath = a[middle].name;
-        rc = strncmp(path, thispath, pathlen);
+        ZIPnode *node = &info->nodes[i];
+        if ((node->namelen == len) && (memcmp(node->name, path, len) == 0))
+            return(node);
+        i = node->hashNext;
+    } /* while */
 
-        if (rc > 0)
-            lo = middle + 1;
+    return(NULL);
+} /* zip_find_node */
 
-        else if (rc < 0)
-            hi = middle - 1;
 
-        else /* substring match...might be dir or entry or nothing. */
+/*
+ * Add a node for the first (len) chars of (name), under the directory named
+ *  by everything before its last '/'. That directory is added too, if we
+ *  haven't seen it yet. Returns the node's index, or ZIP_NO_NODE if we ran
+ *  out of memory.
+ */
+static PHYSFS_uint32 zip_add_node(ZIPinfo *info, PHYSFS_uint32 *nodeAlloc,
+                                  const char *name, PHYSFS_uint32 len,
+                                  ZIPentry *entry)
+{
+    PHYSFS_uint32 parent = 0;
+    PHYSFS_uint32 bucket;
+    PHYSFS_uint32 retval;
+    ZIPnode *node;
+    PHYSFS_uint32 i;
+
+    for (i = len; i > 0; i--)
+    {
+        if (name[i - 1] == '/')
         {
-            int i;
+            node = zip_find_node(info, name, i - 1);
+            if (node != NULL)
+                parent = (PHYSFS_uint32) (node - info->nodes);
+            else
+                parent = zip_add_node(info, nodeAlloc, name, i - 1, NULL);
+            BAIL_IF_MACRO(parent == ZIP_NO_NODE, NULL, ZIP_NO_NODE);
+            break;
+        } /* if */
+    } /* for */
 
-            if (isDir != NULL)
-            {
-                *isDir = (thispath[pathlen] == '/');
-                if (*isDir)
-                    return(NULL);
-            } /* if */
+    if (info->nodeCount == *nodeAlloc)
+    {
+        const PHYSFS_uint32 newAlloc = *nodeAlloc * 2;
+        void *ptr = NULL;
+        if (newAlloc > *nodeAlloc)
+            ptr = allocator.Realloc(info->nodes, newAlloc * sizeof (ZIPnode));
+        BAIL_IF_MACRO(ptr == NULL, ERR_OUT_OF_MEMORY, ZIP_NO_NODE);
+        info->nodes = (ZIPnode *) ptr;
+        *nodeAlloc = newAlloc;
+    } /* if */
+
+    retval = info->nodeCount++;
+    bucket = zip_hash_path(name, len) & (info->bucketCount - 1);
+    node = &info->nodes[retval];
+    node->name = name;
+    node->namelen = len;
+    node->entry = entry;
+    node->firstChild = ZIP_NO_NODE;
+    node->nextSibling = info->nodes[parent].firstChild;
+    node->hashNext = info->buckets[bucket];
+    info->nodes[parent].firstChild = retval;
+    info->buckets[bucket] = retval;
+    return(retval);
+} /* zip_add_node */
+
+
+static int zip_build_index(ZIPinfo *info)
+{
+    const PHYSFS_uint64 start = __PHYSFS_platformGetTicks();
+    PHYSFS_uint32 nodeAlloc = info->entryCount + 1;
+    PHYSFS_uint32 i;
+
+    info->bucketCount = 16;
+    while ((info->bucketCount / 2) < info->entryCount)
+        info->bucketCount *= 2;
+
+    info->buckets = (PHYSFS_uint32 *)
+                allocator.Malloc(info->bucketCount * sizeof (PHYSFS_uint32));
+    BAIL_IF_MACRO(info->buckets == NULL, ERR_OUT_OF_MEMORY, 0);
+    memset(info->buckets, 0xFF, info->bucketCount * sizeof (PHYSFS_uint32));
+
+    info->nodes = (ZIPnode *) allocator.Malloc(nodeAlloc * sizeof (ZIPnode));
+    BAIL_IF_MACRO(info->nodes == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    /* node zero is the root directory. */
+    memset(&info->nodes[0], '\0', sizeof (ZIPnode));
+    info->nodes[0].name = "";
+    info->nodes[0].firstChild = ZIP_NO_NODE;
+    info->nodes[0].nextSibling = ZIP_NO_NODE;
+    info->nodes[0].hashNext = ZIP_NO_NODE;
+    info->nodeCount = 1;
+
+    /*
+     * Entries are sorted, and children are pushed on the front of their
+     *  parent's list, so walk backwards to keep each list in sorted order.
+     */
+    for (i = info->entryCount; i > 0; i--)
+    {
+        ZIPentry *entry = &info->entries[i - 1];
+        const char *name = entry->name;
+        PHYSFS_uint32 len = (PHYSFS_uint32) strlen(name);
+
+        /* "dir/" entries just make sure the directory exists. */
+        if ((len > 0) && (name[len - 1] == '/'))
+        {
+            len--;
+            entry = NULL;
+        } /* if */
+
+        if ((len == 0) || (zip_find_node(info, name, len) != NULL))
+            continue;  /* root, duplicate, or a dir we already inferred. */
+
+        if (zip_add_node(info, &nodeAlloc, name, len, entry) == ZIP_NO_NODE)
+            return(0);
+    } /* for */
+
+    info->indexBytes = (nodeAlloc * sizeof (ZIPnode)) +
+                       (info->bucketCount * sizeof (PHYSFS_uint32));
 
-            if (thispath[pathlen] == '\0') /* found entry? */
-                return(&a[middle]);
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipStats.archives++;
+    zipStats.entries += info->nodeCount - 1;
+    zipStats.indexBytes += info->indexBytes;
+    zipStats.indexMicroseconds += __PHYSFS_platformGetTicks() - start;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
 
-            /* substring match; search remaining space to find it... */
-            for (i = lo; i < hi; i++)
-            {
-                thispath = a[i].name;
-                if (strncmp(path, thispath, pathlen) == 0)
-                {
-                    if (isDir != NULL)
-                    {
-                        *isDir = (thispath[pathlen] == '/');
-                        if (*isDir)
-                            return(NULL);
-                    } /* if */
+    return(1);
+} /* zip_build_index */
 
-                    if (thispath[pathlen] == '\0') /* found entry? */
-                        return(&a[i]);
-                } /* if */
-            } /* for */
-            break;
 
-        } /* else */
-    } /* while */
+/*
+ * This will find the ZIPentry associated with a path in platform-independent
+ *  notation. Directories don't have ZIPentries associated with them, but 
+ *  (*isDir) will be set to non-zero if a dir was hit.
+ */
+static ZIPentry *zip_find_entry(ZIPinfo *info, const char *path, int *isDir)
+{
+    ZIPnode *node = zip_find_node(info, path, (PHYSFS_uint32) strlen(path));
 
     if (isDir != NULL)
-        *isDir = 0;
+    {
+        *isDir = ((node != NULL) && (node->entry == NULL));
+        if (*isDir)
+            return(NULL);
+    } /* if */
 
-    BAIL_MACRO(ERR_NO_SUCH_FILE, NULL);
+    BAIL_IF_MACRO((node == NULL) || (node->entry == NULL),
+                  ERR_NO_SUCH_FILE, NULL);
+    return(node->entry);
 } /* zip_find_entry */
 
 
@@ -651,7 +1524,7 @@ static void zip_expand_symlink_path(char *path)
 } /* zip_expand_symlink_path */
 
 /* (forward reference: zip_follow_symlink and zip_resolve call each other.) */
-static int zip_resolve(void *in, ZIPinfo *info, ZIPentry *entry);
+static int zip_resolve(ZIPinfo *info, ZIPentry *entry);
 
 /*
  * Look for the entry named by (path). If it exists, resolve it, and return
@@ -660,7 +1533,7 @@ static int zip_resolve(void *in, ZIPinfo *info, ZIPentry *entry);
  *  If there's a problem, return NULL. (path) is always free()'d by this
  *  function.
  */
-static ZIPentry *zip_follow_symlink(void *in, ZIPinfo *info, char *path)
+static ZIPentry *zip_follow_symlink(ZIPinfo *info, char *path)
 {
     ZIPentry *entry;
 
@@ -668,7 +1541,7 @@ static ZIPentry *zip_follow_symlink(void *in, ZIPinfo *info, char *path)
     entry = zip_find_entry(info, path, NULL);
     if (entry != NULL)
     {
-        if (!zip_resolve(in, info, entry))  /* recursive! */
+        if (!zip_resolve(info, entry))  /* recursive! */
             entry = NULL;
         else
         {
@@ -682,34 +1555,36 @@ static ZIPentry *zip_follow_symlink(void *in, ZIPinfo *info, char *path)
 } /* zip_follow_symlink */
 
 
-static int zip_resolve_symlink(void *in, ZIPinfo *info, ZIPentry *entry)
+static int zip_resolve_symlink(ZIPinfo *info, ZIPentry *entry)
 {
     char *path;
-    PHYSFS_uint32 size = entry->uncompressed_size;
+    PHYSFS_uint32 size = (PHYSFS_uint32) entry->uncompressed_size;
     int rc = 0;
 
+    /* a link target this big is garbage, and would overflow below. */
+    BAIL_IF_MACRO(entry->uncompressed_size >= 0xFFFFFFFF, ERR_CORRUPTED, 0);
+    BAIL_IF_MACRO(entry->compressed_size > 0xFFFFFFFF, ERR_CORRUPTED, 0);
+
     /*
      * We've already parsed the local file header of the symlink at this
      *  point. Now we need to read the actual link from the file data and
      *  follow it.
      */
 
-    BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, entry->offset), NULL, 0);
-
     path = (char *) allocator.Malloc(size + 1);
     BAIL_IF_MACRO(path == NULL, ERR_OUT_OF_MEMORY, 0);
     
     if (entry->compression_method == COMPMETH_NONE)
-        rc = (__PHYSFS_platformRead(in, path, size, 1) == 1);
+        rc = zip_read_at(info, path, entry->offset, size);
 
     else  /* symlink target path is compressed... */
     {
         z_stream stream;
-        PHYSFS_uint32 complen = entry->compressed_size;
+        PHYSFS_uint32 complen = (PHYSFS_uint32) entry->compressed_size;
         PHYSFS_uint8 *compressed = (PHYSFS_uint8*) __PHYSFS_smallAlloc(complen);
         if (compressed != NULL)
         {
-            if (__PHYSFS_platformRead(in, compressed, complen, 1) == 1)
+            if (zip_read_at(info, compressed, entry->offset, complen))
             {
                 initializeZStream(&stream);
                 stream.next_in = compressed;
@@ -735,7 +1610,7 @@ static int zip_resolve_symlink(void *in, ZIPinfo *info, ZIPentry *entry)
     {
         path[entry->uncompressed_size] = '\0';    /* null-terminate it. */
         zip_convert_dos_path(entry, path);
-        entry->symlink = zip_follow_symlink(in, info, path);
+        entry->symlink = zip_follow_symlink(info, path);
     } /* else */
 
     return(entry->symlink != NULL);
@@ -743,14 +1618,13 @@ static int zip_resolve_symlink(void *in, ZIPinfo *info, ZIPentry *entry)
 
 
 /*
- * Parse the local file header of an entry, and update entry->offset.
+ * Check an entry's local file header, already read into (hdr), against the
+ *  central directory, and update entry->offset to point at the data.
  */
-static int zip_parse_local(void *in, ZIPentry *entry)
+static int zip_check_local(ZIPentry *entry, const PHYSFS_uint8 *hdr)
 {
-    PHYSFS_uint32 ui32;
     PHYSFS_uint16 ui16;
-    PHYSFS_uint16 fnamelen;
-    PHYSFS_uint16 extralen;
+    PHYSFS_uint32 ui32;
 
     /*
      * crc and (un)compressed_size are always zero if this is a "JAR"
@@ -759,30 +1633,50 @@ static int zip_parse_local(void *in, ZIPentry *entry)
      *  aren't zero. That seems to work well.
      */
 
-    BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, entry->offset), NULL, 0);
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    BAIL_IF_MACRO(ui32 != ZIP_LOCAL_FILE_SIG, ERR_CORRUPTED, 0);
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
-    BAIL_IF_MACRO(ui16 != entry->version_needed, ERR_CORRUPTED, 0);
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);  /* general bits. */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
+    BAIL_IF_MACRO(zip_get_ui32(hdr) != ZIP_LOCAL_FILE_SIG, ERR_CORRUPTED, 0);
+
+    /*
+     * Some writers only bump the central directory's copy of this to 4.5
+     *  when the entry's offset needs ZIP64, since the local header doesn't
+     *  store the offset. Let that slide.
+     */
+    ui16 = zip_get_ui16(hdr + 4);
+    BAIL_IF_MACRO((ui16 != entry->version_needed) &&
+                  ((entry->version_needed != 45) || (ui16 > 45)),
+                  ERR_CORRUPTED, 0);
+    /* hdr + 6 is general bits. */
+    ui16 = zip_get_ui16(hdr + 8);
     BAIL_IF_MACRO(ui16 != entry->compression_method, ERR_CORRUPTED, 0);
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);  /* date/time */
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
+    /* hdr + 10 is date/time */
+    ui32 = zip_get_ui32(hdr + 14);
     BAIL_IF_MACRO(ui32 && (ui32 != entry->crc), ERR_CORRUPTED, 0);
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    BAIL_IF_MACRO(ui32 && (ui32 != entry->compressed_size), ERR_CORRUPTED, 0);
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    BAIL_IF_MACRO(ui32 && (ui32 != entry->uncompressed_size),ERR_CORRUPTED,0);
-    BAIL_IF_MACRO(!readui16(in, &fnamelen), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &extralen), NULL, 0);
-
-    entry->offset += fnamelen + extralen + 30;
+    ui32 = zip_get_ui32(hdr + 18);
+    BAIL_IF_MACRO(ui32 && (ui32 != 0xFFFFFFFF) &&  /* 0xFFFFFFFF == ZIP64 */
+                  (ui32 != entry->compressed_size), ERR_CORRUPTED, 0);
+    ui32 = zip_get_ui32(hdr + 22);
+    BAIL_IF_MACRO(ui32 && (ui32 != 0xFFFFFFFF) &&
+                  (ui32 != entry->uncompressed_size), ERR_CORRUPTED, 0);
+
+    /* skip the header, filename and extra field. */
+    entry->offset += ZIP_LOCAL_FILE_LEN + zip_get_ui16(hdr + 26) +
+                     zip_get_ui16(hdr + 28);
     return(1);
+} /* zip_check_local */
+
+
+/*
+ * Parse the local file header of an entry, and update entry->offset.
+ */
+static int zip_parse_local(ZIPinfo *info, ZIPentry *entry)
+{
+    PHYSFS_uint8 hdr[ZIP_LOCAL_FILE_LEN];
+    BAIL_IF_MACRO(!zip_read_at(info, hdr, entry->offset, sizeof (hdr)),
+                  NULL, 0);
+    return(zip_check_local(entry, hdr));
 } /* zip_parse_local */
 
 
-static int zip_resolve(void *in, ZIPinfo *info, ZIPentry *entry)
+static int zip_resolve(ZIPinfo *info, ZIPentry *entry)
 {
     int retval = 1;
     ZipResolveType resolve_type = entry->resolved;
@@ -805,7 +1699,7 @@ static int zip_resolve(void *in, ZIPinfo *info, ZIPentry *entry)
     {
         entry->resolved = ZIP_RESOLVING;
 
-        retval = zip_parse_local(in, entry);
+        retval = zip_parse_local(info, entry);
         if (retval)
         {
             /*
@@ -814,7 +1708,7 @@ static int zip_resolve(void *in, ZIPinfo *info, ZIPentry *entry)
              *  the real file) if all goes well.
              */
             if (resolve_type == ZIP_UNRESOLVED_SYMLINK)
-                retval = zip_resolve_symlink(in, info, entry);
+                retval = zip_resolve_symlink(info, entry);
         } /* if */
 
         if (resolve_type == ZIP_UNRESOLVED_SYMLINK)
@@ -859,11 +1753,18 @@ static int zip_version_does_symlinks(PHYSFS_uint32 version)
 } /* zip_version_does_symlinks */
 
 
-static int zip_entry_is_symlink(const ZIPentry *entry)
+static int zip_entry_is_symlink(ZIPinfo *info, const ZIPentry *entry)
 {
-    return((entry->resolved == ZIP_UNRESOLVED_SYMLINK) ||
-           (entry->resolved == ZIP_BROKEN_SYMLINK) ||
-           (entry->symlink));
+    int retval;
+
+    /* another thread might be in the middle of resolving this entry. */
+    __PHYSFS_platformGrabMutex(info->resolveLock);
+    retval = ((entry->resolved == ZIP_UNRESOLVED_SYMLINK) ||
+              (entry->resolved == ZIP_BROKEN_SYMLINK) ||
+              (entry->symlink));
+    __PHYSFS_platformReleaseMutex(info->resolveLock);
+
+    return(retval);
 } /* zip_entry_is_symlink */
 
 
@@ -912,62 +1813,129 @@ static PHYSFS_sint64 zip_dos_time_to_physfs_time(PHYSFS_uint32 dostime)
 } /* zip_dos_time_to_physfs_time */
 
 
-static int zip_load_entry(void *in, ZIPentry *entry, PHYSFS_uint32 ofs_fixup)
+/*
+ * Fields too big for a plain ZIP record are set to all ones, and the real
+ *  values are in a ZIP64 "extended information" extra field instead, in
+ *  this order, with only the overflowed ones present.
+ */
+static int zip64_read_extra(const PHYSFS_uint8 *extra, PHYSFS_uint16 extralen,
+                            ZIPentry *entry, PHYSFS_uint64 *offset,
+                            PHYSFS_uint16 disk)
+{
+    while (extralen >= 4)
+    {
+        const PHYSFS_uint16 id = zip_get_ui16(extra);
+        PHYSFS_uint16 len = zip_get_ui16(extra + 2);  /* not counting these */
+        const PHYSFS_uint8 *ptr = extra + 4;
+
+        BAIL_IF_MACRO(len > extralen - 4, ERR_CORRUPTED, 0);
+
+        if (id == ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG)
+        {
+            if (entry->uncompressed_size == 0xFFFFFFFF)
+            {
+                BAIL_IF_MACRO(len < 8, ERR_CORRUPTED, 0);
+                entry->uncompressed_size = zip_get_ui64(ptr);
+                ptr += 8;
+                len -= 8;
+            } /* if */
+
+            if (entry->compressed_size == 0xFFFFFFFF)
+            {
+                BAIL_IF_MACRO(len < 8, ERR_CORRUPTED, 0);
+                entry->compressed_size = zip_get_ui64(ptr);
+                ptr += 8;
+                len -= 8;
+            } /* if */
+
+            if (*offset == 0xFFFFFFFF)
+            {
+                BAIL_IF_MACRO(len < 8, ERR_CORRUPTED, 0);
+                *offset = zip_get_ui64(ptr);
+                ptr += 8;
+                len -= 8;
+            } /* if */
+
+            if (disk == 0xFFFF)
+            {
+                BAIL_IF_MACRO(len < 4, ERR_CORRUPTED, 0);
+                BAIL_IF_MACRO(zip_get_ui32(ptr) != 0, ERR_UNSUPPORTED_ARCHIVE, 0);
+            } /* if */
+
+            return(1);
+        } /* if */
+
+        extra += 4 + len;
+        extralen -= 4 + len;
+    } /* while */
+
+    BAIL_MACRO(ERR_CORRUPTED, 0);  /* needed it, but it isn't there. */
+} /* zip64_read_extra */
+
+
+static int zip_load_entry(const PHYSFS_uint8 *buf, PHYSFS_uint64 avail,
+                          ZIPentry *entry, PHYSFS_uint64 ofs_fixup,
+                          PHYSFS_uint64 *reclen)
 {
-    PHYSFS_uint16 fnamelen, extralen, commentlen;
+    PHYSFS_uint16 fnamelen, extralen, commentlen, disk;
     PHYSFS_uint32 external_attr;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint32 ui32;
-    PHYSFS_sint64 si64;
+    PHYSFS_uint64 offset;
 
     /* sanity check with central directory signature... */
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    BAIL_IF_MACRO(ui32 != ZIP_CENTRAL_DIR_SIG, ERR_CORRUPTED, 0);
+    BAIL_IF_MACRO(avail < ZIP_CENTRAL_DIR_LEN, ERR_CORRUPTED, 0);
+    BAIL_IF_MACRO(zip_get_ui32(buf) != ZIP_CENTRAL_DIR_SIG, ERR_CORRUPTED, 0);
 
     /* Get the pertinent parts of the record... */
-    BAIL_IF_MACRO(!readui16(in, &entry->version), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &entry->version_needed), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);  /* general bits */
-    BAIL_IF_MACRO(!readui16(in, &entry->compression_method), NULL, 0);
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    entry->last_mod_time = zip_dos_time_to_physfs_time(ui32);
-    BAIL_IF_MACRO(!readui32(in, &entry->crc), NULL, 0);
-    BAIL_IF_MACRO(!readui32(in, &entry->compressed_size), NULL, 0);
-    BAIL_IF_MACRO(!readui32(in, &entry->uncompressed_size), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &fnamelen), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &extralen), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &commentlen), NULL, 0);
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);  /* disk number start */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);  /* internal file attribs */
-    BAIL_IF_MACRO(!readui32(in, &external_attr), NULL, 0);
-    BAIL_IF_MACRO(!readui32(in, &entry->offset), NULL, 0);
-    entry->offset += ofs_fixup;
+    entry->version = zip_get_ui16(buf + 4);
+    entry->version_needed = zip_get_ui16(buf + 6);
+    /* buf + 8 is general bits */
+    entry->compression_method = zip_get_ui16(buf + 10);
+    entry->last_mod_time = zip_dos_time_to_physfs_time(zip_get_ui32(buf + 12));
+    entry->crc = zip_get_ui32(buf + 16);
+    entry->compressed_size = zip_get_ui32(buf + 20);
+    entry->uncompressed_size = zip_get_ui32(buf + 24);
+    fnamelen = zip_get_ui16(buf + 28);
+    extralen = zip_get_ui16(buf + 30);
+    commentlen = zip_get_ui16(buf + 32);
+    disk = zip_get_ui16(buf + 34);
+    /* buf + 36 is internal file attribs */
+    external_attr = zip_get_ui32(buf + 38);
+    offset = zip_get_ui32(buf + 42);
+
+    BAIL_IF_MACRO(avail - ZIP_CENTRAL_DIR_LEN < fnamelen, ERR_CORRUPTED, 0);
+
+    if ( (entry->uncompressed_size == 0xFFFFFFFF) ||
+         (entry->compressed_size == 0xFFFFFFFF) ||
+         (offset == 0xFFFFFFFF) || (disk == 0xFFFF) )
+    {
+        BAIL_IF_MACRO(avail - ZIP_CENTRAL_DIR_LEN - fnamelen < extralen,
+                      ERR_CORRUPTED, 0);
+        if (!zip64_read_extra(buf + ZIP_CENTRAL_DIR_LEN + fnamelen, extralen,
+                              entry, &offset, disk))
+            return(0);
+    } /* if */
 
+    entry->offset = offset + ofs_fixup;
+
+    entry->checkpoints = NULL;
+    entry->checkpointCount = 0;
+    entry->cached = NULL;
     entry->symlink = NULL;  /* will be resolved later, if necessary. */
     entry->resolved = (zip_has_symlink_attr(entry, external_attr)) ?
                             ZIP_UNRESOLVED_SYMLINK : ZIP_UNRESOLVED_FILE;
 
     entry->name = (char *) allocator.Malloc(fnamelen + 1);
     BAIL_IF_MACRO(entry->name == NULL, ERR_OUT_OF_MEMORY, 0);
-    if (__PHYSFS_platformRead(in, entry->name, fnamelen, 1) != 1)
-        goto zip_load_entry_puked;
-
+    memcpy(entry->name, buf + ZIP_CENTRAL_DIR_LEN, fnamelen);
     entry->name[fnamelen] = '\0';  /* null-terminate the filename. */
     zip_convert_dos_path(entry, entry->name);
 
-    si64 = __PHYSFS_platformTell(in);
-    if (si64 == -1)
-        goto zip_load_entry_puked;
-
-        /* seek to the start of the next entry in the central directory... */
-    if (!__PHYSFS_platformSeek(in, si64 + extralen + commentlen))
-        goto zip_load_entry_puked;
+        /* skip to the start of the next entry in the central directory... */
+    *reclen = ZIP_CENTRAL_DIR_LEN + fnamelen + extralen + commentlen;
+    if (*reclen > avail)
+        *reclen = avail;
 
     return(1);  /* success. */
-
-zip_load_entry_puked:
-    allocator.Free(entry->name);
-    return(0);  /* failure. */
 } /* zip_load_entry */
 
 
@@ -998,69 +1966,201 @@ static void zip_entry_swap(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
 
 
 static int zip_load_entries(void *in, ZIPinfo *info,
-                            PHYSFS_uint32 data_ofs, PHYSFS_uint32 central_ofs)
+                            PHYSFS_uint64 data_ofs, PHYSFS_uint64 central_ofs,
+                            PHYSFS_uint64 central_len)
 {
     PHYSFS_uint32 max = info->entryCount;
+    const PHYSFS_uint8 *ptr = NULL;
+    PHYSFS_uint8 *buf = NULL;
+    void *mapping = NULL;
+    PHYSFS_uint64 pos = 0;
+    PHYSFS_uint64 reclen;
     PHYSFS_uint32 i;
 
-    BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, central_ofs), NULL, 0);
+    /* every entry takes at least this much; don't trust a bogus count. */
+    BAIL_IF_MACRO(max > central_len / ZIP_CENTRAL_DIR_LEN, ERR_CORRUPTED, 0);
+    BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(((PHYSFS_uint64) max) *
+                                                sizeof (ZIPentry)),
+                  ERR_OUT_OF_MEMORY, 0);
+
+    /*
+     * Pull in the whole central directory at once (mapped if the platform
+     *  can, read into a buffer otherwise) and parse it in memory, instead
+     *  of doing a read per field and a seek per entry.
+     */
+    if (central_len > 0)
+    {
+        ptr = (const PHYSFS_uint8 *) __PHYSFS_platformMap(in, central_ofs,
+                                                          central_len,
+                                                          &mapping);
+        if (ptr == NULL)
+        {
+            BAIL_IF_MACRO(central_len > 0xFFFFFFFF, ERR_OUT_OF_MEMORY, 0);
+            BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(central_len),
+                          ERR_OUT_OF_MEMORY, 0);
+            buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) central_len);
+            BAIL_IF_MACRO(buf == NULL, ERR_OUT_OF_MEMORY, 0);
+            if ( (!__PHYSFS_platformSeek(in, central_ofs)) ||
+                 (__PHYSFS_platformRead(in, buf, (PHYSFS_uint32) central_len,
+                                        1) != 1) )
+            {
+                allocator.Free(buf);
+                return(0);
+            } /* if */
+            ptr = buf;
+        } /* if */
+    } /* if */
 
     info->entries = (ZIPentry *) allocator.Malloc(sizeof (ZIPentry) * max);
-    BAIL_IF_MACRO(info->entries == NULL, ERR_OUT_OF_MEMORY, 0);
+    GOTO_IF_MACRO(info->entries == NULL, ERR_OUT_OF_MEMORY, zip_load_failed);
 
     for (i = 0; i < max; i++)
     {
-        if (!zip_load_entry(in, &info->entries[i], data_ofs))
+        if (!zip_load_entry(ptr + pos, central_len - pos, &info->entries[i],
+                            data_ofs, &reclen))
         {
             zip_free_entries(info->entries, i);
-            return(0);
+            info->entries = NULL;
+            goto zip_load_failed;
         } /* if */
+        pos += reclen;
     } /* for */
 
+    if (mapping != NULL)
+        __PHYSFS_platformUnmap(mapping);
+    allocator.Free(buf);
+
     __PHYSFS_sort(info->entries, max, zip_entry_cmp, zip_entry_swap);
     return(1);
+
+zip_load_failed:
+    if (mapping != NULL)
+        __PHYSFS_platformUnmap(mapping);
+    allocator.Free(buf);
+    return(0);
 } /* zip_load_entries */
 
 
+static int zip64_read_end_of_central_dir(void *in, PHYSFS_uint64 pos,
+                                         PHYSFS_uint8 *rec)
+{
+    return( (__PHYSFS_platformSeek(in, pos)) &&
+            (__PHYSFS_platformRead(in, rec, ZIP64_END_OF_CENTRAL_DIR_LEN,
+                                   1) == 1) &&
+            (zip_get_ui32(rec) == ZIP64_END_OF_CENTRAL_DIR_SIG) );
+} /* zip64_read_end_of_central_dir */
+
+
+/*
+ * ZIP64 archives have a second, bigger end-of-central-dir record, and a
+ *  locator for it sitting right before the regular one at (pos). Returns
+ *  1 if we found and parsed it, 0 if this isn't a ZIP64 archive, and -1
+ *  on error. (*rec_pos) is set to where the record actually is.
+ */
+static int zip64_parse_end_of_central_dir(void *in, ZIPinfo *info,
+                                          PHYSFS_sint64 pos,
+                                          PHYSFS_uint64 *rec_pos,
+                                          PHYSFS_uint64 *central_dir_ofs,
+                                          PHYSFS_uint64 *central_dir_len)
+{
+    PHYSFS_uint8 loc[ZIP64_END_OF_CENTRAL_DIR_LOCATOR_LEN];
+    PHYSFS_uint8 rec[ZIP64_END_OF_CENTRAL_DIR_LEN];
+    PHYSFS_uint64 entries;
+
+    if (pos < ZIP64_END_OF_CENTRAL_DIR_LOCATOR_LEN)
+        return(0);
+
+    pos -= ZIP64_END_OF_CENTRAL_DIR_LOCATOR_LEN;
+    BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, pos), NULL, -1);
+    BAIL_IF_MACRO(__PHYSFS_platformRead(in, loc, sizeof (loc), 1) != 1,
+                  NULL, -1);
+
+    if (zip_get_ui32(loc) != ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+        return(0);
+
+    /* number of the disk with the ZIP64 record, and total number of disks */
+    BAIL_IF_MACRO(zip_get_ui32(&loc[4]) != 0, ERR_UNSUPPORTED_ARCHIVE, -1);
+    BAIL_IF_MACRO(zip_get_ui32(&loc[16]) > 1, ERR_UNSUPPORTED_ARCHIVE, -1);
+
+    /*
+     * The locator's offset doesn't account for data prepended to the ZIP
+     *  (self-extractors, etc), so if the record isn't there, try right
+     *  before the locator, which is where it is unless it carries
+     *  "extensible data" (which nothing seems to write).
+     */
+    *rec_pos = zip_get_ui64(&loc[8]);
+    if (!zip64_read_end_of_central_dir(in, *rec_pos, rec))
+    {
+        BAIL_IF_MACRO(pos < ZIP64_END_OF_CENTRAL_DIR_LEN, ERR_CORRUPTED, -1);
+        *rec_pos = pos - ZIP64_END_OF_CENTRAL_DIR_LEN;
+        BAIL_IF_MACRO(!zip64_read_end_of_central_dir(in, *rec_pos, rec),
+                      ERR_CORRUPTED, -1);
+    } /* if */
+
+    /* number of this disk */
+    BAIL_IF_MACRO(zip_get_ui32(&rec[16]) != 0, ERR_UNSUPPORTED_ARCHIVE, -1);
+
+    /* number of the disk with the start of the central directory */
+    BAIL_IF_MACRO(zip_get_ui32(&rec[20]) != 0, ERR_UNSUPPORTED_ARCHIVE, -1);
+
+    /* total number of entries in the central dir, on this disk and overall */
+    entries = zip_get_ui64(&rec[32]);
+    BAIL_IF_MACRO(zip_get_ui64(&rec[24]) != entries,
+                  ERR_UNSUPPORTED_ARCHIVE, -1);
+    BAIL_IF_MACRO(entries > 0xFFFFFFFF, ERR_UNSUPPORTED_ARCHIVE, -1);
+    info->entryCount = (PHYSFS_uint32) entries;
+
+    /* size and offset of the central directory */
+    *central_dir_len = zip_get_ui64(&rec[40]);
+    *central_dir_ofs = zip_get_ui64(&rec[48]);
+
+    return(1);
+} /* zip64_parse_end_of_central_dir */
+
+
 static int zip_parse_end_of_central_dir(void *in, ZIPinfo *info,
-                                        PHYSFS_uint32 *data_start,
-                                        PHYSFS_uint32 *central_dir_ofs)
+                                        PHYSFS_uint64 *data_start,
+                                        PHYSFS_uint64 *central_dir_ofs,
+                                        PHYSFS_uint64 *central_dir_len)
 {
-    PHYSFS_uint32 ui32;
-    PHYSFS_uint16 ui16;
-    PHYSFS_sint64 len;
+    PHYSFS_uint8 rec[ZIP_END_OF_CENTRAL_DIR_LEN];
+    PHYSFS_uint64 central_dir_end;
     PHYSFS_sint64 pos;
+    int rc;
 
-    /* find the end-of-central-dir record, and seek to it. */
-    pos = zip_find_end_of_central_dir(in, &len);
+    /* find the end-of-central-dir record; it was validated on the way. */
+    pos = zip_find_end_of_central_dir(in, rec);
     BAIL_IF_MACRO(pos == -1, NULL, 0);
-    BAIL_IF_MACRO(!__PHYSFS_platformSeek(in, pos), NULL, 0);
 
-    /* check signature again, just in case. */
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
-    BAIL_IF_MACRO(ui32 != ZIP_END_OF_CENTRAL_DIR_SIG, ERR_NOT_AN_ARCHIVE, 0);
+    rc = zip64_parse_end_of_central_dir(in, info, pos, &central_dir_end,
+                                        central_dir_ofs, central_dir_len);
+    BAIL_IF_MACRO(rc == -1, NULL, 0);
 
-    /* number of this disk */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
-    BAIL_IF_MACRO(ui16 != 0, ERR_UNSUPPORTED_ARCHIVE, 0);
+    if (rc == 0)  /* not ZIP64; the regular record has everything. */
+    {
+        central_dir_end = (PHYSFS_uint64) pos;
 
-    /* number of the disk with the start of the central directory */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
-    BAIL_IF_MACRO(ui16 != 0, ERR_UNSUPPORTED_ARCHIVE, 0);
+        /* number of this disk */
+        BAIL_IF_MACRO(zip_get_ui16(&rec[4]) != 0, ERR_UNSUPPORTED_ARCHIVE, 0);
+
+        /* number of the disk with the start of the central directory */
+        BAIL_IF_MACRO(zip_get_ui16(&rec[6]) != 0, ERR_UNSUPPORTED_ARCHIVE, 0);
 
-    /* total number of entries in the central dir on this disk */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
+        /* total number of entries in the central dir, on this disk and all */
+        info->entryCount = zip_get_ui16(&rec[10]);
+        BAIL_IF_MACRO(zip_get_ui16(&rec[8]) != info->entryCount,
+                      ERR_UNSUPPORTED_ARCHIVE, 0);
 
-    /* total number of entries in the central dir */
-    BAIL_IF_MACRO(!readui16(in, &info->entryCount), NULL, 0);
-    BAIL_IF_MACRO(ui16 != info->entryCount, ERR_UNSUPPORTED_ARCHIVE, 0);
+        /* size of the central directory */
+        *central_dir_len = zip_get_ui32(&rec[12]);
 
-    /* size of the central directory */
-    BAIL_IF_MACRO(!readui32(in, &ui32), NULL, 0);
+        /* offset of central directory */
+        *central_dir_ofs = zip_get_ui32(&rec[16]);
+    } /* if */
 
-    /* offset of central directory */
-    BAIL_IF_MACRO(!readui32(in, central_dir_ofs), NULL, 0);
-    BAIL_IF_MACRO(pos < *central_dir_ofs + ui32, ERR_UNSUPPORTED_ARCHIVE, 0);
+    BAIL_IF_MACRO(*central_dir_ofs > central_dir_end, ERR_UNSUPPORTED_ARCHIVE, 0);
+    BAIL_IF_MACRO(*central_dir_len > central_dir_end - *central_dir_ofs,
+                  ERR_UNSUPPORTED_ARCHIVE, 0);
 
     /*
      * For self-extracting archives, etc, there's crapola in the file
@@ -1070,21 +2170,11 @@ static int zip_parse_end_of_central_dir(void *in, ZIPinfo *info,
      *  sizeof central dir)...the difference in bytes is how much arbitrary
      *  data is at the start of the physical file.
      */
-    *data_start = (PHYSFS_uint32) (pos - (*central_dir_ofs + ui32));
+    *data_start = central_dir_end - (*central_dir_ofs + *central_dir_len);
 
     /* Now that we know the difference, fix up the central dir offset... */
     *central_dir_ofs += *data_start;
 
-    /* zipfile comment length */
-    BAIL_IF_MACRO(!readui16(in, &ui16), NULL, 0);
-
-    /*
-     * Make sure that the comment length matches to the end of file...
-     *  If it doesn't, we're either in the wrong part of the file, or the
-     *  file is corrupted, but we give up either way.
-     */
-    BAIL_IF_MACRO((pos + 22 + ui16) != len, ERR_UNSUPPORTED_ARCHIVE, 0);
-
     return(1);  /* made it. */
 } /* zip_parse_end_of_central_dir */
 
@@ -1103,18 +2193,182 @@ static ZIPinfo *zip_create_zipinfo(const char *name)
         BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
     } /* if */
 
+    info->resolveLock = __PHYSFS_platformCreateMutex();
+    info->ioLock = __PHYSFS_platformCreateMutex();
+    if ((info->resolveLock == NULL) || (info->ioLock == NULL))
+    {
+        if (info->resolveLock != NULL)
+            __PHYSFS_platformDestroyMutex(info->resolveLock);
+        if (info->ioLock != NULL)
+            __PHYSFS_platformDestroyMutex(info->ioLock);
+        allocator.Free(ptr);
+        allocator.Free(info);
+        return(NULL);
+    } /* if */
+
     info->archiveName = ptr;
     strcpy(info->archiveName, name);
     return(info);
 } /* zip_create_zipinfo */
 
 
+/*
+ * Map the whole archive into memory, so reads are just memcpy() and inflate
+ *  reads the compressed data where it sits. If the platform can't, or the
+ *  archive doesn't fit in the address space, we quietly read it instead.
+ */
+static void zip_map_archive(ZIPinfo *info)
+{
+    const PHYSFS_sint64 len = __PHYSFS_platformFileLength(info->handle);
+    if (len > 0)
+    {
+        info->mapped = (const PHYSFS_uint8 *)
+                __PHYSFS_platformMap(info->handle, 0, (PHYSFS_uint64) len,
+                                     &info->mapping);
+        if (info->mapped != NULL)
+            info->mappedLen = (PHYSFS_uint64) len;
+    } /* if */
+} /* zip_map_archive */
+
+
+static int zip_offset_cmp(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    ZIPentry **a = (ZIPentry **) _a;
+    if (a[one]->offset == a[two]->offset)
+        return(0);
+    return((a[one]->offset < a[two]->offset) ? -1 : 1);
+} /* zip_offset_cmp */
+
+
+static void zip_offset_swap(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    ZIPentry **a = (ZIPentry **) _a;
+    ZIPentry *tmp = a[one];
+    a[one] = a[two];
+    a[two] = tmp;
+} /* zip_offset_swap */
+
+
+/*
+ * Resolve every entry now instead of on first open, walking the local
+ *  headers in the order they sit in the archive. Headers close enough
+ *  together are read in one go, so this is a handful of big forward reads
+ *  instead of a seek per file; a mapped archive just reads the mapping.
+ *  Symlinks are followed once all the files are done. Entries that fail
+ *  are marked broken, just like a failed first open would, and only fail
+ *  when they're opened. This is just an optimization, so running out of
+ *  memory means we resolve lazily instead. Returns the number of entries
+ *  resolved.
+ */
+static PHYSFS_uint32 zip_resolve_all(ZIPinfo *info)
+{
+    ZIPentry **sorted;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_uint64 bufpos = 0;
+    PHYSFS_uint32 buflen = 0;
+    PHYSFS_uint32 count = 0;
+    PHYSFS_uint32 retval = 0;
+    PHYSFS_uint32 i, j;
+    int ok;
+
+    if (info->entryCount == 0)
+        return(0);
+
+    sorted = (ZIPentry **)
+                allocator.Malloc(info->entryCount * sizeof (ZIPentry *));
+    BAIL_IF_MACRO(sorted == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    if (info->mapped == NULL)
+    {
+        buf = (PHYSFS_uint8 *) allocator.Malloc(ZIP_RESOLVEBUFSIZE);
+        if (buf == NULL)
+        {
+            allocator.Free(sorted);
+            BAIL_MACRO(ERR_OUT_OF_MEMORY, 0);
+        } /* if */
+    } /* if */
+
+    for (i = 0; i < info->entryCount; i++)
+    {
+        ZIPentry *entry = &info->entries[i];
+        if ((entry->resolved == ZIP_UNRESOLVED_FILE) ||
+            (entry->resolved == ZIP_UNRESOLVED_SYMLINK))
+            sorted[count++] = entry;
+    } /* for */
+
+    __PHYSFS_sort(sorted, count, zip_offset_cmp, zip_offset_swap);
+
+    for (i = 0; i < count; i++)
+    {
+        ZIPentry *entry = sorted[i];
+        const PHYSFS_uint64 pos = entry->offset;
+
+        if (entry->resolved != ZIP_UNRESOLVED_FILE)
+            continue;  /* symlinks wait until their targets are done. */
+
+        if (info->mapped != NULL)
+            ok = zip_parse_local(info, entry);  /* no I/O to batch up. */
+
+        else
+        {
+            if ( (pos < bufpos) ||
+                 ((pos + ZIP_LOCAL_FILE_LEN) > bufpos + buflen) )
+            {
+                /* read from here through as many later headers as fit. */
+                PHYSFS_uint64 end = pos + ZIP_LOCAL_FILE_LEN;
+                PHYSFS_sint64 rc;
+                for (j = i + 1; j < count; j++)
+                {
+                    const PHYSFS_uint64 next = sorted[j]->offset;
+                    if ((next + ZIP_LOCAL_FILE_LEN) - pos > ZIP_RESOLVEBUFSIZE)
+                        break;
+                    else if (next + ZIP_LOCAL_FILE_LEN > end)
+                        end = next + ZIP_LOCAL_FILE_LEN;
+                } /* for */
+
+                rc = __PHYSFS_readArchiveAt(info->handle, info->ioLock, buf,
+                                            pos, (PHYSFS_uint32) (end - pos));
+                bufpos = pos;
+                buflen = (rc > 0) ? (PHYSFS_uint32) rc : 0;
+            } /* if */
+
+            ok = ( ((pos + ZIP_LOCAL_FILE_LEN) <= bufpos + buflen) &&
+                   (zip_check_local(entry, buf + (pos - bufpos))) );
+        } /* else */
+
+        entry->resolved = ((ok) ? ZIP_RESOLVED : ZIP_BROKEN_FILE);
+        if (ok)
+            retval++;
+    } /* for */
+
+    if (buf != NULL)
+        allocator.Free(buf);
+
+    for (i = 0; i < count; i++)
+    {
+        if (sorted[i]->resolved == ZIP_UNRESOLVED_SYMLINK)
+        {
+            if (zip_resolve(info, sorted[i]))
+                retval++;
+        } /* if */
+    } /* for */
+
+    allocator.Free(sorted);
+    return(retval);
+} /* zip_resolve_all */
+
+
 static void *ZIP_openArchive(const char *name, int forWriting)
 {
+    const PHYSFS_uint64 start = __PHYSFS_platformGetTicks();
     void *in = NULL;
     ZIPinfo *info = NULL;
-    PHYSFS_uint32 data_start;
-    PHYSFS_uint32 cent_dir_ofs;
+    PHYSFS_uint64 data_start;
+    PHYSFS_uint64 cent_dir_ofs;
+    PHYSFS_uint64 cent_dir_len;
+    PHYSFS_uint32 resolved = 0;
+    int resolveAll;
+    int mapArchive;
 
     BAIL_IF_MACRO(forWriting, ERR_ARC_IS_READ_ONLY, NULL);
 
@@ -1124,20 +2378,55 @@ static void *ZIP_openArchive(const char *name, int forWriting)
     if ((info = zip_create_zipinfo(name)) == NULL)
         goto zip_openarchive_failed;
 
-    if (!zip_parse_end_of_central_dir(in, info, &data_start, &cent_dir_ofs))
+    if (!zip_parse_end_of_central_dir(in, info, &data_start,
+                                      &cent_dir_ofs, &cent_dir_len))
         goto zip_openarchive_failed;
 
-    if (!zip_load_entries(in, info, data_start, cent_dir_ofs))
+    if (!zip_load_entries(in, info, data_start, cent_dir_ofs,
+                          cent_dir_len))
         goto zip_openarchive_failed;
 
-    __PHYSFS_platformClose(in);
+    if (!zip_build_index(info))
+        goto zip_openarchive_failed;
+
+    /* keep the archive open; every file opened in it reads through this. */
+    info->handle = in;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    resolveAll = zipResolveOnMount;
+    mapArchive = zipMapArchives;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
+    if (mapArchive)
+        zip_map_archive(info);
+
+    if (resolveAll)
+        resolved = zip_resolve_all(info);
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipStats.mountMicroseconds += __PHYSFS_platformGetTicks() - start;
+    zipStats.resolvedAtMount += resolved;
+    if (info->mapped != NULL)
+        zipStats.mappedBytes += info->mappedLen;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
     return(info);
 
 zip_openarchive_failed:
     if (info != NULL)
     {
+        if (info->entries != NULL)
+            zip_free_entries(info->entries, info->entryCount);
+        if (info->nodes != NULL)
+            allocator.Free(info->nodes);
+        if (info->buckets != NULL)
+            allocator.Free(info->buckets);
         if (info->archiveName != NULL)
             allocator.Free(info->archiveName);
+        if (info->resolveLock != NULL)
+            __PHYSFS_platformDestroyMutex(info->resolveLock);
+        if (info->ioLock != NULL)
+            __PHYSFS_platformDestroyMutex(info->ioLock);
         allocator.Free(info);
     } /* if */
 
@@ -1148,59 +2437,6 @@ zip_openarchive_failed:
 } /* ZIP_openArchive */
 
 
-static PHYSFS_sint32 zip_find_start_of_dir(ZIPinfo *info, const char *path,
-                                            int stop_on_first_find)
-{
-    PHYSFS_sint32 lo = 0;
-    PHYSFS_sint32 hi = (PHYSFS_sint32) (info->entryCount - 1);
-    PHYSFS_sint32 middle;
-    PHYSFS_uint32 dlen = strlen(path);
-    PHYSFS_sint32 retval = -1;
-    const char *name;
-    int rc;
-
-    if (*path == '\0')  /* root dir? */
-        return(0);
-
-    if ((dlen > 0) && (path[dlen - 1] == '/')) /* ignore trailing slash. */
-        dlen--;
-
-    while (lo <= hi)
-    {
-        middle = lo + ((hi - lo) / 2);
-        name = info->entries[middle].name;
-        rc = strncmp(path, name, dlen);
-        if (rc == 0)
-        {
-            char ch = name[dlen];
-            if ('/' < ch) /* make sure this isn't just a substr match. */
-                rc = -1;
-            else if ('/' > ch)
-                rc = 1;
-            else 
-            {
-                if (stop_on_first_find) /* Just checking dir's existance? */
-                    return(middle);
-
-                if (name[dlen + 1] == '\0') /* Skip initial dir entry. */
-                    return(middle + 1);
-
-                /* there might be more entries earlier in the list. */
-                retval = middle;
-                hi = middle - 1;
-            } /* else */
-        } /* if */
-
-        if (rc > 0)
-            lo = middle + 1;
-        else
-            hi = middle - 1;
-    } /* while */
-
-    return(retval);
-} /* zip_find_start_of_dir */
-
-
 /*
  * Moved to seperate function so we can use alloca then immediately throw
  *  away the allocated stack space...
@@ -1224,43 +2460,29 @@ static void ZIP_enumerateFiles(dvoid *opaque, const char *dname,
                                const char *origdir, void *callbackdata)
 {
     ZIPinfo *info = ((ZIPinfo *) opaque);
-    PHYSFS_sint32 dlen, dlen_inc, max, i;
-
-    i = zip_find_start_of_dir(info, dname, 0);
-    if (i == -1)  /* no such directory. */
-        return;
+    PHYSFS_uint32 dlen = (PHYSFS_uint32) strlen(dname);
+    PHYSFS_uint32 dlen_inc;
+    PHYSFS_uint32 i;
+    ZIPnode *dir;
 
-    dlen = strlen(dname);
     if ((dlen > 0) && (dname[dlen - 1] == '/')) /* ignore trailing slash. */
         dlen--;
 
+    dir = zip_find_node(info, dname, dlen);
+    if ((dir == NULL) || (dir->entry != NULL))  /* no such directory. */
+        return;
+
     dlen_inc = ((dlen > 0) ? 1 : 0) + dlen;
-    max = (PHYSFS_sint32) info->entryCount;
-    while (i < max)
+    for (i = dir->firstChild; i != ZIP_NO_NODE; i = info->nodes[i].nextSibling)
     {
-        char *e = info->entries[i].name;
-        if ((dlen) && ((strncmp(e, dname, dlen) != 0) || (e[dlen] != '/')))
-            break;  /* past end of this dir; we're done. */
+        const ZIPnode *node = &info->nodes[i];
+        if ((omitSymLinks) && (node->entry != NULL) &&
+            (zip_entry_is_symlink(info, node->entry)))
+            continue;
 
-        if ((omitSymLinks) && (zip_entry_is_symlink(&info->entries[i])))
-            i++;
-        else
-        {
-            char *add = e + dlen_inc;
-            char *ptr = strchr(add, '/');
-            PHYSFS_sint32 ln = (PHYSFS_sint32) ((ptr) ? ptr-add : strlen(add));
-            doEnumCallback(cb, callbackdata, origdir, add, ln);
-            ln += dlen_inc;  /* point past entry to children... */
-
-            /* increment counter and skip children of subdirs... */
-            while ((++i < max) && (ptr != NULL))
-            {
-                char *e_new = info->entries[i].name;
-                if ((strncmp(e, e_new, ln) != 0) || (e_new[ln] != '/'))
-                    break;
-            } /* while */
-        } /* else */
-    } /* while */
+        doEnumCallback(cb, callbackdata, origdir, node->name + dlen_inc,
+                       (PHYSFS_sint32) (node->namelen - dlen_inc));
+    } /* for */
 } /* ZIP_enumerateFiles */
 
 
@@ -1295,6 +2517,7 @@ static int ZIP_isDirectory(dvoid *opaque, const char *name, int *fileExists)
     ZIPinfo *info = (ZIPinfo *) opaque;
     int isDir;
     ZIPentry *entry = zip_find_entry(info, name, &isDir);
+    ZIPnode *node;
 
     *fileExists = ((isDir) || (entry != NULL));
     if (isDir)
@@ -1303,56 +2526,97 @@ static int ZIP_isDirectory(dvoid *opaque, const char *name, int *fileExists)
     /* Follow symlinks. This means we might need to resolve entries. */
     BAIL_IF_MACRO(entry == NULL, ERR_NO_SUCH_FILE, 0);
 
+    __PHYSFS_platformGrabMutex(info->resolveLock);
     if (entry->resolved == ZIP_UNRESOLVED_SYMLINK) /* gotta resolve it. */
     {
-        int rc;
-        void *in = __PHYSFS_platformOpenRead(info->archiveName);
-        BAIL_IF_MACRO(in == NULL, NULL, 0);
-        rc = zip_resolve(in, info, entry);
-        __PHYSFS_platformClose(in);
-        if (!rc)
-            return(0);
+        const int rc = zip_resolve(info, entry);
+        BAIL_IF_MACRO_MUTEX(!rc, NULL, info->resolveLock, 0);
     } /* if */
+    __PHYSFS_platformReleaseMutex(info->resolveLock);
 
     BAIL_IF_MACRO(entry->resolved == ZIP_BROKEN_SYMLINK, NULL, 0);
     BAIL_IF_MACRO(entry->symlink == NULL, ERR_NOT_A_DIR, 0);
 
-    return(zip_find_start_of_dir(info, entry->symlink->name, 1) >= 0);
+    entry = entry->symlink;
+    node = zip_find_node(info, entry->name, (PHYSFS_uint32) strlen(entry->name));
+    return((node != NULL) && (node->entry == NULL));
 } /* ZIP_isDirectory */
 
 
 static int ZIP_isSymLink(dvoid *opaque, const char *name, int *fileExists)
 {
+    ZIPinfo *info = (ZIPinfo *) opaque;
     int isDir;
-    const ZIPentry *entry = zip_find_entry((ZIPinfo *) opaque, name, &isDir);
+    const ZIPentry *entry = zip_find_entry(info, name, &isDir);
     *fileExists = ((isDir) || (entry != NULL));
     BAIL_IF_MACRO(entry == NULL, NULL, 0);
-    return(zip_entry_is_symlink(entry));
+    return(zip_entry_is_symlink(info, entry));
 } /* ZIP_isSymLink */
 
 
-static void *zip_get_file_handle(const char *fn, ZIPinfo *inf, ZIPentry *entry)
+static int zip_resolve_for_open(ZIPinfo *info, ZIPentry *entry)
+{
+    int retval;
+    __PHYSFS_platformGrabMutex(info->resolveLock);
+    retval = zip_resolve(info, entry);
+    __PHYSFS_platformReleaseMutex(info->resolveLock);
+    return(retval);
+} /* zip_resolve_for_open */
+
+
+/*
+ * Decompress all of the handle's entry into a new cache item, and have the
+ *  handle read from that from now on. This is just an optimization, so if
+ *  anything goes wrong, the handle carries on inflating as usual; we only
+ *  fail if we can't rewind it to do that.
+ */
+static int zip_cache_fill(ZIPfileinfo *finfo)
 {
-    int success;
-    void *retval = __PHYSFS_platformOpenRead(fn);
-    BAIL_IF_MACRO(retval == NULL, NULL, NULL);
+    ZIPentry *entry = finfo->entry;
+    const PHYSFS_uint64 size = entry->uncompressed_size;
+    ZIPcached *c;
 
-    success = zip_resolve(retval, inf, entry);
-    if (success)
+    c = (ZIPcached *) allocator.Malloc(sizeof (ZIPcached) + (size_t) size);
+    if (c == NULL)
+        return(1);
+
+    if (ZIP_read(finfo, c + 1, (PHYSFS_uint32) size, 1) != 1)
     {
-        PHYSFS_sint64 offset;
-        offset = ((entry->symlink) ? entry->symlink->offset : entry->offset);
-        success = __PHYSFS_platformSeek(retval, offset);
+        allocator.Free(c);
+        return(zip_restart_inflate(finfo, NULL));
     } /* if */
 
-    if (!success)
+    c->entry = NULL;
+    c->size = size;
+    c->refcount = 1;
+    c->prev = c->next = NULL;
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    if (entry->cached != NULL)  /* another handle beat us to it. */
     {
-        __PHYSFS_platformClose(retval);
-        retval = NULL;
+        allocator.Free(c);
+        c = entry->cached;
+        c->refcount++;
     } /* if */
 
-    return(retval);
-} /* zip_get_file_handle */
+    /* if the budget shrank meanwhile, (c) is just private to this handle. */
+    else if (size <= zipCacheBudget)
+    {
+        zip_cache_trim(size);
+        zip_cache_link(c);
+        c->entry = entry;
+        entry->cached = c;
+        zipStats.cacheEntries++;
+        zipStats.cacheBytes += size;
+    } /* else if */
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
+    zip_inflater_release(finfo->inflater);
+    finfo->inflater = NULL;
+    finfo->cached = c;
+    finfo->uncompressed_position = 0;
+    return(1);
+} /* zip_cache_fill */
 
 
 static fvoid *ZIP_openRead(dvoid *opaque, const char *fnm, int *fileExists)
@@ -1360,38 +2624,62 @@ static fvoid *ZIP_openRead(dvoid *opaque, const char *fnm, int *fileExists)
     ZIPinfo *info = (ZIPinfo *) opaque;
     ZIPentry *entry = zip_find_entry(info, fnm, NULL);
     ZIPfileinfo *finfo = NULL;
-    void *in;
+    int cacheable = 0;
 
     *fileExists = (entry != NULL);
     BAIL_IF_MACRO(entry == NULL, NULL, NULL);
-
-    in = zip_get_file_handle(info->archiveName, info, entry);
-    BAIL_IF_MACRO(in == NULL, NULL, NULL);
+    BAIL_IF_MACRO(!zip_resolve_for_open(info, entry), NULL, NULL);
 
     finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    if (finfo == NULL)
-    {
-        __PHYSFS_platformClose(in);
-        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
-    } /* if */
+    BAIL_IF_MACRO(finfo == NULL, ERR_OUT_OF_MEMORY, NULL);
 
     memset(finfo, '\0', sizeof (ZIPfileinfo));
-    finfo->handle = in;
+    finfo->info = info;
     finfo->entry = ((entry->symlink != NULL) ? entry->symlink : entry);
-    initializeZStream(&finfo->stream);
+    finfo->handle = __PHYSFS_openEntryHandle(info->archiveName, info->handle);
+    if (finfo->handle == NULL)
+    {
+        ZIP_fileClose(finfo);
+        return(NULL);
+    } /* if */
+
     if (finfo->entry->compression_method != COMPMETH_NONE)
+        finfo->cached = zip_cache_get(finfo->entry, &cacheable);
+
+    if ( (finfo->entry->compression_method != COMPMETH_NONE) &&
+         (finfo->cached == NULL) )
     {
-        if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
+        finfo->inflater = zip_inflater_get(finfo->entry->compressed_size,
+                                           info->mapped == NULL);
+        if (finfo->inflater == NULL)
         {
             ZIP_fileClose(finfo);
             return(NULL);
         } /* if */
 
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        if (finfo->buffer == NULL)
+        if (cacheable)
         {
-            ZIP_fileClose(finfo);
-            BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+            if (!zip_cache_fill(finfo))
+            {
+                ZIP_fileClose(finfo);
+                return(NULL);
+            } /* if */
+
+            if (finfo->cached != NULL)
+                return(finfo);
+        } /* if */
+
+        __PHYSFS_platformGrabMutex(zipStateLock);
+        if (finfo->entry->uncompressed_size > zipCheckpointInterval)
+            finfo->checkpointInterval = zipCheckpointInterval;
+        __PHYSFS_platformReleaseMutex(zipStateLock);
+
+        if (finfo->checkpointInterval != 0)
+        {
+            finfo->nextCheckpoint = finfo->checkpointInterval;
+            finfo->history = (PHYSFS_uint8 *) allocator.Malloc(ZIP_WINDOWSIZE);
+            if (finfo->history == NULL)  /* fine, just don't add any. */
+                finfo->checkpointInterval = 0;
         } /* if */
     } /* if */
 
@@ -1414,7 +2702,23 @@ static fvoid *ZIP_openAppend(dvoid *opaque, const char *filename)
 static void ZIP_dirClose(dvoid *opaque)
 {
     ZIPinfo *zi = (ZIPinfo *) (opaque);
+
+    __PHYSFS_platformGrabMutex(zipStateLock);
+    zipStats.archives--;
+    zipStats.entries -= zi->nodeCount - 1;
+    zipStats.indexBytes -= zi->indexBytes;
+    if (zi->mapped != NULL)
+        zipStats.mappedBytes -= zi->mappedLen;
+    __PHYSFS_platformReleaseMutex(zipStateLock);
+
     zip_free_entries(zi->entries, zi->entryCount);
+    if (zi->mapped != NULL)
+        __PHYSFS_platformUnmap(zi->mapping);
+    allocator.Free(zi->nodes);
+    allocator.Free(zi->buckets);
+    __PHYSFS_platformClose(zi->handle);
+    __PHYSFS_platformDestroyMutex(zi->resolveLock);
+    __PHYSFS_platformDestroyMutex(zi->ioLock);
     allocator.Free(zi->archiveName);
     allocator.Free(zi);
 } /* ZIP_dirClose */
@@ -1463,7 +2767,10 @@ const PHYSFS_Archiver __PHYSFS_Archiver_ZIP =
     ZIP_tell,               /* tell() method           */
     ZIP_seek,               /* seek() method           */
     ZIP_fileLength,         /* fileLength() method     */
-    ZIP_fileClose           /* fileClose() method      */
+    ZIP_fileClose,          /* fileClose() method      */
+    ZIP_getRawRegion,       /* getRawRegion() method   */
+    ZIP_prefetch,           /* prefetch() method       */
+    NULL                    /* getView() method        */
 };
 
 #endif  /* defined PHYSFS_SUPPORTS_ZIP */
@@ -17,16 +17,62 @@
 #include "physfs_internal.h"
 
 
+/*
+ * A directory, relative to the root of its DirHandle, that verifyPath() has
+ *  already confirmed exists and isn't a symlink.
+ */
+typedef struct __PHYSFS_VERIFIEDPREFIX__
+{
+    PHYSFS_uint32 hash;
+    struct __PHYSFS_VERIFIEDPREFIX__ *next;
+    char path[1];  /* actually allocated to fit the whole string. */
+} VerifiedPrefix;
+
+#define VERIFIED_PREFIX_BUCKETS 64
+#define VERIFIED_PREFIX_MAX 4096
+
 typedef struct __PHYSFS_DIRHANDLE__
 {
     void *opaque;  /* Instance data unique to the archiver. */
     char *dirName;  /* Path to archive in platform-dependent notation. */
     char *mountPoint; /* Mountpoint in virtual file tree. */
     const PHYSFS_Archiver *funcs;  /* Ptr to archiver info for this handle. */
+    PHYSFS_uint32 refcount;  /* Number of SearchPath snapshots holding this. */
+    int removed;  /* Non-zero if no longer in the search path. */
+    void *verifiedLock;  /* Guards the next three. NULL if not caching. */
+    VerifiedPrefix **verified;  /* VERIFIED_PREFIX_BUCKETS, or NULL. */
+    PHYSFS_uint32 verifiedCount;  /* Number of items in (verified). */
+    PHYSFS_uint32 verifiedGeneration;  /* Bumped whenever they're flushed. */
     struct __PHYSFS_DIRHANDLE__ *next;  /* linked list stuff. */
 } DirHandle;
 
 
+/*
+ * One slot of the negative lookup cache: a path that we know, as of
+ *  (generation), isn't anywhere in the search path.
+ */
+typedef struct
+{
+    PHYSFS_uint32 hash;
+    PHYSFS_uint32 generation;
+    char *path;  /* NULL if slot is empty. */
+} NegativeCacheEntry;
+
+
+/*
+ * An immutable copy of the search path. Lookups walk one of these instead of
+ *  the live list, so they only need the stateLock long enough to grab a
+ *  reference to it, and the (potentially slow) archiver work runs without
+ *  holding up other threads.
+ */
+typedef struct
+{
+    PHYSFS_uint32 refcount;  /* the current snapshot holds one, too. */
+    PHYSFS_uint32 count;
+    DirHandle *handles[1];  /* actually allocated to fit (count) handles. */
+} SearchPath;
+
+
 typedef struct __PHYSFS_FILEHANDLE__
 {
     void *opaque;  /* Instance data unique to the archiver for this file. */
@@ -37,10 +83,52 @@ typedef struct __PHYSFS_FILEHANDLE__
     PHYSFS_uint32 bufsize;  /* Bufsize, if set (0 otherwise). Don't touch! */
     PHYSFS_uint32 buffill;  /* Buffer fill size. Don't touch! */
     PHYSFS_uint32 bufpos;  /* Buffer position. Don't touch! */
+    void *readAtLock;  /* serializes PHYSFS_readAt() fallback. May be NULL. */
     struct __PHYSFS_FILEHANDLE__ *next;  /* linked list stuff. */
 } FileHandle;
 
 
+/*
+ * One of these is kept for every pointer handed out by PHYSFS_mapFile().
+ */
+typedef struct __PHYSFS_MAPPEDFILE__
+{
+    const void *data;  /* what the application sees. */
+    void *mapping;  /* from __PHYSFS_platformMap(), or NULL if (data) was
+                       allocated and read into instead. */
+    const PHYSFS_Archiver *funcs;  /* set if (data) is an archiver's view. */
+    fvoid *opaque;  /* the archiver's file handle, open while viewed. */
+    SearchPath *searchPath;  /* keeps (opaque)'s archive alive. */
+    struct __PHYSFS_MAPPEDFILE__ *next;
+} MappedFile;
+
+
+/*
+ * A PHYSFS_readAsync(), PHYSFS_loadAsync() or PHYSFS_prefetch() request.
+ *  These sit in a FIFO until a worker thread gets to them.
+ */
+typedef struct __PHYSFS_ASYNCREQUEST__
+{
+    PHYSFS_File *handle;  /* for PHYSFS_readAsync(), NULL otherwise. */
+    char *filename;  /* for PHYSFS_loadAsync(), NULL otherwise. */
+    char **paths;  /* for PHYSFS_prefetch(), NULL otherwise. One block. */
+    PHYSFS_uint32 pathCount;
+    PHYSFS_uint64 offset;
+    void *buffer;  /* app's for reads, ours for loads. */
+    PHYSFS_uint64 len;
+    PHYSFS_AsyncCallback callback;
+    void *callbackData;
+    PHYSFS_sint64 result;  /* bytes read, or -1 on failure. */
+    char error[80];  /* what went wrong, if (result) is -1. */
+    PHYSFS_uint64 queuedTicks;
+    void *done;  /* semaphore, only created if someone waits on us. */
+    PHYSFS_uint32 waiters;
+    PHYSFS_uint8 finished;
+    PHYSFS_uint8 detached;  /* app freed it before it finished. */
+    struct __PHYSFS_ASYNCREQUEST__ *next;
+} AsyncRequest;
+
+
 typedef struct __PHYSFS_ERRMSGTYPE__
 {
     void *tid;
@@ -67,6 +155,26 @@ extern const PHYSFS_ArchiveInfo    __PHYSFS_ArchiveInfo_WAD;
 extern const PHYSFS_Archiver       __PHYSFS_Archiver_WAD;
 extern const PHYSFS_Archiver       __PHYSFS_Archiver_DIR;
 
+/* State the ZIP archiver shares between archives. */
+extern int __PHYSFS_zipInit(void);
+extern void __PHYSFS_zipDeinit(void);
+extern void __PHYSFS_zipGetStats(PHYSFS_ZipStats *stats);
+extern void __PHYSFS_zipSetCheckpointInterval(PHYSFS_uint32 interval);
+extern void __PHYSFS_zipSetCache(PHYSFS_uint64 budget,
+                                 PHYSFS_uint32 maxEntrySize);
+extern void __PHYSFS_zipSetInflaterPool(PHYSFS_uint32 count);
+extern void __PHYSFS_zipSetResolveOnMount(int enable);
+extern void __PHYSFS_zipSetMapArchives(int enable);
+
+/* ...and the 7z archiver. */
+extern int __PHYSFS_lzmaInit(void);
+extern void __PHYSFS_lzmaDeinit(void);
+extern void __PHYSFS_lzmaGetStats(PHYSFS_7zStats *stats);
+extern void __PHYSFS_lzmaSetCache(PHYSFS_uint64 budget);
+extern const void *__PHYSFS_lzmaFolderOf(fvoid *opaque);
+extern int __PHYSFS_lzmaPredecode(fvoid *opaque);
+extern void __PHYSFS_lzmaReleasePinned(void);
+
 
 static const PHYSFS_ArchiveInfo *supported_types[] =
 {
@@ -127,16 +235,33 @@ static const PHYSFS_Archiver * const archivers[] =
 static int initialized = 0;
 static ErrMsg *errorMessages = NULL;
 static DirHandle *searchPath = NULL;
+static SearchPath *searchPathSnapshot = NULL;
 static DirHandle *writeDir = NULL;
 static FileHandle *openWriteList = NULL;
 static FileHandle *openReadList = NULL;
+static MappedFile *mappedFiles = NULL;
 static char *baseDir = NULL;
 static char *userDir = NULL;
 static int allowSymLinks = 0;
+static int searchPathIndexEnabled = 0;
+static NegativeCacheEntry *negativeCache = NULL;
+static PHYSFS_uint32 negativeCacheSize = 0;
+static PHYSFS_uint32 negativeCacheGeneration = 0;
+static PHYSFS_uint64 negativeCacheHits = 0;
+static PHYSFS_uint64 negativeCacheMisses = 0;
+static AsyncRequest *asyncQueue = NULL;
+static AsyncRequest *asyncQueueTail = NULL;
+static void **asyncThreads = NULL;
+static PHYSFS_uint32 asyncThreadCount = 0;
+static PHYSFS_uint32 asyncThreadsWanted = 2;
+static int asyncStopping = 0;
+static void *asyncWakeup = NULL;
+static PHYSFS_AsyncStats asyncStats;
 
 /* mutexes ... */
 static void *errorLock = NULL;     /* protects error message list.        */
 static void *stateLock = NULL;     /* protects other PhysFS static state. */
+static void *asyncLock = NULL;     /* protects async queue and workers.   */
 
 /* allocator ... */
 static int externalAllocator = 0;
@@ -145,38 +270,198 @@ PHYSFS_Allocator allocator;
 
 /* functions ... */
 
+static PHYSFS_uint32 hashVirtualPath(const char *str)
+{
+    PHYSFS_uint32 hash = 2166136261u;  /* FNV-1a */
+    char ch;
+
+    while ((ch = *(str++)) != '\0')
+    {
+        if ((ch >= 'A') && (ch <= 'Z'))
+            ch += ('a' - 'A');
+        hash = (hash ^ ((PHYSFS_uint8) ch)) * 16777619u;
+    } /* while */
+
+    return(hash);
+} /* hashVirtualPath */
+
+
+/*
+ * Lists we hand back to the app (PHYSFS_enumerateFiles(), etc) are built
+ *  here. Strings are packed back to back in one growing arena, and we only
+ *  keep their offsets, since the arena moves when it grows. When asked to,
+ *  duplicates are weeded out with a small open-addressing hash of entry
+ *  indices. The finished list is a single allocation: the NULL-terminated
+ *  pointer array followed by the strings it points into, so
+ *  PHYSFS_freeList() has exactly one block to free.
+ */
 typedef struct
 {
-    char **list;
+    char *arena;
+    size_t arenaUsed;
+    size_t arenaAlloc;
+    size_t *offsets;
     PHYSFS_uint32 size;
+    PHYSFS_uint32 offsetsAlloc;
+    PHYSFS_uint32 *hash;  /* entry index + 1, zero for an empty slot. */
+    PHYSFS_uint32 hashAlloc;  /* zero or a power of two. */
     const char *errorstr;
 } EnumStringListCallbackData;
 
-static void enumStringListCallback(void *data, const char *str)
+static int growStringListHash(EnumStringListCallbackData *pecd)
+{
+    const PHYSFS_uint32 newAlloc = (pecd->hashAlloc) ? pecd->hashAlloc*2 : 64;
+    const PHYSFS_uint32 mask = newAlloc - 1;
+    PHYSFS_uint32 *ptr;
+    PHYSFS_uint32 slot;
+    PHYSFS_uint32 i;
+
+    if (newAlloc < pecd->hashAlloc)  /* overflowed. */
+        return(0);
+
+    ptr = (PHYSFS_uint32 *) allocator.Malloc(newAlloc * sizeof (PHYSFS_uint32));
+    if (ptr == NULL)
+        return(0);
+
+    memset(ptr, '\0', newAlloc * sizeof (PHYSFS_uint32));
+    for (i = 0; i < pecd->size; i++)
+    {
+        slot = hashVirtualPath(pecd->arena + pecd->offsets[i]) & mask;
+        while (ptr[slot] != 0)
+            slot = (slot + 1) & mask;
+        ptr[slot] = i + 1;
+    } /* for */
+
+    allocator.Free(pecd->hash);
+    pecd->hash = ptr;
+    pecd->hashAlloc = newAlloc;
+    return(1);
+} /* growStringListHash */
+
+
+static void addToStringList(EnumStringListCallbackData *pecd,
+                            const char *str, int unique)
 {
+    const size_t len = strlen(str) + 1;
+    PHYSFS_uint32 slot = 0;
     void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
 
     if (pecd->errorstr)
         return;
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
+    if (unique)
+    {
+        PHYSFS_uint32 mask;
+
+        /* keep the table at most half full, so probe chains stay short. */
+        if ((pecd->size + 1) >= (pecd->hashAlloc / 2))
+        {
+            if (!growStringListHash(pecd))
+            {
+                pecd->errorstr = ERR_OUT_OF_MEMORY;
+                return;
+            } /* if */
+        } /* if */
+
+        mask = pecd->hashAlloc - 1;
+        slot = hashVirtualPath(str) & mask;
+        while (pecd->hash[slot] != 0)
+        {
+            const size_t off = pecd->offsets[pecd->hash[slot] - 1];
+            if (strcmp(pecd->arena + off, str) == 0)
+                return;  /* already in the list. */
+            slot = (slot + 1) & mask;
+        } /* while */
+    } /* if */
 
-    if ((ptr == NULL) || (newstr == NULL))
+    if (pecd->size == pecd->offsetsAlloc)
     {
-        pecd->errorstr = ERR_OUT_OF_MEMORY;
-        pecd->list[pecd->size] = NULL;
-        PHYSFS_freeList(pecd->list);
-        return;
+        const PHYSFS_uint32 newAlloc = (pecd->offsetsAlloc) ?
+                                        pecd->offsetsAlloc * 2 : 64;
+        ptr = NULL;
+        if (newAlloc > pecd->offsetsAlloc)
+            ptr = allocator.Realloc(pecd->offsets, newAlloc * sizeof (size_t));
+        if (ptr == NULL)
+        {
+            pecd->errorstr = ERR_OUT_OF_MEMORY;
+            return;
+        } /* if */
+        pecd->offsets = (size_t *) ptr;
+        pecd->offsetsAlloc = newAlloc;
+    } /* if */
+
+    if ((pecd->arenaAlloc - pecd->arenaUsed) < len)
+    {
+        size_t newAlloc = (pecd->arenaAlloc) ? pecd->arenaAlloc : 1024;
+        while ((newAlloc - pecd->arenaUsed) < len)
+            newAlloc *= 2;
+        ptr = allocator.Realloc(pecd->arena, newAlloc);
+        if (ptr == NULL)
+        {
+            pecd->errorstr = ERR_OUT_OF_MEMORY;
+            return;
+        } /* if */
+        pecd->arena = (char *) ptr;
+        pecd->arenaAlloc = newAlloc;
     } /* if */
 
-    strcpy(newstr, str);
-    pecd->list[pecd->size] = newstr;
+    memcpy(pecd->arena + pecd->arenaUsed, str, len);
+    pecd->offsets[pecd->size] = pecd->arenaUsed;
+    pecd->arenaUsed += len;
+    if (unique)
+        pecd->hash[slot] = pecd->size + 1;
     pecd->size++;
+} /* addToStringList */
+
+
+static int stringListCmp(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    char **a = (char **) _a;
+    return(strcmp(a[one], a[two]));
+} /* stringListCmp */
+
+
+static void stringListSwap(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    char **a = (char **) _a;
+    char *tmp = a[one];
+    a[one] = a[two];
+    a[two] = tmp;
+} /* stringListSwap */
+
+
+static char **finishStringList(EnumStringListCallbackData *pecd, int sorted)
+{
+    const size_t ptrsize = (pecd->size + 1) * sizeof (char *);
+    char **retval = NULL;
+    char *strs;
+    PHYSFS_uint32 i;
+
+    GOTO_IF_MACRO(pecd->errorstr != NULL, pecd->errorstr, finishStringListEnd);
+    retval = (char **) allocator.Malloc(ptrsize + pecd->arenaUsed);
+    GOTO_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, finishStringListEnd);
+
+    strs = ((char *) retval) + ptrsize;
+    if (pecd->arenaUsed > 0)
+        memcpy(strs, pecd->arena, pecd->arenaUsed);
+    for (i = 0; i < pecd->size; i++)
+        retval[i] = strs + pecd->offsets[i];
+    retval[pecd->size] = NULL;
+
+    if (sorted)
+        __PHYSFS_sort(retval, pecd->size, stringListCmp, stringListSwap);
+
+finishStringListEnd:
+    allocator.Free(pecd->arena);
+    allocator.Free(pecd->offsets);
+    allocator.Free(pecd->hash);
+    return(retval);
+} /* finishStringList */
+
+
+static void enumStringListCallback(void *data, const char *str)
+{
+    addToStringList((EnumStringListCallbackData *) data, str, 0);
 } /* enumStringListCallback */
 
 
@@ -184,12 +469,8 @@ static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
 {
     EnumStringListCallbackData ecd;
     memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF_MACRO(ecd.list == NULL, ERR_OUT_OF_MEMORY, NULL);
     func(enumStringListCallback, &ecd);
-    BAIL_IF_MACRO(ecd.errorstr != NULL, ecd.errorstr, NULL);
-    ecd.list[ecd.size] = NULL;
-    return(ecd.list);
+    return(finishStringList(&ecd, 0));
 } /* doEnumStringList */
 
 
@@ -266,6 +547,64 @@ void __PHYSFS_sort(void *entries, PHYSFS_uint32 max,
 } /* __PHYSFS_sort */
 
 
+PHYSFS_sint64 __PHYSFS_readArchiveAt(void *handle, void *lock, void *buffer,
+                                     PHYSFS_uint64 offset, PHYSFS_uint32 len)
+{
+#ifdef PHYSFS_NO_PREAD_SUPPORT
+    PHYSFS_sint64 retval = -1;
+
+    if (lock != NULL)
+        __PHYSFS_platformGrabMutex(lock);
+    if (__PHYSFS_platformSeek(handle, offset))
+        retval = __PHYSFS_platformRead(handle, buffer, 1, len);
+    if (lock != NULL)
+        __PHYSFS_platformReleaseMutex(lock);
+
+    return(retval);
+#else
+    return(__PHYSFS_platformReadAt(handle, buffer, offset, len));
+#endif
+} /* __PHYSFS_readArchiveAt */
+
+
+void *__PHYSFS_openEntryHandle(const char *archive, void *handle)
+{
+#ifdef PHYSFS_NO_PREAD_SUPPORT
+    return(__PHYSFS_platformOpenRead(archive));
+#else
+    return(handle);
+#endif
+} /* __PHYSFS_openEntryHandle */
+
+
+void __PHYSFS_closeEntryHandle(void *entryHandle, void *handle)
+{
+    if ((entryHandle != NULL) && (entryHandle != handle))
+        __PHYSFS_platformClose(entryHandle);
+} /* __PHYSFS_closeEntryHandle */
+
+
+void *__PHYSFS_readTable(void *handle, PHYSFS_uint32 size, PHYSFS_uint32 count)
+{
+    const PHYSFS_uint64 len = ((PHYSFS_uint64) size) * ((PHYSFS_uint64) count);
+    void *retval;
+
+    /* nothing sane has a table this big; the count is probably garbage. */
+    BAIL_IF_MACRO(len > 0x7FFFFFFF, ERR_CORRUPTED, NULL);
+    retval = allocator.Malloc((len > 0) ? (size_t) len : 1);
+    BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+    if ( (len > 0) &&
+         (__PHYSFS_platformRead(handle, retval, size, count) != count) )
+    {
+        allocator.Free(retval);
+        return(NULL);
+    } /* if */
+
+    return(retval);
+} /* __PHYSFS_readTable */
+
+
 static ErrMsg *findErrorForCurrentThread(void)
 {
     ErrMsg *i;
@@ -568,6 +907,10 @@ static DirHandle *createDirHandle(const char *newDir,
         strcat(dirHandle->mountPoint, "/");
     } /* if */
 
+    /* only real directories have symlinks worth caching checks for. */
+    if (dirHandle->funcs == &__PHYSFS_Archiver_DIR)
+        dirHandle->verifiedLock = __PHYSFS_platformCreateMutex();
+
     __PHYSFS_smallFree(tmpmntpnt);
     return(dirHandle);
 
@@ -585,1404 +928,3399 @@ badDirHandle:
 } /* createDirHandle */
 
 
-/* MAKE SURE you've got the stateLock held before calling this! */
-static int freeDirHandle(DirHandle *dh, FileHandle *openList)
+/*
+ * Every DirHandle for a physical directory remembers which directories
+ *  verifyPath() already checked for symlinks, so looking up a file only has
+ *  to check the path elements it hasn't seen before, instead of one lstat()
+ *  per element per lookup. Archives can't change under us, so their
+ *  isSymLink() is cheap and they don't bother. Each cache has its own lock,
+ *  so lookups in different directories don't wait on each other, or on the
+ *  stateLock. A cache lives and dies with its DirHandle, so mounting and
+ *  unmounting take care of themselves; anything written through PhysicsFS
+ *  flushes all of them and bumps their generations, so checks that were
+ *  already underway don't add stale entries afterwards.
+ */
+
+static void freeVerifiedPrefixes(DirHandle *h)
 {
-    FileHandle *i;
+    PHYSFS_uint32 i;
 
-    if (dh == NULL)
-        return(1);
+    if (h->verified == NULL)
+        return;
 
-    for (i = openList; i != NULL; i = i->next)
-        BAIL_IF_MACRO(i->dirHandle == dh, ERR_FILES_STILL_OPEN, 0);
+    for (i = 0; i < VERIFIED_PREFIX_BUCKETS; i++)
+    {
+        VerifiedPrefix *item;
+        VerifiedPrefix *next;
+        for (item = h->verified[i]; item != NULL; item = next)
+        {
+            next = item->next;
+            allocator.Free(item);
+        } /* for */
+    } /* for */
 
-    dh->funcs->dirClose(dh->opaque);
-    allocator.Free(dh->dirName);
-    allocator.Free(dh->mountPoint);
-    allocator.Free(dh);
-    return(1);
-} /* freeDirHandle */
+    allocator.Free(h->verified);
+    h->verified = NULL;
+    h->verifiedCount = 0;
+} /* freeVerifiedPrefixes */
 
 
-static char *calculateUserDir(void)
+static void flushVerifiedPrefixes(DirHandle *h)
 {
-    char *retval = __PHYSFS_platformGetUserDir();
-    if (retval != NULL)
+    if ((h != NULL) && (h->verifiedLock != NULL))
     {
-        /* make sure it really exists and is normalized. */
-        char *ptr = __PHYSFS_platformRealPath(retval);
-        allocator.Free(retval);
-        retval = ptr;
+        __PHYSFS_platformGrabMutex(h->verifiedLock);
+        freeVerifiedPrefixes(h);
+        h->verifiedGeneration++;
+        __PHYSFS_platformReleaseMutex(h->verifiedLock);
     } /* if */
+} /* flushVerifiedPrefixes */
 
-    if (retval == NULL)
-    {
-        const char *dirsep = PHYSFS_getDirSeparator();
-        const char *uname = __PHYSFS_platformGetUserName();
-        const char *str = (uname != NULL) ? uname : "default";
 
-        retval = (char *) allocator.Malloc(strlen(baseDir) + strlen(str) +
-                                           strlen(dirsep) + 6);
+/* MAKE SURE you hold the stateLock before calling this! */
+static void invalidateVerifiedPrefixes(void)
+{
+    DirHandle *i;
+    for (i = searchPath; i != NULL; i = i->next)
+        flushVerifiedPrefixes(i);
+    flushVerifiedPrefixes(writeDir);
+} /* invalidateVerifiedPrefixes */
 
-        if (retval == NULL)
-            __PHYSFS_setError(ERR_OUT_OF_MEMORY);
-        else
-            sprintf(retval, "%susers%s%s", baseDir, dirsep, str);
 
-        allocator.Free((void *) uname);
-    } /* else */
+static int isVerifiedPrefix(const DirHandle *h, const char *path)
+{
+    const PHYSFS_uint32 hash = hashVirtualPath(path);
+    const VerifiedPrefix *item = h->verified[hash % VERIFIED_PREFIX_BUCKETS];
+    for (; item != NULL; item = item->next)
+    {
+        if ((item->hash == hash) && (strcmp(item->path, path) == 0))
+            return(1);
+    } /* for */
 
-    return(retval);
-} /* calculateUserDir */
+    return(0);
+} /* isVerifiedPrefix */
 
 
-static int appendDirSep(char **dir)
+/*
+ * Return the length of the longest directory at the start of archive path
+ *  (fname) that's known to be safe, or zero if there isn't one. (*gen) is
+ *  set to the generation to pass to addVerifiedPrefix().
+ */
+static size_t findVerifiedPrefix(DirHandle *h, char *fname, PHYSFS_uint32 *gen)
 {
-    const char *dirsep = PHYSFS_getDirSeparator();
+    size_t retval = 0;
     char *ptr;
 
-    if (strcmp((*dir + strlen(*dir)) - strlen(dirsep), dirsep) == 0)
-        return(1);
+    *gen = 0;
+    if (h->verifiedLock == NULL)
+        return(0);
 
-    ptr = (char *) allocator.Realloc(*dir, strlen(*dir) + strlen(dirsep) + 1);
-    if (!ptr)
+    __PHYSFS_platformGrabMutex(h->verifiedLock);
+    *gen = h->verifiedGeneration;
+    if (h->verified != NULL)
     {
-        allocator.Free(*dir);
-        return(0);
+        for (ptr = fname + strlen(fname); ptr > fname; ptr--)
+        {
+            if (*ptr == '/')
+            {
+                int found;
+                *ptr = '\0';
+                found = isVerifiedPrefix(h, fname);
+                *ptr = '/';
+                if (found)
+                {
+                    retval = (size_t) (ptr - fname);
+                    break;
+                } /* if */
+            } /* if */
+        } /* for */
     } /* if */
+    __PHYSFS_platformReleaseMutex(h->verifiedLock);
 
-    strcat(ptr, dirsep);
-    *dir = ptr;
-    return(1);
-} /* appendDirSep */
+    return(retval);
+} /* findVerifiedPrefix */
 
 
-static char *calculateBaseDir(const char *argv0)
+/* Remember that directory (path) is safe. Failures are silently ignored. */
+static void addVerifiedPrefix(DirHandle *h, const char *path, PHYSFS_uint32 gen)
 {
-    char *retval = NULL;
-    const char *dirsep = NULL;
-    char *ptr = NULL;
-
-    /* Give the platform layer first shot at this. */
-    retval = __PHYSFS_platformCalcBaseDir(argv0);
-    if (retval != NULL)
-        return(retval);
+    if (h->verifiedLock == NULL)
+        return;
 
-    /* We need argv0 to go on. */
-    BAIL_IF_MACRO(argv0 == NULL, ERR_ARGV0_IS_NULL, NULL);
+    __PHYSFS_platformGrabMutex(h->verifiedLock);
 
-    dirsep = PHYSFS_getDirSeparator();
-    if (strlen(dirsep) == 1)  /* fast path. */
-        ptr = strrchr(argv0, *dirsep);
-    else
+    /* if anything was written while we were checking, don't trust it. */
+    if (gen == h->verifiedGeneration)
     {
-        ptr = strstr(argv0, dirsep);
-        if (ptr != NULL)
+        if (h->verifiedCount >= VERIFIED_PREFIX_MAX)
+            freeVerifiedPrefixes(h);
+
+        if (h->verified == NULL)
         {
-            char *p = ptr;
-            while (p != NULL)
-            {
-                ptr = p;
-                p = strstr(p + 1, dirsep);
-            } /* while */
+            const size_t len = sizeof (VerifiedPrefix *) *
+                                VERIFIED_PREFIX_BUCKETS;
+            h->verified = (VerifiedPrefix **) allocator.Malloc(len);
+            if (h->verified != NULL)
+                memset(h->verified, '\0', len);
         } /* if */
-    } /* else */
 
-    if (ptr != NULL)
-    {
-        size_t size = (size_t) (ptr - argv0);
-        retval = (char *) allocator.Malloc(size + 1);
-        BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
-        memcpy(retval, argv0, size);
-        retval[size] = '\0';
-        return(retval);
+        if ((h->verified != NULL) && (!isVerifiedPrefix(h, path)))
+        {
+            VerifiedPrefix *item = (VerifiedPrefix *)
+                allocator.Malloc(sizeof (VerifiedPrefix) + strlen(path));
+            if (item != NULL)
+            {
+                PHYSFS_uint32 bucket;
+                strcpy(item->path, path);
+                item->hash = hashVirtualPath(path);
+                bucket = item->hash % VERIFIED_PREFIX_BUCKETS;
+                item->next = h->verified[bucket];
+                h->verified[bucket] = item;
+                h->verifiedCount++;
+            } /* if */
+        } /* if */
     } /* if */
 
-    /* argv0 wasn't helpful. */
-    BAIL_MACRO(ERR_INVALID_ARGUMENT, NULL);
-    return(NULL);
-} /* calculateBaseDir */
+    __PHYSFS_platformReleaseMutex(h->verifiedLock);
+} /* addVerifiedPrefix */
 
 
-static int initializeMutexes(void)
+static void closeDirHandle(DirHandle *dh)
 {
-    errorLock = __PHYSFS_platformCreateMutex();
-    if (errorLock == NULL)
-        goto initializeMutexes_failed;
+    freeVerifiedPrefixes(dh);
+    if (dh->verifiedLock != NULL)
+        __PHYSFS_platformDestroyMutex(dh->verifiedLock);
+    dh->funcs->dirClose(dh->opaque);
+    allocator.Free(dh->dirName);
+    allocator.Free(dh->mountPoint);
+    allocator.Free(dh);
+} /* closeDirHandle */
 
-    stateLock = __PHYSFS_platformCreateMutex();
-    if (stateLock == NULL)
-        goto initializeMutexes_failed;
 
-    return(1);  /* success. */
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int freeDirHandle(DirHandle *dh, FileHandle *openList)
+{
+    FileHandle *i;
 
-initializeMutexes_failed:
-    if (errorLock != NULL)
-        __PHYSFS_platformDestroyMutex(errorLock);
+    if (dh == NULL)
+        return(1);
 
-    if (stateLock != NULL)
-        __PHYSFS_platformDestroyMutex(stateLock);
-
-    errorLock = stateLock = NULL;
-    return(0);  /* failed. */
-} /* initializeMutexes */
+    for (i = openList; i != NULL; i = i->next)
+        BAIL_IF_MACRO(i->dirHandle == dh, ERR_FILES_STILL_OPEN, 0);
 
+    closeDirHandle(dh);
+    return(1);
+} /* freeDirHandle */
 
-static void setDefaultAllocator(void);
 
-int PHYSFS_init(const char *argv0)
+/* MAKE SURE you've got the stateLock held before calling this! */
+static void releaseSearchPath(SearchPath *sp)
 {
-    char *ptr;
-
-    BAIL_IF_MACRO(initialized, ERR_IS_INITIALIZED, 0);
-
-    if (!externalAllocator)
-        setDefaultAllocator();
+    PHYSFS_uint32 i;
 
-    if (allocator.Init != NULL)
-        BAIL_IF_MACRO(!allocator.Init(), NULL, 0);
+    if ((sp == NULL) || (--sp->refcount > 0))
+        return;
 
-    BAIL_IF_MACRO(!__PHYSFS_platformInit(), NULL, 0);
+    for (i = 0; i < sp->count; i++)
+    {
+        DirHandle *dh = sp->handles[i];
+        if ((--dh->refcount == 0) && (dh->removed))
+            closeDirHandle(dh);  /* last one out turns off the lights. */
+    } /* for */
 
-    BAIL_IF_MACRO(!initializeMutexes(), NULL, 0);
+    allocator.Free(sp);
+} /* releaseSearchPath */
 
-    baseDir = calculateBaseDir(argv0);
-    BAIL_IF_MACRO(baseDir == NULL, NULL, 0);
 
-    /* !!! FIXME: only call this if we got this from argv0 (unreliable). */
-    ptr = __PHYSFS_platformRealPath(baseDir);
-    allocator.Free(baseDir);
-    BAIL_IF_MACRO(ptr == NULL, NULL, 0);
-    baseDir = ptr;
+/*
+ * Replace the current snapshot with a fresh copy of the search path. Threads
+ *  still walking the old one keep it (and any DirHandles removed since) alive
+ *  until they are done with it.
+ *
+ * MAKE SURE you've got the stateLock held before calling this!
+ */
+static int publishSearchPath(void)
+{
+    SearchPath *sp = NULL;
+    PHYSFS_uint32 count = 0;
+    DirHandle *i;
 
-    BAIL_IF_MACRO(!appendDirSep(&baseDir), NULL, 0);
+    for (i = searchPath; i != NULL; i = i->next)
+        count++;
 
-    userDir = calculateUserDir();
-    if ((userDir == NULL) || (!appendDirSep(&userDir)))
+    if (count > 0)
     {
-        allocator.Free(baseDir);
-        baseDir = NULL;
-        return(0);
+        const size_t len = sizeof (SearchPath) + (sizeof (DirHandle *) * count);
+        sp = (SearchPath *) allocator.Malloc(len);
+        BAIL_IF_MACRO(sp == NULL, ERR_OUT_OF_MEMORY, 0);
+        sp->refcount = 1;
+        sp->count = 0;
+        for (i = searchPath; i != NULL; i = i->next)
+        {
+            i->refcount++;
+            sp->handles[sp->count++] = i;
+        } /* for */
     } /* if */
 
-    initialized = 1;
+    releaseSearchPath(searchPathSnapshot);
+    searchPathSnapshot = sp;
+    return(1);
+} /* publishSearchPath */
 
-    /* This makes sure that the error subsystem is initialized. */
-    __PHYSFS_setError(PHYSFS_getLastError());
 
-    return(1);
-} /* PHYSFS_init */
+/*
+ * The search path index maps every virtual path that lives in an archive to
+ *  the first archive in the search path that has it, so a lookup doesn't
+ *  have to ask every mounted archive in turn. Real directories are never
+ *  indexed (their contents can change behind our backs), so they are still
+ *  probed on every lookup.
+ *
+ * Paths are hashed and compared with low-ASCII case folded, since some
+ *  archivers (HOG, MVL, QPAK) match filenames case-insensitively. That makes
+ *  the index conservative: a miss means no archive can have the file, but a
+ *  hit is only a hint, and the archiver itself still gets the final word.
+ */
+typedef struct __PHYSFS_PATHINDEXENTRY__
+{
+    PHYSFS_uint32 hash;
+    DirHandle *dirHandle;  /* first archive in the search path with path. */
+    struct __PHYSFS_PATHINDEXENTRY__ *next;
+    char path[1];  /* actually allocated to fit the whole string. */
+} PathIndexEntry;
 
+typedef struct
+{
+    int active;  /* non-zero if the index can answer this lookup. */
+    int pastHit;  /* non-zero once we've walked past (hit). */
+    const DirHandle *hit;  /* first archive that might have it, or NULL. */
+} PathIndexProbe;
 
-/* MAKE SURE you hold stateLock before calling this! */
-static int closeFileHandleList(FileHandle **list)
+typedef struct
 {
-    FileHandle *i;
-    FileHandle *next = NULL;
+    DirHandle *dirHandle;
+    const char *arcdir;  /* dir being enumerated, relative to the archive. */
+    int replace;
+    int failed;
+} PathIndexBuildData;
 
-    for (i = *list; i != NULL; i = next)
+static PathIndexEntry **pathIndex = NULL;
+static PHYSFS_uint32 pathIndexBuckets = 0;
+static PHYSFS_uint32 pathIndexCount = 0;
+
+
+static int isIndexableDirHandle(const DirHandle *h)
+{
+    return(h->funcs != &__PHYSFS_Archiver_DIR);
+} /* isIndexableDirHandle */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void freePathIndex(void)
+{
+    PHYSFS_uint32 i;
+
+    for (i = 0; i < pathIndexBuckets; i++)
     {
-        next = i->next;
-        if (!i->funcs->fileClose(i->opaque))
+        PathIndexEntry *entry;
+        PathIndexEntry *next;
+        for (entry = pathIndex[i]; entry != NULL; entry = next)
         {
-            *list = i;
-            return(0);
-        } /* if */
-
-        allocator.Free(i);
+            next = entry->next;
+            allocator.Free(entry);
+        } /* for */
     } /* for */
 
-    *list = NULL;
-    return(1);
-} /* closeFileHandleList */
+    allocator.Free(pathIndex);
+    pathIndex = NULL;
+    pathIndexBuckets = pathIndexCount = 0;
+} /* freePathIndex */
 
 
-/* MAKE SURE you hold the stateLock before calling this! */
-static void freeSearchPath(void)
+static int growPathIndex(void)
 {
-    DirHandle *i;
-    DirHandle *next = NULL;
+    const PHYSFS_uint32 newbuckets = (pathIndexBuckets) ?
+                                        pathIndexBuckets * 2 : 256;
+    const size_t len = sizeof (PathIndexEntry *) * newbuckets;
+    PathIndexEntry **newindex = (PathIndexEntry **) allocator.Malloc(len);
+    PHYSFS_uint32 i;
 
-    closeFileHandleList(&openReadList);
+    BAIL_IF_MACRO(newindex == NULL, ERR_OUT_OF_MEMORY, 0);
+    memset(newindex, '\0', len);
 
-    if (searchPath != NULL)
+    for (i = 0; i < pathIndexBuckets; i++)
     {
-        for (i = searchPath; i != NULL; i = next)
+        PathIndexEntry *entry;
+        PathIndexEntry *next;
+        for (entry = pathIndex[i]; entry != NULL; entry = next)
         {
-            next = i->next;
-            freeDirHandle(i, openReadList);
+            const PHYSFS_uint32 bucket = entry->hash & (newbuckets - 1);
+            next = entry->next;
+            entry->next = newindex[bucket];
+            newindex[bucket] = entry;
         } /* for */
-        searchPath = NULL;
-    } /* if */
-} /* freeSearchPath */
+    } /* for */
+
+    allocator.Free(pathIndex);
+    pathIndex = newindex;
+    pathIndexBuckets = newbuckets;
+    return(1);
+} /* growPathIndex */
 
 
-int PHYSFS_deinit(void)
+static PathIndexEntry *findPathIndexEntry(const char *path,
+                                          PHYSFS_uint32 hash)
 {
-    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
-    BAIL_IF_MACRO(!__PHYSFS_platformDeinit(), NULL, 0);
+    PathIndexEntry *entry = pathIndex[hash & (pathIndexBuckets - 1)];
+    for (; entry != NULL; entry = entry->next)
+    {
+        if ((entry->hash == hash) &&
+            (__PHYSFS_stricmpASCII(entry->path, path) == 0))
+            return(entry);
+    } /* for */
 
-    closeFileHandleList(&openWriteList);
-    BAIL_IF_MACRO(!PHYSFS_setWriteDir(NULL), ERR_FILES_STILL_OPEN, 0);
+    return(NULL);
+} /* findPathIndexEntry */
 
-    freeSearchPath();
-    freeErrorMessages();
 
-    if (baseDir != NULL)
+/*
+ * Add (path) to the index as belonging to (dh). If (replace) is zero, an
+ *  existing entry (from an archive earlier in the search path) is left alone.
+ */
+static int addToPathIndex(const char *path, DirHandle *dh, int replace)
+{
+    const PHYSFS_uint32 hash = hashVirtualPath(path);
+    PathIndexEntry *entry = findPathIndexEntry(path, hash);
+    PHYSFS_uint32 bucket;
+
+    if (entry != NULL)
     {
-        allocator.Free(baseDir);
-        baseDir = NULL;
+        if (replace)
+            entry->dirHandle = dh;
+        return(1);
     } /* if */
 
-    if (userDir != NULL)
+    if (pathIndexCount >= pathIndexBuckets)  /* keep chains short. */
+        BAIL_IF_MACRO(!growPathIndex(), NULL, 0);
+
+    entry = (PathIndexEntry *) allocator.Malloc(sizeof (PathIndexEntry) +
+                                                 strlen(path));
+    BAIL_IF_MACRO(entry == NULL, ERR_OUT_OF_MEMORY, 0);
+    strcpy(entry->path, path);
+    entry->hash = hash;
+    entry->dirHandle = dh;
+    bucket = hash & (pathIndexBuckets - 1);
+    entry->next = pathIndex[bucket];
+    pathIndex[bucket] = entry;
+    pathIndexCount++;
+    return(1);
+} /* addToPathIndex */
+
+
+static void pathIndexEnumCallback(void *data, const char *origdir,
+                                  const char *str)
+{
+    PathIndexBuildData *pibd = (PathIndexBuildData *) data;
+    DirHandle *dh = pibd->dirHandle;
+    const char *mntpnt = (dh->mountPoint != NULL) ? dh->mountPoint : "";
+    const size_t mntlen = strlen(mntpnt);
+    const size_t dirlen = strlen(pibd->arcdir);
+    char *virtpath;
+    char *arcpath;
+    int isLink;
+    int exists;
+
+    if (pibd->failed)
+        return;
+
+    virtpath = (char *) allocator.Malloc(mntlen + dirlen + strlen(str) + 2);
+    if (virtpath == NULL)
     {
-        allocator.Free(userDir);
-        userDir = NULL;
+        pibd->failed = 1;
+        return;
     } /* if */
 
-    allowSymLinks = 0;
-    initialized = 0;
+    strcpy(virtpath, mntpnt);
+    arcpath = virtpath + mntlen;
+    strcpy(arcpath, pibd->arcdir);
+    if (dirlen > 0)
+        strcat(arcpath, "/");
+    strcat(arcpath, str);
 
-    __PHYSFS_platformDestroyMutex(errorLock);
-    __PHYSFS_platformDestroyMutex(stateLock);
+    if (!addToPathIndex(virtpath, dh, pibd->replace))
+        pibd->failed = 1;
 
-    if (allocator.Deinit != NULL)
-        allocator.Deinit();
+    /* recurse into subdirs, but never through a symlink. */
+    else
+    {
+        isLink = dh->funcs->isSymLink(dh->opaque, arcpath, &exists);
+        if ((!isLink) && (dh->funcs->isDirectory(dh->opaque, arcpath, &exists)))
+        {
+            PathIndexBuildData subdir;
+            memcpy(&subdir, pibd, sizeof (subdir));
+            subdir.arcdir = arcpath;
+            dh->funcs->enumerateFiles(dh->opaque, arcpath, 0,
+                                      pathIndexEnumCallback, NULL, &subdir);
+            pibd->failed = subdir.failed;
+        } /* if */
+    } /* else */
 
-    errorLock = stateLock = NULL;
-    return(1);
-} /* PHYSFS_deinit */
+    allocator.Free(virtpath);
+} /* pathIndexEnumCallback */
 
 
-int PHYSFS_isInit(void)
+/* MAKE SURE you hold the stateLock before calling this! */
+static int addDirHandleToPathIndex(DirHandle *dh, int replace)
 {
-    return(initialized);
-} /* PHYSFS_isInit */
+    PathIndexBuildData pibd;
 
+    if (!isIndexableDirHandle(dh))
+        return(1);
 
-const PHYSFS_ArchiveInfo **PHYSFS_supportedArchiveTypes(void)
-{
-    return(supported_types);
-} /* PHYSFS_supportedArchiveTypes */
+    /* the mountpoint itself is a lookup this archive gets to answer, too. */
+    if (dh->mountPoint != NULL)
+    {
+        const size_t len = strlen(dh->mountPoint);
+        char *mntpnt = (char *) __PHYSFS_smallAlloc(len);
+        int rc;
+        BAIL_IF_MACRO(mntpnt == NULL, ERR_OUT_OF_MEMORY, 0);
+        memcpy(mntpnt, dh->mountPoint, len - 1);  /* chop the trailing '/'. */
+        mntpnt[len - 1] = '\0';
+        rc = addToPathIndex(mntpnt, dh, replace);
+        __PHYSFS_smallFree(mntpnt);
+        BAIL_IF_MACRO(!rc, NULL, 0);
+    } /* if */
+
+    memset(&pibd, '\0', sizeof (pibd));
+    pibd.dirHandle = dh;
+    pibd.arcdir = "";
+    pibd.replace = replace;
+    dh->funcs->enumerateFiles(dh->opaque, "", 0, pathIndexEnumCallback,
+                              NULL, &pibd);
+    BAIL_IF_MACRO(pibd.failed, ERR_OUT_OF_MEMORY, 0);
+    return(1);
+} /* addDirHandleToPathIndex */
 
 
-void PHYSFS_freeList(void *list)
+/*
+ * (Re)build the whole index from the current search path. If this fails,
+ *  the index is thrown away and lookups quietly go back to walking the
+ *  search path, since a partial index would report false misses.
+ *
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static void rebuildPathIndex(void)
 {
-    void **i;
-    for (i = (void **) list; *i != NULL; i++)
-        allocator.Free(*i);
+    DirHandle *i;
 
-    allocator.Free(list);
-} /* PHYSFS_freeList */
+    freePathIndex();
+    if (!searchPathIndexEnabled)
+        return;
 
+    if (!growPathIndex())
+        return;
 
-const char *PHYSFS_getDirSeparator(void)
-{
-    return(__PHYSFS_platformDirSeparator);
-} /* PHYSFS_getDirSeparator */
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (!addDirHandleToPathIndex(i, 0))
+        {
+            freePathIndex();
+            return;
+        } /* if */
+    } /* for */
+} /* rebuildPathIndex */
 
 
-char **PHYSFS_getCdRomDirs(void)
+/* MAKE SURE you hold the stateLock before calling this! */
+static void updatePathIndexForMount(DirHandle *dh, int appended)
 {
-    return(doEnumStringList(__PHYSFS_platformDetectAvailableCDs));
-} /* PHYSFS_getCdRomDirs */
+    if (!searchPathIndexEnabled)
+        return;
+    else if (pathIndex == NULL)  /* a previous build failed; try again. */
+        rebuildPathIndex();
+    else if (!addDirHandleToPathIndex(dh, !appended))
+        freePathIndex();
+} /* updatePathIndexForMount */
 
 
-void PHYSFS_getCdRomDirsCallback(PHYSFS_StringCallback callback, void *data)
+/*
+ * Prepare to walk the search path for (fname), which must be an output from
+ *  sanitizePlatformIndependentPath().
+ *
+ * MAKE SURE you hold the stateLock before calling this!
+ */
+static void probePathIndex(PathIndexProbe *probe, const char *fname)
 {
-    __PHYSFS_platformDetectAvailableCDs(callback, data);
-} /* PHYSFS_getCdRomDirsCallback */
+    probe->active = ((pathIndex != NULL) && (*fname != '\0'));
+    probe->pastHit = 0;
+    probe->hit = NULL;
 
+    if (probe->active)
+    {
+        const PathIndexEntry *entry;
+        entry = findPathIndexEntry(fname, hashVirtualPath(fname));
+        if (entry != NULL)
+            probe->hit = entry->dirHandle;
+    } /* if */
+} /* probePathIndex */
 
-const char *PHYSFS_getBaseDir(void)
+
+/*
+ * Returns non-zero if the index proves that (h) can't have the file, so
+ *  the caller doesn't have to ask the archiver. Call this for each DirHandle
+ *  in search path order.
+ */
+static int pathIndexSkips(PathIndexProbe *probe, const DirHandle *h)
 {
-    return(baseDir);   /* this is calculated in PHYSFS_init()... */
-} /* PHYSFS_getBaseDir */
+    if ((!probe->active) || (probe->pastHit) || (!isIndexableDirHandle(h)))
+        return(0);
 
+    if (h == probe->hit)
+    {
+        /* if this archive disappoints us, check everything after it. */
+        probe->pastHit = 1;
+        return(0);
+    } /* if */
 
-const char *PHYSFS_getUserDir(void)
-{
-    return(userDir);   /* this is calculated in PHYSFS_init()... */
-} /* PHYSFS_getUserDir */
+    return(1);
+} /* pathIndexSkips */
 
 
-const char *PHYSFS_getWriteDir(void)
+/*
+ * Get a reference to the current search path snapshot, and if (probe) isn't
+ *  NULL, consult the search path index for (fname) while we're at it, so the
+ *  two are guaranteed to agree. Returns NULL if the search path is empty.
+ *  Pass the return value to ungrabSearchPath() when done with it.
+ */
+static SearchPath *grabSearchPath(PathIndexProbe *probe, const char *fname)
 {
-    const char *retval = NULL;
+    SearchPath *retval;
 
     __PHYSFS_platformGrabMutex(stateLock);
-    if (writeDir != NULL)
-        retval = writeDir->dirName;
+    retval = searchPathSnapshot;
+    if (retval != NULL)
+        retval->refcount++;
+    if (probe != NULL)
+        probePathIndex(probe, fname);
     __PHYSFS_platformReleaseMutex(stateLock);
 
     return(retval);
-} /* PHYSFS_getWriteDir */
+} /* grabSearchPath */
 
 
-int PHYSFS_setWriteDir(const char *newDir)
+static void ungrabSearchPath(SearchPath *sp)
 {
-    int retval = 1;
-
-    __PHYSFS_platformGrabMutex(stateLock);
-
-    if (writeDir != NULL)
+    if (sp != NULL)
     {
-        BAIL_IF_MACRO_MUTEX(!freeDirHandle(writeDir, openWriteList), NULL,
-                            stateLock, 0);
-        writeDir = NULL;
+        __PHYSFS_platformGrabMutex(stateLock);
+        releaseSearchPath(sp);
+        __PHYSFS_platformReleaseMutex(stateLock);
     } /* if */
+} /* ungrabSearchPath */
 
-    if (newDir != NULL)
-    {
-        writeDir = createDirHandle(newDir, NULL, 1);
-        retval = (writeDir != NULL);
-    } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+static PHYSFS_uint32 searchPathLength(const SearchPath *sp)
+{
+    return((sp != NULL) ? sp->count : 0);
+} /* searchPathLength */
 
-    return(retval);
-} /* PHYSFS_setWriteDir */
 
+/*
+ * The negative lookup cache remembers paths that weren't found anywhere in
+ *  the search path, so probing for the same missing file again (a common
+ *  pattern for optional overrides) doesn't walk every mount each time.
+ *
+ * It's a fixed-size, direct-mapped table; a new miss simply evicts whatever
+ *  was in its slot. Anything that could make a missing file appear (mounting,
+ *  unmounting, writing, changing the write dir, etc) bumps the generation
+ *  counter, which invalidates every entry at once.
+ */
 
-int PHYSFS_mount(const char *newDir, const char *mountPoint, int appendToPath)
+/* MAKE SURE you hold the stateLock before calling this! */
+static void invalidateNegativeCache(void)
 {
-    DirHandle *dh;
-    DirHandle *prev = NULL;
-    DirHandle *i;
+    negativeCacheGeneration++;
+} /* invalidateNegativeCache */
 
-    BAIL_IF_MACRO(newDir == NULL, ERR_INVALID_ARGUMENT, 0);
 
-    if (mountPoint == NULL)
-        mountPoint = "/";
+/* MAKE SURE you hold the stateLock before calling this! */
+static void freeNegativeCache(void)
+{
+    PHYSFS_uint32 i;
+    for (i = 0; i < negativeCacheSize; i++)
+        allocator.Free(negativeCache[i].path);
+    allocator.Free(negativeCache);
+    negativeCache = NULL;
+    negativeCacheSize = 0;
+} /* freeNegativeCache */
 
-    __PHYSFS_platformGrabMutex(stateLock);
 
-    for (i = searchPath; i != NULL; i = i->next)
-    {
-        /* already in search path? */
-        BAIL_IF_MACRO_MUTEX(strcmp(newDir, i->dirName)==0, NULL, stateLock, 1);
-        prev = i;
-    } /* for */
+/*
+ * Returns non-zero if (fname) is known not to exist. Otherwise, (*gen) is
+ *  set to the generation to pass to addNegativeCache() after searching.
+ *  (fname) must be an output from sanitizePlatformIndependentPath().
+ */
+static int checkNegativeCache(const char *fname, PHYSFS_uint32 *gen)
+{
+    int retval = 0;
 
-    dh = createDirHandle(newDir, mountPoint, 0);
-    BAIL_IF_MACRO_MUTEX(dh == NULL, NULL, stateLock, 0);
-
-    if (appendToPath)
+    __PHYSFS_platformGrabMutex(stateLock);
+    *gen = negativeCacheGeneration;
+    if (negativeCache != NULL)
     {
-        if (prev == NULL)
-            searchPath = dh;
+        const PHYSFS_uint32 hash = hashVirtualPath(fname);
+        const NegativeCacheEntry *entry;
+        entry = &negativeCache[hash % negativeCacheSize];
+        retval = ( (entry->path != NULL) && (entry->hash == hash) &&
+                   (entry->generation == negativeCacheGeneration) &&
+                   (strcmp(entry->path, fname) == 0) );
+        if (retval)
+            negativeCacheHits++;
         else
-            prev->next = dh;
+            negativeCacheMisses++;
     } /* if */
-    else
-    {
-        dh->next = searchPath;
-        searchPath = dh;
-    } /* else */
-
     __PHYSFS_platformReleaseMutex(stateLock);
-    return(1);
-} /* PHYSFS_mount */
 
-
-int PHYSFS_addToSearchPath(const char *newDir, int appendToPath)
-{
-    return(PHYSFS_mount(newDir, NULL, appendToPath));
-} /* PHYSFS_addToSearchPath */
+    return(retval);
+} /* checkNegativeCache */
 
 
-int PHYSFS_removeFromSearchPath(const char *oldDir)
+/*
+ * Remember that (fname) wasn't found. If anything was invalidated since
+ *  (gen) came from checkNegativeCache(), the search might have been looking
+ *  at an outdated search path, so we don't cache it.
+ */
+static void addNegativeCache(const char *fname, PHYSFS_uint32 gen)
 {
-    DirHandle *i;
-    DirHandle *prev = NULL;
-    DirHandle *next = NULL;
-
-    BAIL_IF_MACRO(oldDir == NULL, ERR_INVALID_ARGUMENT, 0);
-
     __PHYSFS_platformGrabMutex(stateLock);
-    for (i = searchPath; i != NULL; i = i->next)
+    if ((negativeCache != NULL) && (gen == negativeCacheGeneration))
     {
-        if (strcmp(i->dirName, oldDir) == 0)
+        const PHYSFS_uint32 hash = hashVirtualPath(fname);
+        NegativeCacheEntry *entry = &negativeCache[hash % negativeCacheSize];
+        const size_t len = strlen(fname) + 1;
+        char *ptr = (char *) allocator.Realloc(entry->path, len);
+        if (ptr != NULL)  /* if out of memory, just don't cache it. */
         {
-            next = i->next;
-            BAIL_IF_MACRO_MUTEX(!freeDirHandle(i, openReadList), NULL,
-                                stateLock, 0);
-
-            if (prev == NULL)
-                searchPath = next;
-            else
-                prev->next = next;
-
-            BAIL_MACRO_MUTEX(NULL, stateLock, 1);
+            memcpy(ptr, fname, len);
+            entry->path = ptr;
+            entry->hash = hash;
+            entry->generation = gen;
         } /* if */
-        prev = i;
-    } /* for */
-
-    BAIL_MACRO_MUTEX(ERR_NOT_IN_SEARCH_PATH, stateLock, 0);
-} /* PHYSFS_removeFromSearchPath */
+    } /* if */
+    __PHYSFS_platformReleaseMutex(stateLock);
+} /* addNegativeCache */
 
 
-char **PHYSFS_getSearchPath(void)
+static char *calculateUserDir(void)
 {
-    return(doEnumStringList(PHYSFS_getSearchPathCallback));
-} /* PHYSFS_getSearchPath */
-
+    char *retval = __PHYSFS_platformGetUserDir();
+    if (retval != NULL)
+    {
+        /* make sure it really exists and is normalized. */
+        char *ptr = __PHYSFS_platformRealPath(retval);
+        allocator.Free(retval);
+        retval = ptr;
+    } /* if */
 
-const char *PHYSFS_getMountPoint(const char *dir)
-{
-    DirHandle *i;
-    __PHYSFS_platformGrabMutex(stateLock);
-    for (i = searchPath; i != NULL; i = i->next)
+    if (retval == NULL)
     {
-        if (strcmp(i->dirName, dir) == 0)
-        {
-            const char *retval = ((i->mountPoint) ? i->mountPoint : "/");
-            __PHYSFS_platformReleaseMutex(stateLock);
-            return(retval);
-        } /* if */
-    } /* for */
-    __PHYSFS_platformReleaseMutex(stateLock);
+        const char *dirsep = PHYSFS_getDirSeparator();
+        const char *uname = __PHYSFS_platformGetUserName();
+        const char *str = (uname != NULL) ? uname : "default";
 
-    BAIL_MACRO(ERR_NOT_IN_SEARCH_PATH, NULL);
-} /* PHYSFS_getMountPoint */
+        retval = (char *) allocator.Malloc(strlen(baseDir) + strlen(str) +
+                                           strlen(dirsep) + 6);
 
+        if (retval == NULL)
+            __PHYSFS_setError(ERR_OUT_OF_MEMORY);
+        else
+            sprintf(retval, "%susers%s%s", baseDir, dirsep, str);
 
-void PHYSFS_getSearchPathCallback(PHYSFS_StringCallback callback, void *data)
-{
-    DirHandle *i;
+        allocator.Free((void *) uname);
+    } /* else */
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    return(retval);
+} /* calculateUserDir */
 
-    for (i = searchPath; i != NULL; i = i->next)
-        callback(data, i->dirName);
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-} /* PHYSFS_getSearchPathCallback */
+static int appendDirSep(char **dir)
+{
+    const char *dirsep = PHYSFS_getDirSeparator();
+    char *ptr;
 
+    if (strcmp((*dir + strlen(*dir)) - strlen(dirsep), dirsep) == 0)
+        return(1);
 
-/* Split out to avoid stack allocation in a loop. */
-static void setSaneCfgAddPath(const char *i, const size_t l, const char *dirsep,
-                              int archivesFirst)
-{
-    const char *d = PHYSFS_getRealDir(i);
-    const size_t allocsize = strlen(d) + strlen(dirsep) + l + 1;
-    char *str = (char *) __PHYSFS_smallAlloc(allocsize);
-    if (str != NULL)
+    ptr = (char *) allocator.Realloc(*dir, strlen(*dir) + strlen(dirsep) + 1);
+    if (!ptr)
     {
-        sprintf(str, "%s%s%s", d, dirsep, i);
-        PHYSFS_addToSearchPath(str, archivesFirst == 0);
-        __PHYSFS_smallFree(str);
+        allocator.Free(*dir);
+        return(0);
     } /* if */
-} /* setSaneCfgAddPath */
-
 
-int PHYSFS_setSaneConfig(const char *organization, const char *appName,
-                         const char *archiveExt, int includeCdRoms,
-                         int archivesFirst)
-{
-    const char *basedir = PHYSFS_getBaseDir();
-    const char *userdir = PHYSFS_getUserDir();
-    const char *dirsep = PHYSFS_getDirSeparator();
-    PHYSFS_uint64 len = 0;
-    char *str = NULL;
+    strcat(ptr, dirsep);
+    *dir = ptr;
+    return(1);
+} /* appendDirSep */
 
-    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
 
-    /* set write dir... */
-    len = (strlen(userdir) + (strlen(organization) * 2) +
-            (strlen(appName) * 2) + (strlen(dirsep) * 3) + 2);
+static char *calculateBaseDir(const char *argv0)
+{
+    char *retval = NULL;
+    const char *dirsep = NULL;
+    char *ptr = NULL;
 
-    str = (char *) __PHYSFS_smallAlloc(len);
+    /* Give the platform layer first shot at this. */
+    retval = __PHYSFS_platformCalcBaseDir(argv0);
+    if (retval != NULL)
+        return(retval);
 
-    BAIL_IF_MACRO(str == NULL, ERR_OUT_OF_MEMORY, 0);
-    sprintf(str, "%s.%s%s%s", userdir, organization, dirsep, appName);
+    /* We need argv0 to go on. */
+    BAIL_IF_MACRO(argv0 == NULL, ERR_ARGV0_IS_NULL, NULL);
 
-    if (!PHYSFS_setWriteDir(str))
+    dirsep = PHYSFS_getDirSeparator();
+    if (strlen(dirsep) == 1)  /* fast path. */
+        ptr = strrchr(argv0, *dirsep);
+    else
     {
-        int no_write = 0;
-        sprintf(str, ".%s/%s", organization, appName);
-        if ( (PHYSFS_setWriteDir(userdir)) &&
-             (PHYSFS_mkdir(str)) )
+        ptr = strstr(argv0, dirsep);
+        if (ptr != NULL)
         {
-            sprintf(str, "%s.%s%s%s", userdir, organization, dirsep, appName);
-            if (!PHYSFS_setWriteDir(str))
-                no_write = 1;
+            char *p = ptr;
+            while (p != NULL)
+            {
+                ptr = p;
+                p = strstr(p + 1, dirsep);
+            } /* while */
         } /* if */
-        else
-        {
-            no_write = 1;
-        } /* else */
+    } /* else */
 
-        if (no_write)
-        {
-            PHYSFS_setWriteDir(NULL);   /* just in case. */
-            __PHYSFS_smallFree(str);
-            BAIL_MACRO(ERR_CANT_SET_WRITE_DIR, 0);
-        } /* if */
+    if (ptr != NULL)
+    {
+        size_t size = (size_t) (ptr - argv0);
+        retval = (char *) allocator.Malloc(size + 1);
+        BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
+        memcpy(retval, argv0, size);
+        retval[size] = '\0';
+        return(retval);
     } /* if */
 
-    /* Put write dir first in search path... */
-    PHYSFS_addToSearchPath(str, 0);
-    __PHYSFS_smallFree(str);
+    /* argv0 wasn't helpful. */
+    BAIL_MACRO(ERR_INVALID_ARGUMENT, NULL);
+    return(NULL);
+} /* calculateBaseDir */
 
-        /* Put base path on search path... */
-    PHYSFS_addToSearchPath(basedir, 1);
 
-        /* handle CD-ROMs... */
-    if (includeCdRoms)
-    {
-        char **cds = PHYSFS_getCdRomDirs();
-        char **i;
-        for (i = cds; *i != NULL; i++)
-            PHYSFS_addToSearchPath(*i, 1);
+static int initializeMutexes(void)
+{
+    errorLock = __PHYSFS_platformCreateMutex();
+    if (errorLock == NULL)
+        goto initializeMutexes_failed;
 
-        PHYSFS_freeList(cds);
-    } /* if */
+    stateLock = __PHYSFS_platformCreateMutex();
+    if (stateLock == NULL)
+        goto initializeMutexes_failed;
 
-        /* Root out archives, and add them to search path... */
-    if (archiveExt != NULL)
-    {
-        char **rc = PHYSFS_enumerateFiles("/");
-        char **i;
-        size_t extlen = strlen(archiveExt);
-        char *ext;
+    asyncLock = __PHYSFS_platformCreateMutex();
+    if (asyncLock == NULL)
+        goto initializeMutexes_failed;
 
-        for (i = rc; *i != NULL; i++)
-        {
-            size_t l = strlen(*i);
-            if ((l > extlen) && ((*i)[l - extlen - 1] == '.'))
-            {
-                ext = (*i) + (l - extlen);
-                if (__PHYSFS_stricmpASCII(ext, archiveExt) == 0)
-                    setSaneCfgAddPath(*i, l, dirsep, archivesFirst);
-            } /* if */
-        } /* for */
+    return(1);  /* success. */
 
-        PHYSFS_freeList(rc);
-    } /* if */
+initializeMutexes_failed:
+    if (errorLock != NULL)
+        __PHYSFS_platformDestroyMutex(errorLock);
 
-    return(1);
-} /* PHYSFS_setSaneConfig */
+    if (stateLock != NULL)
+        __PHYSFS_platformDestroyMutex(stateLock);
 
+    if (asyncLock != NULL)
+        __PHYSFS_platformDestroyMutex(asyncLock);
 
-void PHYSFS_permitSymbolicLinks(int allow)
-{
-    allowSymLinks = allow;
-} /* PHYSFS_permitSymbolicLinks */
+    errorLock = stateLock = asyncLock = NULL;
+    return(0);  /* failed. */
+} /* initializeMutexes */
 
 
-int PHYSFS_symbolicLinksPermitted(void)
+static void setDefaultAllocator(void);
+
+int PHYSFS_init(const char *argv0)
 {
-    return(allowSymLinks);
-} /* PHYSFS_symbolicLinksPermitted */
+    char *ptr;
 
+    BAIL_IF_MACRO(initialized, ERR_IS_INITIALIZED, 0);
 
-/* string manipulation in C makes my ass itch. */
-char *__PHYSFS_convertToDependent(const char *prepend,
+    if (!externalAllocator)
+        setDefaultAllocator();
+
+    if (allocator.Init != NULL)
+        BAIL_IF_MACRO(!allocator.Init(), NULL, 0);
+
+    BAIL_IF_MACRO(!__PHYSFS_platformInit(), NULL, 0);
+
+    BAIL_IF_MACRO(!initializeMutexes(), NULL, 0);
+
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    BAIL_IF_MACRO(!__PHYSFS_zipInit(), NULL, 0);
+#endif
+#if (defined PHYSFS_SUPPORTS_7Z)
+    BAIL_IF_MACRO(!__PHYSFS_lzmaInit(), NULL, 0);
+#endif
+
+    baseDir = calculateBaseDir(argv0);
+    BAIL_IF_MACRO(baseDir == NULL, NULL, 0);
+
+    /* !!! FIXME: only call this if we got this from argv0 (unreliable). */
+    ptr = __PHYSFS_platformRealPath(baseDir);
+    allocator.Free(baseDir);
+    BAIL_IF_MACRO(ptr == NULL, NULL, 0);
+    baseDir = ptr;
+
+    BAIL_IF_MACRO(!appendDirSep(&baseDir), NULL, 0);
+
+    userDir = calculateUserDir();
+    if ((userDir == NULL) || (!appendDirSep(&userDir)))
+    {
+        allocator.Free(baseDir);
+        baseDir = NULL;
+        return(0);
+    } /* if */
+
+    initialized = 1;
+
+    /* This makes sure that the error subsystem is initialized. */
+    __PHYSFS_setError(PHYSFS_getLastError());
+
+    return(1);
+} /* PHYSFS_init */
+
+
+/* MAKE SURE you hold stateLock before calling this! */
+static int closeFileHandleList(FileHandle **list)
+{
+    FileHandle *i;
+    FileHandle *next = NULL;
+
+    for (i = *list; i != NULL; i = next)
+    {
+        next = i->next;
+        if (!i->funcs->fileClose(i->opaque))
+        {
+            *list = i;
+            return(0);
+        } /* if */
+
+        if (i->readAtLock != NULL)
+            __PHYSFS_platformDestroyMutex(i->readAtLock);
+        allocator.Free(i);
+    } /* for */
+
+    *list = NULL;
+    return(1);
+} /* closeFileHandleList */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void releaseMappedFile(MappedFile *mf)
+{
+    if (mf->opaque != NULL)
+    {
+        mf->funcs->fileClose(mf->opaque);
+        releaseSearchPath(mf->searchPath);
+    } /* if */
+    else if (mf->mapping != NULL)
+        __PHYSFS_platformUnmap(mf->mapping);
+    else
+        allocator.Free((void *) mf->data);
+    allocator.Free(mf);
+} /* releaseMappedFile */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void freeMappedFiles(void)
+{
+    MappedFile *i;
+    MappedFile *next;
+
+    for (i = mappedFiles; i != NULL; i = next)
+    {
+        next = i->next;
+        releaseMappedFile(i);
+    } /* for */
+
+    mappedFiles = NULL;
+} /* freeMappedFiles */
+
+
+/* MAKE SURE you hold the stateLock before calling this! */
+static void freeSearchPath(void)
+{
+    DirHandle *i;
+    DirHandle *next = NULL;
+
+    closeFileHandleList(&openReadList);
+
+    releaseSearchPath(searchPathSnapshot);
+    searchPathSnapshot = NULL;
+
+    if (searchPath != NULL)
+    {
+        for (i = searchPath; i != NULL; i = next)
+        {
+            next = i->next;
+            freeDirHandle(i, openReadList);
+        } /* for */
+        searchPath = NULL;
+    } /* if */
+
+    freePathIndex();
+} /* freeSearchPath */
+
+
+static void stopAsyncWorkers(void);
+
+int PHYSFS_deinit(void)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+    stopAsyncWorkers();  /* finishes queued work while files are still open. */
+    BAIL_IF_MACRO(!__PHYSFS_platformDeinit(), NULL, 0);
+
+    closeFileHandleList(&openWriteList);
+    BAIL_IF_MACRO(!PHYSFS_setWriteDir(NULL), ERR_FILES_STILL_OPEN, 0);
+
+    freeMappedFiles();
+    freeSearchPath();
+    freeNegativeCache();
+    freeErrorMessages();
+
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipDeinit();
+#endif
+#if (defined PHYSFS_SUPPORTS_7Z)
+    __PHYSFS_lzmaDeinit();
+#endif
+
+    if (baseDir != NULL)
+    {
+        allocator.Free(baseDir);
+        baseDir = NULL;
+    } /* if */
+
+    if (userDir != NULL)
+    {
+        allocator.Free(userDir);
+        userDir = NULL;
+    } /* if */
+
+    allowSymLinks = 0;
+    searchPathIndexEnabled = 0;
+    negativeCacheHits = negativeCacheMisses = 0;
+    initialized = 0;
+
+    if (asyncWakeup != NULL)
+    {
+        __PHYSFS_platformDestroySemaphore(asyncWakeup);
+        asyncWakeup = NULL;
+    } /* if */
+    asyncThreadsWanted = 2;
+    memset(&asyncStats, '\0', sizeof (asyncStats));
+
+    __PHYSFS_platformDestroyMutex(errorLock);
+    __PHYSFS_platformDestroyMutex(stateLock);
+    __PHYSFS_platformDestroyMutex(asyncLock);
+
+    if (allocator.Deinit != NULL)
+        allocator.Deinit();
+
+    errorLock = stateLock = asyncLock = NULL;
+    return(1);
+} /* PHYSFS_deinit */
+
+
+int PHYSFS_isInit(void)
+{
+    return(initialized);
+} /* PHYSFS_isInit */
+
+
+const PHYSFS_ArchiveInfo **PHYSFS_supportedArchiveTypes(void)
+{
+    return(supported_types);
+} /* PHYSFS_supportedArchiveTypes */
+
+
+void PHYSFS_freeList(void *list)
+{
+    /* the strings live in the same allocation as the list itself. */
+    allocator.Free(list);
+} /* PHYSFS_freeList */
+
+
+const char *PHYSFS_getDirSeparator(void)
+{
+    return(__PHYSFS_platformDirSeparator);
+} /* PHYSFS_getDirSeparator */
+
+
+char **PHYSFS_getCdRomDirs(void)
+{
+    return(doEnumStringList(__PHYSFS_platformDetectAvailableCDs));
+} /* PHYSFS_getCdRomDirs */
+
+
+void PHYSFS_getCdRomDirsCallback(PHYSFS_StringCallback callback, void *data)
+{
+    __PHYSFS_platformDetectAvailableCDs(callback, data);
+} /* PHYSFS_getCdRomDirsCallback */
+
+
+const char *PHYSFS_getBaseDir(void)
+{
+    return(baseDir);   /* this is calculated in PHYSFS_init()... */
+} /* PHYSFS_getBaseDir */
+
+
+const char *PHYSFS_getUserDir(void)
+{
+    return(userDir);   /* this is calculated in PHYSFS_init()... */
+} /* PHYSFS_getUserDir */
+
+
+const char *PHYSFS_getWriteDir(void)
+{
+    const char *retval = NULL;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    if (writeDir != NULL)
+        retval = writeDir->dirName;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return(retval);
+} /* PHYSFS_getWriteDir */
+
+
+int PHYSFS_setWriteDir(const char *newDir)
+{
+    int retval = 1;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    invalidateNegativeCache();
+    invalidateVerifiedPrefixes();
+
+    if (writeDir != NULL)
+    {
+        BAIL_IF_MACRO_MUTEX(!freeDirHandle(writeDir, openWriteList), NULL,
+                            stateLock, 0);
+        writeDir = NULL;
+    } /* if */
+
+    if (newDir != NULL)
+    {
+        writeDir = createDirHandle(newDir, NULL, 1);
+        retval = (writeDir != NULL);
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return(retval);
+} /* PHYSFS_setWriteDir */
+
+
+int PHYSFS_mount(const char *newDir, const char *mountPoint, int appendToPath)
+{
+    DirHandle *dh;
+    DirHandle *prev = NULL;
+    DirHandle *i;
+
+    BAIL_IF_MACRO(newDir == NULL, ERR_INVALID_ARGUMENT, 0);
+
+    if (mountPoint == NULL)
+        mountPoint = "/";
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        /* already in search path? */
+        BAIL_IF_MACRO_MUTEX(strcmp(newDir, i->dirName)==0, NULL, stateLock, 1);
+        prev = i;
+    } /* for */
+
+    dh = createDirHandle(newDir, mountPoint, 0);
+    BAIL_IF_MACRO_MUTEX(dh == NULL, NULL, stateLock, 0);
+    invalidateNegativeCache();
+
+    if (appendToPath)
+    {
+        if (prev == NULL)
+            searchPath = dh;
+        else
+            prev->next = dh;
+    } /* if */
+    else
+    {
+        dh->next = searchPath;
+        searchPath = dh;
+    } /* else */
+
+    if (!publishSearchPath())
+    {
+        if (appendToPath)
+        {
+            if (prev == NULL)
+                searchPath = NULL;
+            else
+                prev->next = NULL;
+        } /* if */
+        else
+        {
+            searchPath = dh->next;
+        } /* else */
+
+        freeDirHandle(dh, NULL);
+        BAIL_MACRO_MUTEX(NULL, stateLock, 0);
+    } /* if */
+
+    updatePathIndexForMount(dh, appendToPath);
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return(1);
+} /* PHYSFS_mount */
+
+
+int PHYSFS_addToSearchPath(const char *newDir, int appendToPath)
+{
+    return(PHYSFS_mount(newDir, NULL, appendToPath));
+} /* PHYSFS_addToSearchPath */
+
+
+int PHYSFS_removeFromSearchPath(const char *oldDir)
+{
+    DirHandle *i;
+    DirHandle *prev = NULL;
+    FileHandle *fh;
+
+    BAIL_IF_MACRO(oldDir == NULL, ERR_INVALID_ARGUMENT, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, oldDir) == 0)
+        {
+            for (fh = openReadList; fh != NULL; fh = fh->next)
+            {
+                BAIL_IF_MACRO_MUTEX(fh->dirHandle == i, ERR_FILES_STILL_OPEN,
+                                    stateLock, 0);
+            } /* for */
+
+            if (prev == NULL)
+                searchPath = i->next;
+            else
+                prev->next = i->next;
+
+            /*
+             * Other threads might still be looking at this in an older
+             *  snapshot; it gets closed when the last of those is released.
+             */
+            i->removed = 1;
+            if (!publishSearchPath())
+            {
+                i->removed = 0;
+                if (prev == NULL)
+                    searchPath = i;
+                else
+                    prev->next = i;
+                BAIL_MACRO_MUTEX(NULL, stateLock, 0);
+            } /* if */
+
+            rebuildPathIndex();
+            invalidateNegativeCache();
+
+            BAIL_MACRO_MUTEX(NULL, stateLock, 1);
+        } /* if */
+        prev = i;
+    } /* for */
+
+    BAIL_MACRO_MUTEX(ERR_NOT_IN_SEARCH_PATH, stateLock, 0);
+} /* PHYSFS_removeFromSearchPath */
+
+
+char **PHYSFS_getSearchPath(void)
+{
+    return(doEnumStringList(PHYSFS_getSearchPathCallback));
+} /* PHYSFS_getSearchPath */
+
+
+const char *PHYSFS_getMountPoint(const char *dir)
+{
+    DirHandle *i;
+    __PHYSFS_platformGrabMutex(stateLock);
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, dir) == 0)
+        {
+            const char *retval = ((i->mountPoint) ? i->mountPoint : "/");
+            __PHYSFS_platformReleaseMutex(stateLock);
+            return(retval);
+        } /* if */
+    } /* for */
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    BAIL_MACRO(ERR_NOT_IN_SEARCH_PATH, NULL);
+} /* PHYSFS_getMountPoint */
+
+
+void PHYSFS_getSearchPathCallback(PHYSFS_StringCallback callback, void *data)
+{
+    SearchPath *sp = grabSearchPath(NULL, NULL);
+    PHYSFS_uint32 n;
+
+    for (n = 0; n < searchPathLength(sp); n++)
+        callback(data, sp->handles[n]->dirName);
+
+    ungrabSearchPath(sp);
+} /* PHYSFS_getSearchPathCallback */
+
+
+/* Split out to avoid stack allocation in a loop. */
+static void setSaneCfgAddPath(const char *i, const size_t l, const char *dirsep,
+                              int archivesFirst)
+{
+    const char *d = PHYSFS_getRealDir(i);
+    const size_t allocsize = strlen(d) + strlen(dirsep) + l + 1;
+    char *str = (char *) __PHYSFS_smallAlloc(allocsize);
+    if (str != NULL)
+    {
+        sprintf(str, "%s%s%s", d, dirsep, i);
+        PHYSFS_addToSearchPath(str, archivesFirst == 0);
+        __PHYSFS_smallFree(str);
+    } /* if */
+} /* setSaneCfgAddPath */
+
+
+int PHYSFS_setSaneConfig(const char *organization, const char *appName,
+                         const char *archiveExt, int includeCdRoms,
+                         int archivesFirst)
+{
+    const char *basedir = PHYSFS_getBaseDir();
+    const char *userdir = PHYSFS_getUserDir();
+    const char *dirsep = PHYSFS_getDirSeparator();
+    PHYSFS_uint64 len = 0;
+    char *str = NULL;
+
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+
+    /* set write dir... */
+    len = (strlen(userdir) + (strlen(organization) * 2) +
+            (strlen(appName) * 2) + (strlen(dirsep) * 3) + 2);
+
+    str = (char *) __PHYSFS_smallAlloc(len);
+
+    BAIL_IF_MACRO(str == NULL, ERR_OUT_OF_MEMORY, 0);
+    sprintf(str, "%s.%s%s%s", userdir, organization, dirsep, appName);
+
+    if (!PHYSFS_setWriteDir(str))
+    {
+        int no_write = 0;
+        sprintf(str, ".%s/%s", organization, appName);
+        if ( (PHYSFS_setWriteDir(userdir)) &&
+             (PHYSFS_mkdir(str)) )
+        {
+            sprintf(str, "%s.%s%s%s", userdir, organization, dirsep, appName);
+            if (!PHYSFS_setWriteDir(str))
+                no_write = 1;
+        } /* if */
+        else
+        {
+            no_write = 1;
+        } /* else */
+
+        if (no_write)
+        {
+            PHYSFS_setWriteDir(NULL);   /* just in case. */
+            __PHYSFS_smallFree(str);
+            BAIL_MACRO(ERR_CANT_SET_WRITE_DIR, 0);
+        } /* if */
+    } /* if */
+
+    /* Put write dir first in search path... */
+    PHYSFS_addToSearchPath(str, 0);
+    __PHYSFS_smallFree(str);
+
+        /* Put base path on search path... */
+    PHYSFS_addToSearchPath(basedir, 1);
+
+        /* handle CD-ROMs... */
+    if (includeCdRoms)
+    {
+        char **cds = PHYSFS_getCdRomDirs();
+        char **i;
+        for (i = cds; *i != NULL; i++)
+            PHYSFS_addToSearchPath(*i, 1);
+
+        PHYSFS_freeList(cds);
+    } /* if */
+
+        /* Root out archives, and add them to search path... */
+    if (archiveExt != NULL)
+    {
+        char **rc = PHYSFS_enumerateFiles("/");
+        char **i;
+        size_t extlen = strlen(archiveExt);
+        char *ext;
+
+        for (i = rc; *i != NULL; i++)
+        {
+            size_t l = strlen(*i);
+            if ((l > extlen) && ((*i)[l - extlen - 1] == '.'))
+            {
+                ext = (*i) + (l - extlen);
+                if (__PHYSFS_stricmpASCII(ext, archiveExt) == 0)
+                    setSaneCfgAddPath(*i, l, dirsep, archivesFirst);
+            } /* if */
+        } /* for */
+
+        PHYSFS_freeList(rc);
+    } /* if */
+
+    return(1);
+} /* PHYSFS_setSaneConfig */
+
+
+void PHYSFS_permitSymbolicLinks(int allow)
+{
+    allowSymLinks = allow;
+    if (initialized)
+    {
+        /* denied symlinks look like missing files, so flush those out. */
+        __PHYSFS_platformGrabMutex(stateLock);
+        invalidateNegativeCache();
+        invalidateVerifiedPrefixes();
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* if */
+} /* PHYSFS_permitSymbolicLinks */
+
+
+int PHYSFS_symbolicLinksPermitted(void)
+{
+    return(allowSymLinks);
+} /* PHYSFS_symbolicLinksPermitted */
+
+
+void PHYSFS_enableSearchPathIndex(int enable)
+{
+    if (!initialized)  /* the first mount will build it. */
+        searchPathIndexEnabled = enable;
+    else
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        searchPathIndexEnabled = enable;
+        rebuildPathIndex();
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* else */
+} /* PHYSFS_enableSearchPathIndex */
+
+
+int PHYSFS_searchPathIndexEnabled(void)
+{
+    return(searchPathIndexEnabled);
+} /* PHYSFS_searchPathIndexEnabled */
+
+
+int PHYSFS_setNegativeCacheSize(PHYSFS_uint32 entries)
+{
+    NegativeCacheEntry *cache = NULL;
+
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+
+    if (entries > 0)
+    {
+        const PHYSFS_uint64 len = ((PHYSFS_uint64) entries) *
+                                    sizeof (NegativeCacheEntry);
+        BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(len), ERR_OUT_OF_MEMORY, 0);
+        cache = (NegativeCacheEntry *) allocator.Malloc(len);
+        BAIL_IF_MACRO(cache == NULL, ERR_OUT_OF_MEMORY, 0);
+        memset(cache, '\0', (size_t) len);
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    freeNegativeCache();
+    negativeCache = cache;
+    negativeCacheSize = entries;
+    invalidateNegativeCache();  /* in case someone's mid-search. */
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return(1);
+} /* PHYSFS_setNegativeCacheSize */
+
+
+void PHYSFS_flushNegativeCache(void)
+{
+    if (initialized)
+    {
+        __PHYSFS_platformGrabMutex(stateLock);
+        invalidateNegativeCache();
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* if */
+} /* PHYSFS_flushNegativeCache */
+
+
+void PHYSFS_getNegativeCacheStats(PHYSFS_uint64 *hits, PHYSFS_uint64 *misses)
+{
+    if (initialized)
+        __PHYSFS_platformGrabMutex(stateLock);
+
+    if (hits != NULL)
+        *hits = negativeCacheHits;
+    if (misses != NULL)
+        *misses = negativeCacheMisses;
+
+    if (initialized)
+        __PHYSFS_platformReleaseMutex(stateLock);
+} /* PHYSFS_getNegativeCacheStats */
+
+
+/* string manipulation in C makes my ass itch. */
+char *__PHYSFS_convertToDependent(const char *prepend,
                                   const char *dirName,
                                   const char *append)
 {
-    const char *dirsep = __PHYSFS_platformDirSeparator;
-    size_t sepsize = strlen(dirsep);
-    char *str;
-    char *i1;
-    char *i2;
-    size_t allocSize;
+    const char *dirsep = __PHYSFS_platformDirSeparator;
+    size_t sepsize = strlen(dirsep);
+    char *str;
+    char *i1;
+    char *i2;
+    size_t allocSize;
+
+    while (*dirName == '/')  /* !!! FIXME: pass through sanitize function. */
+        dirName++;
+
+    allocSize = strlen(dirName) + 1;
+    if (prepend != NULL)
+        allocSize += strlen(prepend) + sepsize;
+    if (append != NULL)
+        allocSize += strlen(append) + sepsize;
+
+    /* make sure there's enough space if the dir separator is bigger. */
+    if (sepsize > 1)
+    {
+        str = (char *) dirName;
+        do
+        {
+            str = strchr(str, '/');
+            if (str != NULL)
+            {
+                allocSize += (sepsize - 1);
+                str++;
+            } /* if */
+        } while (str != NULL);
+    } /* if */
+
+    str = (char *) allocator.Malloc(allocSize);
+    BAIL_IF_MACRO(str == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+    if (prepend == NULL)
+        *str = '\0';
+    else
+    {
+        strcpy(str, prepend);
+        strcat(str, dirsep);
+    } /* else */
+
+    for (i1 = (char *) dirName, i2 = str + strlen(str); *i1; i1++, i2++)
+    {
+        if (*i1 == '/')
+        {
+            strcpy(i2, dirsep);
+            i2 += sepsize;
+        } /* if */
+        else
+        {
+            *i2 = *i1;
+        } /* else */
+    } /* for */
+    *i2 = '\0';
+
+    if (append)
+    {
+        strcat(str, dirsep);
+        strcat(str, append);
+    } /* if */
+
+    return(str);
+} /* __PHYSFS_convertToDependent */
+
+
+/*
+ * Verify that (fname) (in platform-independent notation), in relation
+ *  to (h) is secure. That means that each element of fname is checked
+ *  for symlinks (if they aren't permitted). This also allows for quick
+ *  rejection of files that exist outside an archive's mountpoint.
+ *
+ * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
+ *  at a time), you should always pass zero for "allowMissing" for efficiency.
+ *
+ * (fname) must point to an output from sanitizePlatformIndependentPath(),
+ *  since it will make sure that path names are in the right format for
+ *  passing certain checks. It will also do checks for "insecure" pathnames
+ *  like ".." which should be done once instead of once per archive. This also
+ *  gives us license to treat (fname) as scratch space in this function.
+ *
+ * Returns non-zero if string is safe, zero if there's a security issue.
+ *  PHYSFS_getLastError() will specify what was wrong. (*fname) will be
+ *  updated to point past any mount point elements so it is prepared to
+ *  be used with the archiver directly.
+ */
+static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
+{
+    char *fname = *_fname;
+    int retval = 1;
+    char *start;
+    char *end;
+
+    if (*fname == '\0')  /* quick rejection. */
+        return(1);
+
+    /* !!! FIXME: This codeblock sucks. */
+    if (h->mountPoint != NULL)  /* NULL mountpoint means "/". */
+    {
+        size_t mntpntlen = strlen(h->mountPoint);
+        size_t len = strlen(fname);
+        assert(mntpntlen > 1); /* root mount points should be NULL. */
+        /* not under the mountpoint, so skip this archive. */
+        BAIL_IF_MACRO(len < mntpntlen-1, ERR_NO_SUCH_PATH, 0);
+        /* !!! FIXME: Case insensitive? */
+        retval = strncmp(h->mountPoint, fname, mntpntlen-1);
+        BAIL_IF_MACRO(retval != 0, ERR_NO_SUCH_PATH, 0);
+        if (len > mntpntlen-1)  /* corner case... */
+            BAIL_IF_MACRO(fname[mntpntlen-1] != '/', ERR_NO_SUCH_PATH, 0);
+        fname += mntpntlen-1;  /* move to start of actual archive path. */
+        if (*fname == '/')
+            fname++;
+        *_fname = fname;  /* skip mountpoint for later use. */
+        retval = 1;  /* may be reset, below. */
+    } /* if */
+
+    start = fname;
+    if (!allowSymLinks)
+    {
+        /* skip any leading directories we've already checked. */
+        PHYSFS_uint32 gen;
+        const size_t verified = findVerifiedPrefix(h, fname, &gen);
+        if (verified > 0)
+            start = fname + verified + 1;
+
+        while (1)
+        {
+            int rc = 0;
+            end = strchr(start, '/');
+
+            if (end != NULL) *end = '\0';
+            rc = h->funcs->isSymLink(h->opaque, fname, &retval);
+            if (end != NULL) *end = '/';
+
+            BAIL_IF_MACRO(rc, ERR_SYMLINK_DISALLOWED, 0);   /* insecure. */
+
+            /* break out early if path element is missing. */
+            if (!retval)
+            {
+                /*
+                 * We need to clear it if it's the last element of the path,
+                 *  since this might be a non-existant file we're opening
+                 *  for writing...
+                 */
+                if ((end == NULL) || (allowMissing))
+                    retval = 1;
+                break;
+            } /* if */
+
+            if (end == NULL)
+                break;
+
+            *end = '\0';
+            addVerifiedPrefix(h, fname, gen);
+            *end = '/';
+
+            start = end + 1;
+        } /* while */
+    } /* if */
+
+    return(retval);
+} /* verifyPath */
+
+
+static int doMkdir(const char *_dname, char *dname)
+{
+    DirHandle *h;
+    char *start;
+    char *end;
+    int retval = 0;
+    int exists = 1;  /* force existance check on first path element. */
+
+    BAIL_IF_MACRO(!sanitizePlatformIndependentPath(_dname, dname), NULL, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    BAIL_IF_MACRO_MUTEX(writeDir == NULL, ERR_NO_WRITE_DIR, stateLock, 0);
+    h = writeDir;
+    BAIL_IF_MACRO_MUTEX(!verifyPath(h, &dname, 1), NULL, stateLock, 0);
+    invalidateNegativeCache();
+    invalidateVerifiedPrefixes();
+
+    start = dname;
+    while (1)
+    {
+        end = strchr(start, '/');
+        if (end != NULL)
+            *end = '\0';
+
+        /* only check for existance if all parent dirs existed, too... */
+        if (exists)
+            retval = h->funcs->isDirectory(h->opaque, dname, &exists);
+
+        if (!exists)
+            retval = h->funcs->mkdir(h->opaque, dname);
+
+        if (!retval)
+            break;
+
+        if (end == NULL)
+            break;
+
+        *end = '/';
+        start = end + 1;
+    } /* while */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return(retval);
+} /* doMkdir */
+
+
+int PHYSFS_mkdir(const char *_dname)
+{
+    int retval = 0;
+    char *dname;
+    size_t len;
+
+    BAIL_IF_MACRO(_dname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_dname) + 1;
+    dname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(dname == NULL, ERR_OUT_OF_MEMORY, 0);
+    retval = doMkdir(_dname, dname);
+    __PHYSFS_smallFree(dname);
+    return(retval);
+} /* PHYSFS_mkdir */
+
+
+static int doDelete(const char *_fname, char *fname)
+{
+    int retval;
+    DirHandle *h;
+    BAIL_IF_MACRO(!sanitizePlatformIndependentPath(_fname, fname), NULL, 0);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    BAIL_IF_MACRO_MUTEX(writeDir == NULL, ERR_NO_WRITE_DIR, stateLock, 0);
+    h = writeDir;
+    BAIL_IF_MACRO_MUTEX(!verifyPath(h, &fname, 0), NULL, stateLock, 0);
+    invalidateNegativeCache();
+    invalidateVerifiedPrefixes();
+    retval = h->funcs->remove(h->opaque, fname);
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return(retval);
+} /* doDelete */
+
+
+int PHYSFS_delete(const char *_fname)
+{
+    int retval;
+    char *fname;
+    size_t len;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+    retval = doDelete(_fname, fname);
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_delete */
+
+
+const char *PHYSFS_getRealDir(const char *_fname)
+{
+    const char *retval = NULL;
+    char *fname = NULL;
+    PHYSFS_uint32 gen;
+    size_t len;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, NULL);
+    len = strlen(_fname) + 1;
+    fname = __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, NULL);
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        retval = NULL;
+
+    else if (checkNegativeCache(fname, &gen))
+        __PHYSFS_setError(ERR_NO_SUCH_FILE);
+
+    else
+    {
+        PathIndexProbe probe;
+        SearchPath *sp = grabSearchPath(&probe, fname);
+        PHYSFS_uint32 n;
+        for (n = 0; ((n < searchPathLength(sp)) && (retval == NULL)); n++)
+        {
+            DirHandle *i = sp->handles[n];
+            char *arcfname = fname;
+            if (partOfMountPoint(i, arcfname))
+                retval = i->dirName;
+            else if (pathIndexSkips(&probe, i))
+                continue;
+            else if (verifyPath(i, &arcfname, 0))
+            {
+                if (i->funcs->exists(i->opaque, arcfname))
+                    retval = i->dirName;
+            } /* if */
+        } /* for */
+        ungrabSearchPath(sp);
+
+        if (retval == NULL)
+            addNegativeCache(fname, gen);
+    } /* else */
+
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_getRealDir */
+
+
+static void enumFilesCallback(void *data, const char *origdir, const char *str)
+{
+    addToStringList((EnumStringListCallbackData *) data, str, 1);
+} /* enumFilesCallback */
+
+
+char **PHYSFS_enumerateFiles(const char *path)
+{
+    EnumStringListCallbackData ecd;
+    memset(&ecd, '\0', sizeof (ecd));
+    PHYSFS_enumerateFilesCallback(path, enumFilesCallback, &ecd);
+    return(finishStringList(&ecd, 1));
+} /* PHYSFS_enumerateFiles */
+
+
+/*
+ * Broke out to seperate function so we can use stack allocation gratuitously.
+ */
+static void enumerateFromMountPoint(DirHandle *i, const char *arcfname,
+                                    PHYSFS_EnumFilesCallback callback,
+                                    const char *_fname, void *data)
+{
+    const size_t len = strlen(arcfname);
+    char *ptr = NULL;
+    char *end = NULL;
+    const size_t slen = strlen(i->mountPoint) + 1;
+    char *mountPoint = (char *) __PHYSFS_smallAlloc(slen);
+
+    if (mountPoint == NULL)
+        return;  /* oh well. */
+
+    strcpy(mountPoint, i->mountPoint);
+    ptr = mountPoint + ((len) ? len + 1 : 0);
+    end = strchr(ptr, '/');
+    assert(end);  /* should always find a terminating '/'. */
+    *end = '\0';
+    callback(data, _fname, ptr);
+    __PHYSFS_smallFree(mountPoint);
+} /* enumerateFromMountPoint */
+
+
+/* !!! FIXME: this should report error conditions. */
+void PHYSFS_enumerateFilesCallback(const char *_fname,
+                                   PHYSFS_EnumFilesCallback callback,
+                                   void *data)
+{
+    size_t len;
+    char *fname;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, ) /*0*/;
+    BAIL_IF_MACRO(callback == NULL, ERR_INVALID_ARGUMENT, ) /*0*/;
+
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, ) /*0*/;
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        SearchPath *sp = grabSearchPath(NULL, NULL);
+        const int noSyms = !allowSymLinks;
+        PHYSFS_uint32 n;
+
+        for (n = 0; n < searchPathLength(sp); n++)
+        {
+            DirHandle *i = sp->handles[n];
+            char *arcfname = fname;
+            if (partOfMountPoint(i, arcfname))
+                enumerateFromMountPoint(i, arcfname, callback, _fname, data);
+
+            else if (verifyPath(i, &arcfname, 0))
+            {
+                i->funcs->enumerateFiles(i->opaque, arcfname, noSyms,
+                                         callback, _fname, data);
+            } /* else if */
+        } /* for */
+        ungrabSearchPath(sp);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+} /* PHYSFS_enumerateFilesCallback */
+
+
+int PHYSFS_exists(const char *fname)
+{
+    return(PHYSFS_getRealDir(fname) != NULL);
+} /* PHYSFS_exists */
+
+
+PHYSFS_sint64 PHYSFS_getLastModTime(const char *_fname)
+{
+    PHYSFS_sint64 retval = -1;
+    char *fname;
+    size_t len;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, -1);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, -1);
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        if (*fname == '\0')   /* eh...punt if it's the root dir. */
+            retval = 1;  /* !!! FIXME: Maybe this should be an error? */
+        else
+        {
+            PathIndexProbe probe;
+            SearchPath *sp = grabSearchPath(&probe, fname);
+            PHYSFS_uint32 n;
+            int exists = 0;
+            for (n = 0; ((n < searchPathLength(sp)) && (!exists)); n++)
+            {
+                DirHandle *i = sp->handles[n];
+                char *arcfname = fname;
+                exists = partOfMountPoint(i, arcfname);
+                if (exists)
+                    retval = 1; /* !!! FIXME: What's the right value? */
+                else if (pathIndexSkips(&probe, i))
+                    continue;
+                else if (verifyPath(i, &arcfname, 0))
+                {
+                    retval = i->funcs->getLastModTime(i->opaque, arcfname,
+                                                      &exists);
+                } /* else if */
+            } /* for */
+            ungrabSearchPath(sp);
+        } /* else */
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_getLastModTime */
+
+
+int PHYSFS_isDirectory(const char *_fname)
+{
+    int retval = 0;
+    size_t len;
+    char *fname;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        retval = 0;
+
+    else if (*fname == '\0')
+        retval = 1;  /* Root is always a dir.  :) */
+
+    else
+    {
+        PathIndexProbe probe;
+        SearchPath *sp = grabSearchPath(&probe, fname);
+        PHYSFS_uint32 n;
+        int exists = 0;
+
+        for (n = 0; ((n < searchPathLength(sp)) && (!exists)); n++)
+        {
+            DirHandle *i = sp->handles[n];
+            char *arcfname = fname;
+            if ((exists = partOfMountPoint(i, arcfname)) != 0)
+                retval = 1;
+            else if (pathIndexSkips(&probe, i))
+                continue;
+            else if (verifyPath(i, &arcfname, 0))
+                retval = i->funcs->isDirectory(i->opaque, arcfname, &exists);
+        } /* for */
+        ungrabSearchPath(sp);
+    } /* else */
+
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_isDirectory */
+
+
+int PHYSFS_isSymbolicLink(const char *_fname)
+{
+    int retval = 0;
+    size_t len;
+    char *fname;
+
+    BAIL_IF_MACRO(!allowSymLinks, ERR_SYMLINK_DISALLOWED, 0);
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        retval = 0;
+
+    else if (*fname == '\0')
+        retval = 1;  /* Root is never a symlink. */
+
+    else
+    {
+        SearchPath *sp = grabSearchPath(NULL, NULL);
+        PHYSFS_uint32 n;
+        int fileExists = 0;
+
+        for (n = 0; ((n < searchPathLength(sp)) && (!fileExists)); n++)
+        {
+            DirHandle *i = sp->handles[n];
+            char *arcfname = fname;
+            if ((fileExists = partOfMountPoint(i, arcfname)) != 0)
+                retval = 0;  /* virtual dir...not a symlink. */
+            else if (verifyPath(i, &arcfname, 0))
+                retval = i->funcs->isSymLink(i->opaque, arcfname, &fileExists);
+        } /* for */
+        ungrabSearchPath(sp);
+    } /* else */
+
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_isSymbolicLink */
+
+
+static PHYSFS_File *doOpenWrite(const char *_fname, int appending)
+{
+    FileHandle *fh = NULL;
+    size_t len;
+    char *fname;
 
-    while (*dirName == '/')  /* !!! FIXME: pass through sanitize function. */
-        dirName++;
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
 
-    allocSize = strlen(dirName) + 1;
-    if (prepend != NULL)
-        allocSize += strlen(prepend) + sepsize;
-    if (append != NULL)
-        allocSize += strlen(append) + sepsize;
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        void *opaque = NULL;
+        DirHandle *h = NULL;
+        const PHYSFS_Archiver *f;
 
-    /* make sure there's enough space if the dir separator is bigger. */
-    if (sepsize > 1)
+        __PHYSFS_platformGrabMutex(stateLock);
+
+        GOTO_IF_MACRO(!writeDir, ERR_NO_WRITE_DIR, doOpenWriteEnd);
+
+        h = writeDir;
+        GOTO_IF_MACRO(!verifyPath(h, &fname, 0), NULL, doOpenWriteEnd);
+        invalidateNegativeCache();
+        invalidateVerifiedPrefixes();
+
+        f = h->funcs;
+        if (appending)
+            opaque = f->openAppend(h->opaque, fname);
+        else
+            opaque = f->openWrite(h->opaque, fname);
+
+        GOTO_IF_MACRO(opaque == NULL, NULL, doOpenWriteEnd);
+
+        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+        if (fh == NULL)
+        {
+            f->fileClose(opaque);
+            GOTO_MACRO(ERR_OUT_OF_MEMORY, doOpenWriteEnd);
+        } /* if */
+        else
+        {
+            memset(fh, '\0', sizeof (FileHandle));
+            fh->opaque = opaque;
+            fh->dirHandle = h;
+            fh->funcs = h->funcs;
+            fh->next = openWriteList;
+            openWriteList = fh;
+        } /* else */
+
+        doOpenWriteEnd:
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* if */
+
+    __PHYSFS_smallFree(fname);
+    return((PHYSFS_File *) fh);
+} /* doOpenWrite */
+
+
+PHYSFS_File *PHYSFS_openWrite(const char *filename)
+{
+    return(doOpenWrite(filename, 0));
+} /* PHYSFS_openWrite */
+
+
+PHYSFS_File *PHYSFS_openAppend(const char *filename)
+{
+    return(doOpenWrite(filename, 1));
+} /* PHYSFS_openAppend */
+
+
+/*
+ * Find (fname) in search path snapshot (sp) and open it for reading. Returns
+ *  the archiver's file handle and sets (*dh) to the DirHandle it came from.
+ *  (*exists) is set to non-zero if (fname) was found at all, even if it
+ *  couldn't be opened (it's a directory, etc).
+ */
+static fvoid *openReadFromSearchPath(SearchPath *sp, PathIndexProbe *probe,
+                                     char *fname, DirHandle **dh, int *exists)
+{
+    int fileExists = 0;
+    int probed = 0;
+    fvoid *retval = NULL;
+    PHYSFS_uint32 n;
+
+    *exists = 0;
+    BAIL_IF_MACRO(sp == NULL, ERR_NO_SUCH_PATH, NULL);
+
+    for (n = 0; (n < sp->count) && (!fileExists); n++)
     {
-        str = (char *) dirName;
+        DirHandle *i = sp->handles[n];
+        char *arcfname = fname;
+        if (partOfMountPoint(i, arcfname))
+            *exists = 1;
+
+        if (pathIndexSkips(probe, i))
+            continue;
+
+        probed = 1;
+        if (verifyPath(i, &arcfname, 0))
+        {
+            retval = i->funcs->openRead(i->opaque, arcfname, &fileExists);
+            if (retval)
+            {
+                *dh = i;
+                break;
+            } /* if */
+        } /* if */
+    } /* for */
+
+    if (fileExists)
+        *exists = 1;
+
+    /* !!! FIXME: may not set an error if openRead didn't fail. */
+    BAIL_IF_MACRO(!probed, ERR_NO_SUCH_FILE, NULL);
+    return(retval);
+} /* openReadFromSearchPath */
+
+
+PHYSFS_File *PHYSFS_openRead(const char *_fname)
+{
+    FileHandle *fh = NULL;
+    PHYSFS_uint32 gen;
+    char *fname;
+    size_t len;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
+    len = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        fh = NULL;
+
+    else if (checkNegativeCache(fname, &gen))
+        __PHYSFS_setError(ERR_NO_SUCH_FILE);
+
+    else
+    {
+        int raced;
         do
         {
-            str = strchr(str, '/');
-            if (str != NULL)
+            PathIndexProbe probe;
+            SearchPath *sp = grabSearchPath(&probe, fname);
+            DirHandle *i = NULL;
+            int exists;
+            fvoid *opaque;
+
+            opaque = openReadFromSearchPath(sp, &probe, fname, &i, &exists);
+            if ((!exists) && (sp != NULL))
+                addNegativeCache(fname, gen);
+
+            raced = 0;
+            if (opaque != NULL)
             {
-                allocSize += (sepsize - 1);
-                str++;
+                __PHYSFS_platformGrabMutex(stateLock);
+
+                /* removed from the search path while we opened it? Retry. */
+                if (i->removed)
+                {
+                    i->funcs->fileClose(opaque);
+                    raced = 1;
+                } /* if */
+
+                else
+                {
+                    fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+                    if (fh == NULL)
+                    {
+                        i->funcs->fileClose(opaque);
+                        __PHYSFS_setError(ERR_OUT_OF_MEMORY);
+                    } /* if */
+                    else
+                    {
+                        memset(fh, '\0', sizeof (FileHandle));
+                        fh->opaque = opaque;
+                        fh->forReading = 1;
+                        fh->dirHandle = i;
+                        fh->funcs = i->funcs;
+                        fh->next = openReadList;
+                        openReadList = fh;
+                    } /* else */
+                } /* else */
+
+                __PHYSFS_platformReleaseMutex(stateLock);
             } /* if */
-        } while (str != NULL);
+
+            ungrabSearchPath(sp);
+        } while (raced);
+    } /* else */
+
+    __PHYSFS_smallFree(fname);
+    return((PHYSFS_File *) fh);
+} /* PHYSFS_openRead */
+
+
+static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
+{
+    FileHandle *prev = NULL;
+    FileHandle *i;
+    int rc = 1;
+
+    for (i = *list; i != NULL; i = i->next)
+    {
+        if (i == handle)  /* handle is in this list? */
+        {
+            PHYSFS_uint8 *tmp = handle->buffer;
+            rc = PHYSFS_flush((PHYSFS_File *) handle);
+            if (rc)
+                rc = handle->funcs->fileClose(handle->opaque);
+            if (!rc)
+                return(-1);
+
+            if (tmp != NULL)  /* free any associated buffer. */
+                allocator.Free(tmp);
+
+            if (handle->readAtLock != NULL)
+                __PHYSFS_platformDestroyMutex(handle->readAtLock);
+
+            if (prev == NULL)
+                *list = handle->next;
+            else
+                prev->next = handle->next;
+
+            allocator.Free(handle);
+            return(1);
+        } /* if */
+        prev = i;
+    } /* for */
+
+    return(0);
+} /* closeHandleInOpenList */
+
+
+int PHYSFS_close(PHYSFS_File *_handle)
+{
+    FileHandle *handle = (FileHandle *) _handle;
+    int rc;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+
+    /* -1 == close failure. 0 == not found. 1 == success. */
+    rc = closeHandleInOpenList(&openReadList, handle);
+    BAIL_IF_MACRO_MUTEX(rc == -1, NULL, stateLock, 0);
+    if (!rc)
+    {
+        rc = closeHandleInOpenList(&openWriteList, handle);
+        BAIL_IF_MACRO_MUTEX(rc == -1, NULL, stateLock, 0);
     } /* if */
 
-    str = (char *) allocator.Malloc(allocSize);
-    BAIL_IF_MACRO(str == NULL, ERR_OUT_OF_MEMORY, NULL);
+    __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF_MACRO(!rc, ERR_NOT_A_HANDLE, 0);
+    return(1);
+} /* PHYSFS_close */
+
+
+/*
+ * Read an archiver's file from start to end into a buffer of exactly the
+ *  right size. Stored data goes straight from disk into the buffer with
+ *  positional reads where we can; anything else goes through read().
+ */
+static void *readArchiverFile(const PHYSFS_Archiver *funcs, fvoid *opaque,
+                              PHYSFS_uint64 *_len)
+{
+    const PHYSFS_sint64 flen = funcs->fileLength(opaque);
+    PHYSFS_uint8 *retval;
+    PHYSFS_uint64 total = 0;
+    PHYSFS_uint64 len;
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+    PHYSFS_uint64 base = 0;
+    void *raw = NULL;
+#endif
+
+    BAIL_IF_MACRO(flen < 0, NULL, NULL);
+    len = (PHYSFS_uint64) flen;
+    BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(len), ERR_OUT_OF_MEMORY, NULL);
+    retval = (PHYSFS_uint8 *) allocator.Malloc((len > 0) ? len : 1);
+    BAIL_IF_MACRO(retval == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+    if ((funcs->getRawRegion == NULL) ||
+        (!funcs->getRawRegion(opaque, &raw, &base)))
+        raw = NULL;
+#endif
+
+    while (total < len)
+    {
+        const PHYSFS_uint64 left = len - total;
+        const PHYSFS_uint32 chunk = (left > 0x40000000) ? 0x40000000 :
+                                                          (PHYSFS_uint32) left;
+        PHYSFS_sint64 rc;
+
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+        if (raw != NULL)
+            rc = __PHYSFS_platformReadAt(raw, retval + total, base + total,
+                                         chunk);
+        else
+#endif
+        rc = funcs->read(opaque, retval + total, 1, chunk);
+
+        if (rc <= 0)
+        {
+            allocator.Free(retval);
+            if (rc == 0)
+                __PHYSFS_setError(ERR_PAST_EOF);  /* file shrank? */
+            return(NULL);
+        } /* if */
+        total += (PHYSFS_uint64) rc;
+    } /* while */
+
+    *_len = len;
+    return(retval);
+} /* readArchiverFile */
+
+
+void *PHYSFS_loadFile(const char *_fname, PHYSFS_uint64 *len)
+{
+    void *retval = NULL;
+    PHYSFS_uint32 gen;
+    char *fname;
+    size_t fnamelen;
+
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF_MACRO(len == NULL, ERR_INVALID_ARGUMENT, NULL);
+    fnamelen = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(fnamelen);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        retval = NULL;
+
+    else if (checkNegativeCache(fname, &gen))
+        __PHYSFS_setError(ERR_NO_SUCH_FILE);
+
+    else
+    {
+        /*
+         * No PHYSFS_File here, so nothing to put on the open list: holding
+         *  the search path snapshot keeps the archive alive until we're done.
+         */
+        PathIndexProbe probe;
+        SearchPath *sp = grabSearchPath(&probe, fname);
+        DirHandle *i = NULL;
+        int exists;
+        fvoid *opaque;
+
+        opaque = openReadFromSearchPath(sp, &probe, fname, &i, &exists);
+        if ((!exists) && (sp != NULL))
+            addNegativeCache(fname, gen);
+
+        if (opaque != NULL)
+        {
+            retval = readArchiverFile(i->funcs, opaque, len);
+            i->funcs->fileClose(opaque);
+        } /* if */
+
+        ungrabSearchPath(sp);
+    } /* else */
+
+    __PHYSFS_smallFree(fname);
+    return(retval);
+} /* PHYSFS_loadFile */
+
+
+/*
+ * Fill in (mf) for archiver file (opaque): a view of the archiver's own
+ *  copy if it has one in memory, a mapping if the data is sitting in a real
+ *  file as-is, or a buffer we read it into otherwise. Only a view keeps
+ *  (opaque) open; it's closed in the other cases. Returns zero on error.
+ */
+static int mapArchiverFile(MappedFile *mf, const PHYSFS_Archiver *funcs,
+                           fvoid *opaque, PHYSFS_uint64 *len)
+{
+    const PHYSFS_sint64 flen = funcs->fileLength(opaque);
+    void *handle;
+    PHYSFS_uint64 offset;
+
+    if (flen < 0)
+    {
+        funcs->fileClose(opaque);
+        return(0);
+    } /* if */
 
-    if (prepend == NULL)
-        *str = '\0';
-    else
+    /* already decoded in memory? Just point at it, no copies. */
+    if ( (flen > 0) && (funcs->getView != NULL) &&
+         (funcs->getView(opaque, &mf->data)) )
     {
-        strcpy(str, prepend);
-        strcat(str, dirsep);
-    } /* else */
+        mf->funcs = funcs;
+        mf->opaque = opaque;  /* the view lasts as long as this is open. */
+        *len = (PHYSFS_uint64) flen;
+        return(1);
+    } /* if */
 
-    for (i1 = (char *) dirName, i2 = str + strlen(str); *i1; i1++, i2++)
+    /* map it if the data is sitting in a real file as-is... */
+    if ( (flen > 0) && (funcs->getRawRegion != NULL) &&
+         (funcs->getRawRegion(opaque, &handle, &offset)) )
     {
-        if (*i1 == '/')
-        {
-            strcpy(i2, dirsep);
-            i2 += sepsize;
-        } /* if */
-        else
-        {
-            *i2 = *i1;
-        } /* else */
-    } /* for */
-    *i2 = '\0';
+        mf->data = __PHYSFS_platformMap(handle, offset, (PHYSFS_uint64) flen,
+                                        &mf->mapping);
+    } /* if */
 
-    if (append)
+    /* ...otherwise (compressed, empty, can't map, etc), read it all in. */
+    if (mf->data == NULL)
     {
-        strcat(str, dirsep);
-        strcat(str, append);
+        mf->mapping = NULL;
+        mf->data = readArchiverFile(funcs, opaque, len);
     } /* if */
 
-    return(str);
-} /* __PHYSFS_convertToDependent */
+    funcs->fileClose(opaque);  /* the mapping outlives the handle. */
+    *len = (PHYSFS_uint64) flen;
+    return(mf->data != NULL);
+} /* mapArchiverFile */
 
 
-/*
- * Verify that (fname) (in platform-independent notation), in relation
- *  to (h) is secure. That means that each element of fname is checked
- *  for symlinks (if they aren't permitted). This also allows for quick
- *  rejection of files that exist outside an archive's mountpoint.
- *
- * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
- *  at a time), you should always pass zero for "allowMissing" for efficiency.
- *
- * (fname) must point to an output from sanitizePlatformIndependentPath(),
- *  since it will make sure that path names are in the right format for
- *  passing certain checks. It will also do checks for "insecure" pathnames
- *  like ".." which should be done once instead of once per archive. This also
- *  gives us license to treat (fname) as scratch space in this function.
- *
- * Returns non-zero if string is safe, zero if there's a security issue.
- *  PHYSFS_getLastError() will specify what was wrong. (*fname) will be
- *  updated to point past any mount point elements so it is prepared to
- *  be used with the archiver directly.
- */
-static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
+const void *PHYSFS_mapFile(const char *_fname, PHYSFS_uint64 *len)
 {
-    char *fname = *_fname;
-    int retval = 1;
-    char *start;
-    char *end;
+    MappedFile *mf;
+    PHYSFS_uint32 gen;
+    char *fname;
+    size_t fnamelen;
+    int rc = 0;
 
-    if (*fname == '\0')  /* quick rejection. */
-        return(1);
+    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF_MACRO(len == NULL, ERR_INVALID_ARGUMENT, NULL);
+    fnamelen = strlen(_fname) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(fnamelen);
+    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, NULL);
+    mf = (MappedFile *) allocator.Malloc(sizeof (MappedFile));
+    GOTO_IF_MACRO(mf == NULL, ERR_OUT_OF_MEMORY, mapFileFailed);
+    memset(mf, '\0', sizeof (MappedFile));
 
-    /* !!! FIXME: This codeblock sucks. */
-    if (h->mountPoint != NULL)  /* NULL mountpoint means "/". */
+    if (!sanitizePlatformIndependentPath(_fname, fname))
+        rc = 0;  /* error's already set. */
+
+    else if (checkNegativeCache(fname, &gen))
+        __PHYSFS_setError(ERR_NO_SUCH_FILE);
+
+    else
     {
-        size_t mntpntlen = strlen(h->mountPoint);
-        size_t len = strlen(fname);
-        assert(mntpntlen > 1); /* root mount points should be NULL. */
-        /* not under the mountpoint, so skip this archive. */
-        BAIL_IF_MACRO(len < mntpntlen-1, ERR_NO_SUCH_PATH, 0);
-        /* !!! FIXME: Case insensitive? */
-        retval = strncmp(h->mountPoint, fname, mntpntlen-1);
-        BAIL_IF_MACRO(retval != 0, ERR_NO_SUCH_PATH, 0);
-        if (len > mntpntlen-1)  /* corner case... */
-            BAIL_IF_MACRO(fname[mntpntlen-1] != '/', ERR_NO_SUCH_PATH, 0);
-        fname += mntpntlen-1;  /* move to start of actual archive path. */
-        if (*fname == '/')
-            fname++;
-        *_fname = fname;  /* skip mountpoint for later use. */
-        retval = 1;  /* may be reset, below. */
-    } /* if */
+        /*
+         * As with PHYSFS_loadFile(), the search path snapshot keeps the
+         *  archive alive, and a view holds on to it until it's unmapped,
+         *  so the archive can still be removed from the search path.
+         */
+        PathIndexProbe probe;
+        SearchPath *sp = grabSearchPath(&probe, fname);
+        DirHandle *i = NULL;
+        int exists;
+        fvoid *opaque;
 
-    start = fname;
-    if (!allowSymLinks)
+        opaque = openReadFromSearchPath(sp, &probe, fname, &i, &exists);
+        if ((!exists) && (sp != NULL))
+            addNegativeCache(fname, gen);
+
+        if (opaque != NULL)
+            rc = mapArchiverFile(mf, i->funcs, opaque, len);
+
+        if (mf->opaque != NULL)
+            mf->searchPath = sp;
+        else
+            ungrabSearchPath(sp);
+    } /* else */
+
+    GOTO_IF_MACRO(!rc, NULL, mapFileFailed);
+    __PHYSFS_smallFree(fname);
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    mf->next = mappedFiles;
+    mappedFiles = mf;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return(mf->data);
+
+mapFileFailed:
+    if (mf != NULL)
+        allocator.Free(mf);  /* nothing's mapped or open if we failed. */
+    __PHYSFS_smallFree(fname);
+    return(NULL);
+} /* PHYSFS_mapFile */
+
+
+int PHYSFS_unmapFile(const void *data)
+{
+    MappedFile *prev = NULL;
+    MappedFile *i;
+
+    __PHYSFS_platformGrabMutex(stateLock);
+    for (i = mappedFiles; i != NULL; i = i->next)
     {
-        while (1)
+        if (i->data == data)
         {
-            int rc = 0;
-            end = strchr(start, '/');
+            if (prev == NULL)
+                mappedFiles = i->next;
+            else
+                prev->next = i->next;
+            break;
+        } /* if */
+        prev = i;
+    } /* for */
 
-            if (end != NULL) *end = '\0';
-            rc = h->funcs->isSymLink(h->opaque, fname, &retval);
-            if (end != NULL) *end = '/';
+    /* views with the same pointer are the same file, so any one will do. */
+    BAIL_IF_MACRO_MUTEX(i == NULL, ERR_INVALID_ARGUMENT, stateLock, 0);
+    releaseMappedFile(i);
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return(1);
+} /* PHYSFS_unmapFile */
 
-            BAIL_IF_MACRO(rc, ERR_SYMLINK_DISALLOWED, 0);   /* insecure. */
 
-            /* break out early if path element is missing. */
-            if (!retval)
+static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *buffer,
+                                    PHYSFS_uint32 objSize,
+                                    PHYSFS_uint32 objCount)
+{
+    PHYSFS_sint64 retval = 0;
+    PHYSFS_uint32 remainder = 0;
+
+    while (objCount > 0)
+    {
+        PHYSFS_uint32 buffered = fh->buffill - fh->bufpos;
+        PHYSFS_uint64 mustread = (objSize * objCount) - remainder;
+        PHYSFS_uint32 copied;
+
+        if (buffered == 0) /* need to refill buffer? */
+        {
+            PHYSFS_sint64 rc = fh->funcs->read(fh->opaque, fh->buffer,
+                                                1, fh->bufsize);
+            if (rc <= 0)
             {
-                /*
-                 * We need to clear it if it's the last element of the path,
-                 *  since this might be a non-existant file we're opening
-                 *  for writing...
-                 */
-                if ((end == NULL) || (allowMissing))
-                    retval = 1;
-                break;
+                fh->bufpos -= remainder;
+                return(((rc == -1) && (retval == 0)) ? -1 : retval);
             } /* if */
 
-            if (end == NULL)
-                break;
+            buffered = fh->buffill = (PHYSFS_uint32) rc;
+            fh->bufpos = 0;
+        } /* if */
 
-            start = end + 1;
-        } /* while */
-    } /* if */
+        if (buffered > mustread)
+            buffered = (PHYSFS_uint32) mustread;
+
+        memcpy(buffer, fh->buffer + fh->bufpos, (size_t) buffered);
+        buffer = ((PHYSFS_uint8 *) buffer) + buffered;
+        fh->bufpos += buffered;
+        buffered += remainder;  /* take remainder into account. */
+        copied = (buffered / objSize);
+        remainder = (buffered % objSize);
+        retval += copied;
+        objCount -= copied;
+    } /* while */
 
     return(retval);
-} /* verifyPath */
+} /* doBufferedRead */
 
 
-static int doMkdir(const char *_dname, char *dname)
+PHYSFS_sint64 PHYSFS_read(PHYSFS_File *handle, void *buffer,
+                          PHYSFS_uint32 objSize, PHYSFS_uint32 objCount)
 {
-    DirHandle *h;
-    char *start;
-    char *end;
-    int retval = 0;
-    int exists = 1;  /* force existance check on first path element. */
+    FileHandle *fh = (FileHandle *) handle;
 
-    BAIL_IF_MACRO(!sanitizePlatformIndependentPath(_dname, dname), NULL, 0);
+    BAIL_IF_MACRO(!fh->forReading, ERR_FILE_ALREADY_OPEN_W, -1);
+    BAIL_IF_MACRO(objSize == 0, NULL, 0);
+    BAIL_IF_MACRO(objCount == 0, NULL, 0);
+    if (fh->buffer != NULL)
+        return(doBufferedRead(fh, buffer, objSize, objCount));
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    BAIL_IF_MACRO_MUTEX(writeDir == NULL, ERR_NO_WRITE_DIR, stateLock, 0);
-    h = writeDir;
-    BAIL_IF_MACRO_MUTEX(!verifyPath(h, &dname, 1), NULL, stateLock, 0);
+    return(fh->funcs->read(fh->opaque, buffer, objSize, objCount));
+} /* PHYSFS_read */
 
-    start = dname;
-    while (1)
-    {
-        end = strchr(start, '/');
-        if (end != NULL)
-            *end = '\0';
 
-        /* only check for existance if all parent dirs existed, too... */
-        if (exists)
-            retval = h->funcs->isDirectory(h->opaque, dname, &exists);
+/*
+ * PHYSFS_readAt() for files we can't pread() from: hold the handle's lock,
+ *  seek the archiver to (offset), read, and put the archiver back where it
+ *  was, so any PHYSFS_read() buffering on this handle is none the wiser.
+ */
+static PHYSFS_sint64 doLockedReadAt(FileHandle *fh, PHYSFS_uint64 offset,
+                                    PHYSFS_uint8 *buffer, PHYSFS_uint64 len)
+{
+    const PHYSFS_Archiver *funcs = fh->funcs;
+    PHYSFS_sint64 retval = 0;
+    PHYSFS_sint64 pos;
 
-        if (!exists)
-            retval = h->funcs->mkdir(h->opaque, dname);
+    __PHYSFS_platformGrabMutex(stateLock);
+    if (fh->readAtLock == NULL)
+        fh->readAtLock = __PHYSFS_platformCreateMutex();
+    __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF_MACRO(fh->readAtLock == NULL, NULL, -1);
 
-        if (!retval)
-            break;
+    __PHYSFS_platformGrabMutex(fh->readAtLock);
+    pos = funcs->tell(fh->opaque);
+    GOTO_IF_MACRO(pos < 0, NULL, lockedReadAtFailed);
+    GOTO_IF_MACRO(!funcs->seek(fh->opaque, offset), NULL, lockedReadAtFailed);
 
-        if (end == NULL)
+    while (len > 0)
+    {
+        const PHYSFS_uint32 chunk = (len > 0x40000000) ? 0x40000000 :
+                                                         (PHYSFS_uint32) len;
+        const PHYSFS_sint64 rc = funcs->read(fh->opaque, buffer, 1, chunk);
+        if (rc < 0)
+        {
+            if (retval == 0)
+                retval = -1;
             break;
+        } /* if */
 
-        *end = '/';
-        start = end + 1;
+        retval += rc;
+        buffer += (size_t) rc;
+        len -= (PHYSFS_uint64) rc;
+        if (rc < chunk)
+            break;  /* EOF. */
     } /* while */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    funcs->seek(fh->opaque, (PHYSFS_uint64) pos);
+    __PHYSFS_platformReleaseMutex(fh->readAtLock);
     return(retval);
-} /* doMkdir */
 
+lockedReadAtFailed:
+    __PHYSFS_platformReleaseMutex(fh->readAtLock);
+    return(-1);
+} /* doLockedReadAt */
 
-int PHYSFS_mkdir(const char *_dname)
+
+PHYSFS_sint64 PHYSFS_readAt(PHYSFS_File *handle, PHYSFS_uint64 offset,
+                            void *buffer, PHYSFS_uint64 len)
 {
-    int retval = 0;
-    char *dname;
-    size_t len;
+    FileHandle *fh = (FileHandle *) handle;
+    const PHYSFS_Archiver *funcs = fh->funcs;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buffer;
+    PHYSFS_sint64 flen;
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+    PHYSFS_sint64 retval = 0;
+    PHYSFS_uint64 base;
+    void *raw;
+#endif
+
+    BAIL_IF_MACRO(!fh->forReading, ERR_FILE_ALREADY_OPEN_W, -1);
+    BAIL_IF_MACRO(len == 0, NULL, 0);
+
+    flen = funcs->fileLength(fh->opaque);
+    BAIL_IF_MACRO(flen < 0, NULL, -1);
+    if (offset >= (PHYSFS_uint64) flen)
+        return(0);  /* reading past EOF isn't an error, you just get nothing. */
+    if (len > ((PHYSFS_uint64) flen) - offset)
+        len = ((PHYSFS_uint64) flen) - offset;
+
+#ifdef PHYSFS_NO_PREAD_SUPPORT
+    return(doLockedReadAt(fh, offset, ptr, len));
+#else
+    /* Raw bytes on disk? Read them without touching any shared state. */
+    if ((funcs->getRawRegion == NULL) ||
+        (!funcs->getRawRegion(fh->opaque, &raw, &base)))
+        return(doLockedReadAt(fh, offset, ptr, len));
+
+    while (len > 0)
+    {
+        const PHYSFS_uint32 chunk = (len > 0x40000000) ? 0x40000000 :
+                                                         (PHYSFS_uint32) len;
+        const PHYSFS_sint64 rc = __PHYSFS_platformReadAt(raw, ptr,
+                                                         base + offset, chunk);
+        if (rc < 0)
+            return((retval == 0) ? -1 : retval);
+
+        retval += rc;
+        ptr += (size_t) rc;
+        offset += (PHYSFS_uint64) rc;
+        len -= (PHYSFS_uint64) rc;
+        if (rc < chunk)
+            break;  /* EOF (the archive got truncated under us?) */
+    } /* while */
 
-    BAIL_IF_MACRO(_dname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_dname) + 1;
-    dname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(dname == NULL, ERR_OUT_OF_MEMORY, 0);
-    retval = doMkdir(_dname, dname);
-    __PHYSFS_smallFree(dname);
     return(retval);
-} /* PHYSFS_mkdir */
+#endif
+} /* PHYSFS_readAt */
 
 
-static int doDelete(const char *_fname, char *fname)
+/*
+ * Get a file's data on its way into the OS's cache: ask nicely if we can
+ *  find the bytes on disk, otherwise read it through once and throw the
+ *  results away. Either way, resolving the path warms our own lookups.
+ */
+static void prefetchHandle(PHYSFS_File *file, PHYSFS_uint8 *scratch,
+                           PHYSFS_uint32 scratchlen)
 {
-    int retval;
-    DirHandle *h;
-    BAIL_IF_MACRO(!sanitizePlatformIndependentPath(_fname, fname), NULL, 0);
-
-    __PHYSFS_platformGrabMutex(stateLock);
+    FileHandle *fh = (FileHandle *) file;
+    int hinted = 0;
+    PHYSFS_sint64 flen;
+    PHYSFS_uint64 offset;
+    void *handle;
+
+    if (fh->funcs->prefetch != NULL)
+        hinted = fh->funcs->prefetch(fh->opaque);
+    else if ( (fh->funcs->getRawRegion != NULL) &&
+              (fh->funcs->getRawRegion(fh->opaque, &handle, &offset)) )
+    {
+        flen = fh->funcs->fileLength(fh->opaque);
+        if (flen >= 0)
+        {
+            hinted = __PHYSFS_platformPrefetch(handle, offset,
+                                               (PHYSFS_uint64) flen);
+        } /* if */
+    } /* else if */
 
-    BAIL_IF_MACRO_MUTEX(writeDir == NULL, ERR_NO_WRITE_DIR, stateLock, 0);
-    h = writeDir;
-    BAIL_IF_MACRO_MUTEX(!verifyPath(h, &fname, 0), NULL, stateLock, 0);
-    retval = h->funcs->remove(h->opaque, fname);
+    if ((!hinted) && (scratch != NULL))
+    {
+        PHYSFS_sint64 rc;
+        do
+        {
+            rc = PHYSFS_read(file, scratch, 1, scratchlen);
+        } while (rc == (PHYSFS_sint64) scratchlen);
+    } /* if */
+} /* prefetchHandle */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    return(retval);
-} /* doDelete */
 
+static int prefetchFile(const char *fname, PHYSFS_uint8 *scratch,
+                        PHYSFS_uint32 scratchlen)
+{
+    PHYSFS_File *file = PHYSFS_openRead(fname);
+    BAIL_IF_MACRO(file == NULL, NULL, 0);
+    prefetchHandle(file, scratch, scratchlen);
+    PHYSFS_close(file);
+    return(1);
+} /* prefetchFile */
 
-int PHYSFS_delete(const char *_fname)
+
+static PHYSFS_sint64 prefetchFiles(char **paths, PHYSFS_uint32 count)
 {
-    int retval;
-    char *fname;
-    size_t len;
+    const PHYSFS_uint32 scratchlen = 64 * 1024;
+    PHYSFS_uint8 *scratch = (PHYSFS_uint8 *) allocator.Malloc(scratchlen);
+    PHYSFS_sint64 retval = 0;
+    PHYSFS_uint32 i;
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
-    retval = doDelete(_fname, fname);
-    __PHYSFS_smallFree(fname);
+    for (i = 0; i < count; i++)
+        retval += prefetchFile(paths[i], scratch, scratchlen);
+
+    if (scratch != NULL)
+        allocator.Free(scratch);
     return(retval);
-} /* PHYSFS_delete */
+} /* prefetchFiles */
 
 
-const char *PHYSFS_getRealDir(const char *_fname)
+static void freeAsyncRequest(AsyncRequest *req)
 {
-    const char *retval = NULL;
-    char *fname = NULL;
-    size_t len;
+    if (req->done != NULL)
+        __PHYSFS_platformDestroySemaphore(req->done);
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, NULL);
-    len = strlen(_fname) + 1;
-    fname = __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, NULL);
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    if (req->filename != NULL)
     {
-        DirHandle *i;
-        __PHYSFS_platformGrabMutex(stateLock);
-        for (i = searchPath; ((i != NULL) && (retval == NULL)); i = i->next)
-        {
-            char *arcfname = fname;
-            if (partOfMountPoint(i, arcfname))
-                retval = i->dirName;
-            else if (verifyPath(i, &arcfname, 0))
-            {
-                if (i->funcs->exists(i->opaque, arcfname))
-                    retval = i->dirName;
-            } /* if */
-        } /* for */
-        __PHYSFS_platformReleaseMutex(stateLock);
+        allocator.Free(req->filename);
+        if (req->buffer != NULL)  /* loads own their buffer. */
+            allocator.Free(req->buffer);
     } /* if */
 
-    __PHYSFS_smallFree(fname);
-    return(retval);
-} /* PHYSFS_getRealDir */
+    if (req->paths != NULL)
+        allocator.Free(req->paths);
+
+    allocator.Free(req);
+} /* freeAsyncRequest */
 
 
-static int locateInStringList(const char *str,
-                              char **list,
-                              PHYSFS_uint32 *pos)
+/* Do the actual work, on a worker thread or (if we have none) the caller's. */
+static void runAsyncRequest(AsyncRequest *req)
 {
-    PHYSFS_uint32 len = *pos;
-    PHYSFS_uint32 half_len;
-    PHYSFS_uint32 lo = 0;
-    PHYSFS_uint32 middle;
-    int cmp;
+    const PHYSFS_uint64 start = __PHYSFS_platformGetTicks();
+    PHYSFS_uint64 now;
+    PHYSFS_uint32 i;
 
-    while (len > 0)
+    if (req->paths != NULL)
+        req->result = prefetchFiles(req->paths, req->pathCount);
+    else if (req->filename == NULL)
+        req->result = PHYSFS_readAt(req->handle, req->offset,
+                                    req->buffer, req->len);
+    else
     {
-        half_len = len >> 1;
-        middle = lo + half_len;
-        cmp = strcmp(list[middle], str);
+        PHYSFS_uint64 len = 0;
+        req->buffer = PHYSFS_loadFile(req->filename, &len);
+        req->result = (req->buffer == NULL) ? -1 : (PHYSFS_sint64) len;
+    } /* else */
 
-        if (cmp == 0)  /* it's in the list already. */
-            return(1);
-        else if (cmp > 0)
-            len = half_len;
-        else
-        {
-            lo = middle + 1;
-            len -= half_len + 1;
-        } /* else */
-    } /* while */
+    if (req->result < 0)
+    {
+        const char *err = PHYSFS_getLastError();
+        strncpy(req->error, (err != NULL) ? err : "", sizeof (req->error));
+        req->error[sizeof (req->error) - 1] = '\0';
+        __PHYSFS_setError(req->error);  /* so the callback can see it, too. */
+    } /* if */
 
-    *pos = lo;
-    return(0);
-} /* locateInStringList */
+    if (req->callback != NULL)
+    {
+        req->callback(req->callbackData, (PHYSFS_AsyncRequest *) req,
+                      req->buffer, req->result);
+    } /* if */
 
+    now = __PHYSFS_platformGetTicks();
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    asyncStats.active--;
+    asyncStats.completed++;
+    if (req->result < 0)
+        asyncStats.failed++;
+    asyncStats.totalQueueMicroseconds += start - req->queuedTicks;
+    asyncStats.totalServiceMicroseconds += now - start;
+    if (now - req->queuedTicks > asyncStats.maxLatencyMicroseconds)
+        asyncStats.maxLatencyMicroseconds = now - req->queuedTicks;
+
+    req->finished = 1;
+    if (req->detached)
+        freeAsyncRequest(req);
+    else
+    {
+        for (i = 0; i < req->waiters; i++)
+            __PHYSFS_platformPostSemaphore(req->done);
+    } /* else */
+    __PHYSFS_platformReleaseMutex(asyncLock);
+} /* runAsyncRequest */
 
-static void enumFilesCallback(void *data, const char *origdir, const char *str)
+
+/*
+ * Worker threads sleep on (asyncWakeup), which is posted once per queued
+ *  request, and once per worker when it's time to quit. Finding the queue
+ *  empty after a wakeup means the latter.
+ */
+static void asyncWorker(void *unused)
 {
-    PHYSFS_uint32 pos;
-    void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    while (1)
+    {
+        AsyncRequest *req;
 
-    /*
-     * See if file is in the list already, and if not, insert it in there
-     *  alphabetically...
-     */
-    pos = pecd->size;
-    if (locateInStringList(str, pecd->list, &pos))
-        return;  /* already in the list. */
+        __PHYSFS_platformWaitSemaphore(asyncWakeup);
+        __PHYSFS_platformGrabMutex(asyncLock);
+        req = asyncQueue;
+        if (req == NULL)
+        {
+            __PHYSFS_platformReleaseMutex(asyncLock);
+            break;
+        } /* if */
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
+        asyncQueue = req->next;
+        if (asyncQueue == NULL)
+            asyncQueueTail = NULL;
+        asyncStats.queueDepth--;
+        asyncStats.active++;
+        __PHYSFS_platformReleaseMutex(asyncLock);
+
+        runAsyncRequest(req);
+    } /* while */
+} /* asyncWorker */
 
-    if ((ptr == NULL) || (newstr == NULL))
-        return;  /* better luck next time. */
 
-    strcpy(newstr, str);
+/* Call with (asyncLock) held. */
+static int startAsyncWorkers(void)
+{
+    PHYSFS_uint32 i;
+    void **threads;
 
-    if (pos != pecd->size)
+    if (asyncWakeup == NULL)
     {
-        memmove(&pecd->list[pos+1], &pecd->list[pos],
-                 sizeof (char *) * ((pecd->size) - pos));
+        asyncWakeup = __PHYSFS_platformCreateSemaphore();
+        BAIL_IF_MACRO(asyncWakeup == NULL, NULL, 0);
     } /* if */
 
-    pecd->list[pos] = newstr;
-    pecd->size++;
-} /* enumFilesCallback */
+    threads = (void **) allocator.Malloc(sizeof (void *) * asyncThreadsWanted);
+    BAIL_IF_MACRO(threads == NULL, ERR_OUT_OF_MEMORY, 0);
 
+    for (i = 0; i < asyncThreadsWanted; i++)
+    {
+        threads[i] = __PHYSFS_platformCreateThread(asyncWorker, NULL);
+        if (threads[i] == NULL)
+            break;  /* make do with what we've got. */
+    } /* for */
 
-char **PHYSFS_enumerateFiles(const char *path)
-{
-    EnumStringListCallbackData ecd;
-    memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF_MACRO(ecd.list == NULL, ERR_OUT_OF_MEMORY, NULL);
-    PHYSFS_enumerateFilesCallback(path, enumFilesCallback, &ecd);
-    ecd.list[ecd.size] = NULL;
-    return(ecd.list);
-} /* PHYSFS_enumerateFiles */
+    if (i == 0)
+    {
+        allocator.Free(threads);
+        return(0);
+    } /* if */
 
+    asyncThreads = threads;
+    asyncThreadCount = asyncStats.threads = i;
+    return(1);
+} /* startAsyncWorkers */
 
-/*
- * Broke out to seperate function so we can use stack allocation gratuitously.
- */
-static void enumerateFromMountPoint(DirHandle *i, const char *arcfname,
-                                    PHYSFS_EnumFilesCallback callback,
-                                    const char *_fname, void *data)
+
+/* Let the workers finish everything queued, then wait for them to quit. */
+static void stopAsyncWorkers(void)
 {
-    const size_t len = strlen(arcfname);
-    char *ptr = NULL;
-    char *end = NULL;
-    const size_t slen = strlen(i->mountPoint) + 1;
-    char *mountPoint = (char *) __PHYSFS_smallAlloc(slen);
+    PHYSFS_uint32 i;
+    PHYSFS_uint32 count;
+    void **threads;
 
-    if (mountPoint == NULL)
-        return;  /* oh well. */
+    __PHYSFS_platformGrabMutex(asyncLock);
+    threads = asyncThreads;
+    count = asyncThreadCount;
+    if ((count == 0) || (asyncStopping))
+    {
+        __PHYSFS_platformReleaseMutex(asyncLock);
+        return;
+    } /* if */
+    asyncStopping = 1;  /* new requests run synchronously for now. */
+    __PHYSFS_platformReleaseMutex(asyncLock);
 
-    strcpy(mountPoint, i->mountPoint);
-    ptr = mountPoint + ((len) ? len + 1 : 0);
-    end = strchr(ptr, '/');
-    assert(end);  /* should always find a terminating '/'. */
-    *end = '\0';
-    callback(data, _fname, ptr);
-    __PHYSFS_smallFree(mountPoint);
-} /* enumerateFromMountPoint */
+    for (i = 0; i < count; i++)
+        __PHYSFS_platformPostSemaphore(asyncWakeup);
 
+    for (i = 0; i < count; i++)
+        __PHYSFS_platformJoinThread(threads[i]);
 
-/* !!! FIXME: this should report error conditions. */
-void PHYSFS_enumerateFilesCallback(const char *_fname,
-                                   PHYSFS_EnumFilesCallback callback,
-                                   void *data)
-{
-    size_t len;
-    char *fname;
+    allocator.Free(threads);
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, ) /*0*/;
-    BAIL_IF_MACRO(callback == NULL, ERR_INVALID_ARGUMENT, ) /*0*/;
+    __PHYSFS_platformGrabMutex(asyncLock);
+    asyncThreads = NULL;
+    asyncThreadCount = asyncStats.threads = 0;
+    asyncStopping = 0;
+    __PHYSFS_platformReleaseMutex(asyncLock);
+} /* stopAsyncWorkers */
 
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, ) /*0*/;
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
-    {
-        DirHandle *i;
-        int noSyms;
+static PHYSFS_AsyncRequest *queueAsyncRequest(AsyncRequest *req)
+{
+    req->queuedTicks = __PHYSFS_platformGetTicks();
 
-        __PHYSFS_platformGrabMutex(stateLock);
-        noSyms = !allowSymLinks;
-        for (i = searchPath; i != NULL; i = i->next)
-        {
-            char *arcfname = fname;
-            if (partOfMountPoint(i, arcfname))
-                enumerateFromMountPoint(i, arcfname, callback, _fname, data);
+    __PHYSFS_platformGrabMutex(asyncLock);
+    if ((asyncThreadCount == 0) && (asyncThreadsWanted > 0) && (!asyncStopping))
+    {
+        if (!startAsyncWorkers())
+            asyncThreadsWanted = 0;  /* no threads here; don't keep trying. */
+    } /* if */
 
-            else if (verifyPath(i, &arcfname, 0))
-            {
-                i->funcs->enumerateFiles(i->opaque, arcfname, noSyms,
-                                         callback, _fname, data);
-            } /* else if */
-        } /* for */
-        __PHYSFS_platformReleaseMutex(stateLock);
+    if ((asyncThreadCount == 0) || (asyncStopping))
+    {
+        asyncStats.active++;
+        __PHYSFS_platformReleaseMutex(asyncLock);
+        runAsyncRequest(req);  /* nobody to hand it to; do it ourselves. */
+        return((PHYSFS_AsyncRequest *) req);
     } /* if */
 
-    __PHYSFS_smallFree(fname);
-} /* PHYSFS_enumerateFilesCallback */
+    if (asyncQueueTail == NULL)
+        asyncQueue = req;
+    else
+        asyncQueueTail->next = req;
+    asyncQueueTail = req;
 
+    asyncStats.queueDepth++;
+    if (asyncStats.queueDepth > asyncStats.maxQueueDepth)
+        asyncStats.maxQueueDepth = asyncStats.queueDepth;
 
-int PHYSFS_exists(const char *fname)
-{
-    return(PHYSFS_getRealDir(fname) != NULL);
-} /* PHYSFS_exists */
+    __PHYSFS_platformPostSemaphore(asyncWakeup);
+    __PHYSFS_platformReleaseMutex(asyncLock);
+    return((PHYSFS_AsyncRequest *) req);
+} /* queueAsyncRequest */
 
 
-PHYSFS_sint64 PHYSFS_getLastModTime(const char *_fname)
+static AsyncRequest *allocAsyncRequest(PHYSFS_AsyncCallback callback,
+                                       void *data)
 {
-    PHYSFS_sint64 retval = -1;
-    char *fname;
-    size_t len;
+    AsyncRequest *req;
+    req = (AsyncRequest *) allocator.Malloc(sizeof (AsyncRequest));
+    BAIL_IF_MACRO(req == NULL, ERR_OUT_OF_MEMORY, NULL);
+    memset(req, '\0', sizeof (AsyncRequest));
+    req->callback = callback;
+    req->callbackData = data;
+    return(req);
+} /* allocAsyncRequest */
+
+
+PHYSFS_AsyncRequest *PHYSFS_readAsync(PHYSFS_File *handle,
+                                      PHYSFS_uint64 offset, void *buffer,
+                                      PHYSFS_uint64 len,
+                                      PHYSFS_AsyncCallback callback,
+                                      void *data)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    AsyncRequest *req;
+
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF_MACRO(handle == NULL, ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF_MACRO((buffer == NULL) && (len > 0), ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF_MACRO(!fh->forReading, ERR_FILE_ALREADY_OPEN_W, NULL);
+
+    req = allocAsyncRequest(callback, data);
+    BAIL_IF_MACRO(req == NULL, NULL, NULL);
+    req->handle = handle;
+    req->offset = offset;
+    req->buffer = buffer;
+    req->len = len;
+    return(queueAsyncRequest(req));
+} /* PHYSFS_readAsync */
+
+
+PHYSFS_AsyncRequest *PHYSFS_loadAsync(const char *filename,
+                                      PHYSFS_AsyncCallback callback,
+                                      void *data)
+{
+    AsyncRequest *req;
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, -1);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, -1);
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF_MACRO(filename == NULL, ERR_INVALID_ARGUMENT, NULL);
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    req = allocAsyncRequest(callback, data);
+    BAIL_IF_MACRO(req == NULL, NULL, NULL);
+    req->filename = (char *) allocator.Malloc(strlen(filename) + 1);
+    if (req->filename == NULL)
     {
-        if (*fname == '\0')   /* eh...punt if it's the root dir. */
-            retval = 1;  /* !!! FIXME: Maybe this should be an error? */
-        else
-        {
-            DirHandle *i;
-            int exists = 0;
-            __PHYSFS_platformGrabMutex(stateLock);
-            for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
-            {
-                char *arcfname = fname;
-                exists = partOfMountPoint(i, arcfname);
-                if (exists)
-                    retval = 1; /* !!! FIXME: What's the right value? */
-                else if (verifyPath(i, &arcfname, 0))
-                {
-                    retval = i->funcs->getLastModTime(i->opaque, arcfname,
-                                                      &exists);
-                } /* else if */
-            } /* for */
-            __PHYSFS_platformReleaseMutex(stateLock);
-        } /* else */
+        allocator.Free(req);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
     } /* if */
-
-    __PHYSFS_smallFree(fname);
-    return(retval);
-} /* PHYSFS_getLastModTime */
+    strcpy(req->filename, filename);
+    return(queueAsyncRequest(req));
+} /* PHYSFS_loadAsync */
 
 
-int PHYSFS_isDirectory(const char *_fname)
+PHYSFS_AsyncRequest *PHYSFS_prefetch(const char **paths,
+                                     PHYSFS_uint32 count)
 {
-    int retval = 0;
-    size_t len;
-    char *fname;
+    AsyncRequest *req;
+    size_t len = 0;
+    char *ptr;
+    PHYSFS_uint32 i;
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, NULL);
+    BAIL_IF_MACRO((paths == NULL) && (count > 0), ERR_INVALID_ARGUMENT, NULL);
 
-    if (!sanitizePlatformIndependentPath(_fname, fname))
-        retval = 0;
+    for (i = 0; i < count; i++)
+    {
+        BAIL_IF_MACRO(paths[i] == NULL, ERR_INVALID_ARGUMENT, NULL);
+        len += strlen(paths[i]) + 1;
+    } /* for */
 
-    else if (*fname == '\0')
-        retval = 1;  /* Root is always a dir.  :) */
+    req = allocAsyncRequest(NULL, NULL);
+    BAIL_IF_MACRO(req == NULL, NULL, NULL);
 
-    else
+    /* copy the list, so the app can free theirs as soon as we return. */
+    req->paths = (char **) allocator.Malloc((sizeof (char *) * (count + 1)) + len);
+    if (req->paths == NULL)
     {
-        DirHandle *i;
-        int exists = 0;
+        allocator.Free(req);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
 
-        __PHYSFS_platformGrabMutex(stateLock);
-        for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
-        {
-            char *arcfname = fname;
-            if ((exists = partOfMountPoint(i, arcfname)) != 0)
-                retval = 1;
-            else if (verifyPath(i, &arcfname, 0))
-                retval = i->funcs->isDirectory(i->opaque, arcfname, &exists);
-        } /* for */
-        __PHYSFS_platformReleaseMutex(stateLock);
-    } /* else */
+    ptr = (char *) (req->paths + count + 1);
+    for (i = 0; i < count; i++)
+    {
+        req->paths[i] = ptr;
+        strcpy(ptr, paths[i]);
+        ptr += strlen(ptr) + 1;
+    } /* for */
+    req->paths[count] = NULL;
+    req->pathCount = count;
 
-    __PHYSFS_smallFree(fname);
-    return(retval);
-} /* PHYSFS_isDirectory */
+    return(queueAsyncRequest(req));
+} /* PHYSFS_prefetch */
 
 
-int PHYSFS_isSymbolicLink(const char *_fname)
+int PHYSFS_asyncDone(PHYSFS_AsyncRequest *_req)
 {
-    int retval = 0;
-    size_t len;
-    char *fname;
-
-    BAIL_IF_MACRO(!allowSymLinks, ERR_SYMLINK_DISALLOWED, 0);
-
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+    AsyncRequest *req = (AsyncRequest *) _req;
+    int retval;
 
-    if (!sanitizePlatformIndependentPath(_fname, fname))
-        retval = 0;
+    BAIL_IF_MACRO(req == NULL, ERR_INVALID_ARGUMENT, 0);
+    __PHYSFS_platformGrabMutex(asyncLock);
+    retval = (int) req->finished;
+    __PHYSFS_platformReleaseMutex(asyncLock);
+    return(retval);
+} /* PHYSFS_asyncDone */
 
-    else if (*fname == '\0')
-        retval = 1;  /* Root is never a symlink. */
 
-    else
-    {
-        DirHandle *i;
-        int fileExists = 0;
+PHYSFS_sint64 PHYSFS_asyncWait(PHYSFS_AsyncRequest *_req, void **buffer)
+{
+    AsyncRequest *req = (AsyncRequest *) _req;
 
-        __PHYSFS_platformGrabMutex(stateLock);
-        for (i = searchPath; ((i != NULL) && (!fileExists)); i = i->next)
-        {
-            char *arcfname = fname;
-            if ((fileExists = partOfMountPoint(i, arcfname)) != 0)
-                retval = 0;  /* virtual dir...not a symlink. */
-            else if (verifyPath(i, &arcfname, 0))
-                retval = i->funcs->isSymLink(i->opaque, arcfname, &fileExists);
-        } /* for */
-        __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF_MACRO(req == NULL, ERR_INVALID_ARGUMENT, -1);
+
+    __PHYSFS_platformGrabMutex(asyncLock);
+    if (req->finished)
+        __PHYSFS_platformReleaseMutex(asyncLock);
+    else
+    {
+        if (req->done == NULL)
+            req->done = __PHYSFS_platformCreateSemaphore();
+        BAIL_IF_MACRO_MUTEX(req->done == NULL, NULL, asyncLock, -1);
+        req->waiters++;
+        __PHYSFS_platformReleaseMutex(asyncLock);
+        __PHYSFS_platformWaitSemaphore(req->done);
     } /* else */
 
-    __PHYSFS_smallFree(fname);
-    return(retval);
-} /* PHYSFS_isSymbolicLink */
+    if (buffer != NULL)
+        *buffer = req->buffer;
 
+    BAIL_IF_MACRO(req->result < 0, req->error, -1);
+    return(req->result);
+} /* PHYSFS_asyncWait */
 
-static PHYSFS_File *doOpenWrite(const char *_fname, int appending)
+
+void PHYSFS_asyncFree(PHYSFS_AsyncRequest *_req)
 {
-    FileHandle *fh = NULL;
-    size_t len;
-    char *fname;
+    AsyncRequest *req = (AsyncRequest *) _req;
+    int finished;
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
+    if (req == NULL)
+        return;
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+    __PHYSFS_platformGrabMutex(asyncLock);
+    finished = (int) req->finished;
+    if (!finished)
+        req->detached = 1;  /* the worker frees it when it's done. */
+    __PHYSFS_platformReleaseMutex(asyncLock);
+
+    if (finished)
+        freeAsyncRequest(req);
+} /* PHYSFS_asyncFree */
+
+
+int PHYSFS_setAsyncThreadCount(PHYSFS_uint32 count)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+    stopAsyncWorkers();  /* the next request starts (count) new ones. */
+    __PHYSFS_platformGrabMutex(asyncLock);
+    asyncThreadsWanted = count;
+    __PHYSFS_platformReleaseMutex(asyncLock);
+    return(1);
+} /* PHYSFS_setAsyncThreadCount */
+
+
+void PHYSFS_getAsyncStats(PHYSFS_AsyncStats *stats)
+{
+    BAIL_IF_MACRO(stats == NULL, ERR_INVALID_ARGUMENT, );
+    if (!initialized)
     {
-        void *opaque = NULL;
-        DirHandle *h = NULL;
-        const PHYSFS_Archiver *f;
+        memset(stats, '\0', sizeof (PHYSFS_AsyncStats));
+        return;
+    } /* if */
 
-        __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_platformGrabMutex(asyncLock);
+    memcpy(stats, &asyncStats, sizeof (PHYSFS_AsyncStats));
+    __PHYSFS_platformReleaseMutex(asyncLock);
+} /* PHYSFS_getAsyncStats */
 
-        GOTO_IF_MACRO(!writeDir, ERR_NO_WRITE_DIR, doOpenWriteEnd);
 
-        h = writeDir;
-        GOTO_IF_MACRO(!verifyPath(h, &fname, 0), NULL, doOpenWriteEnd);
+void PHYSFS_getZipStats(PHYSFS_ZipStats *stats)
+{
+    BAIL_IF_MACRO(stats == NULL, ERR_INVALID_ARGUMENT, );
+    memset(stats, '\0', sizeof (PHYSFS_ZipStats));
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    if (initialized)
+        __PHYSFS_zipGetStats(stats);
+#endif
+} /* PHYSFS_getZipStats */
 
-        f = h->funcs;
-        if (appending)
-            opaque = f->openAppend(h->opaque, fname);
-        else
-            opaque = f->openWrite(h->opaque, fname);
 
-        GOTO_IF_MACRO(opaque == NULL, NULL, doOpenWriteEnd);
+int PHYSFS_setZipCheckpointInterval(PHYSFS_uint32 interval)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipSetCheckpointInterval(interval);
+#endif
+    return(1);
+} /* PHYSFS_setZipCheckpointInterval */
 
-        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-        if (fh == NULL)
-        {
-            f->fileClose(opaque);
-            GOTO_MACRO(ERR_OUT_OF_MEMORY, doOpenWriteEnd);
-        } /* if */
-        else
-        {
-            memset(fh, '\0', sizeof (FileHandle));
-            fh->opaque = opaque;
-            fh->dirHandle = h;
-            fh->funcs = h->funcs;
-            fh->next = openWriteList;
-            openWriteList = fh;
-        } /* else */
 
-        doOpenWriteEnd:
-        __PHYSFS_platformReleaseMutex(stateLock);
-    } /* if */
+int PHYSFS_setZipCache(PHYSFS_uint64 budget, PHYSFS_uint32 maxEntrySize)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipSetCache(budget, maxEntrySize);
+#endif
+    return(1);
+} /* PHYSFS_setZipCache */
 
-    __PHYSFS_smallFree(fname);
-    return((PHYSFS_File *) fh);
-} /* doOpenWrite */
+
+int PHYSFS_setZipInflaterPool(PHYSFS_uint32 count)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipSetInflaterPool(count);
+#endif
+    return(1);
+} /* PHYSFS_setZipInflaterPool */
 
 
-PHYSFS_File *PHYSFS_openWrite(const char *filename)
+int PHYSFS_setZipResolveOnMount(int enable)
 {
-    return(doOpenWrite(filename, 0));
-} /* PHYSFS_openWrite */
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipSetResolveOnMount(enable);
+#endif
+    return(1);
+} /* PHYSFS_setZipResolveOnMount */
 
 
-PHYSFS_File *PHYSFS_openAppend(const char *filename)
+int PHYSFS_setZipMapArchives(int enable)
 {
-    return(doOpenWrite(filename, 1));
-} /* PHYSFS_openAppend */
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_ZIP)
+    __PHYSFS_zipSetMapArchives(enable);
+#endif
+    return(1);
+} /* PHYSFS_setZipMapArchives */
 
 
-PHYSFS_File *PHYSFS_openRead(const char *_fname)
+void PHYSFS_get7zStats(PHYSFS_7zStats *stats)
 {
-    FileHandle *fh = NULL;
-    char *fname;
-    size_t len;
+    BAIL_IF_MACRO(stats == NULL, ERR_INVALID_ARGUMENT, );
+    memset(stats, '\0', sizeof (PHYSFS_7zStats));
+#if (defined PHYSFS_SUPPORTS_7Z)
+    if (initialized)
+        __PHYSFS_lzmaGetStats(stats);
+#endif
+} /* PHYSFS_get7zStats */
 
-    BAIL_IF_MACRO(_fname == NULL, ERR_INVALID_ARGUMENT, 0);
-    len = strlen(_fname) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MACRO(fname == NULL, ERR_OUT_OF_MEMORY, 0);
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
-    {
-        int fileExists = 0;
-        DirHandle *i = NULL;
-        fvoid *opaque = NULL;
+int PHYSFS_set7zCache(PHYSFS_uint64 budget)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_7Z)
+    __PHYSFS_lzmaSetCache(budget);
+#endif
+    return(1);
+} /* PHYSFS_set7zCache */
 
-        __PHYSFS_platformGrabMutex(stateLock);
 
-        GOTO_IF_MACRO(!searchPath, ERR_NO_SUCH_PATH, openReadEnd);
+/* A file for PHYSFS_predecode(), and the 7z folder it's packed in. */
+typedef struct
+{
+    PHYSFS_File *file;
+    const void *folder;  /* NULL if it's not in a 7z archive. */
+} PredecodeItem;
 
-        /* !!! FIXME: Why aren't we using a for loop here? */
-        i = searchPath;
+/*
+ * PHYSFS_predecode()'s work list. Its threads each take the next item
+ *  until there are none left.
+ */
+typedef struct
+{
+    PredecodeItem *items;
+    PHYSFS_uint32 count;
+    PHYSFS_uint32 next;
+    void *lock;  /* guards (next), (failed) and (error). */
+    int failed;
+    char error[80];  /* the first thing that went wrong. */
+} PredecodeWork;
 
-        do
-        {
-            char *arcfname = fname;
-            if (verifyPath(i, &arcfname, 0))
-            {
-                opaque = i->funcs->openRead(i->opaque, arcfname, &fileExists);
-                if (opaque)
-                    break;
-            } /* if */
-            i = i->next;
-        } while ((i != NULL) && (!fileExists));
 
-        /* !!! FIXME: may not set an error if openRead didn't fail. */
-        GOTO_IF_MACRO(opaque == NULL, NULL, openReadEnd);
+static int predecodeItemCmp(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    PredecodeItem *items = (PredecodeItem *) _a;
+    const size_t a = (size_t) items[one].folder;
+    const size_t b = (size_t) items[two].folder;
+    return((a < b) ? -1 : ((a > b) ? 1 : 0));
+} /* predecodeItemCmp */
 
-        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-        if (fh == NULL)
-        {
-            i->funcs->fileClose(opaque);
-            GOTO_MACRO(ERR_OUT_OF_MEMORY, openReadEnd);
-        } /* if */
 
-        memset(fh, '\0', sizeof (FileHandle));
-        fh->opaque = opaque;
-        fh->forReading = 1;
-        fh->dirHandle = i;
-        fh->funcs = i->funcs;
-        fh->next = openReadList;
-        openReadList = fh;
+static void predecodeItemSwap(void *_a, PHYSFS_uint32 one, PHYSFS_uint32 two)
+{
+    PredecodeItem *items = (PredecodeItem *) _a;
+    PredecodeItem tmp;
+    memcpy(&tmp, &items[one], sizeof (PredecodeItem));
+    memcpy(&items[one], &items[two], sizeof (PredecodeItem));
+    memcpy(&items[two], &tmp, sizeof (PredecodeItem));
+} /* predecodeItemSwap */
 
-        openReadEnd:
-        __PHYSFS_platformReleaseMutex(stateLock);
-    } /* if */
 
-    __PHYSFS_smallFree(fname);
-    return((PHYSFS_File *) fh);
-} /* PHYSFS_openRead */
+static int predecodeItem(PredecodeItem *item, PHYSFS_uint8 *scratch,
+                         PHYSFS_uint32 scratchlen)
+{
+#if (defined PHYSFS_SUPPORTS_7Z)
+    if (item->folder != NULL)
+        return(__PHYSFS_lzmaPredecode(((FileHandle *) item->file)->opaque));
+#endif
+    prefetchHandle(item->file, scratch, scratchlen);
+    return(1);
+} /* predecodeItem */
 
 
-static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
+static void predecodeWorker(void *_work)
 {
-    FileHandle *prev = NULL;
-    FileHandle *i;
-    int rc = 1;
+    PredecodeWork *work = (PredecodeWork *) _work;
+    const PHYSFS_uint32 scratchlen = 64 * 1024;
+    PHYSFS_uint8 *scratch = (PHYSFS_uint8 *) allocator.Malloc(scratchlen);
 
-    for (i = *list; i != NULL; i = i->next)
+    while (1)
     {
-        if (i == handle)  /* handle is in this list? */
-        {
-            PHYSFS_uint8 *tmp = handle->buffer;
-            rc = PHYSFS_flush((PHYSFS_File *) handle);
-            if (rc)
-                rc = handle->funcs->fileClose(handle->opaque);
-            if (!rc)
-                return(-1);
+        PredecodeItem *item = NULL;
 
-            if (tmp != NULL)  /* free any associated buffer. */
-                allocator.Free(tmp);
+        __PHYSFS_platformGrabMutex(work->lock);
+        if (work->next < work->count)
+            item = &work->items[work->next++];
+        __PHYSFS_platformReleaseMutex(work->lock);
 
-            if (prev == NULL)
-                *list = handle->next;
-            else
-                prev->next = handle->next;
+        if (item == NULL)
+            break;
 
-            allocator.Free(handle);
-            return(1);
+        if (!predecodeItem(item, scratch, scratchlen))
+        {
+            const char *err = PHYSFS_getLastError();
+            __PHYSFS_platformGrabMutex(work->lock);
+            if (!work->failed)
+            {
+                work->failed = 1;
+                strncpy(work->error, (err != NULL) ? err : "",
+                        sizeof (work->error));
+                work->error[sizeof (work->error) - 1] = '\0';
+            } /* if */
+            __PHYSFS_platformReleaseMutex(work->lock);
         } /* if */
-        prev = i;
-    } /* for */
+    } /* while */
 
-    return(0);
-} /* closeHandleInOpenList */
+    if (scratch != NULL)
+        allocator.Free(scratch);
+} /* predecodeWorker */
 
 
-int PHYSFS_close(PHYSFS_File *_handle)
+PHYSFS_sint64 PHYSFS_predecode(const char **paths, PHYSFS_uint32 count)
 {
-    FileHandle *handle = (FileHandle *) _handle;
-    int rc;
+    PredecodeWork work;
+    void **threads = NULL;
+    PHYSFS_uint32 threadCount;
+    PHYSFS_uint32 started = 0;
+    PHYSFS_uint32 found = 0;
+    PHYSFS_uint32 i;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, -1);
+    BAIL_IF_MACRO((paths == NULL) && (count > 0), ERR_INVALID_ARGUMENT, -1);
+    for (i = 0; i < count; i++)
+        BAIL_IF_MACRO(paths[i] == NULL, ERR_INVALID_ARGUMENT, -1);
+    if (count == 0)
+        return(0);
 
-    /* -1 == close failure. 0 == not found. 1 == success. */
-    rc = closeHandleInOpenList(&openReadList, handle);
-    BAIL_IF_MACRO_MUTEX(rc == -1, NULL, stateLock, 0);
-    if (!rc)
+    memset(&work, '\0', sizeof (work));
+    work.items = (PredecodeItem *)
+                    allocator.Malloc(sizeof (PredecodeItem) * count);
+    BAIL_IF_MACRO(work.items == NULL, ERR_OUT_OF_MEMORY, -1);
+    work.lock = __PHYSFS_platformCreateMutex();
+    if (work.lock == NULL)
     {
-        rc = closeHandleInOpenList(&openWriteList, handle);
-        BAIL_IF_MACRO_MUTEX(rc == -1, NULL, stateLock, 0);
+        allocator.Free(work.items);
+        return(-1);
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    BAIL_IF_MACRO(!rc, ERR_NOT_A_HANDLE, 0);
-    return(1);
-} /* PHYSFS_close */
-
+    /* opening is quick; it's the decoding that's worth spreading out. */
+    for (i = 0; i < count; i++)
+    {
+        PHYSFS_File *file = PHYSFS_openRead(paths[i]);
+        if (file == NULL)
+            continue;  /* missing files aren't an error. */
 
-static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *buffer,
-                                    PHYSFS_uint32 objSize,
-                                    PHYSFS_uint32 objCount)
-{
-    PHYSFS_sint64 retval = 0;
-    PHYSFS_uint32 remainder = 0;
+        work.items[found].file = file;
+        work.items[found].folder = NULL;
+#if (defined PHYSFS_SUPPORTS_7Z)
+        {
+            FileHandle *fh = (FileHandle *) file;
+            if (fh->funcs == &__PHYSFS_Archiver_LZMA)
+                work.items[found].folder = __PHYSFS_lzmaFolderOf(fh->opaque);
+        }
+#endif
+        found++;
+    } /* for */
 
-    while (objCount > 0)
+    /* sorted, files sharing a folder are side by side; decode the first. */
+    __PHYSFS_sort(work.items, found, predecodeItemCmp, predecodeItemSwap);
+    for (i = 0; i < found; i++)
     {
-        PHYSFS_uint32 buffered = fh->buffill - fh->bufpos;
-        PHYSFS_uint64 mustread = (objSize * objCount) - remainder;
-        PHYSFS_uint32 copied;
+        const void *folder = work.items[i].folder;
+        if ( (folder != NULL) && (work.count > 0) &&
+             (work.items[work.count - 1].folder == folder) )
+            PHYSFS_close(work.items[i].file);
+        else
+            work.items[work.count++] = work.items[i];
+    } /* for */
 
-        if (buffered == 0) /* need to refill buffer? */
+    /* one thread per core, counting this one, but no more than the work. */
+    threadCount = __PHYSFS_platformCpuCount();
+    if (threadCount > work.count)
+        threadCount = work.count;
+    if (threadCount > 1)
+        threads = (void **) allocator.Malloc(sizeof (void *) * threadCount);
+    if (threads != NULL)
+    {
+        for (started = 0; started < threadCount - 1; started++)
         {
-            PHYSFS_sint64 rc = fh->funcs->read(fh->opaque, fh->buffer,
-                                                1, fh->bufsize);
-            if (rc <= 0)
-            {
-                fh->bufpos -= remainder;
-                return(((rc == -1) && (retval == 0)) ? -1 : retval);
-            } /* if */
-
-            buffered = fh->buffill = (PHYSFS_uint32) rc;
-            fh->bufpos = 0;
-        } /* if */
+            threads[started] = __PHYSFS_platformCreateThread(predecodeWorker,
+                                                             &work);
+            if (threads[started] == NULL)
+                break;  /* make do with what we've got. */
+        } /* for */
+    } /* if */
 
-        if (buffered > mustread)
-            buffered = (PHYSFS_uint32) mustread;
+    predecodeWorker(&work);
 
-        memcpy(buffer, fh->buffer + fh->bufpos, (size_t) buffered);
-        buffer = ((PHYSFS_uint8 *) buffer) + buffered;
-        fh->bufpos += buffered;
-        buffered += remainder;  /* take remainder into account. */
-        copied = (buffered / objSize);
-        remainder = (buffered % objSize);
-        retval += copied;
-        objCount -= copied;
-    } /* while */
+    for (i = 0; i < started; i++)
+        __PHYSFS_platformJoinThread(threads[i]);
+    if (threads != NULL)
+        allocator.Free(threads);
 
-    return(retval);
-} /* doBufferedRead */
+    /* the decoded folders are pinned now; the handles can go. */
+    for (i = 0; i < work.count; i++)
+        PHYSFS_close(work.items[i].file);
 
+    __PHYSFS_platformDestroyMutex(work.lock);
+    allocator.Free(work.items);
 
-PHYSFS_sint64 PHYSFS_read(PHYSFS_File *handle, void *buffer,
-                          PHYSFS_uint32 objSize, PHYSFS_uint32 objCount)
-{
-    FileHandle *fh = (FileHandle *) handle;
+    BAIL_IF_MACRO(work.failed, work.error, -1);
+    return((PHYSFS_sint64) found);
+} /* PHYSFS_predecode */
 
-    BAIL_IF_MACRO(!fh->forReading, ERR_FILE_ALREADY_OPEN_W, -1);
-    BAIL_IF_MACRO(objSize == 0, NULL, 0);
-    BAIL_IF_MACRO(objCount == 0, NULL, 0);
-    if (fh->buffer != NULL)
-        return(doBufferedRead(fh, buffer, objSize, objCount));
 
-    return(fh->funcs->read(fh->opaque, buffer, objSize, objCount));
-} /* PHYSFS_read */
+int PHYSFS_releasePredecoded(void)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, 0);
+#if (defined PHYSFS_SUPPORTS_7Z)
+    __PHYSFS_lzmaReleasePinned();
+#endif
+    return(1);
+} /* PHYSFS_releasePredecoded */
 
 
 static PHYSFS_sint64 doBufferedWrite(PHYSFS_File *handle, const void *buffer,
@@ -2150,6 +4488,13 @@ int PHYSFS_setAllocator(const PHYSFS_Allocator *a)
 } /* PHYSFS_setAllocator */
 
 
+const PHYSFS_Allocator *PHYSFS_getAllocator(void)
+{
+    BAIL_IF_MACRO(!initialized, ERR_NOT_INITIALIZED, NULL);
+    return(&allocator);
+} /* PHYSFS_getAllocator */
+
+
 static void *mallocAllocatorMalloc(PHYSFS_uint64 s)
 {
     BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(s), ERR_OUT_OF_MEMORY, NULL);
@@ -2219,4 +4564,3 @@ void __PHYSFS_smallFree(void *ptr)
 } /* __PHYSFS_smallFree */
 
 /* end of physfs.c ... */
-
@@ -623,6 +623,12 @@ __EXPORT__ const char *PHYSFS_getDirSeparator(void);
  *  in platform-independent notation. That is, when setting up your
  *  search and write paths, etc, symlinks are never checked for.
  *
+ * To save time, PhysicsFS remembers which directories it has already checked,
+ *  and only checks them again after something is written through PhysicsFS.
+ *  If directories in the search path might be replaced with symlinks behind
+ *  PhysicsFS's back, call this function again (with the same value) to make
+ *  it forget and recheck everything.
+ *
  * Symbolic link permission can be enabled or disabled at any time after
  *  you've called PHYSFS_init(), and is disabled by default.
  *
@@ -2385,6 +2391,791 @@ __EXPORT__ void PHYSFS_utf8FromLatin1(const char *src, char *dst,
 /* Everything above this line is part of the PhysicsFS 2.0 API. */
 
 
+/**
+ * \fn void PHYSFS_enableSearchPathIndex(int enable)
+ * \brief Enable or disable the search path index.
+ *
+ * Normally, looking up a file means asking every archive in the search path,
+ *  in order, until one of them has it. With a lot of archives mounted, this
+ *  adds up, especially for files that don't exist anywhere.
+ *
+ * When the index is enabled, PhysicsFS catalogs the contents of every
+ *  mounted archive (but not physical directories, whose contents may change
+ *  behind our backs), and PHYSFS_openRead(), PHYSFS_exists(),
+ *  PHYSFS_getRealDir(), PHYSFS_isDirectory() and PHYSFS_getLastModTime()
+ *  use it to go straight to the archive that has a given file. Results are
+ *  identical either way; this only changes how fast they are found.
+ *
+ * The index is updated as archives are mounted and removed, which makes
+ *  mounting slower, and it costs some memory per file. If building it fails
+ *  (out of memory, etc), PhysicsFS quietly goes back to walking the search
+ *  path.
+ *
+ * The index can be enabled or disabled at any time, and is disabled by
+ *  default.
+ *
+ *   \param enable nonzero to enable the index, zero to disable and free it.
+ *
+ * \sa PHYSFS_searchPathIndexEnabled
+ */
+__EXPORT__ void PHYSFS_enableSearchPathIndex(int enable);
+
+
+/**
+ * \fn int PHYSFS_searchPathIndexEnabled(void)
+ * \brief Determine if the search path index is enabled.
+ *
+ *   \return true if enabled, false otherwise.
+ *
+ * \sa PHYSFS_enableSearchPathIndex
+ */
+__EXPORT__ int PHYSFS_searchPathIndexEnabled(void);
+
+
+/**
+ * \fn int PHYSFS_setNegativeCacheSize(PHYSFS_uint32 entries)
+ * \brief Set the size of the cache of files known not to exist.
+ *
+ * Probing for files that usually aren't there (optional overrides, trying
+ *  several file extensions in turn, etc) is expensive: every miss has to ask
+ *  every archive and directory in the search path, which often means a
+ *  system call per directory. With this cache enabled, PhysicsFS remembers
+ *  up to (entries) recent misses, and PHYSFS_openRead(), PHYSFS_exists()
+ *  and PHYSFS_getRealDir() fail immediately if asked for one of them again.
+ *
+ * The cache is flushed automatically by anything done through PhysicsFS
+ *  that might make a missing file appear: mounting, unmounting, changing the
+ *  write dir, opening files for writing, deleting, making directories, and
+ *  changing symlink permission. It can not know about files that other
+ *  processes create in directories in the search path, though; if you
+ *  expect that, call PHYSFS_flushNegativeCache() when it happens.
+ *
+ * The cache is disabled (has zero entries) by default. Setting a new size
+ *  discards anything that was cached.
+ *
+ *   \param entries Maximum number of misses to remember. Zero disables the
+ *                  cache.
+ *  \return nonzero on success, zero on error. Specifics of the error can be
+ *          gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_flushNegativeCache
+ * \sa PHYSFS_getNegativeCacheStats
+ */
+__EXPORT__ int PHYSFS_setNegativeCacheSize(PHYSFS_uint32 entries);
+
+
+/**
+ * \fn void PHYSFS_flushNegativeCache(void)
+ * \brief Forget every cached miss.
+ *
+ * Call this if files might have been added to the search path behind
+ *  PhysicsFS's back.
+ *
+ * \sa PHYSFS_setNegativeCacheSize
+ */
+__EXPORT__ void PHYSFS_flushNegativeCache(void);
+
+
+/**
+ * \fn void PHYSFS_getNegativeCacheStats(PHYSFS_uint64 *hits, PHYSFS_uint64 *misses)
+ * \brief Report how well the negative lookup cache is doing.
+ *
+ * A hit is a lookup that the cache answered without searching. A miss is a
+ *  lookup that had to search the search path (whether or not the file turned
+ *  out to exist). Lookups made while the cache is disabled aren't counted.
+ *  The counters are reset by PHYSFS_deinit().
+ *
+ *   \param hits If not NULL, receives the number of cache hits.
+ *   \param misses If not NULL, receives the number of cache misses.
+ *
+ * \sa PHYSFS_setNegativeCacheSize
+ */
+__EXPORT__ void PHYSFS_getNegativeCacheStats(PHYSFS_uint64 *hits,
+                                             PHYSFS_uint64 *misses);
+
+
+/**
+ * \fn const void *PHYSFS_mapFile(const char *filename, PHYSFS_uint64 *len)
+ * \brief Get a read-only view of a file's entire contents.
+ *
+ * This is a fast way to get at a whole file without copying it through a
+ *  buffer of your own. Where possible, PhysicsFS hands back a memory mapping
+ *  of the data: files in a physical directory, and files stored without
+ *  compression in an archive (ZIP entries that weren't deflated, and
+ *  everything in GRP, HOG, MVL, WAD and QPAK files) are mapped directly from
+ *  disk, and only the parts you actually touch are paged in. Files in 7z
+ *  archives point straight into the decoded folder they're packed in, which
+ *  stays in memory, shared with any other reader of the folder, until you
+ *  unmap them (folders too big to decode whole are the exception). Other
+ *  files (compressed data, or on platforms that can't map files) are
+ *  decompressed or read into a buffer, once, which you get instead. Either
+ *  way, you don't need to care which one you got.
+ *
+ * The returned memory is read-only! Writing to it may crash your program.
+ *  The view stays valid until you pass it to PHYSFS_unmapFile(), even if
+ *  the archive it came from is removed from the search path in the
+ *  meantime. PHYSFS_deinit() releases any views you didn't.
+ *
+ * If the file on disk is changed while it's mapped, the results are
+ *  undefined.
+ *
+ *   \param filename File to view, in platform-independent notation.
+ *   \param len Receives the length of the file, in bytes.
+ *  \return A pointer to the file's contents, or NULL on error. Specifics of
+ *          the error can be gleaned from PHYSFS_getLastError(). Empty files
+ *          return a valid pointer (and a length of zero).
+ *
+ * \sa PHYSFS_unmapFile
+ */
+__EXPORT__ const void *PHYSFS_mapFile(const char *filename,
+                                      PHYSFS_uint64 *len);
+
+
+/**
+ * \fn int PHYSFS_unmapFile(const void *data)
+ * \brief Release a view from PHYSFS_mapFile().
+ *
+ *   \param data A pointer previously returned by PHYSFS_mapFile().
+ *  \return nonzero on success, zero on error (not a pointer we gave you).
+ *
+ * \sa PHYSFS_mapFile
+ */
+__EXPORT__ int PHYSFS_unmapFile(const void *data);
+
+
+/**
+ * \fn void *PHYSFS_loadFile(const char *filename, PHYSFS_uint64 *len)
+ * \brief Read an entire file into memory in one call.
+ *
+ * This is the same as opening (filename), allocating a buffer of
+ *  PHYSFS_fileLength() bytes, reading the whole thing into it and closing
+ *  the file, but cheaper: no PHYSFS_File is created, and the data is read
+ *  (or decompressed) straight into the buffer in one pass.
+ *
+ * The buffer is allocated with the current allocator, and is exactly as
+ *  big as the file (except an empty file still gets a one-byte buffer).
+ *  Free it with PHYSFS_getAllocator()->Free() when you're done.
+ *
+ *   \param filename File to load, in platform-independent notation.
+ *   \param len Receives the length of the file, in bytes.
+ *  \return The file's contents, or NULL on error. Specifics of the error
+ *          can be gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_mapFile
+ * \sa PHYSFS_loadAsync
+ */
+__EXPORT__ void *PHYSFS_loadFile(const char *filename, PHYSFS_uint64 *len);
+
+
+/**
+ * \fn const PHYSFS_Allocator *PHYSFS_getAllocator(void)
+ * \brief Discover the current allocator.
+ *
+ * This function exposes the function pointers that make up the currently
+ *  used allocator. You need this to free memory PhysicsFS allocated on
+ *  your behalf, such as the buffer from PHYSFS_loadFile(), and it's also
+ *  handy for external code that wants to share the same allocator.
+ *
+ * This call is only valid between PHYSFS_init() and PHYSFS_deinit() calls;
+ *  it will return NULL if the library isn't initialized. Don't use the
+ *  returned allocator after a call to PHYSFS_deinit().
+ *
+ * Do not call the returned allocator's Init() or Deinit() methods under any
+ *  circumstances.
+ *
+ *  \return Pointer to the current allocator, or NULL if not initialized.
+ *
+ * \sa PHYSFS_Allocator
+ * \sa PHYSFS_setAllocator
+ */
+__EXPORT__ const PHYSFS_Allocator *PHYSFS_getAllocator(void);
+
+
+/**
+ * \fn PHYSFS_sint64 PHYSFS_readAt(PHYSFS_File *handle, PHYSFS_uint64 offset, void *buffer, PHYSFS_uint64 len)
+ * \brief Read data from a specific position in a PhysicsFS filehandle.
+ *
+ * This is like seeking to (offset) and calling PHYSFS_read(), except it
+ *  doesn't use or change the handle's file position, and you may call it
+ *  from several threads at once on the same handle. This lets you fan reads
+ *  of one big file out across threads without opening it over and over.
+ *
+ * Files in a physical directory and files stored uncompressed in an archive
+ *  are read with no locking at all on platforms that support it. Compressed
+ *  files still work, but calls on the same handle take turns, since there's
+ *  only one decompressor per handle.
+ *
+ * Calling PHYSFS_read(), PHYSFS_seek() or PHYSFS_setBuffer() on the handle
+ *  while another thread is in PHYSFS_readAt() on it is still not safe.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param offset Number of bytes from start of file to read from.
+ *   \param buffer buffer to store read data into.
+ *   \param len number of bytes to read.
+ *  \return number of bytes read, which is less than (len) only if the end
+ *          of the file was reached, or -1 if complete failure. Specifics of
+ *          the error can be gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_read
+ */
+__EXPORT__ PHYSFS_sint64 PHYSFS_readAt(PHYSFS_File *handle,
+                                       PHYSFS_uint64 offset, void *buffer,
+                                       PHYSFS_uint64 len);
+
+
+/**
+ * \struct PHYSFS_AsyncRequest
+ * \brief A pending (or finished) asynchronous read.
+ *
+ * You get a pointer to one of these from PHYSFS_readAsync() or
+ *  PHYSFS_loadAsync(). Treat it as opaque, like a PHYSFS_File, and give it
+ *  back to PHYSFS_asyncFree() when you're done with it.
+ *
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_loadAsync
+ * \sa PHYSFS_asyncDone
+ * \sa PHYSFS_asyncWait
+ * \sa PHYSFS_asyncFree
+ */
+typedef struct PHYSFS_AsyncRequest
+{
+    void *opaque;  /**< That's all you get. Don't touch. */
+} PHYSFS_AsyncRequest;
+
+
+/**
+ * \typedef PHYSFS_AsyncCallback
+ * \brief Function signature for async read completion callbacks.
+ *
+ * This is called once the work for a request is done, successful or not,
+ *  on whatever thread did the work. That's usually one of PhysicsFS's
+ *  worker threads, so be ready for that. PHYSFS_getLastError() tells you
+ *  what went wrong if (len) is -1.
+ *
+ * You may call PHYSFS_asyncFree() on (req) from here, and you may queue
+ *  more requests, but don't PHYSFS_asyncWait() on (req), and don't call
+ *  PHYSFS_setAsyncThreadCount().
+ *
+ *    \param data User-defined data pointer, passed through from the API
+ *                that queued the request.
+ *    \param req The request that finished.
+ *    \param buffer Where the data went; your buffer for PHYSFS_readAsync(),
+ *                  the file's contents for PHYSFS_loadAsync().
+ *    \param len Number of bytes read, or -1 on error.
+ *
+ * \sa PHYSFS_readAsync
+ * \sa PHYSFS_loadAsync
+ */
+typedef void (*PHYSFS_AsyncCallback)(void *data, PHYSFS_AsyncRequest *req,
+                                     void *buffer, PHYSFS_sint64 len);
+
+
+/**
+ * \struct PHYSFS_AsyncStats
+ * \brief Counters describing the async worker pool.
+ *
+ * Times are in microseconds. "Queue" time is from the request being made
+ *  until a worker picks it up; "service" time is the work itself, including
+ *  the callback. Latency is the two added together.
+ *
+ * \sa PHYSFS_getAsyncStats
+ */
+typedef struct PHYSFS_AsyncStats
+{
+    PHYSFS_uint32 threads;  /**< Worker threads currently running. */
+    PHYSFS_uint32 queueDepth;  /**< Requests waiting for a worker. */
+    PHYSFS_uint32 maxQueueDepth;  /**< Most requests ever waiting at once. */
+    PHYSFS_uint32 active;  /**< Requests being worked on right now. */
+    PHYSFS_uint64 completed;  /**< Requests finished, failures included. */
+    PHYSFS_uint64 failed;  /**< Requests that failed. */
+    PHYSFS_uint64 totalQueueMicroseconds;  /**< Sum of all queue times. */
+    PHYSFS_uint64 totalServiceMicroseconds;  /**< Sum of all service times. */
+    PHYSFS_uint64 maxLatencyMicroseconds;  /**< Worst latency seen. */
+} PHYSFS_AsyncStats;
+
+
+/**
+ * \fn PHYSFS_AsyncRequest *PHYSFS_readAsync(PHYSFS_File *handle, PHYSFS_uint64 offset, void *buffer, PHYSFS_uint64 len, PHYSFS_AsyncCallback callback, void *data)
+ * \brief Read from a file in the background.
+ *
+ * This queues a PHYSFS_readAt() for a worker thread and returns right
+ *  away. Any decompression happens on the worker, too. Find out when it's
+ *  done through (callback), PHYSFS_asyncDone() or PHYSFS_asyncWait().
+ *
+ * Don't touch (buffer), or close (handle), until the request is finished.
+ *  Several requests may be pending on one handle at once.
+ *
+ * If threads aren't available (or you asked for zero of them with
+ *  PHYSFS_setAsyncThreadCount()), the read happens before this function
+ *  returns, callback and all.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param offset Number of bytes from start of file to read from.
+ *   \param buffer buffer to store read data into.
+ *   \param len number of bytes to read.
+ *   \param callback Function to call when done. May be NULL.
+ *   \param data Pointer passed through to (callback).
+ *  \return A request to pass to PHYSFS_asyncFree() eventually, or NULL if
+ *          the request couldn't be queued. Specifics of the error can be
+ *          gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_readAt
+ * \sa PHYSFS_loadAsync
+ */
+__EXPORT__ PHYSFS_AsyncRequest *PHYSFS_readAsync(PHYSFS_File *handle,
+                                                 PHYSFS_uint64 offset,
+                                                 void *buffer,
+                                                 PHYSFS_uint64 len,
+                                                 PHYSFS_AsyncCallback callback,
+                                                 void *data);
+
+
+/**
+ * \fn PHYSFS_AsyncRequest *PHYSFS_loadAsync(const char *filename, PHYSFS_AsyncCallback callback, void *data)
+ * \brief Read an entire file into memory in the background.
+ *
+ * This is PHYSFS_readAsync() for the common case: a worker opens
+ *  (filename), reads all of it into a buffer it allocates, and closes it.
+ *  The buffer belongs to the request; it's freed by PHYSFS_asyncFree().
+ *
+ *   \param filename File to load, in platform-independent notation.
+ *   \param callback Function to call when done. May be NULL.
+ *   \param data Pointer passed through to (callback).
+ *  \return A request to pass to PHYSFS_asyncFree() eventually, or NULL if
+ *          the request couldn't be queued. Specifics of the error can be
+ *          gleaned from PHYSFS_getLastError(). A file that doesn't exist
+ *          is reported when the request finishes, not here.
+ *
+ * \sa PHYSFS_readAsync
+ */
+__EXPORT__ PHYSFS_AsyncRequest *PHYSFS_loadAsync(const char *filename,
+                                                 PHYSFS_AsyncCallback callback,
+                                                 void *data);
+
+
+/**
+ * \fn PHYSFS_AsyncRequest *PHYSFS_prefetch(const char **paths, PHYSFS_uint32 count)
+ * \brief Warm up caches for files you'll need soon.
+ *
+ * If you know what you're going to load a little before you load it, hand
+ *  the list to this function. Each file is looked up in the search path
+ *  and the OS is asked to start reading its bytes from disk (the file
+ *  itself, or its range inside an archive), so later PHYSFS_openRead() and
+ *  PHYSFS_read() calls don't have to wait on the disk. On platforms that
+ *  can't take such a hint, the file is read through once instead.
+ *
+ * The work happens on the async worker threads; this returns right away.
+ *  Use PHYSFS_asyncDone() or PHYSFS_asyncWait() on the result to see when
+ *  it's finished, and PHYSFS_asyncFree() it when you're done (you can free
+ *  it right away if you don't care). The result is the number of files
+ *  that were found. Missing files aren't an error.
+ *
+ * Prefetching is only a hint: the OS can throw the data out again before
+ *  you get to it.
+ *
+ *   \param paths Files to prefetch, in platform-independent notation. The
+ *                list is copied, so you can free it as soon as this returns.
+ *   \param count Number of strings in (paths).
+ *  \return A request to pass to PHYSFS_asyncFree() eventually, or NULL on
+ *          error. Specifics of the error can be gleaned from
+ *          PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_loadAsync
+ */
+__EXPORT__ PHYSFS_AsyncRequest *PHYSFS_prefetch(const char **paths,
+                                                PHYSFS_uint32 count);
+
+
+/**
+ * \fn int PHYSFS_asyncDone(PHYSFS_AsyncRequest *req)
+ * \brief Check if an async request has finished, without blocking.
+ *
+ * "Finished" means the work and the callback are both done.
+ *
+ *   \param req A request from PHYSFS_readAsync() or PHYSFS_loadAsync().
+ *  \return nonzero if finished, zero if still pending.
+ *
+ * \sa PHYSFS_asyncWait
+ */
+__EXPORT__ int PHYSFS_asyncDone(PHYSFS_AsyncRequest *req);
+
+
+/**
+ * \fn PHYSFS_sint64 PHYSFS_asyncWait(PHYSFS_AsyncRequest *req, void **buffer)
+ * \brief Block until an async request finishes, and get its result.
+ *
+ * Returns right away if the request is already finished, so this is also
+ *  how you get the results after PHYSFS_asyncDone() says it's ready.
+ *
+ *   \param req A request from PHYSFS_readAsync() or PHYSFS_loadAsync().
+ *   \param buffer If not NULL, receives the request's buffer (for loads,
+ *                 it stays valid until PHYSFS_asyncFree()).
+ *  \return number of bytes read, or -1 on error. Specifics of the error
+ *          can be gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_asyncDone
+ */
+__EXPORT__ PHYSFS_sint64 PHYSFS_asyncWait(PHYSFS_AsyncRequest *req,
+                                          void **buffer);
+
+
+/**
+ * \fn void PHYSFS_asyncFree(PHYSFS_AsyncRequest *req)
+ * \brief Release an async request.
+ *
+ * You can do this before the request finishes if you only care about the
+ *  callback; the work still happens, and the request is released after.
+ *  Free all your requests before calling PHYSFS_deinit().
+ *
+ *   \param req A request from PHYSFS_readAsync() or PHYSFS_loadAsync().
+ *               NULL is ignored.
+ */
+__EXPORT__ void PHYSFS_asyncFree(PHYSFS_AsyncRequest *req);
+
+
+/**
+ * \fn int PHYSFS_setAsyncThreadCount(PHYSFS_uint32 count)
+ * \brief Choose how many worker threads handle async requests.
+ *
+ * The default is 2. Workers are started when the first request is made,
+ *  and stopped by PHYSFS_deinit(). Changing the count waits for the
+ *  current workers to finish everything already queued. Zero means no
+ *  workers: every "async" request does its work before returning.
+ *
+ * This must be called after PHYSFS_init(), and not from an async callback.
+ *
+ *   \param count Number of worker threads to use.
+ *  \return nonzero on success, zero on error.
+ *
+ * \sa PHYSFS_getAsyncStats
+ */
+__EXPORT__ int PHYSFS_setAsyncThreadCount(PHYSFS_uint32 count);
+
+
+/**
+ * \fn void PHYSFS_getAsyncStats(PHYSFS_AsyncStats *stats)
+ * \brief Get a snapshot of the async worker pool's counters.
+ *
+ * The counters are reset by PHYSFS_deinit().
+ *
+ *   \param stats Filled in with the current numbers.
+ *
+ * \sa PHYSFS_AsyncStats
+ */
+__EXPORT__ void PHYSFS_getAsyncStats(PHYSFS_AsyncStats *stats);
+
+
+/**
+ * \struct PHYSFS_ZipStats
+ * \brief Numbers describing the mounted ZIP archives.
+ *
+ * Each mounted ZIP keeps an index of its files and directories, built
+ *  when it's mounted, so finding or listing anything in it doesn't depend
+ *  on how big the archive is. These report what that costs, along with
+ *  the seek checkpoints and decompressed file cache shared by all of them.
+ *
+ * \sa PHYSFS_getZipStats
+ */
+typedef struct PHYSFS_ZipStats
+{
+    PHYSFS_uint32 archives;  /**< ZIP archives mounted right now. */
+    PHYSFS_uint64 entries;  /**< Files and directories they index. */
+    PHYSFS_uint64 indexBytes;  /**< Memory their indexes use. */
+    PHYSFS_uint64 indexMicroseconds;  /**< Time spent building indexes. */
+    PHYSFS_uint64 checkpoints;  /**< Seek checkpoints held right now. */
+    PHYSFS_uint64 checkpointBytes;  /**< Memory those checkpoints use. */
+    PHYSFS_uint64 cacheEntries;  /**< Decompressed files cached right now. */
+    PHYSFS_uint64 cacheBytes;  /**< Memory those cached files use. */
+    PHYSFS_uint64 cacheHits;  /**< Opens served from the cache. */
+    PHYSFS_uint64 cacheMisses;  /**< Cacheable opens that weren't cached. */
+    PHYSFS_uint64 cacheEvictions;  /**< Files pushed out to make room. */
+    PHYSFS_uint32 pooledInflaters;  /**< Idle decompressors kept for reuse. */
+    PHYSFS_uint64 mountMicroseconds;  /**< Time spent mounting ZIPs. */
+    PHYSFS_uint64 resolvedAtMount;  /**< Files whose headers mounts checked. */
+    PHYSFS_uint64 mappedBytes;  /**< Archive bytes mapped into memory. */
+} PHYSFS_ZipStats;
+
+
+/**
+ * \fn void PHYSFS_getZipStats(PHYSFS_ZipStats *stats)
+ * \brief Get a snapshot of the ZIP archiver's numbers.
+ *
+ * (indexMicroseconds), (mountMicroseconds), (resolvedAtMount) and the
+ *  cache's hits, misses and evictions add up everything since
+ *  PHYSFS_init(); the other fields only count archives that are still
+ *  mounted. Everything is zero if PhysicsFS was built without ZIP support.
+ *
+ *   \param stats Filled in with the current numbers.
+ *
+ * \sa PHYSFS_ZipStats
+ */
+__EXPORT__ void PHYSFS_getZipStats(PHYSFS_ZipStats *stats);
+
+
+/**
+ * \fn int PHYSFS_setZipCheckpointInterval(PHYSFS_uint32 interval)
+ * \brief Make seeking around in compressed ZIP entries cheaper.
+ *
+ * A compressed file can only be decoded from the start, so by default
+ *  seeking backwards in one decodes everything up to the new position
+ *  all over again. For big files that get seeked around in a lot (audio,
+ *  video), that adds up fast.
+ *
+ * With this set to something other than zero, reading a compressed file
+ *  leaves a checkpoint roughly every (interval) bytes, and seeks pick up
+ *  from the closest checkpoint before the new position instead. Every
+ *  handle to the same file shares its checkpoints, which are kept until
+ *  the archive is unmounted. Each one costs about 32 kilobytes, so
+ *  smaller intervals mean faster seeks and more memory;
+ *  PHYSFS_getZipStats() reports how much is in use. Files smaller than
+ *  (interval) never get checkpoints.
+ *
+ * This affects files opened after the call. The default is zero (no
+ *  checkpoints), and PHYSFS_deinit() resets it.
+ *
+ *   \param interval Uncompressed bytes between checkpoints, or zero.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_getZipStats
+ */
+__EXPORT__ int PHYSFS_setZipCheckpointInterval(PHYSFS_uint32 interval);
+
+
+/**
+ * \fn int PHYSFS_setZipCache(PHYSFS_uint64 budget, PHYSFS_uint32 maxEntrySize)
+ * \brief Keep recently used compressed ZIP files around, decompressed.
+ *
+ * Files that get opened over and over (shaders, config files, UI art)
+ *  normally get decompressed from scratch every time. With a cache budget
+ *  set, opening a compressed file no bigger than (maxEntrySize) bytes
+ *  decompresses all of it into memory, and opening it again later, from
+ *  any thread, reads straight out of that copy until it's pushed out to
+ *  make room for something else. All mounted ZIPs share the budget, and
+ *  the least recently opened files go first. Files that are still open
+ *  keep their data until they're closed, even if it's been pushed out.
+ *
+ * Files stored without compression are never cached, since reading them
+ *  is already as cheap as it gets. PHYSFS_getZipStats() reports how well
+ *  the cache is doing.
+ *
+ * Lowering the budget pushes out whatever no longer fits right away;
+ *  zero turns the cache off and empties it. The default is no cache and
+ *  a (maxEntrySize) of one megabyte, and PHYSFS_deinit() resets them.
+ *
+ *   \param budget Most memory, in bytes, to spend on cached files.
+ *   \param maxEntrySize Biggest file, in bytes, worth caching.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_getZipStats
+ */
+__EXPORT__ int PHYSFS_setZipCache(PHYSFS_uint64 budget,
+                                  PHYSFS_uint32 maxEntrySize);
+
+
+/**
+ * \fn int PHYSFS_setZipInflaterPool(PHYSFS_uint32 count)
+ * \brief Set how many idle ZIP decompressors to keep around.
+ *
+ * Reading a compressed file needs about 40 kilobytes of decompressor
+ *  state, plus a read buffer sized to the file's compressed data (between
+ *  one and 256 kilobytes). Closing the file hands these back to a pool
+ *  instead of freeing them, so opening the next compressed file doesn't
+ *  have to allocate them again. This sets how many the pool holds onto;
+ *  if you open lots of compressed files at once, a bigger pool means
+ *  less time in the allocator, and zero turns pooling off.
+ *
+ * Shrinking the pool frees the extras right away. The default is 8, and
+ *  PHYSFS_deinit() frees the pool and resets it.
+ *
+ *   \param count Most idle decompressors to keep.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_getZipStats
+ */
+__EXPORT__ int PHYSFS_setZipInflaterPool(PHYSFS_uint32 count);
+
+
+/**
+ * \fn int PHYSFS_setZipResolveOnMount(int enable)
+ * \brief Check every file's ZIP header when the archive is mounted.
+ *
+ * Each file in a ZIP has a small header of its own in front of its data,
+ *  which the central directory doesn't describe fully. By default, that
+ *  header is read the first time the file is opened, which costs a seek
+ *  there and another to the data. That keeps mounting fast, but on slow
+ *  seeking media (hard drives, optical discs) a lot of first opens add up
+ *  to far more time than reading through the archive once.
+ *
+ * With this enabled, ZIPs mounted afterwards read all these headers in
+ *  the order they're stored, a few hundred kilobytes at a time, and follow
+ *  any symlinks, so the first open of every file goes straight to its
+ *  data. Mounting takes longer; (mountMicroseconds) in PHYSFS_getZipStats()
+ *  shows how much. Files with bad headers still only fail when opened.
+ *
+ * Archives that are already mounted aren't affected. The default is off,
+ *  and PHYSFS_deinit() resets it.
+ *
+ *   \param enable nonzero to check headers at mount, zero to check them
+ *                 on first open.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_getZipStats
+ * \sa PHYSFS_mount
+ */
+__EXPORT__ int PHYSFS_setZipResolveOnMount(int enable);
+
+
+/**
+ * \fn int PHYSFS_setZipMapArchives(int enable)
+ * \brief Map whole ZIP archives into memory when they're mounted.
+ *
+ * Normally, reading a file in a ZIP copies its bytes from the archive into
+ *  your buffer (or, if it's compressed, into a staging buffer to be
+ *  decompressed from) with a system call each time. With this enabled,
+ *  ZIPs mounted afterwards are memory-mapped, so reading a stored file is
+ *  a memcpy() out of the mapping, and compressed files decompress straight
+ *  from it, with no staging buffer and no system calls at all. This is a
+ *  big win for lots of small reads, like a game loading its assets.
+ *
+ * It costs address space rather than memory: the operating system pages
+ *  the archive in as it's read, and can drop those pages again whenever it
+ *  likes. Archives that can't be mapped (too big for a 32-bit address
+ *  space, or a platform that can't map files) are read normally. Don't
+ *  change or truncate an archive while it's mounted this way; on most
+ *  systems, touching a part that's gone crashes the program.
+ *
+ * Archives that are already mounted aren't affected. The default is off,
+ *  and PHYSFS_deinit() resets it. PHYSFS_getZipStats() reports how much
+ *  is mapped.
+ *
+ *   \param enable nonzero to map archives mounted from now on, zero to
+ *                 read them normally.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_getZipStats
+ * \sa PHYSFS_mount
+ */
+__EXPORT__ int PHYSFS_setZipMapArchives(int enable);
+
+
+/**
+ * \struct PHYSFS_7zStats
+ * \brief What the 7z archiver's cache of decoded folders is up to.
+ *
+ * A 7z archive packs its files into one or more "folders," each of which
+ *  has to be decoded all at once before any file in it can be read.
+ *
+ * \sa PHYSFS_get7zStats
+ * \sa PHYSFS_set7zCache
+ */
+typedef struct PHYSFS_7zStats
+{
+    PHYSFS_uint32 cachedFolders;  /**< Decoded folders in memory right now. */
+    PHYSFS_uint64 cachedBytes;  /**< Memory those folders use. */
+    PHYSFS_uint64 decodes;  /**< Folders decoded. */
+    PHYSFS_uint64 cacheHits;  /**< Opens whose folder was already decoded. */
+    PHYSFS_uint64 evictions;  /**< Folders freed to stay in budget. */
+    PHYSFS_uint64 streamedFolders;  /**< Decoders set up for big folders. */
+    PHYSFS_uint32 pinnedFolders;  /**< Held by PHYSFS_predecode(). */
+} PHYSFS_7zStats;
+
+
+/**
+ * \fn void PHYSFS_get7zStats(PHYSFS_7zStats *stats)
+ * \brief Get a snapshot of the 7z archiver's numbers.
+ *
+ * Folders bigger than 16 megabytes are, where possible, decoded a bit at
+ *  a time as they're read, and never cached. Each open file doing that
+ *  has a decoder of its own, and (streamedFolders) counts how many were
+ *  set up. A streamed folder's CRC is checked when one of them decodes
+ *  through to the end of it.
+ *
+ * (decodes), (cacheHits), (evictions) and (streamedFolders) add up
+ *  everything since PHYSFS_init(); the other fields only count what's in
+ *  memory now. Everything is zero if PhysicsFS was built without 7z
+ *  support.
+ *
+ *   \param stats Filled in with the current numbers.
+ *
+ * \sa PHYSFS_7zStats
+ */
+__EXPORT__ void PHYSFS_get7zStats(PHYSFS_7zStats *stats);
+
+
+/**
+ * \fn int PHYSFS_set7zCache(PHYSFS_uint64 budget)
+ * \brief Keep decoded 7z folders around after their files are closed.
+ *
+ * Reading any file in a 7z archive decodes the whole folder it's packed
+ *  in. By default, that's thrown away as soon as the last file using it
+ *  is closed, so opening, reading and closing a few hundred small files
+ *  from one folder decodes it a few hundred times. With a budget set,
+ *  decoded folders stay in memory after they're closed, and the least
+ *  recently used ones are only freed when the total goes over budget.
+ *  All mounted 7z archives share the budget. Folders with files still
+ *  open count against it, but are never freed while they're in use.
+ *
+ * Lowering the budget frees whatever no longer fits right away; zero
+ *  turns the cache off. The default is zero, and PHYSFS_deinit() resets
+ *  it.
+ *
+ *   \param budget Most memory, in bytes, to spend on decoded folders.
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_get7zStats
+ */
+__EXPORT__ int PHYSFS_set7zCache(PHYSFS_uint64 budget);
+
+
+/**
+ * \fn PHYSFS_sint64 PHYSFS_predecode(const char **paths, PHYSFS_uint32 count)
+ * \brief Decode the archive data behind a list of files, on every core.
+ *
+ * Files in compressed archives cost a decode before their first read; in
+ *  7z archives that means decoding the whole folder the file is packed in.
+ *  This sorts the files by folder and decodes each folder once, no matter
+ *  how many of the files share it, spreading the folders over one thread
+ *  per core. Files from other archive types are prefetched as with
+ *  PHYSFS_prefetch(). The async worker threads aren't involved, so this
+ *  is safe to call from an async callback.
+ *
+ * Decoded folders are pinned: they stay in memory, whatever the budget set
+ *  with PHYSFS_set7zCache(), until PHYSFS_releasePredecoded() is called or
+ *  their archive is unmounted. Folders too big to decode whole (see
+ *  PHYSFS_get7zStats()) are only prefetched from disk, and not pinned.
+ *
+ * This blocks until everything's done.
+ *
+ *   \param paths Files to predecode, in platform-independent notation.
+ *   \param count Number of strings in (paths).
+ *  \return The number of files that were found, or -1 on error. Missing
+ *          files aren't an error, but a folder that fails to decode is;
+ *          the others are still decoded and pinned. Specifics of the
+ *          error can be gleaned from PHYSFS_getLastError().
+ *
+ * \sa PHYSFS_releasePredecoded
+ * \sa PHYSFS_prefetch
+ * \sa PHYSFS_set7zCache
+ */
+__EXPORT__ PHYSFS_sint64 PHYSFS_predecode(const char **paths,
+                                          PHYSFS_uint32 count);
+
+
+/**
+ * \fn int PHYSFS_releasePredecoded(void)
+ * \brief Let go of the 7z folders PHYSFS_predecode() pinned.
+ *
+ * Each folder is then freed once no open file is using it, unless it fits
+ *  in the budget set with PHYSFS_set7zCache(), in which case it's kept
+ *  like any other decoded folder. PHYSFS_deinit() lets go of them, too.
+ *
+ *  \return nonzero on success, zero if PhysicsFS isn't initialized.
+ *
+ * \sa PHYSFS_predecode
+ */
+__EXPORT__ int PHYSFS_releasePredecoded(void);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -935,6 +935,41 @@ typedef struct
          *  file. On failure, call __PHYSFS_setError().
          */
     int (*fileClose)(fvoid *opaque);
+
+        /*
+         * If the file's contents are stored verbatim (uncompressed, etc) in
+         *  a physical file, set (*handle) to a platform file handle for it
+         *  (as from __PHYSFS_platformOpenRead()) and (*offset) to where the
+         *  data starts, and return non-zero. The data is fileLength() bytes
+         *  long. This lets the caller map or read the data directly; it
+         *  must not change the handle's file position. Return zero if the
+         *  data isn't stored that way. Archives don't have to implement
+         *  this. (Set it to NULL if not implemented).
+         */
+    int (*getRawRegion)(fvoid *opaque, void **handle, PHYSFS_uint64 *offset);
+
+        /*
+         * Ask the OS to start reading the file's data from disk (with
+         *  __PHYSFS_platformPrefetch()), so later reads don't wait for it.
+         *  Return non-zero if that happened, zero if the caller should just
+         *  read the file through instead. Only needed when getRawRegion()
+         *  doesn't cover it (compressed data, etc). Archives that decode
+         *  whole blocks may decode the file's block here instead. This may
+         *  be called from several threads at once, on different handles.
+         *  Archives don't have to implement this. (Set it to NULL if not
+         *  implemented).
+         */
+    int (*prefetch)(fvoid *opaque);
+
+        /*
+         * If the file's whole contents are already sitting in memory in one
+         *  piece (a decoded block, etc), set (*data) to them and return
+         *  non-zero. They must stay valid and unchanged until the handle is
+         *  closed. Return zero if that isn't the case; the caller will read
+         *  the file instead. Archives don't have to implement this. (Set it
+         *  to NULL if not implemented).
+         */
+    int (*getView)(fvoid *opaque, const void **data);
 } PHYSFS_Archiver;
 
 
@@ -1008,6 +1043,42 @@ void __PHYSFS_sort(void *entries, PHYSFS_uint32 max,
                    int (*cmpfn)(void *, PHYSFS_uint32, PHYSFS_uint32),
                    void (*swapfn)(void *, PHYSFS_uint32, PHYSFS_uint32));
 
+/*
+ * Archivers open their archive once, when it's mounted, and read it with
+ *  this: read up to (len) bytes at (offset) in the archive, no matter where
+ *  the handle's file pointer is. Where the platform has
+ *  __PHYSFS_platformReadAt(), that's all this is, and (lock) is ignored.
+ *  Elsewhere, if (handle) is shared, (lock) must be a mutex the archive
+ *  owns; it's held around a seek and a read. Pass NULL for a handle from
+ *  __PHYSFS_openEntryHandle().
+ *  Returns the number of bytes read (fewer than (len) only at EOF), or
+ *  (-1) on error.
+ */
+PHYSFS_sint64 __PHYSFS_readArchiveAt(void *handle, void *lock, void *buffer,
+                                     PHYSFS_uint64 offset, PHYSFS_uint32 len);
+
+/*
+ * Get the handle a file opened in an archive should read through. That's
+ *  the archive's own (handle) where the platform has
+ *  __PHYSFS_platformReadAt(), so opening a file costs no open() call. Where
+ *  it doesn't, it's a new handle on (archive), so files don't queue up on
+ *  one lock to seek and read; read it with a NULL lock. Returns NULL on
+ *  error. Pass the result to __PHYSFS_closeEntryHandle() along with
+ *  (handle) when the file is closed; NULL is fine there.
+ */
+void *__PHYSFS_openEntryHandle(const char *archive, void *handle);
+void __PHYSFS_closeEntryHandle(void *entryHandle, void *handle);
+
+/*
+ * Read (count) records of (size) bytes each, from where platform file
+ *  (handle) is now, into a new buffer from the allocator, in a single read.
+ *  Archivers with a fixed-size directory entry load their whole table of
+ *  contents with this, then pick the fields out in memory. Returns NULL on
+ *  error (including a short read); otherwise, allocator.Free() the buffer
+ *  when done with it.
+ */
+void *__PHYSFS_readTable(void *handle, PHYSFS_uint32 size, PHYSFS_uint32 count);
+
 
 /* These get used all over for lessening code clutter. */
 #define BAIL_MACRO(e, r) { __PHYSFS_setError(e); return r; }
@@ -1192,6 +1263,21 @@ void *__PHYSFS_platformOpenAppend(const char *filename);
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
                                     PHYSFS_uint32 size, PHYSFS_uint32 count);
 
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+/*
+ * Read up to (len) bytes from a platform-specific file handle, starting
+ *  (offset) bytes into the file, without using or moving the file pointer.
+ *  This may be called from several threads at once on the same (opaque).
+ *  Return the number of bytes read (fewer than (len) only at EOF), or (-1)
+ *  on error, after calling __PHYSFS_setError().
+ *
+ * Platforms that can't do this define PHYSFS_NO_PREAD_SUPPORT in
+ *  physfs_platforms.h and needn't implement it.
+ */
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 offset, PHYSFS_uint32 len);
+#endif
+
 /*
  * Write more data to a platform-specific file handle. (opaque) should be
  *  cast to whatever data type your platform uses. Write a maximum of (count)
@@ -1273,6 +1359,36 @@ int __PHYSFS_platformFlush(void *opaque);
  */
 int __PHYSFS_platformClose(void *opaque);
 
+/*
+ * Map (len) bytes of a file into memory, read-only, starting (offset) bytes
+ *  into it. (opaque) is a handle from __PHYSFS_platformOpenRead(); the
+ *  mapping must stay valid after that handle is closed. (len) will never be
+ *  zero. Set (*mapping) to whatever __PHYSFS_platformUnmap() will need.
+ *
+ * Return a pointer to the first requested byte, or NULL on error (or if
+ *  your platform can't map files); the caller will read the data into a
+ *  buffer instead.
+ */
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+                                 PHYSFS_uint64 len, void **mapping);
+
+/*
+ * Release a mapping made by __PHYSFS_platformMap().
+ */
+void __PHYSFS_platformUnmap(void *mapping);
+
+/*
+ * Hint that (len) bytes starting (offset) bytes into a file will be read
+ *  soon, so the OS can start pulling them into its cache. (opaque) is a
+ *  handle from __PHYSFS_platformOpenRead(). This must not block on the
+ *  reads, or move the file pointer.
+ *
+ * Return non-zero if the hint was given, zero if your platform can't; the
+ *  caller will read the data itself to warm the cache instead.
+ */
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len);
+
 /*
  * Platform implementation of PHYSFS_getCdRomDirsCallback()...
  *  CD directories are discovered and reported to the callback one at a time.
@@ -1472,6 +1588,55 @@ int __PHYSFS_platformGrabMutex(void *mutex);
  */
 void __PHYSFS_platformReleaseMutex(void *mutex);
 
+/*
+ * Start a new thread that calls (func) with (data), and return a handle for
+ *  __PHYSFS_platformJoinThread(). Return NULL and call __PHYSFS_setError()
+ *  on failure; platforms without threads always fail with
+ *  ERR_NOT_SUPPORTED, and the caller does the work itself instead.
+ */
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data);
+
+/*
+ * Block until a thread from __PHYSFS_platformCreateThread() has returned
+ *  from its (func), then clean up any resources associated with it.
+ */
+void __PHYSFS_platformJoinThread(void *thread);
+
+/*
+ * Create a counting semaphore with an initial count of zero, or return NULL
+ *  on error. Only needed where __PHYSFS_platformCreateThread() works.
+ */
+void *__PHYSFS_platformCreateSemaphore(void);
+
+/*
+ * Destroy a semaphore from __PHYSFS_platformCreateSemaphore(). No thread is
+ *  waiting on it when this is called.
+ */
+void __PHYSFS_platformDestroySemaphore(void *sem);
+
+/*
+ * Increment a semaphore's count, waking one waiting thread if there is one.
+ */
+void __PHYSFS_platformPostSemaphore(void *sem);
+
+/*
+ * Block until a semaphore's count is non-zero, then decrement it.
+ */
+void __PHYSFS_platformWaitSemaphore(void *sem);
+
+/*
+ * Get the number of microseconds elapsed since some arbitrary, fixed point
+ *  in time. This is only used for measuring intervals, so it should not
+ *  jump around when the wall clock is changed, if your platform can help it.
+ */
+PHYSFS_uint64 __PHYSFS_platformGetTicks(void);
+
+/*
+ * Get the number of threads that can run at once here, which is at least 1.
+ *  Used to decide how many threads to spread work over.
+ */
+PHYSFS_uint32 __PHYSFS_platformCpuCount(void);
+
 /*
  * Called at the start of PHYSFS_init() to prepare the allocator, if the user
  *  hasn't selected their own allocator via PHYSFS_setAllocator().
@@ -19,8 +19,11 @@
 #elif ((defined __BEOS__) || (defined __beos__))
 #  define PHYSFS_PLATFORM_BEOS
 #  define PHYSFS_PLATFORM_POSIX
+#  define PHYSFS_NO_MMAP_SUPPORT
+#  define PHYSFS_NO_PREAD_SUPPORT
 #elif (defined _WIN32_WCE) || (defined _WIN64_WCE)
 #  define PHYSFS_PLATFORM_POCKETPC
+#  define PHYSFS_NO_PREAD_SUPPORT
 #elif ((defined WINAPI_FAMILY) && WINAPI_FAMILY == WINAPI_FAMILY_APP)
 #	define PHYSFS_PLATFORM_WINRT 1
 #	define PHYSFS_NO_CDROM_SUPPORT 1
@@ -29,6 +32,7 @@
 #  define PHYSFS_PLATFORM_WINDOWS
 #elif (defined OS2)
 #  define PHYSFS_PLATFORM_OS2
+#  define PHYSFS_NO_PREAD_SUPPORT
 #elif ((defined __MACH__) && (defined __APPLE__))
 /* To check if iphone or not, we need to include this file */
 # include <TargetConditionals.h> 
@@ -245,6 +245,76 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+typedef struct
+{
+    thread_id thread;
+    void (*func)(void *);
+    void *data;
+} BeOSThread;
+
+static int32 beosThreadEntry(void *data)
+{
+    BeOSThread *t = (BeOSThread *) data;
+    t->func(t->data);
+    return(0);
+} /* beosThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    BeOSThread *t = (BeOSThread *) allocator.Malloc(sizeof (BeOSThread));
+    BAIL_IF_MACRO(t == NULL, ERR_OUT_OF_MEMORY, NULL);
+    t->func = func;
+    t->data = data;
+    t->thread = spawn_thread(beosThreadEntry, "PhysicsFS worker",
+                             B_NORMAL_PRIORITY, t);
+    if ((t->thread < B_NO_ERROR) || (resume_thread(t->thread) != B_NO_ERROR))
+    {
+        if (t->thread >= B_NO_ERROR)
+            kill_thread(t->thread);
+        allocator.Free(t);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    return((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    BeOSThread *t = (BeOSThread *) thread;
+    status_t rc;
+    wait_for_thread(t->thread, &rc);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    sem_id s = create_sem(0, "PhysicsFS semaphore");
+    BAIL_IF_MACRO(s < B_NO_ERROR, ERR_OUT_OF_MEMORY, NULL);
+    return((void *) ((size_t) s));
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    delete_sem((sem_id) ((size_t) sem));
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    release_sem((sem_id) ((size_t) sem));
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    while (acquire_sem((sem_id) ((size_t) sem)) == B_INTERRUPTED) {}
+} /* __PHYSFS_platformWaitSemaphore */
+
+
 int __PHYSFS_platformSetDefaultAllocator(PHYSFS_Allocator *a)
 {
     return(0);  /* just use malloc() and friends. */
@@ -413,6 +413,83 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     MPExitCriticalRegion(m);
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    MPTaskID task;
+    MPQueueID queue;  /* gets a message when the task ends. */
+    void (*func)(void *);
+    void *data;
+} MacOSXThread;
+
+static OSStatus macosxThreadEntry(void *parameter)
+{
+    MacOSXThread *t = (MacOSXThread *) parameter;
+    t->func(t->data);
+    return(noErr);
+} /* macosxThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    MacOSXThread *t = (MacOSXThread *) allocator.Malloc(sizeof (MacOSXThread));
+    BAIL_IF_MACRO(t == NULL, ERR_OUT_OF_MEMORY, NULL);
+    t->func = func;
+    t->data = data;
+
+    if (osxerr(MPCreateQueue(&t->queue)) != noErr)
+    {
+        allocator.Free(t);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    if (osxerr(MPCreateTask(macosxThreadEntry, t, 0, t->queue,
+                            NULL, NULL, 0, &t->task)) != noErr)
+    {
+        MPDeleteQueue(t->queue);
+        allocator.Free(t);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    return((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    MacOSXThread *t = (MacOSXThread *) thread;
+    MPWaitOnQueue(t->queue, NULL, NULL, NULL, kDurationForever);
+    MPDeleteQueue(t->queue);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    MPSemaphoreID s = NULL;
+    if (osxerr(MPCreateSemaphore(0xFFFFFFFF, 0, &s)) != noErr)
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    return((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    MPDeleteSemaphore((MPSemaphoreID) sem);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    MPSignalSemaphore((MPSemaphoreID) sem);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    MPWaitOnSemaphore((MPSemaphoreID) sem, kDurationForever);
+} /* __PHYSFS_platformWaitSemaphore */
+
 #endif /* PHYSFS_PLATFORM_MACOSX */
 
 /* end of macosx.c ... */
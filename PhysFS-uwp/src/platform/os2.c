@@ -614,6 +614,25 @@ int __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+                                 PHYSFS_uint64 len, void **mapping)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);  /* caller will read it instead. */
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *mapping)
+{
+} /* __PHYSFS_platformUnmap */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len)
+{
+    return(0);  /* no readahead hint for file handles; caller reads it. */
+} /* __PHYSFS_platformPrefetch */
+
+
 int __PHYSFS_platformDelete(const char *path)
 {
     if (__PHYSFS_platformIsDirectory(path))
@@ -690,6 +709,57 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+/* !!! FIXME: DosCreateThread() would work; until then, no async workers. */
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);  /* caller will do the work. */
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+} /* __PHYSFS_platformJoinThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+PHYSFS_uint64 __PHYSFS_platformGetTicks(void)
+{
+    ULONG ms = 0;
+    DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof (ms));
+    return(((PHYSFS_uint64) ms) * 1000);
+} /* __PHYSFS_platformGetTicks */
+
+
+PHYSFS_uint32 __PHYSFS_platformCpuCount(void)
+{
+    ULONG count = 0;
+    if (DosQuerySysInfo(QSV_NUMPROCESSORS, QSV_NUMPROCESSORS,
+                        &count, sizeof (count)) != NO_ERROR)
+        return(1);
+    return((count > 0) ? (PHYSFS_uint32) count : 1);
+} /* __PHYSFS_platformCpuCount */
+
+
 /* !!! FIXME: Don't use C runtime for allocators? */
 int __PHYSFS_platformSetDefaultAllocator(PHYSFS_Allocator *a)
 {
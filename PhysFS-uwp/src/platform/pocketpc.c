@@ -542,6 +542,25 @@ int __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+                                 PHYSFS_uint64 len, void **mapping)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);  /* caller will read it instead. */
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *mapping)
+{
+} /* __PHYSFS_platformUnmap */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len)
+{
+    return(0);  /* no readahead hint for file handles; caller reads it. */
+} /* __PHYSFS_platformPrefetch */
+
+
 int __PHYSFS_platformDelete(const char *path)
 {
     wchar_t *w_path = NULL;
@@ -594,6 +613,89 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+typedef struct
+{
+    HANDLE thread;
+    void (*func)(void *);
+    void *data;
+} WinApiThread;
+
+static DWORD WINAPI winApiThreadEntry(LPVOID arg)
+{
+    WinApiThread *t = (WinApiThread *) arg;
+    t->func(t->data);
+    return(0);
+} /* winApiThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    WinApiThread *t = (WinApiThread *) allocator.Malloc(sizeof (WinApiThread));
+    BAIL_IF_MACRO(t == NULL, ERR_OUT_OF_MEMORY, NULL);
+    t->func = func;
+    t->data = data;
+    t->thread = CreateThread(NULL, 0, winApiThreadEntry, t, 0, NULL);
+    if (t->thread == NULL)
+    {
+        allocator.Free(t);
+        BAIL_MACRO(win32strerror(), NULL);
+    } /* if */
+
+    return((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    WinApiThread *t = (WinApiThread *) thread;
+    WaitForSingleObject(t->thread, INFINITE);
+    CloseHandle(t->thread);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    HANDLE s = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+    BAIL_IF_MACRO(s == NULL, win32strerror(), NULL);
+    return((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    CloseHandle((HANDLE) sem);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    ReleaseSemaphore((HANDLE) sem, 1, NULL);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    WaitForSingleObject((HANDLE) sem, INFINITE);
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+PHYSFS_uint64 __PHYSFS_platformGetTicks(void)
+{
+    /* wraps every 49 days, but we only ever subtract nearby values. */
+    return(((PHYSFS_uint64) GetTickCount()) * 1000);
+} /* __PHYSFS_platformGetTicks */
+
+
+PHYSFS_uint32 __PHYSFS_platformCpuCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return((info.dwNumberOfProcessors > 0) ?
+            (PHYSFS_uint32) info.dwNumberOfProcessors : 1);
+} /* __PHYSFS_platformCpuCount */
+
+
 PHYSFS_sint64 __PHYSFS_platformGetLastModTime(const char *fname)
 {
     BAIL_MACRO(ERR_NOT_IMPLEMENTED, -1);
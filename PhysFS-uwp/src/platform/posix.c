@@ -6,6 +6,11 @@
  *  This file written by Ryan C. Gordon.
  */
 
+/* get a 64-bit off_t on 32-bit systems, so we can reach past 2 gigs. */
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_platforms.h"
 
@@ -22,9 +27,11 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
+#include <sys/time.h>
 
-#ifdef PHYSFS_HAVE_LLSEEK
-#include <linux/unistd.h>
+#ifndef PHYSFS_NO_MMAP_SUPPORT
+#include <sys/mman.h>
 #endif
 
 #include "physfs_internal.h"
@@ -247,11 +254,44 @@ int __PHYSFS_platformMkDir(const char *path)
 } /* __PHYSFS_platformMkDir */
 
 
+/*
+ * We keep track of the file position ourselves and do all i/o with
+ *  pread()/pwrite(), so seeking, telling and reading cost one syscall
+ *  between them instead of two or three. The fd's own position is unused.
+ */
+typedef struct
+{
+    int fd;
+    PHYSFS_uint64 pos;
+} PosixFile;
+
+
+#ifdef PHYSFS_NO_PREAD_SUPPORT
+static ssize_t posixPread(int fd, void *buf, size_t len, off_t pos)
+{
+    if (lseek(fd, pos, SEEK_SET) == -1)
+        return(-1);
+    return(read(fd, buf, len));
+} /* posixPread */
+
+static ssize_t posixPwrite(int fd, const void *buf, size_t len, off_t pos)
+{
+    if (lseek(fd, pos, SEEK_SET) == -1)
+        return(-1);
+    return(write(fd, buf, len));
+} /* posixPwrite */
+#else
+#define posixPread(fd, buf, len, pos) pread(fd, buf, len, pos)
+#define posixPwrite(fd, buf, len, pos) pwrite(fd, buf, len, pos)
+#endif
+
+
 static void *doOpen(const char *filename, int mode)
 {
     const int appending = (mode & O_APPEND);
+    PosixFile *retval;
+    off_t pos = 0;
     int fd;
-    int *retval;
     errno = 0;
 
     /* O_APPEND doesn't actually behave as we'd like. */
@@ -262,21 +302,23 @@ static void *doOpen(const char *filename, int mode)
 
     if (appending)
     {
-        if (lseek(fd, 0, SEEK_END) < 0)
+        pos = lseek(fd, 0, SEEK_END);
+        if (pos < 0)
         {
             close(fd);
             BAIL_MACRO(strerror(errno), NULL);
         } /* if */
     } /* if */
 
-    retval = (int *) allocator.Malloc(sizeof (int));
+    retval = (PosixFile *) allocator.Malloc(sizeof (PosixFile));
     if (retval == NULL)
     {
         close(fd);
         BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
     } /* if */
 
-    *retval = fd;
+    retval->fd = fd;
+    retval->pos = (PHYSFS_uint64) pos;
     return((void *) retval);
 } /* doOpen */
 
@@ -302,77 +344,99 @@ void *__PHYSFS_platformOpenAppend(const char *filename)
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
                                     PHYSFS_uint32 size, PHYSFS_uint32 count)
 {
-    int fd = *((int *) opaque);
-    int max = size * count;
-    int rc = read(fd, buffer, max);
+    PosixFile *f = (PosixFile *) opaque;
+    const size_t max = ((size_t) size) * ((size_t) count);
+    ssize_t rc;
+
+    BAIL_IF_MACRO(((PHYSFS_uint64) (off_t) f->pos) != f->pos,
+                  ERR_SEEK_OUT_OF_RANGE, -1);
+    rc = posixPread(f->fd, buffer, max, (off_t) f->pos);
+    BAIL_IF_MACRO(rc == -1, strerror(errno), -1);
+    assert(((size_t) rc) <= max);
+
+    /* only count whole objects; the next read starts on an object boundary. */
+    rc /= size;
+    f->pos += ((PHYSFS_uint64) rc) * size;
+    return((PHYSFS_sint64) rc);
+} /* __PHYSFS_platformRead */
 
-    BAIL_IF_MACRO(rc == -1, strerror(errno), rc);
-    assert(rc <= max);
 
-    if ((rc < max) && (size > 1))
-        lseek(fd, -(rc % size), SEEK_CUR); /* rollback to object boundary. */
+#ifndef PHYSFS_NO_PREAD_SUPPORT
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 offset, PHYSFS_uint32 len)
+{
+    int fd = ((PosixFile *) opaque)->fd;
+    char *ptr = (char *) buffer;
+    PHYSFS_sint64 retval = 0;
 
-    return(rc / size);
-} /* __PHYSFS_platformRead */
+    while (len > 0)
+    {
+        const off_t pos = (off_t) offset;
+        ssize_t rc;
 
+        BAIL_IF_MACRO(((PHYSFS_uint64) pos) != offset,
+                      ERR_SEEK_OUT_OF_RANGE, (retval == 0) ? -1 : retval);
 
-PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
-                                     PHYSFS_uint32 size, PHYSFS_uint32 count)
-{
-    int fd = *((int *) opaque);
-    int max = size * count;
-    int rc = write(fd, (void *) buffer, max);
+        rc = pread(fd, ptr, (size_t) len, pos);
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        BAIL_IF_MACRO(rc == -1, strerror(errno), (retval == 0) ? -1 : retval);
+        if (rc == 0)
+            break;  /* EOF. */
+
+        retval += rc;
+        ptr += rc;
+        offset += (PHYSFS_uint64) rc;
+        len -= (PHYSFS_uint32) rc;
+    } /* while */
 
-    BAIL_IF_MACRO(rc == -1, strerror(errno), rc);
-    assert(rc <= max);
+    return(retval);
+} /* __PHYSFS_platformReadAt */
+#endif
 
-    if ((rc < max) && (size > 1))
-        lseek(fd, -(rc % size), SEEK_CUR); /* rollback to object boundary. */
 
-    return(rc / size);
+PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
+                                     PHYSFS_uint32 size, PHYSFS_uint32 count)
+{
+    PosixFile *f = (PosixFile *) opaque;
+    const size_t max = ((size_t) size) * ((size_t) count);
+    ssize_t rc;
+
+    BAIL_IF_MACRO(((PHYSFS_uint64) (off_t) f->pos) != f->pos,
+                  ERR_SEEK_OUT_OF_RANGE, -1);
+    rc = posixPwrite(f->fd, buffer, max, (off_t) f->pos);
+    BAIL_IF_MACRO(rc == -1, strerror(errno), -1);
+    assert(((size_t) rc) <= max);
+
+    /* a partial object will be overwritten by the next write. */
+    rc /= size;
+    f->pos += ((PHYSFS_uint64) rc) * size;
+    return((PHYSFS_sint64) rc);
 } /* __PHYSFS_platformWrite */
 
 
 int __PHYSFS_platformSeek(void *opaque, PHYSFS_uint64 pos)
 {
-    int fd = *((int *) opaque);
-
-    #ifdef PHYSFS_HAVE_LLSEEK
-      unsigned long offset_high = ((pos >> 32) & 0xFFFFFFFF);
-      unsigned long offset_low = (pos & 0xFFFFFFFF);
-      loff_t retoffset;
-      int rc = llseek(fd, offset_high, offset_low, &retoffset, SEEK_SET);
-      BAIL_IF_MACRO(rc == -1, strerror(errno), 0);
-    #else
-      BAIL_IF_MACRO(lseek(fd, (int) pos, SEEK_SET) == -1, strerror(errno), 0);
-    #endif
+    PosixFile *f = (PosixFile *) opaque;
+    const off_t offset = (off_t) pos;
 
+    /* nothing to ask the kernel; the next read or write uses (pos). */
+    BAIL_IF_MACRO((offset < 0) || (((PHYSFS_uint64) offset) != pos),
+                  ERR_SEEK_OUT_OF_RANGE, 0);
+    f->pos = pos;
     return(1);
 } /* __PHYSFS_platformSeek */
 
 
 PHYSFS_sint64 __PHYSFS_platformTell(void *opaque)
 {
-    int fd = *((int *) opaque);
-    PHYSFS_sint64 retval;
-
-    #ifdef PHYSFS_HAVE_LLSEEK
-      loff_t retoffset;
-      int rc = llseek(fd, 0, &retoffset, SEEK_CUR);
-      BAIL_IF_MACRO(rc == -1, strerror(errno), -1);
-      retval = (PHYSFS_sint64) retoffset;
-    #else
-      retval = (PHYSFS_sint64) lseek(fd, 0, SEEK_CUR);
-      BAIL_IF_MACRO(retval == -1, strerror(errno), -1);
-    #endif
-
-    return(retval);
+    return((PHYSFS_sint64) ((PosixFile *) opaque)->pos);
 } /* __PHYSFS_platformTell */
 
 
 PHYSFS_sint64 __PHYSFS_platformFileLength(void *opaque)
 {
-    int fd = *((int *) opaque);
+    int fd = ((PosixFile *) opaque)->fd;
     struct stat statbuf;
     BAIL_IF_MACRO(fstat(fd, &statbuf) == -1, strerror(errno), -1);
     return((PHYSFS_sint64) statbuf.st_size);
@@ -389,7 +453,7 @@ int __PHYSFS_platformEOF(void *opaque)
 
 int __PHYSFS_platformFlush(void *opaque)
 {
-    int fd = *((int *) opaque);
+    int fd = ((PosixFile *) opaque)->fd;
     BAIL_IF_MACRO(fsync(fd) == -1, strerror(errno), 0);
     return(1);
 } /* __PHYSFS_platformFlush */
@@ -397,13 +461,102 @@ int __PHYSFS_platformFlush(void *opaque)
 
 int __PHYSFS_platformClose(void *opaque)
 {
-    int fd = *((int *) opaque);
+    int fd = ((PosixFile *) opaque)->fd;
     BAIL_IF_MACRO(close(fd) == -1, strerror(errno), 0);
     allocator.Free(opaque);
     return(1);
 } /* __PHYSFS_platformClose */
 
 
+#ifdef PHYSFS_NO_MMAP_SUPPORT
+
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+                                 PHYSFS_uint64 len, void **mapping)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *mapping)
+{
+} /* __PHYSFS_platformUnmap */
+
+#else
+
+typedef struct
+{
+    void *base;
+    size_t len;
+} PosixMapping;
+
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+                                 PHYSFS_uint64 len, void **mapping)
+{
+    int fd = ((PosixFile *) opaque)->fd;
+    const PHYSFS_uint64 skip = offset % ((PHYSFS_uint64) sysconf(_SC_PAGESIZE));
+    const off_t start = (off_t) (offset - skip);
+    PosixMapping *m;
+    void *base;
+
+    BAIL_IF_MACRO(((PHYSFS_uint64) start) != offset - skip,
+                  ERR_SEEK_OUT_OF_RANGE, NULL);
+    BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(len + skip),
+                  ERR_OUT_OF_MEMORY, NULL);
+
+    m = (PosixMapping *) allocator.Malloc(sizeof (PosixMapping));
+    BAIL_IF_MACRO(m == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+    /* mmap() wants a page-aligned offset, so map a little extra. */
+    m->len = (size_t) (len + skip);
+    base = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, start);
+    if (base == MAP_FAILED)
+    {
+        allocator.Free(m);
+        BAIL_MACRO(strerror(errno), NULL);
+    } /* if */
+
+    m->base = base;
+    *mapping = m;
+    return(((const PHYSFS_uint8 *) base) + skip);
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *mapping)
+{
+    PosixMapping *m = (PosixMapping *) mapping;
+    munmap(m->base, m->len);
+    allocator.Free(m);
+} /* __PHYSFS_platformUnmap */
+
+#endif  /* PHYSFS_NO_MMAP_SUPPORT */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                              PHYSFS_uint64 len)
+{
+    int fd = ((PosixFile *) opaque)->fd;
+    const off_t start = (off_t) offset;
+
+    BAIL_IF_MACRO((start < 0) || (((PHYSFS_uint64) start) != offset),
+                  ERR_SEEK_OUT_OF_RANGE, 0);
+
+#if (defined POSIX_FADV_WILLNEED)
+    if ((((off_t) len) < 0) || (((PHYSFS_uint64) (off_t) len) != len))
+        len = 0;  /* zero means "to the end of the file." */
+    return(posix_fadvise(fd, start, (off_t) len, POSIX_FADV_WILLNEED) == 0);
+#elif (defined F_RDADVISE)
+    {
+        struct radvisory ra;
+        ra.ra_offset = start;
+        ra.ra_count = (len > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) len;
+        return(fcntl(fd, F_RDADVISE, &ra) != -1);
+    }
+#else
+    return(0);
+#endif
+} /* __PHYSFS_platformPrefetch */
+
+
 int __PHYSFS_platformDelete(const char *path)
 {
     BAIL_IF_MACRO(remove(path) == -1, strerror(errno), 0);
@@ -418,6 +571,37 @@ PHYSFS_sint64 __PHYSFS_platformGetLastModTime(const char *fname)
     return statbuf.st_mtime;
 } /* __PHYSFS_platformGetLastModTime */
 
+
+PHYSFS_uint64 __PHYSFS_platformGetTicks(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return((((PHYSFS_uint64) ts.tv_sec) * 1000000) +
+               (((PHYSFS_uint64) ts.tv_nsec) / 1000));
+    } /* if */
+#endif
+
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return((((PHYSFS_uint64) tv.tv_sec) * 1000000) +
+               ((PHYSFS_uint64) tv.tv_usec));
+    }
+} /* __PHYSFS_platformGetTicks */
+
+
+PHYSFS_uint32 __PHYSFS_platformCpuCount(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+        return((PHYSFS_uint32) count);
+#endif
+    return(1);
+} /* __PHYSFS_platformCpuCount */
+
 #endif  /* PHYSFS_PLATFORM_POSIX */
 
 /* end of posix.c ... */
@@ -348,6 +348,17 @@ void __PHYSFS_platformDestroyMutex(void *mutex) {}
 int __PHYSFS_platformGrabMutex(void *mutex) { return(1); }
 void __PHYSFS_platformReleaseMutex(void *mutex) {}
 
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    BAIL_MACRO(ERR_NOT_SUPPORTED, NULL);
+} /* __PHYSFS_platformCreateThread */
+
+void __PHYSFS_platformJoinThread(void *thread) {}
+void *__PHYSFS_platformCreateSemaphore(void) { return((void *) 0x0001); }
+void __PHYSFS_platformDestroySemaphore(void *sem) {}
+void __PHYSFS_platformPostSemaphore(void *sem) {}
+void __PHYSFS_platformWaitSemaphore(void *sem) {}
+
 #else
 
 typedef struct
@@ -423,6 +434,109 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     } /* if */
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    pthread_t thread;
+    void (*func)(void *);
+    void *data;
+} PthreadThread;
+
+static void *pthreadThreadEntry(void *arg)
+{
+    PthreadThread *t = (PthreadThread *) arg;
+    t->func(t->data);
+    return(NULL);
+} /* pthreadThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+    int rc;
+    PthreadThread *t = (PthreadThread *) allocator.Malloc(sizeof (PthreadThread));
+    BAIL_IF_MACRO(t == NULL, ERR_OUT_OF_MEMORY, NULL);
+    t->func = func;
+    t->data = data;
+    rc = pthread_create(&t->thread, NULL, pthreadThreadEntry, t);
+    if (rc != 0)
+    {
+        allocator.Free(t);
+        BAIL_MACRO(strerror(rc), NULL);
+    } /* if */
+
+    return((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+    PthreadThread *t = (PthreadThread *) thread;
+    pthread_join(t->thread, NULL);
+    allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
+/* sem_init() isn't everywhere (hello, Mac OS X), so build our own. */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    PHYSFS_uint32 count;
+} PthreadSemaphore;
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    PthreadSemaphore *s;
+    s = (PthreadSemaphore *) allocator.Malloc(sizeof (PthreadSemaphore));
+    BAIL_IF_MACRO(s == NULL, ERR_OUT_OF_MEMORY, NULL);
+
+    if (pthread_mutex_init(&s->mutex, NULL) != 0)
+    {
+        allocator.Free(s);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    if (pthread_cond_init(&s->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&s->mutex);
+        allocator.Free(s);
+        BAIL_MACRO(ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    s->count = 0;
+    return((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    allocator.Free(s);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_mutex_lock(&s->mutex);
+    s->count++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_mutex_lock(&s->mutex);
+    while (s->count == 0)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    s->count--;
+    pthread_mutex_unlock(&s->mutex);
+} /* __PHYSFS_platformWaitSemaphore */
+
 #endif /* !PHYSFS_NO_THREAD_SUPPORT */
 
 #endif /* PHYSFS_PLATFORM_UNIX */
@@ -0,0 +1,745 @@
+/**
+ * Regression checks for PhysicsFS.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ *
+ * Every check builds the files it needs in a scratch directory under the
+ *  current working directory, mounts them and looks at what comes back,
+ *  so run this from somewhere writable. Build it against a PhysicsFS with
+ *  zip support, with its headers (and zlib's) on the include path:
+ *
+ *    cc -I../src -I../src/zlib123 -o test_regress test_regress.c libphysfs.a
+ *
+ * It prints a line per check, and exits with the number that failed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "physfs.h"
+#include "zlib.h"
+
+#define SCRATCH_DIR "physfs-regress"
+
+static char scratchDir[1024];
+
+
+/* Bail out of a check, saying why. Checks clean up after a "done:" label. */
+#define CHECK_MACRO(c) if (!(c)) { \
+    const char *err = PHYSFS_getLastError(); \
+    printf("    failed at line %d: %s\n", __LINE__, #c); \
+    if (err != NULL) \
+        printf("    last error: %s\n", err); \
+    goto done; \
+}
+
+
+/* Platform-dependent path of (fname), a file in the scratch directory. */
+static const char *scratchPath(const char *fname)
+{
+    static char retval[1024];
+    const char *sep = PHYSFS_getDirSeparator();
+    char *ptr;
+
+    sprintf(retval, "%s%s%s", scratchDir, sep, fname);
+    if (strcmp(sep, "/") != 0)
+    {
+        for (ptr = retval + strlen(scratchDir); *ptr; ptr++)
+        {
+            if (*ptr == '/')
+                *ptr = *sep;  /* !!! FIXME: multichar separators. */
+        } /* for */
+    } /* if */
+
+    return(retval);
+} /* scratchPath */
+
+
+/* Write (len) bytes to (fname) in the scratch dir, making its parents. */
+static int writeFile(const char *fname, const void *data, PHYSFS_uint32 len)
+{
+    char dir[256];
+    char *ptr;
+    PHYSFS_File *out;
+    int retval;
+
+    strncpy(dir, fname, sizeof (dir));
+    dir[sizeof (dir) - 1] = '\0';
+    ptr = strrchr(dir, '/');
+    if (ptr != NULL)
+    {
+        *ptr = '\0';
+        if (!PHYSFS_mkdir(dir))
+            return(0);
+    } /* if */
+
+    out = PHYSFS_openWrite(fname);
+    if (out == NULL)
+        return(0);
+    retval = (PHYSFS_write(out, data, 1, len) == (PHYSFS_sint64) len);
+    return(PHYSFS_close(out) && retval);
+} /* writeFile */
+
+
+/* Delete (dir) in the scratch dir, and everything in it. */
+static void removeTree(const char *dir)
+{
+    char path[256];
+    char mounted[sizeof (path) + 8];
+    char **list;
+    char **i;
+
+    sprintf(mounted, "scratch/%s", dir);
+    list = PHYSFS_enumerateFiles(mounted);
+    for (i = list; *i != NULL; i++)
+    {
+        sprintf(path, "%s/%s", dir, *i);
+        sprintf(mounted, "scratch/%s", path);
+        if (PHYSFS_isDirectory(mounted))
+            removeTree(path);
+        else
+            PHYSFS_delete(path);
+    } /* for */
+    PHYSFS_freeList(list);
+
+    PHYSFS_delete(dir);
+} /* removeTree */
+
+
+/* A block of memory that grows as it's written, to build archives in. */
+typedef struct
+{
+    PHYSFS_uint8 *data;
+    PHYSFS_uint32 len;
+    PHYSFS_uint32 alloc;
+} Buffer;
+
+
+/* Make room for (len) more bytes at the end of (buf). */
+static void grow(Buffer *buf, PHYSFS_uint32 len)
+{
+    if (buf->len + len > buf->alloc)
+    {
+        buf->alloc = (buf->alloc * 2 > buf->len + len) ?
+                        buf->alloc * 2 : buf->len + len;
+        buf->data = (PHYSFS_uint8 *) realloc(buf->data, buf->alloc);
+        if (buf->data == NULL)
+        {
+            printf("Out of memory!\n");
+            exit(1);
+        } /* if */
+    } /* if */
+} /* grow */
+
+
+static void put(Buffer *buf, const void *data, PHYSFS_uint32 len)
+{
+    grow(buf, len);
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+} /* put */
+
+
+static void put16(Buffer *buf, PHYSFS_uint32 val)
+{
+    PHYSFS_uint8 bytes[2];
+    bytes[0] = (PHYSFS_uint8) (val & 0xFF);
+    bytes[1] = (PHYSFS_uint8) ((val >> 8) & 0xFF);
+    put(buf, bytes, sizeof (bytes));
+} /* put16 */
+
+
+static void put32(Buffer *buf, PHYSFS_uint32 val)
+{
+    put16(buf, val & 0xFFFF);
+    put16(buf, (val >> 16) & 0xFFFF);
+} /* put32 */
+
+
+static void put64(Buffer *buf, PHYSFS_uint64 val)
+{
+    put32(buf, (PHYSFS_uint32) (val & 0xFFFFFFFF));
+    put32(buf, (PHYSFS_uint32) (val >> 32));
+} /* put64 */
+
+
+/* Overwrite the 32 bits at (pos), which is already written. */
+static void poke32(Buffer *buf, PHYSFS_uint32 pos, PHYSFS_uint32 val)
+{
+    const PHYSFS_uint32 len = buf->len;
+    buf->len = pos;
+    put32(buf, val);
+    buf->len = len;
+} /* poke32 */
+
+
+/* Append (len) bytes of (data), raw-deflated as ZIP wants it. */
+static int putDeflated(Buffer *buf, const void *data, PHYSFS_uint32 len)
+{
+    z_stream stream;
+    PHYSFS_uint32 bound;
+    int rc;
+
+    memset(&stream, '\0', sizeof (stream));
+    if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return(0);
+
+    bound = (PHYSFS_uint32) deflateBound(&stream, len);
+    grow(buf, bound);
+    stream.next_in = (Bytef *) data;
+    stream.avail_in = len;
+    stream.next_out = buf->data + buf->len;
+    stream.avail_out = bound;
+    rc = deflate(&stream, Z_FINISH);
+    buf->len += bound - stream.avail_out;
+    deflateEnd(&stream);
+    return(rc == Z_STREAM_END);
+} /* putDeflated */
+
+
+/* One file for writeZip(). */
+typedef struct
+{
+    const char *name;
+    const void *data;
+    PHYSFS_uint32 len;
+    int deflated;  /* compress it, instead of storing it as-is. */
+} ZipEntry;
+
+
+/*
+ * Write (count) files to (fname) as a ZIP archive, followed by (comment)
+ *  and then (trailing) bytes of junk after the archive's last record. If
+ *  (zip64) is set, every size, offset and count goes in the ZIP64 fields,
+ *  like an archive too big for the old ones would have them.
+ */
+static int writeZip(const char *fname, const ZipEntry *entries,
+                    PHYSFS_uint32 count, const char *comment,
+                    PHYSFS_uint32 trailing, int zip64)
+{
+    const PHYSFS_uint32 version = zip64 ? 45 : 20;
+    Buffer buf;
+    PHYSFS_uint32 *offsets;
+    PHYSFS_uint32 *sizes;
+    PHYSFS_uint32 central;
+    PHYSFS_uint32 record;
+    PHYSFS_uint32 i;
+    int retval = 0;
+
+    memset(&buf, '\0', sizeof (buf));
+    offsets = (PHYSFS_uint32 *) malloc(sizeof (PHYSFS_uint32) * (count + 1));
+    sizes = (PHYSFS_uint32 *) malloc(sizeof (PHYSFS_uint32) * (count + 1));
+    if ((offsets == NULL) || (sizes == NULL))
+        goto done;
+
+    for (i = 0; i < count; i++)
+    {
+        const ZipEntry *entry = &entries[i];
+        const PHYSFS_uint32 namelen = (PHYSFS_uint32) strlen(entry->name);
+        const PHYSFS_uint32 crc = (PHYSFS_uint32) crc32(crc32(0, Z_NULL, 0),
+                                    (const Bytef *) entry->data, entry->len);
+        PHYSFS_uint32 sizepos;
+        PHYSFS_uint32 start;
+        offsets[i] = buf.len;
+        put32(&buf, 0x04034b50);  /* local file header. */
+        put16(&buf, version);  /* version needed. */
+        put16(&buf, 0);  /* flags. */
+        put16(&buf, entry->deflated ? 8 : 0);  /* deflated or stored. */
+        put32(&buf, 0x00210000);  /* midnight, January 1st, 1980. */
+        put32(&buf, crc);
+        sizepos = buf.len;
+        put32(&buf, zip64 ? 0xFFFFFFFF : 0);  /* compressed size. */
+        put32(&buf, zip64 ? 0xFFFFFFFF : entry->len);
+        put16(&buf, namelen);
+        put16(&buf, zip64 ? 20 : 0);  /* extra field length. */
+        put(&buf, entry->name, namelen);
+
+        if (zip64)
+        {
+            put16(&buf, 0x0001);  /* ZIP64 extended information. */
+            put16(&buf, 16);
+            put64(&buf, entry->len);
+            sizepos = buf.len;
+            put64(&buf, 0);  /* compressed size. */
+        } /* if */
+
+        start = buf.len;
+        if (!entry->deflated)
+            put(&buf, entry->data, entry->len);
+        else if (!putDeflated(&buf, entry->data, entry->len))
+            goto done;
+        sizes[i] = buf.len - start;
+        poke32(&buf, sizepos, sizes[i]);  /* now we know it. */
+    } /* for */
+
+    central = buf.len;
+    for (i = 0; i < count; i++)
+    {
+        const ZipEntry *entry = &entries[i];
+        const PHYSFS_uint32 namelen = (PHYSFS_uint32) strlen(entry->name);
+        const PHYSFS_uint32 crc = (PHYSFS_uint32) crc32(crc32(0, Z_NULL, 0),
+                                    (const Bytef *) entry->data, entry->len);
+        put32(&buf, 0x02014b50);  /* central directory entry. */
+        put16(&buf, version);  /* version made by (MS-DOS). */
+        put16(&buf, version);  /* version needed. */
+        put16(&buf, 0);  /* flags. */
+        put16(&buf, entry->deflated ? 8 : 0);
+        put32(&buf, 0x00210000);
+        put32(&buf, crc);
+        put32(&buf, zip64 ? 0xFFFFFFFF : sizes[i]);
+        put32(&buf, zip64 ? 0xFFFFFFFF : entry->len);
+        put16(&buf, namelen);
+        put16(&buf, zip64 ? 28 : 0);  /* extra field length. */
+        put16(&buf, 0);  /* comment length. */
+        put16(&buf, 0);  /* disk number. */
+        put16(&buf, 0);  /* internal attributes. */
+        put32(&buf, 0);  /* external attributes. */
+        put32(&buf, zip64 ? 0xFFFFFFFF : offsets[i]);
+        put(&buf, entry->name, namelen);
+
+        if (zip64)
+        {
+            put16(&buf, 0x0001);  /* ZIP64 extended information. */
+            put16(&buf, 24);
+            put64(&buf, entry->len);
+            put64(&buf, sizes[i]);
+            put64(&buf, offsets[i]);
+        } /* if */
+    } /* for */
+
+    record = buf.len;
+    if (zip64)
+    {
+        put32(&buf, 0x06064b50);  /* ZIP64 end of central directory. */
+        put64(&buf, 44);  /* size of the rest of this record. */
+        put16(&buf, version);  /* version made by. */
+        put16(&buf, version);  /* version needed. */
+        put32(&buf, 0);  /* this disk. */
+        put32(&buf, 0);  /* disk with the central directory. */
+        put64(&buf, count);  /* entries on this disk. */
+        put64(&buf, count);  /* entries in all. */
+        put64(&buf, record - central);  /* central directory size. */
+        put64(&buf, central);
+
+        put32(&buf, 0x07064b50);  /* ZIP64 end of central dir locator. */
+        put32(&buf, 0);  /* disk with the ZIP64 record. */
+        put64(&buf, record);
+        put32(&buf, 1);  /* total disks. */
+    } /* if */
+
+    put32(&buf, 0x06054b50);  /* end of central directory. */
+    put16(&buf, 0);  /* this disk. */
+    put16(&buf, 0);  /* disk with the central directory. */
+    put16(&buf, zip64 ? 0xFFFF : count);  /* entries on this disk. */
+    put16(&buf, zip64 ? 0xFFFF : count);  /* entries in all. */
+    put32(&buf, zip64 ? 0xFFFFFFFF : record - central);  /* cdir size. */
+    put32(&buf, zip64 ? 0xFFFFFFFF : central);
+    put16(&buf, (PHYSFS_uint32) strlen(comment));
+    put(&buf, comment, (PHYSFS_uint32) strlen(comment));
+
+    for (i = 0; i < trailing; i++)
+        put(&buf, "\0", 1);
+
+    retval = writeFile(fname, buf.data, buf.len);
+
+done:
+    free(buf.data);
+    free(offsets);
+    free(sizes);
+    return(retval);
+} /* writeZip */
+
+
+/* Does (fname) hold exactly (len) bytes of (data)? */
+static int contentIs(const char *fname, const void *data, PHYSFS_uint32 len)
+{
+    PHYSFS_File *in = PHYSFS_openRead(fname);
+    char *buf;
+    int retval;
+
+    if (in == NULL)
+        return(0);
+
+    buf = (char *) malloc(len + 1);
+    retval = ( (buf != NULL) && (PHYSFS_fileLength(in) == len) &&
+               (PHYSFS_read(in, buf, 1, len + 1) == len) &&
+               (memcmp(buf, data, len) == 0) );
+    free(buf);
+    PHYSFS_close(in);
+    return(retval);
+} /* contentIs */
+
+
+/* Is (list) exactly (expected), in order? */
+static int listIs(char **list, const char **expected)
+{
+    PHYSFS_uint32 i;
+
+    for (i = 0; (list[i] != NULL) && (expected[i] != NULL); i++)
+    {
+        if (strcmp(list[i], expected[i]) != 0)
+        {
+            printf("    item %u is \"%s\", wanted \"%s\"\n",
+                   (unsigned int) i, list[i], expected[i]);
+            return(0);
+        } /* if */
+    } /* for */
+
+    if ((list[i] != NULL) || (expected[i] != NULL))
+    {
+        printf("    list has %s items than expected\n",
+               (list[i] != NULL) ? "more" : "fewer");
+        return(0);
+    } /* if */
+
+    return(1);
+} /* listIs */
+
+
+/*
+ * Names from several mounts come back once each, sorted, whichever mount
+ *  (or mount point) they came from.
+ */
+static int checkEnumerateDedupe(void)
+{
+    static const char *shared[] = { "x", "y", "z", NULL };
+    char **list = NULL;
+    char fname[32];
+    int retval = 0;
+    int i;
+
+    /* 500 files in each of two dirs, half of them in both. */
+    for (i = 0; i < 750; i++)
+    {
+        sprintf(fname, "enum%d/f%03d", (i < 500) ? 1 : 2, i);
+        CHECK_MACRO(writeFile(fname, "x", 1));
+        if ((i >= 250) && (i < 500))
+        {
+            fname[4] = '2';
+            CHECK_MACRO(writeFile(fname, "x", 1));
+        } /* if */
+    } /* for */
+    CHECK_MACRO(writeFile("enum1/shared/x", "x", 1));
+    CHECK_MACRO(writeFile("enum2/shared/y", "y", 1));
+    CHECK_MACRO(writeFile("enum3/z", "z", 1));
+
+    CHECK_MACRO(PHYSFS_mount(scratchPath("enum1"), NULL, 1));
+    CHECK_MACRO(PHYSFS_mount(scratchPath("enum2"), NULL, 1));
+    CHECK_MACRO(PHYSFS_mount(scratchPath("enum3"), "shared", 1));
+
+    list = PHYSFS_enumerateFiles("");
+    CHECK_MACRO(list != NULL);
+    for (i = 0; i < 750; i++)
+    {
+        sprintf(fname, "f%03d", i);
+        CHECK_MACRO((list[i] != NULL) && (strcmp(list[i], fname) == 0));
+    } /* for */
+    CHECK_MACRO((list[750] != NULL) && (strcmp(list[750], "shared") == 0));
+    CHECK_MACRO(list[751] == NULL);
+    PHYSFS_freeList(list);
+
+    list = PHYSFS_enumerateFiles("shared");
+    CHECK_MACRO(list != NULL);
+    CHECK_MACRO(listIs(list, shared));
+
+    retval = 1;
+
+done:
+    if (list != NULL)
+        PHYSFS_freeList(list);
+    PHYSFS_removeFromSearchPath(scratchPath("enum1"));
+    PHYSFS_removeFromSearchPath(scratchPath("enum2"));
+    PHYSFS_removeFromSearchPath(scratchPath("enum3"));
+    return(retval);
+} /* checkEnumerateDedupe */
+
+
+/*
+ * The end-of-central-directory record's comment has to reach exactly to
+ *  the end of the file. Something that looks like the record inside the
+ *  comment doesn't count, and an archive with data after its comment is
+ *  rejected, like it always was.
+ */
+static int checkZipEndOfCentralDir(void)
+{
+    static const char text[] = "Hello, world!";
+    static const ZipEntry entry = { "a.txt", text, sizeof (text) - 1, 0 };
+    static const char *fakeRecord = "PK\005\006 is just part of this "
+                                    "comment, not the real record.";
+    int retval = 0;
+
+    CHECK_MACRO(writeZip("trailing-zeros.zip", &entry, 1, "", 511, 0));
+    CHECK_MACRO(writeZip("trailing-junk.zip", &entry, 1, "Hi!", 100, 0));
+    CHECK_MACRO(writeZip("fake-record.zip", &entry, 1, fakeRecord, 0, 0));
+
+    CHECK_MACRO(PHYSFS_mount(scratchPath("fake-record.zip"), "f", 1));
+    CHECK_MACRO(contentIs("f/a.txt", text, sizeof (text) - 1));
+    CHECK_MACRO(!PHYSFS_mount(scratchPath("trailing-zeros.zip"), "z", 1));
+    CHECK_MACRO(!PHYSFS_exists("z/a.txt"));
+    CHECK_MACRO(!PHYSFS_mount(scratchPath("trailing-junk.zip"), "j", 1));
+    CHECK_MACRO(!PHYSFS_exists("j/a.txt"));
+
+    retval = 1;
+
+done:
+    PHYSFS_removeFromSearchPath(scratchPath("trailing-zeros.zip"));
+    PHYSFS_removeFromSearchPath(scratchPath("trailing-junk.zip"));
+    PHYSFS_removeFromSearchPath(scratchPath("fake-record.zip"));
+    return(retval);
+} /* checkZipEndOfCentralDir */
+
+
+/* Fill (buf) with (len) bytes that deflate, but not to nothing. */
+static void fillData(PHYSFS_uint8 *buf, PHYSFS_uint32 len)
+{
+    static const char letters[] = "etaoin shrdlu\n";
+    PHYSFS_uint32 seed = 1;
+    PHYSFS_uint32 i;
+
+    for (i = 0; i < len; i++)
+    {
+        seed = (seed * 1103515245) + 12345;
+        buf[i] = letters[(seed >> 16) % (sizeof (letters) - 1)];
+    } /* for */
+} /* fillData */
+
+
+/* Seek (in) to (pos) and check the (len) bytes there against (data). */
+static int readAt(PHYSFS_File *in, const PHYSFS_uint8 *data,
+                  PHYSFS_uint32 pos, PHYSFS_uint32 len)
+{
+    PHYSFS_uint8 buf[4096];
+
+    if (!PHYSFS_seek(in, pos))
+        return(0);
+    if (PHYSFS_read(in, buf, 1, len) != len)
+        return(0);
+    if (PHYSFS_tell(in) != pos + len)
+        return(0);
+    return(memcmp(buf, data + pos, len) == 0);
+} /* readAt */
+
+
+/*
+ * With seek checkpoints on, seeking anywhere in a deflated entry, forwards
+ *  or backwards, from the handle that left the checkpoints or from another
+ *  handle, has to land on the right bytes.
+ */
+static int checkZipCheckpointSeek(void)
+{
+    const PHYSFS_uint32 interval = 64 * 1024;
+    const PHYSFS_uint32 len = 2 * 1024 * 1024 + 123;
+    PHYSFS_uint8 *data = (PHYSFS_uint8 *) malloc(len);
+    PHYSFS_File *first = NULL;
+    PHYSFS_File *second = NULL;
+    ZipEntry entry;
+    PHYSFS_ZipStats stats;
+    PHYSFS_uint32 pos;
+    PHYSFS_uint32 i;
+    int retval = 0;
+
+    CHECK_MACRO(data != NULL);
+    fillData(data, len);
+    entry.name = "big.txt";
+    entry.data = data;
+    entry.len = len;
+    entry.deflated = 1;
+    CHECK_MACRO(writeZip("seek.zip", &entry, 1, "", 0, 0));
+
+    CHECK_MACRO(PHYSFS_setZipCheckpointInterval(interval));
+    CHECK_MACRO(PHYSFS_mount(scratchPath("seek.zip"), NULL, 1));
+
+    /* read it all once, leaving checkpoints behind. */
+    first = PHYSFS_openRead("big.txt");
+    CHECK_MACRO(first != NULL);
+    for (pos = 0; pos + 4096 <= len; pos += 4096)
+        CHECK_MACRO(readAt(first, data, pos, 4096));
+    PHYSFS_getZipStats(&stats);
+    CHECK_MACRO(stats.checkpoints > 0);
+
+    /* right on, just before and just after checkpoints, going backwards. */
+    for (i = len / interval; i > 0; i--)
+    {
+        pos = i * interval;
+        CHECK_MACRO(readAt(first, data, pos - 1, 3));
+        CHECK_MACRO(readAt(first, data, pos - 100, 100));
+        CHECK_MACRO(readAt(first, data, pos, 100));
+    } /* for */
+    CHECK_MACRO(readAt(first, data, 0, 100));
+    CHECK_MACRO(readAt(first, data, len - 100, 100));
+
+    /* all over the place, from a handle that never read anything. */
+    second = PHYSFS_openRead("big.txt");
+    CHECK_MACRO(second != NULL);
+    for (i = 0, pos = 7; i < 200; i++)
+    {
+        pos = ((pos * 1103515245) + 12345) & 0x7FFFFFFF;
+        CHECK_MACRO(readAt(second, data, pos % (len - 1000), 1000));
+    } /* for */
+    CHECK_MACRO(readAt(second, data, len - 1, 1));
+    CHECK_MACRO(PHYSFS_seek(second, len));
+    CHECK_MACRO(PHYSFS_eof(second));
+
+    retval = 1;
+
+done:
+    if (first != NULL)
+        PHYSFS_close(first);
+    if (second != NULL)
+        PHYSFS_close(second);
+    PHYSFS_removeFromSearchPath(scratchPath("seek.zip"));
+    PHYSFS_setZipCheckpointInterval(0);
+    free(data);
+    return(retval);
+} /* checkZipCheckpointSeek */
+
+
+/* ZIP64 archives, with or without a comment, read back like any other. */
+static int checkZip64(void)
+{
+    static const char text[] = "Hello from the ZIP64 fields.\n";
+    PHYSFS_uint8 data[10000];
+    ZipEntry entries[2];
+    int retval = 0;
+
+    fillData(data, sizeof (data));
+    entries[0].name = "stored.txt";
+    entries[0].data = text;
+    entries[0].len = sizeof (text) - 1;
+    entries[0].deflated = 0;
+    entries[1].name = "dir/deflated.txt";
+    entries[1].data = data;
+    entries[1].len = sizeof (data);
+    entries[1].deflated = 1;
+    CHECK_MACRO(writeZip("zip64.zip", entries, 2, "", 0, 1));
+    CHECK_MACRO(writeZip("zip64-comment.zip", entries, 2, "Hi!", 0, 1));
+
+    CHECK_MACRO(PHYSFS_mount(scratchPath("zip64.zip"), "a", 1));
+    CHECK_MACRO(PHYSFS_mount(scratchPath("zip64-comment.zip"), "b", 1));
+    CHECK_MACRO(contentIs("a/stored.txt", text, sizeof (text) - 1));
+    CHECK_MACRO(contentIs("a/dir/deflated.txt", data, sizeof (data)));
+    CHECK_MACRO(contentIs("b/stored.txt", text, sizeof (text) - 1));
+    CHECK_MACRO(contentIs("b/dir/deflated.txt", data, sizeof (data)));
+    retval = 1;
+
+done:
+    PHYSFS_removeFromSearchPath(scratchPath("zip64.zip"));
+    PHYSFS_removeFromSearchPath(scratchPath("zip64-comment.zip"));
+    return(retval);
+} /* checkZip64 */
+
+
+/* More entries than the old end-of-central-dir record can count. */
+static int checkZip64ManyEntries(void)
+{
+    const PHYSFS_uint32 count = 70000;
+    ZipEntry *entries = (ZipEntry *) malloc(sizeof (ZipEntry) * count);
+    char *names = (char *) malloc(8 * count);
+    char **list = NULL;
+    PHYSFS_uint32 i;
+    int retval = 0;
+
+    CHECK_MACRO((entries != NULL) && (names != NULL));
+    for (i = 0; i < count; i++)
+    {
+        char *name = names + (i * 8);
+        sprintf(name, "f%05u", (unsigned int) i);
+        entries[i].name = name;
+        entries[i].data = name;  /* each file holds its own name. */
+        entries[i].len = 6;
+        entries[i].deflated = 0;
+    } /* for */
+    CHECK_MACRO(writeZip("many.zip", entries, count, "", 0, 1));
+    CHECK_MACRO(PHYSFS_mount(scratchPath("many.zip"), "many", 1));
+
+    list = PHYSFS_enumerateFiles("many");
+    CHECK_MACRO(list != NULL);
+    for (i = 0; (i < count) && (list[i] != NULL); i++)
+        CHECK_MACRO(strcmp(list[i], entries[i].name) == 0);
+    CHECK_MACRO((i == count) && (list[i] == NULL));
+
+    CHECK_MACRO(contentIs("many/f00000", "f00000", 6));
+    CHECK_MACRO(contentIs("many/f65535", "f65535", 6));
+    CHECK_MACRO(contentIs("many/f69999", "f69999", 6));
+    retval = 1;
+
+done:
+    if (list != NULL)
+        PHYSFS_freeList(list);
+    PHYSFS_removeFromSearchPath(scratchPath("many.zip"));
+    free(names);
+    free(entries);
+    return(retval);
+} /* checkZip64ManyEntries */
+
+
+typedef struct
+{
+    const char *name;
+    int (*fn)(void);
+} Check;
+
+static const Check checks[] =
+{
+    { "enumeration merges mounts without duplicates", checkEnumerateDedupe },
+    { "ZIP comments must reach the end of the file", checkZipEndOfCentralDir },
+    { "seeks in deflated ZIP entries use checkpoints", checkZipCheckpointSeek },
+    { "ZIP64 archives mount and read", checkZip64 },
+    { "ZIP64 archives list more than 65535 entries", checkZip64ManyEntries },
+    { NULL, NULL }
+};
+
+
+int main(int argc, char **argv)
+{
+    const char *sep;
+    char **list;
+    char **i;
+    int failed = 0;
+    int rc;
+    const Check *check;
+
+    if (!PHYSFS_init(argv[0]))
+    {
+        printf("PHYSFS_init() failed: %s\n", PHYSFS_getLastError());
+        return(1);
+    } /* if */
+
+    /* a fresh scratch dir, under wherever we were run from. */
+    sep = PHYSFS_getDirSeparator();
+    sprintf(scratchDir, ".%s%s", sep, SCRATCH_DIR);
+    if ( (!PHYSFS_setWriteDir(".")) || (!PHYSFS_mkdir(SCRATCH_DIR)) ||
+         (!PHYSFS_setWriteDir(scratchDir)) )
+    {
+        printf("Can't make a scratch dir: %s\n", PHYSFS_getLastError());
+        PHYSFS_deinit();
+        return(1);
+    } /* if */
+
+    for (check = checks; check->name != NULL; check++)
+    {
+        rc = check->fn();
+        printf("%s: %s\n", rc ? "PASS" : "FAIL", check->name);
+        if (!rc)
+            failed++;
+    } /* for */
+
+    /* throw away everything the checks wrote. */
+    if (PHYSFS_mount(scratchDir, "scratch", 1))
+    {
+        list = PHYSFS_enumerateFiles("scratch");
+        for (i = list; *i != NULL; i++)
+            removeTree(*i);
+        PHYSFS_freeList(list);
+        PHYSFS_removeFromSearchPath(scratchDir);
+    } /* if */
+    PHYSFS_setWriteDir(".");
+    PHYSFS_delete(SCRATCH_DIR);
+
+    PHYSFS_deinit();
+    return(failed);
+} /* main */
+
+/* end of test_regress.c ... */
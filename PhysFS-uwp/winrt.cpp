@@ -100,9 +100,17 @@ static char *codepageToUtf8Heap(const char *cpstr)
 } /* codepageToUtf8Heap */
 
 
+/*
+* We keep track of the file position ourselves and hand it to ReadFile()
+*  and WriteFile() in an OVERLAPPED, as posix.c does with pread(), so
+*  several threads can read one handle at once without a lock. The handle
+*  isn't opened for overlapped i/o, so these calls still block, and they
+*  still drag the handle's own file pointer along, but nothing uses it.
+*/
 typedef struct
 {
 	HANDLE handle;
+	PHYSFS_uint64 pos;
 	int readonly;
 } WinApiFile;
 
@@ -877,6 +885,7 @@ static void *doOpen(const char *fname, DWORD mode, DWORD creation, int rdonly)
 
 	retval->readonly = rdonly;
 	retval->handle = fileHandle;
+	retval->pos = 0;
 	return(retval);
 } /* doOpen */
 
@@ -895,117 +904,117 @@ void *__PHYSFS_platformOpenWrite(const char *filename)
 
 void *__PHYSFS_platformOpenAppend(const char *filename)
 {
-	void *retval = doOpen(filename, GENERIC_WRITE, OPEN_ALWAYS, 0);
+	WinApiFile *retval;
+	retval = (WinApiFile *)doOpen(filename, GENERIC_WRITE, OPEN_ALWAYS, 0);
 	if (retval != NULL)
 	{
-		HANDLE h = ((WinApiFile *)retval)->handle;
-		//DWORD rc = SetFilePointer(h, 0, NULL, FILE_END);
-		const LARGE_INTEGER zero = { 0 };
-		DWORD rc = SetFilePointerEx(h, zero, NULL, FILE_END);
-		if (rc == PHYSFS_INVALID_SET_FILE_POINTER)
+		const PHYSFS_sint64 len = __PHYSFS_platformFileLength(retval);
+		if (len < 0)
 		{
-			const char *err = winApiStrError();
-			CloseHandle(h);
+			CloseHandle(retval->handle);
 			allocator.Free(retval);
-			BAIL_MACRO(err, NULL);
+			return(NULL);
 		} /* if */
+		retval->pos = (PHYSFS_uint64)len;
 	} /* if */
 
 	return retval;
-
 } /* __PHYSFS_platformOpenAppend */
 
 
+static PHYSFS_sint64 doReadAt(HANDLE Handle, void *buffer,
+	PHYSFS_uint64 offset, PHYSFS_uint32 len)
+{
+	DWORD CountOfBytesRead = 0;
+	OVERLAPPED ov;
+
+	memset(&ov, '\0', sizeof(ov));
+	ov.Offset = LOWORDER_UINT64(offset);
+	ov.OffsetHigh = HIGHORDER_UINT64(offset);
+	if (!ReadFile(Handle, buffer, len, &CountOfBytesRead, &ov))
+	{
+		/* starting at or past EOF fails this way; that's just no data. */
+		BAIL_IF_MACRO(GetLastError() != ERROR_HANDLE_EOF,
+			winApiStrError(), -1);
+		CountOfBytesRead = 0;
+	} /* if */
+
+	return((PHYSFS_sint64)CountOfBytesRead);
+} /* doReadAt */
+
+
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
 	PHYSFS_uint32 size, PHYSFS_uint32 count)
+{
+	WinApiFile *f = (WinApiFile *)opaque;
+	PHYSFS_sint64 retval = doReadAt(f->handle, buffer, f->pos, count * size);
+	BAIL_IF_MACRO(retval == -1, NULL, -1);
+
+	/* only count whole objects; the next read starts on an object boundary. */
+	retval /= size;
+	f->pos += ((PHYSFS_uint64)retval) * size;
+	return(retval);
+} /* __PHYSFS_platformRead */
+
+
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+	PHYSFS_uint64 offset, PHYSFS_uint32 len)
 {
 	HANDLE Handle = ((WinApiFile *)opaque)->handle;
-	DWORD CountOfBytesRead;
-	PHYSFS_sint64 retval;
+	PHYSFS_uint8 *ptr = (PHYSFS_uint8 *)buffer;
+	PHYSFS_sint64 retval = 0;
 
-	/* Read data from the file */
-	/* !!! FIXME: uint32 might be a greater # than DWORD */
-	if (!ReadFile(Handle, buffer, count * size, &CountOfBytesRead, NULL))
-	{
-		BAIL_MACRO(winApiStrError(), -1);
-	} /* if */
-	else
+	while (len > 0)
 	{
-		/* Return the number of "objects" read. */
-		/* !!! FIXME: What if not the right amount of bytes was read to make an object? */
-		retval = CountOfBytesRead / size;
-	} /* else */
+		const PHYSFS_sint64 rc = doReadAt(Handle, ptr, offset, len);
+		BAIL_IF_MACRO(rc == -1, NULL, (retval == 0) ? -1 : retval);
+		if (rc == 0)
+			break;  /* EOF. */
+
+		retval += rc;
+		ptr += (size_t)rc;
+		offset += (PHYSFS_uint64)rc;
+		len -= (PHYSFS_uint32)rc;
+	} /* while */
 
 	return(retval);
-} /* __PHYSFS_platformRead */
+} /* __PHYSFS_platformReadAt */
 
 
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
 	PHYSFS_uint32 size, PHYSFS_uint32 count)
 {
-	HANDLE Handle = ((WinApiFile *)opaque)->handle;
+	WinApiFile *f = (WinApiFile *)opaque;
 	DWORD CountOfBytesWritten;
 	PHYSFS_sint64 retval;
+	OVERLAPPED ov;
 
-	/* Read data from the file */
-	/* !!! FIXME: uint32 might be a greater # than DWORD */
-	if (!WriteFile(Handle, buffer, count * size, &CountOfBytesWritten, NULL))
-	{
+	memset(&ov, '\0', sizeof(ov));
+	ov.Offset = LOWORDER_UINT64(f->pos);
+	ov.OffsetHigh = HIGHORDER_UINT64(f->pos);
+	if (!WriteFile(f->handle, buffer, count * size, &CountOfBytesWritten, &ov))
 		BAIL_MACRO(winApiStrError(), -1);
-	} /* if */
-	else
-	{
-		/* Return the number of "objects" read. */
-		/* !!! FIXME: What if not the right number of bytes was written? */
-		retval = CountOfBytesWritten / size;
-	} /* else */
 
+	/* a partial object will be overwritten by the next write. */
+	retval = CountOfBytesWritten / size;
+	f->pos += ((PHYSFS_uint64)retval) * size;
 	return(retval);
 } /* __PHYSFS_platformWrite */
 
 
 int __PHYSFS_platformSeek(void *opaque, PHYSFS_uint64 pos)
 {
-	HANDLE Handle = ((WinApiFile *)opaque)->handle;
-	BOOL rc;
-
-	LARGE_INTEGER li;
-	li.LowPart = LOWORDER_UINT64(pos);
-	li.HighPart = HIGHORDER_UINT64(pos);
-
-	rc = SetFilePointerEx(Handle, li, NULL, FILE_BEGIN);
-
-	if (!rc && (GetLastError() != NO_ERROR))
-	{
-		return 0;
-	} /* if */
-
-	return 1;  /* No error occured */
+	/* nothing to ask the kernel; the next read or write uses (pos). */
+	BAIL_IF_MACRO(pos > __PHYSFS_UI64(0x7FFFFFFFFFFFFFFF),
+		ERR_SEEK_OUT_OF_RANGE, 0);
+	((WinApiFile *)opaque)->pos = pos;
+	return 1;
 } /* __PHYSFS_platformSeek */
 
 
 PHYSFS_sint64 __PHYSFS_platformTell(void *opaque)
 {
-	HANDLE Handle = ((WinApiFile *)opaque)->handle;
-	PHYSFS_sint64 retval;
-	BOOL rc;
-
-	LARGE_INTEGER zero;
-	zero.QuadPart = 0;
-	LARGE_INTEGER out;
-
-	rc = SetFilePointerEx(Handle, zero, &out, FILE_CURRENT);
-	if (!rc)
-	{
-		return 0;
-	} /* if */
-	else
-	{
-		retval = out.QuadPart;
-		assert(retval >= 0);
-	} /* else */
-
-	return retval;
+	return((PHYSFS_sint64)((WinApiFile *)opaque)->pos);
 } /* __PHYSFS_platformTell */
 
 
@@ -1064,6 +1073,54 @@ int __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMap(void *opaque, PHYSFS_uint64 offset,
+	PHYSFS_uint64 len, void **mapping)
+{
+	HANDLE Handle = ((WinApiFile *)opaque)->handle;
+	const PHYSFS_uint64 end = offset + len;
+	PHYSFS_uint64 skip;
+	SYSTEM_INFO sysinfo;
+	HANDLE map;
+	void *base;
+
+	/* views have to start on an allocation granularity boundary. */
+	GetNativeSystemInfo(&sysinfo);
+	skip = offset % sysinfo.dwAllocationGranularity;
+	offset -= skip;
+	BAIL_IF_MACRO(__PHYSFS_ui64FitsAddressSpace(len + skip),
+		ERR_OUT_OF_MEMORY, NULL);
+
+	map = CreateFileMappingFromApp(Handle, NULL, PAGE_READONLY, end, NULL);
+	BAIL_IF_MACRO(map == NULL, winApiStrError(), NULL);
+
+	base = MapViewOfFileFromApp(map, FILE_MAP_READ, offset,
+		(SIZE_T)(len + skip));
+	if (base == NULL)
+	{
+		const char *err = winApiStrError();
+		CloseHandle(map);
+		BAIL_MACRO(err, NULL);
+	} /* if */
+
+	CloseHandle(map);  /* the view keeps the mapping object alive. */
+	*mapping = base;
+	return(((const PHYSFS_uint8 *)base) + skip);
+} /* __PHYSFS_platformMap */
+
+
+void __PHYSFS_platformUnmap(void *mapping)
+{
+	UnmapViewOfFile(mapping);
+} /* __PHYSFS_platformUnmap */
+
+
+int __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+							  PHYSFS_uint64 len)
+{
+	return(0);  /* no readahead hint for file handles; caller reads it. */
+} /* __PHYSFS_platformPrefetch */
+
+
 static int doPlatformDelete(LPWSTR wpath)
 {
 	/* If filename is a folder */
@@ -1129,6 +1186,97 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+typedef struct
+{
+	HANDLE thread;
+	void (*func)(void *);
+	void *data;
+} WinApiThread;
+
+static DWORD WINAPI winApiThreadEntry(LPVOID arg)
+{
+	WinApiThread *t = (WinApiThread *) arg;
+	t->func(t->data);
+	return(0);
+} /* winApiThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*func)(void *), void *data)
+{
+	WinApiThread *t = (WinApiThread *) allocator.Malloc(sizeof (WinApiThread));
+	BAIL_IF_MACRO(t == NULL, ERR_OUT_OF_MEMORY, NULL);
+	t->func = func;
+	t->data = data;
+	t->thread = CreateThread(NULL, 0, winApiThreadEntry, t, 0, NULL);
+	if (t->thread == NULL)
+	{
+		allocator.Free(t);
+		BAIL_MACRO(winApiStrError(), NULL);
+	} /* if */
+
+	return((void *) t);
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformJoinThread(void *thread)
+{
+	WinApiThread *t = (WinApiThread *) thread;
+	WaitForSingleObject(t->thread, INFINITE);
+	CloseHandle(t->thread);
+	allocator.Free(t);
+} /* __PHYSFS_platformJoinThread */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+	HANDLE s = CreateSemaphoreEx(NULL, 0, 0x7FFFFFFF, NULL, 0,
+								 SEMAPHORE_ALL_ACCESS);
+	BAIL_IF_MACRO(s == NULL, winApiStrError(), NULL);
+	return((void *) s);
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+	CloseHandle((HANDLE) sem);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+	ReleaseSemaphore((HANDLE) sem, 1, NULL);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+	WaitForSingleObject((HANDLE) sem, INFINITE);
+} /* __PHYSFS_platformWaitSemaphore */
+
+
+PHYSFS_uint64 __PHYSFS_platformGetTicks(void)
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return((PHYSFS_uint64) ((now.QuadPart / freq.QuadPart) * 1000000) +
+		   (PHYSFS_uint64) (((now.QuadPart % freq.QuadPart) * 1000000) /
+							freq.QuadPart));
+} /* __PHYSFS_platformGetTicks */
+
+
+PHYSFS_uint32 __PHYSFS_platformCpuCount(void)
+{
+	SYSTEM_INFO info;
+	GetNativeSystemInfo(&info);
+	return((info.dwNumberOfProcessors > 0) ?
+			(PHYSFS_uint32) info.dwNumberOfProcessors : 1);
+} /* __PHYSFS_platformCpuCount */
+
+
 static PHYSFS_sint64 FileTimeToPhysfsTime(const FILETIME *ft)
 {
 	SYSTEMTIME st_utc;